@@ -0,0 +1,447 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file phys_mesh_cache.cpp
+ * @author Brian Lach
+ * @date October 18, 2026
+ */
+
+#include "phys_mesh_cache.h"
+#include "physx_globals.h"
+
+#include <virtualFileSystem.h>
+#include <lightMutex.h>
+#include <lightMutexHolder.h>
+#include <pnotify.h>
+
+#include <algorithm>
+#include <fstream>
+
+struct physmeshcacheheader_t
+{
+	int ident;
+	int version;
+	unsigned int key;
+	unsigned int physx_version;
+	unsigned int size;
+};
+
+// Serial object ids can't be 0.
+#define MESH_ID( id ) ( (PxSerialObjectId)( id ) + 1 )
+
+// Memory of a destroyed cache whose meshes are still used by shapes.
+struct physmeshmemory_t
+{
+	void *memory;
+	pvector<PxBase *> meshes;
+	pvector<PxU32> refs;
+};
+
+static pvector<physmeshmemory_t> s_ReleasedMemory;
+static LightMutex s_ReleasedMemoryLock( "CPhysMeshCache::s_ReleasedMemoryLock" );
+
+static PxU32 GetMeshReferenceCount( PxBase *object )
+{
+	if ( PxTriangleMesh *tri_mesh = object->is<PxTriangleMesh>() )
+	{
+		return tri_mesh->getReferenceCount();
+	}
+	else if ( PxConvexMesh *convex_mesh = object->is<PxConvexMesh>() )
+	{
+		return convex_mesh->getReferenceCount();
+	}
+
+	return 1;
+}
+
+/**
+ * Releases the meshes and frees the memory they live in, if nothing but the
+ * cache still references them.
+ */
+static bool FreeMeshMemory( physmeshmemory_t &mem )
+{
+	for ( size_t i = 0; i < mem.meshes.size(); i++ )
+	{
+		if ( GetMeshReferenceCount( mem.meshes[i] ) > mem.refs[i] )
+		{
+			return false;
+		}
+	}
+
+	// Drop every reference the meshes were read with, so they are destroyed
+	// before the memory goes.
+	for ( size_t i = 0; i < mem.meshes.size(); i++ )
+	{
+		for ( PxU32 j = 0; j < mem.refs[i]; j++ )
+		{
+			mem.meshes[i]->release();
+		}
+	}
+	free( mem.memory );
+	return true;
+}
+
+CPhysMeshCache::CPhysMeshCache( unsigned int key ) :
+	m_iKey( key ),
+	m_pMemory( nullptr ),
+	m_bDirty( false )
+{
+	m_pCollection = PxCreateCollection();
+}
+
+CPhysMeshCache::~CPhysMeshCache()
+{
+	for ( PxU32 i = 0; i < m_pCollection->getNbObjects(); i++ )
+	{
+		PxBase *object = &m_pCollection->getObject( i );
+		if ( !is_deserialized( object ) )
+		{
+			object->release();
+		}
+	}
+	m_pCollection->release();
+
+	// The deserialized meshes have to go before the memory they live in, which
+	// waits for any shapes still using them.
+	if ( m_pMemory )
+	{
+		physmeshmemory_t mem;
+		mem.memory = m_pMemory;
+		for ( size_t i = 0; i < m_Deserialized.size(); i++ )
+		{
+			mem.meshes.push_back( m_Deserialized[i].mesh );
+			mem.refs.push_back( m_Deserialized[i].refs );
+		}
+		m_pMemory = nullptr;
+		m_Deserialized.clear();
+
+		LightMutexHolder holder( s_ReleasedMemoryLock );
+		s_ReleasedMemory.push_back( mem );
+	}
+
+	free_released_memory();
+}
+
+/**
+ * Frees the memory of destroyed caches whose meshes are no longer used by any
+ * shape. Called whenever a cache is read or destroyed; call it after releasing
+ * the shapes of a level to get the memory back sooner. Returns the number of
+ * caches whose memory is still in use.
+ */
+int CPhysMeshCache::free_released_memory()
+{
+	LightMutexHolder holder( s_ReleasedMemoryLock );
+
+	for ( size_t i = 0; i < s_ReleasedMemory.size(); )
+	{
+		if ( FreeMeshMemory( s_ReleasedMemory[i] ) )
+		{
+			s_ReleasedMemory.erase( s_ReleasedMemory.begin() + i );
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	return (int)s_ReleasedMemory.size();
+}
+
+bool CPhysMeshCache::is_deserialized( PxBase *pMesh ) const
+{
+	for ( size_t i = 0; i < m_Deserialized.size(); i++ )
+	{
+		if ( m_Deserialized[i].mesh == pMesh )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Returns where the mesh cache of the given BSP file is stored.
+ */
+Filename CPhysMeshCache::get_cache_filename( const Filename &bsp_file )
+{
+	Filename filename( bsp_file );
+	filename.set_extension( "pxcache" );
+	filename.set_binary();
+	return filename;
+}
+
+/**
+ * Loads the meshes from the cache file. Returns false if the file doesn't exist
+ * or was written for different geometry or a different version of PhysX, in
+ * which case the meshes have to be cooked again.
+ */
+bool CPhysMeshCache::read( const Filename &filename )
+{
+	nassertr( m_pMemory == nullptr, false );
+
+	free_released_memory();
+
+	VirtualFileSystem *vfs = VirtualFileSystem::get_global_ptr();
+
+	std::string data;
+	if ( !vfs->read_file( filename, data, true ) )
+	{
+		return false;
+	}
+
+	if ( data.size() < sizeof( physmeshcacheheader_t ) )
+	{
+		return false;
+	}
+
+	physmeshcacheheader_t header;
+	memcpy( &header, data.data(), sizeof( header ) );
+	if ( header.ident != PHYSMESHCACHE_IDENT ||
+	     header.version != PHYSMESHCACHE_VERSION ||
+	     header.key != m_iKey ||
+	     header.physx_version != PX_PHYSICS_VERSION ||
+	     header.size != data.size() - sizeof( header ) )
+	{
+		return false;
+	}
+
+	// Binary collections must be deserialized from aligned memory.
+	m_pMemory = malloc( header.size + PX_SERIAL_FILE_ALIGN );
+	void *aligned = (void *)( ( (size_t)m_pMemory + PX_SERIAL_FILE_ALIGN - 1 ) & ~(size_t)( PX_SERIAL_FILE_ALIGN - 1 ) );
+	memcpy( aligned, data.data() + sizeof( header ), header.size );
+
+	PxCollection *collection = PxSerialization::createCollectionFromBinary( aligned, *GetPxSerializationRegistry() );
+	if ( !collection )
+	{
+		free( m_pMemory );
+		m_pMemory = nullptr;
+		return false;
+	}
+
+	for ( PxU32 i = 0; i < collection->getNbObjects(); i++ )
+	{
+		PxBase &object = collection->getObject( i );
+		m_pCollection->add( object, collection->getId( object ) );
+		DeserializedMesh deserialized;
+		deserialized.mesh = &object;
+		deserialized.refs = GetMeshReferenceCount( &object );
+		m_Deserialized.push_back( deserialized );
+	}
+	collection->release();
+
+	m_bDirty = false;
+	return true;
+}
+
+/**
+ * Writes every mesh in the cache to the file.
+ */
+bool CPhysMeshCache::write( const Filename &filename )
+{
+	PxSerializationRegistry *registry = GetPxSerializationRegistry();
+
+	PxSerialization::complete( *m_pCollection, *registry );
+
+	PxDefaultMemoryOutputStream stream;
+	if ( !PxSerialization::serializeCollectionToBinary( stream, *m_pCollection, *registry ) )
+	{
+		return false;
+	}
+
+	physmeshcacheheader_t header;
+	header.ident = PHYSMESHCACHE_IDENT;
+	header.version = PHYSMESHCACHE_VERSION;
+	header.key = m_iKey;
+	header.physx_version = PX_PHYSICS_VERSION;
+	header.size = stream.getSize();
+
+	Filename out_file( filename );
+	out_file.set_binary();
+
+	std::ofstream out;
+	if ( !out_file.open_write( out ) )
+	{
+		return false;
+	}
+	out.write( (const char *)&header, sizeof( header ) );
+	out.write( (const char *)stream.getData(), stream.getSize() );
+	out.close();
+
+	m_bDirty = false;
+	return true;
+}
+
+static bool CompareTriangleMeshes( const PxTriangleMesh *a, const PxTriangleMesh *b )
+{
+	if ( a->getNbVertices() != b->getNbVertices() ||
+	     a->getNbTriangles() != b->getNbTriangles() ||
+	     a->getTriangleMeshFlags() != b->getTriangleMeshFlags() )
+	{
+		return false;
+	}
+
+	size_t index_size = ( a->getTriangleMeshFlags() & PxTriangleMeshFlag::e16_BIT_INDICES ) ? sizeof( PxU16 ) : sizeof( PxU32 );
+	return memcmp( a->getVertices(), b->getVertices(), a->getNbVertices() * sizeof( PxVec3 ) ) == 0 &&
+		memcmp( a->getTriangles(), b->getTriangles(), a->getNbTriangles() * 3 * index_size ) == 0;
+}
+
+static bool CompareConvexMeshes( const PxConvexMesh *a, const PxConvexMesh *b )
+{
+	if ( a->getNbVertices() != b->getNbVertices() ||
+	     a->getNbPolygons() != b->getNbPolygons() ||
+	     memcmp( a->getVertices(), b->getVertices(), a->getNbVertices() * sizeof( PxVec3 ) ) != 0 )
+	{
+		return false;
+	}
+
+	PxU32 num_indices = 0;
+	for ( PxU32 i = 0; i < a->getNbPolygons(); i++ )
+	{
+		PxHullPolygon poly_a, poly_b;
+		a->getPolygonData( i, poly_a );
+		b->getPolygonData( i, poly_b );
+		if ( memcmp( &poly_a, &poly_b, sizeof( PxHullPolygon ) ) != 0 )
+		{
+			return false;
+		}
+		num_indices = std::max( num_indices, (PxU32)poly_a.mIndexBase + poly_a.mNbVerts );
+	}
+
+	return memcmp( a->getIndexBuffer(), b->getIndexBuffer(), num_indices ) == 0;
+}
+
+/**
+ * Returns true if the other cache holds the same meshes under the same ids,
+ * with the same vertices, triangles and polygons. p3pxcache uses it to check
+ * that the cache file it wrote reads back intact.
+ */
+bool CPhysMeshCache::has_same_meshes( const CPhysMeshCache *other ) const
+{
+	bool ok = other->m_pCollection->getNbObjects() == m_pCollection->getNbObjects();
+	for ( PxU32 i = 0; i < m_pCollection->getNbObjects(); i++ )
+	{
+		PxBase &object = m_pCollection->getObject( i );
+		PxSerialObjectId id = m_pCollection->getId( object );
+		PxBase *other_object = other->m_pCollection->find( id );
+
+		bool same = false;
+		if ( other_object )
+		{
+			if ( PxTriangleMesh *tri_mesh = object.is<PxTriangleMesh>() )
+			{
+				PxTriangleMesh *other_mesh = other_object->is<PxTriangleMesh>();
+				same = other_mesh && CompareTriangleMeshes( tri_mesh, other_mesh );
+			}
+			else if ( PxConvexMesh *convex_mesh = object.is<PxConvexMesh>() )
+			{
+				PxConvexMesh *other_mesh = other_object->is<PxConvexMesh>();
+				same = other_mesh && CompareConvexMeshes( convex_mesh, other_mesh );
+			}
+		}
+
+		if ( !same )
+		{
+			nout << "Mesh " << (int)( id - 1 ) << " differs between the mesh caches\n";
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+bool CPhysMeshCache::has_mesh( int id ) const
+{
+	return m_pCollection->find( MESH_ID( id ) ) != nullptr;
+}
+
+/**
+ * Returns the geometry of the mesh with the given id, or nullptr if the cache
+ * doesn't have it.
+ */
+PT( CPhysGeometry ) CPhysMeshCache::get_mesh( int id )
+{
+	PxBase *object = m_pCollection->find( MESH_ID( id ) );
+	if ( !object )
+	{
+		return nullptr;
+	}
+
+	if ( PxTriangleMesh *tri_mesh = object->is<PxTriangleMesh>() )
+	{
+		return new CPhysTriangleMesh( tri_mesh, this );
+	}
+	else if ( PxConvexMesh *convex_mesh = object->is<PxConvexMesh>() )
+	{
+		return new CPhysConvexMesh( convex_mesh, this );
+	}
+
+	return nullptr;
+}
+
+void CPhysMeshCache::add_mesh( int id, PxBase *pMesh )
+{
+	PxBase *old = m_pCollection->find( MESH_ID( id ) );
+	if ( old )
+	{
+		m_pCollection->remove( *old );
+		// A deserialized mesh is released along with its memory.
+		if ( !is_deserialized( old ) )
+		{
+			old->release();
+		}
+	}
+
+	m_pCollection->add( *pMesh, MESH_ID( id ) );
+	m_bDirty = true;
+}
+
+/**
+ * Cooks a triangle mesh from the data and stores it in the cache under id.
+ */
+PT( CPhysGeometry ) CPhysMeshCache::cook_triangle_mesh( int id, const CPhysMeshData *data )
+{
+	nassertr( data->get_num_triangles() > 0, nullptr );
+
+	PxTriangleMeshDesc desc;
+	desc.points.count = data->get_num_vertices();
+	desc.points.stride = sizeof( LPoint3f );
+	desc.points.data = &data->get_vertices()[0];
+	desc.triangles.count = data->get_num_triangles();
+	desc.triangles.stride = 3 * sizeof( PxU32 );
+	desc.triangles.data = &data->get_indices()[0];
+
+	PxTriangleMesh *mesh = GetPxCooking()->createTriangleMesh( desc, GetPxPhysics()->getPhysicsInsertionCallback() );
+	if ( !mesh )
+	{
+		return nullptr;
+	}
+
+	add_mesh( id, mesh );
+	return new CPhysTriangleMesh( mesh, this );
+}
+
+/**
+ * Cooks the convex hull of the data's vertices and stores it in the cache under id.
+ */
+PT( CPhysGeometry ) CPhysMeshCache::cook_convex_mesh( int id, const CPhysMeshData *data )
+{
+	nassertr( data->get_num_vertices() >= 4, nullptr );
+
+	PxConvexMeshDesc desc;
+	desc.points.count = data->get_num_vertices();
+	desc.points.stride = sizeof( LPoint3f );
+	desc.points.data = &data->get_vertices()[0];
+	desc.flags = PxConvexFlag::eCOMPUTE_CONVEX;
+
+	PxConvexMesh *mesh = GetPxCooking()->createConvexMesh( desc, GetPxPhysics()->getPhysicsInsertionCallback() );
+	if ( !mesh )
+	{
+		return nullptr;
+	}
+
+	add_mesh( id, mesh );
+	return new CPhysConvexMesh( mesh, this );
+}
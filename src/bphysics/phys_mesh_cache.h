@@ -0,0 +1,102 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file phys_mesh_cache.h
+ * @author Brian Lach
+ * @date October 18, 2026
+ */
+
+#pragma once
+
+#include "config_bphysics.h"
+#include <referenceCount.h>
+#include <pointerTo.h>
+#include <filename.h>
+#include <pvector.h>
+#include "physx_types.h"
+
+#include "phys_triangle_mesh.h"
+
+#define PHYSMESHCACHE_IDENT	(('C'<<24)+('M'<<16)+('X'<<8)+'P')	// "PXMC"
+#define PHYSMESHCACHE_VERSION	1
+
+/**
+ * On-disk cache of cooked collision meshes for a level, stored next to the BSP
+ * file. The meshes are kept as a PhysX binary collection, so loading them is a
+ * single read plus PxSerialization::createCollectionFromBinary(), no cooking.
+ *
+ * The cache is keyed by a checksum of the level geometry (see
+ * BSPLoader::get_collision_checksum()); a cache written for a different key,
+ * PhysX version or cache version is ignored. Meshes are identified by a
+ * caller-chosen number, e.g. the brush model index.
+ *
+ * Typical use: read() the cache, get_mesh() every model, and for any that are
+ * missing cook_triangle_mesh()/cook_convex_mesh() and write() the cache back.
+ * p3pxcache writes the cache for a compiled level ahead of time.
+ *
+ * Shapes made from a deserialized mesh only hold a PhysX reference to it, so
+ * when the cache is destroyed while a shape still uses one of its meshes, the
+ * memory they were read into is kept until free_released_memory() finds that
+ * every shape is gone.
+ */
+class EXPORT_BPHYSICS CPhysMeshCache : public ReferenceCount
+{
+PUBLISHED:
+	CPhysMeshCache( unsigned int key );
+	~CPhysMeshCache();
+
+	static Filename get_cache_filename( const Filename &bsp_file );
+
+	bool read( const Filename &filename );
+	bool write( const Filename &filename );
+
+	bool has_mesh( int id ) const;
+	PT( CPhysGeometry ) get_mesh( int id );
+
+	PT( CPhysGeometry ) cook_triangle_mesh( int id, const CPhysMeshData *data );
+	PT( CPhysGeometry ) cook_convex_mesh( int id, const CPhysMeshData *data );
+
+	unsigned int get_key() const;
+	bool is_dirty() const;
+
+	bool has_same_meshes( const CPhysMeshCache *other ) const;
+
+	static int free_released_memory();
+
+private:
+	void add_mesh( int id, PxBase *pMesh );
+	bool is_deserialized( PxBase *pMesh ) const;
+
+	unsigned int m_iKey;
+
+	// Everything in the cache, the deserialized meshes and the newly cooked ones.
+	PxCollection *m_pCollection;
+
+	// Memory the deserialized meshes live in, it must outlive them.
+	void *m_pMemory;
+
+	// Every mesh that lives in m_pMemory, including ones replaced since, with
+	// the number of references it was read with.
+	struct DeserializedMesh
+	{
+		PxBase *mesh;
+		unsigned int refs;
+	};
+	pvector<DeserializedMesh> m_Deserialized;
+
+	// True if a mesh was cooked since the cache was read.
+	bool m_bDirty;
+};
+
+INLINE unsigned int CPhysMeshCache::get_key() const
+{
+	return m_iKey;
+}
+
+INLINE bool CPhysMeshCache::is_dirty() const
+{
+	return m_bDirty;
+}
@@ -0,0 +1,65 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file phys_query_batch.cpp
+ * @author Brian Lach
+ * @date October 18, 2026
+ */
+
+#include "phys_query_batch.h"
+
+CPhysQueryBatch::CPhysQueryBatch( int max_overlap_hits ) :
+	m_nMaxOverlapHits( max_overlap_hits )
+{
+}
+
+int CPhysQueryBatch::add_raycast( const LPoint3f &origin, const LVector3f &dir, float distance )
+{
+	Query query;
+	query.type = QT_raycast;
+	query.origin = origin;
+	query.dir = dir;
+	query.distance = distance;
+	m_Queries.push_back( query );
+	return (int)m_Queries.size() - 1;
+}
+
+int CPhysQueryBatch::add_sweep( CPhysGeometry *geometry, const LPoint3f &origin, const LVector3f &dir, float distance )
+{
+	Query query;
+	query.type = QT_sweep;
+	query.origin = origin;
+	query.dir = dir;
+	query.distance = distance;
+	query.geometry = geometry;
+	m_Queries.push_back( query );
+	return (int)m_Queries.size() - 1;
+}
+
+int CPhysQueryBatch::add_overlap( CPhysGeometry *geometry, const LPoint3f &origin )
+{
+	Query query;
+	query.type = QT_overlap;
+	query.origin = origin;
+	query.dir = LVector3f::zero();
+	query.distance = 0.0f;
+	query.geometry = geometry;
+	m_Queries.push_back( query );
+	return (int)m_Queries.size() - 1;
+}
+
+void CPhysQueryBatch::clear()
+{
+	m_Queries.clear();
+	m_bHit.clear();
+	m_HitPos.clear();
+	m_HitNormal.clear();
+	m_flHitDistance.clear();
+	m_pHitActor.clear();
+	m_pOverlapActors.clear();
+	m_iOverlapFirst.clear();
+	m_nOverlapHits.clear();
+}
@@ -0,0 +1,136 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file phys_query_batch.h
+ * @author Brian Lach
+ * @date October 18, 2026
+ */
+
+#pragma once
+
+#include "config_bphysics.h"
+#include <referenceCount.h>
+#include <pointerTo.h>
+#include <pvector.h>
+#include "luse.h"
+#include "physx_types.h"
+
+#include "phys_geometry.h"
+
+/**
+ * A list of raycast, sweep and overlap queries that are run together by
+ * CPhysScene::execute_queries(). The results are kept in flat arrays indexed
+ * by the number add_*() returned for the query.
+ *
+ * A batch can be reused: clear() it, add the queries of the next frame, and
+ * execute it again without reallocating.
+ */
+class EXPORT_BPHYSICS CPhysQueryBatch : public ReferenceCount
+{
+PUBLISHED:
+	enum QueryType
+	{
+		QT_raycast,
+		QT_sweep,
+		QT_overlap,
+	};
+
+	CPhysQueryBatch( int max_overlap_hits = 32 );
+
+	int add_raycast( const LPoint3f &origin, const LVector3f &dir, float distance );
+	int add_sweep( CPhysGeometry *geometry, const LPoint3f &origin, const LVector3f &dir, float distance );
+	int add_overlap( CPhysGeometry *geometry, const LPoint3f &origin );
+
+	void clear();
+	int get_num_queries() const;
+	QueryType get_query_type( int n ) const;
+
+	// Results of raycasts and sweeps.
+	bool has_hit( int n ) const;
+	LPoint3f get_hit_pos( int n ) const;
+	LVector3f get_hit_normal( int n ) const;
+	float get_hit_distance( int n ) const;
+
+	// Results of overlaps.
+	int get_num_overlap_hits( int n ) const;
+
+public:
+	PxActor *get_hit_actor( int n ) const;
+	PxActor *get_overlap_hit_actor( int n, int i ) const;
+
+private:
+	friend class CPhysScene;
+
+	struct Query
+	{
+		QueryType type;
+		LPoint3f origin;
+		LVector3f dir;
+		float distance;
+		PT( CPhysGeometry ) geometry;
+	};
+
+	pvector<Query> m_Queries;
+
+	// Flat results, one entry per query.
+	pvector<unsigned char> m_bHit;
+	pvector<LPoint3f> m_HitPos;
+	pvector<LVector3f> m_HitNormal;
+	pvector<float> m_flHitDistance;
+	pvector<PxActor *> m_pHitActor;
+
+	// The actors touched by all overlaps, m_iOverlapFirst[n] is where the
+	// hits of query n start and m_nOverlapHits[n] how many there are.
+	pvector<PxActor *> m_pOverlapActors;
+	pvector<int> m_iOverlapFirst;
+	pvector<int> m_nOverlapHits;
+	int m_nMaxOverlapHits;
+};
+
+INLINE int CPhysQueryBatch::get_num_queries() const
+{
+	return (int)m_Queries.size();
+}
+
+INLINE CPhysQueryBatch::QueryType CPhysQueryBatch::get_query_type( int n ) const
+{
+	return m_Queries[n].type;
+}
+
+INLINE bool CPhysQueryBatch::has_hit( int n ) const
+{
+	return m_bHit[n] != 0;
+}
+
+INLINE LPoint3f CPhysQueryBatch::get_hit_pos( int n ) const
+{
+	return m_HitPos[n];
+}
+
+INLINE LVector3f CPhysQueryBatch::get_hit_normal( int n ) const
+{
+	return m_HitNormal[n];
+}
+
+INLINE float CPhysQueryBatch::get_hit_distance( int n ) const
+{
+	return m_flHitDistance[n];
+}
+
+INLINE int CPhysQueryBatch::get_num_overlap_hits( int n ) const
+{
+	return m_nOverlapHits[n];
+}
+
+INLINE PxActor *CPhysQueryBatch::get_hit_actor( int n ) const
+{
+	return m_pHitActor[n];
+}
+
+INLINE PxActor *CPhysQueryBatch::get_overlap_hit_actor( int n, int i ) const
+{
+	return m_pOverlapActors[m_iOverlapFirst[n] + i];
+}
@@ -11,17 +11,161 @@
 
 #include "phys_scene.h"
 #include "physx_globals.h"
+#include "physx_utils.h"
 
-CPhysScene::CPhysScene( const CPhysSceneDesc &desc )
+CPhysScene::CPhysScene( const CPhysSceneDesc &desc ) :
+	m_pDispatcher( nullptr ),
+	m_bSimulating( false )
 {
-	m_pScene = GetPxPhysics()->createScene( desc.get_desc() );
+	PxSceneDesc scene_desc = desc.get_desc();
+	if ( desc.get_num_worker_threads() > 0 )
+	{
+		m_pDispatcher = PxDefaultCpuDispatcherCreate( desc.get_num_worker_threads() );
+		scene_desc.cpuDispatcher = m_pDispatcher;
+	}
+
+	m_pScene = GetPxPhysics()->createScene( scene_desc );
 }
 
 CPhysScene::~CPhysScene()
 {
 	if ( m_pScene )
 	{
+		if ( m_bSimulating )
+		{
+			m_pScene->fetchResults( true );
+		}
 		m_pScene->release();
 		m_pScene = nullptr;
 	}
+
+	if ( m_pDispatcher )
+	{
+		( (PxDefaultCpuDispatcher *)m_pDispatcher )->release();
+		m_pDispatcher = nullptr;
+	}
+}
+
+/**
+ * Starts simulating the scene forward by dt seconds on the worker threads and
+ * returns right away. The results are applied by fetch_results().
+ */
+void CPhysScene::simulate( float dt )
+{
+	nassertv( !m_bSimulating );
+
+	m_pScene->simulate( dt );
+	m_bSimulating = true;
+}
+
+/**
+ * Applies the results of the simulation started by simulate(). If block is
+ * false and the simulation hasn't finished yet, returns false and does nothing.
+ */
+bool CPhysScene::fetch_results( bool block )
+{
+	if ( !m_bSimulating )
+	{
+		return true;
+	}
+
+	if ( !m_pScene->fetchResults( block ) )
+	{
+		return false;
+	}
+
+	m_bSimulating = false;
+	return true;
+}
+
+/**
+ * Simulates the scene forward by dt seconds and waits for it to finish.
+ */
+void CPhysScene::step( float dt )
+{
+	simulate( dt );
+	fetch_results( true );
+}
+
+/**
+ * Runs every query in the batch against the scene and stores the results in it.
+ * Queries see the scene as of the last fetch_results(), so they can be run while
+ * the scene is simulating.
+ */
+void CPhysScene::execute_queries( CPhysQueryBatch *batch ) const
+{
+	size_t num_queries = batch->m_Queries.size();
+
+	batch->m_bHit.assign( num_queries, 0 );
+	batch->m_HitPos.assign( num_queries, LPoint3f::zero() );
+	batch->m_HitNormal.assign( num_queries, LVector3f::zero() );
+	batch->m_flHitDistance.assign( num_queries, 0.0f );
+	batch->m_pHitActor.assign( num_queries, nullptr );
+	batch->m_iOverlapFirst.assign( num_queries, 0 );
+	batch->m_nOverlapHits.assign( num_queries, 0 );
+	batch->m_pOverlapActors.clear();
+
+	pvector<PxOverlapHit> touches( std::max( batch->m_nMaxOverlapHits, 1 ) );
+
+	// Overlaps report everything they touch instead of stopping at the first hit.
+	PxQueryFilterData overlap_filter( PxQueryFlag::eSTATIC | PxQueryFlag::eDYNAMIC | PxQueryFlag::eNO_BLOCK );
+
+	for ( size_t i = 0; i < num_queries; i++ )
+	{
+		const CPhysQueryBatch::Query &query = batch->m_Queries[i];
+		PxVec3 origin = Vec3_to_PxVec3( query.origin );
+
+		switch ( query.type )
+		{
+		case CPhysQueryBatch::QT_raycast:
+			{
+				PxRaycastBuffer hit;
+				if ( m_pScene->raycast( origin, Vec3_to_PxVec3( query.dir ).getNormalized(),
+							query.distance, hit ) && hit.hasBlock )
+				{
+					batch->m_bHit[i] = 1;
+					batch->m_HitPos[i] = PxVec3_to_Vec3( hit.block.position );
+					batch->m_HitNormal[i] = PxVec3_to_Vec3( hit.block.normal );
+					batch->m_flHitDistance[i] = hit.block.distance;
+					batch->m_pHitActor[i] = hit.block.actor;
+				}
+			}
+			break;
+		case CPhysQueryBatch::QT_sweep:
+			{
+				nassertd( query.geometry && query.geometry->get_geometry() ) continue;
+
+				PxSweepBuffer hit;
+				if ( m_pScene->sweep( *query.geometry->get_geometry(), PxTransform( origin ),
+						      Vec3_to_PxVec3( query.dir ).getNormalized(), query.distance, hit ) &&
+				     hit.hasBlock )
+				{
+					batch->m_bHit[i] = 1;
+					batch->m_HitPos[i] = PxVec3_to_Vec3( hit.block.position );
+					batch->m_HitNormal[i] = PxVec3_to_Vec3( hit.block.normal );
+					batch->m_flHitDistance[i] = hit.block.distance;
+					batch->m_pHitActor[i] = hit.block.actor;
+				}
+			}
+			break;
+		case CPhysQueryBatch::QT_overlap:
+			{
+				nassertd( query.geometry && query.geometry->get_geometry() ) continue;
+
+				PxOverlapBuffer hit( &touches[0], (PxU32)touches.size() );
+				batch->m_iOverlapFirst[i] = (int)batch->m_pOverlapActors.size();
+				if ( m_pScene->overlap( *query.geometry->get_geometry(), PxTransform( origin ), hit, overlap_filter ) )
+				{
+					PxU32 num_touches = hit.getNbTouches();
+					for ( PxU32 j = 0; j < num_touches; j++ )
+					{
+						batch->m_pOverlapActors.push_back( hit.getTouch( j ).actor );
+					}
+					batch->m_bHit[i] = num_touches > 0;
+					batch->m_nOverlapHits[i] = (int)num_touches;
+				}
+			}
+			break;
+		}
+	}
 }
@@ -16,13 +16,43 @@
 #include "physx_types.h"
 
 #include "phys_scene_desc.h"
+#include "phys_query_batch.h"
 
-class CPhysScene : public ReferenceCount
+/**
+ * A PhysX scene. Simulation runs on the worker threads of the scene's dispatcher;
+ * simulate() only starts it, so game logic can run until fetch_results().
+ */
+class EXPORT_BPHYSICS CPhysScene : public ReferenceCount
 {
 PUBLISHED:
 	CPhysScene( const CPhysSceneDesc &desc );
 	~CPhysScene();
 
+	void simulate( float dt );
+	bool fetch_results( bool block = true );
+	void step( float dt );
+	bool is_simulating() const;
+
+	void execute_queries( CPhysQueryBatch *batch ) const;
+
+public:
+	PxScene *get_scene() const;
+
 private:
 	PxScene *m_pScene;
-};
\ No newline at end of file
+
+	// Only set if the scene has a dispatcher of its own.
+	PxCpuDispatcher *m_pDispatcher;
+
+	bool m_bSimulating;
+};
+
+INLINE bool CPhysScene::is_simulating() const
+{
+	return m_bSimulating;
+}
+
+INLINE PxScene *CPhysScene::get_scene() const
+{
+	return m_pScene;
+}
\ No newline at end of file
@@ -11,10 +11,15 @@
 
 #include "phys_scene_desc.h"
 #include "physx_utils.h"
+#include "physx_globals.h"
 
 CPhysSceneDesc::CPhysSceneDesc() :
-	m_Desc( physx::PxTolerancesScale() )
+	m_Desc( physx::PxTolerancesScale() ),
+	m_nWorkerThreads( 0 )
 {
+	// A scene can't be created without these.
+	m_Desc.cpuDispatcher = GetPxDefaultCpuDispatcher();
+	m_Desc.filterShader = PxDefaultSimulationFilterShader;
 }
 
 void CPhysSceneDesc::set_gravity( const LVector3f &gravity )
@@ -27,6 +32,16 @@ LVector3f CPhysSceneDesc::get_gravity() const
 	return PxVec3_to_Vec3( m_Desc.gravity );
 }
 
+void CPhysSceneDesc::set_num_worker_threads( int threads )
+{
+	m_nWorkerThreads = threads;
+}
+
+int CPhysSceneDesc::get_num_worker_threads() const
+{
+	return m_nWorkerThreads;
+}
+
 const physx::PxSceneDesc &CPhysSceneDesc::get_desc() const
 {
 	return m_Desc;
@@ -23,9 +23,16 @@ PUBLISHED:
 	void set_gravity( const LVector3f &gravity );
 	LVector3f get_gravity() const;
 
+	void set_num_worker_threads( int threads );
+	int get_num_worker_threads() const;
+
 public:
 	const physx::PxSceneDesc &get_desc() const;
 
 private:
 	physx::PxSceneDesc m_Desc;
+
+	// 0 means the scene runs on the shared dispatcher (physx-worker-threads),
+	// otherwise the scene gets a dispatcher of its own with this many threads.
+	int m_nWorkerThreads;
 };
@@ -0,0 +1,69 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file phys_triangle_mesh.cpp
+ * @author Brian Lach
+ * @date October 18, 2026
+ */
+
+#include "phys_triangle_mesh.h"
+#include "physx_globals.h"
+
+CPhysMeshData::CPhysMeshData()
+{
+}
+
+int CPhysMeshData::add_vertex( const LPoint3f &pos )
+{
+	m_Vertices.push_back( pos );
+	return (int)m_Vertices.size() - 1;
+}
+
+void CPhysMeshData::add_triangle( int v0, int v1, int v2 )
+{
+	m_Indices.push_back( (unsigned int)v0 );
+	m_Indices.push_back( (unsigned int)v1 );
+	m_Indices.push_back( (unsigned int)v2 );
+}
+
+void CPhysMeshData::clear()
+{
+	m_Vertices.clear();
+	m_Indices.clear();
+}
+
+//====================================================================//
+
+CPhysTriangleMesh::CPhysTriangleMesh( PxTriangleMesh *pMesh, ReferenceCount *pOwner ) :
+	m_pMesh( pMesh ),
+	m_pOwner( pOwner )
+{
+	m_pGeometry = new PxTriangleMeshGeometry( pMesh );
+}
+
+int CPhysTriangleMesh::get_num_triangles() const
+{
+	return (int)m_pMesh->getNbTriangles();
+}
+
+int CPhysTriangleMesh::get_num_vertices() const
+{
+	return (int)m_pMesh->getNbVertices();
+}
+
+//====================================================================//
+
+CPhysConvexMesh::CPhysConvexMesh( PxConvexMesh *pMesh, ReferenceCount *pOwner ) :
+	m_pMesh( pMesh ),
+	m_pOwner( pOwner )
+{
+	m_pGeometry = new PxConvexMeshGeometry( pMesh );
+}
+
+int CPhysConvexMesh::get_num_vertices() const
+{
+	return (int)m_pMesh->getNbVertices();
+}
@@ -0,0 +1,114 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file phys_triangle_mesh.h
+ * @author Brian Lach
+ * @date October 18, 2026
+ */
+
+#pragma once
+
+#include "config_bphysics.h"
+#include <referenceCount.h>
+#include <pointerTo.h>
+#include <pvector.h>
+#include "luse.h"
+#include "physx_types.h"
+
+#include "phys_geometry.h"
+
+/**
+ * Vertices and triangles to cook a triangle or convex mesh from. Convex meshes
+ * only use the vertices.
+ */
+class EXPORT_BPHYSICS CPhysMeshData : public ReferenceCount
+{
+PUBLISHED:
+	CPhysMeshData();
+
+	int add_vertex( const LPoint3f &pos );
+	void add_triangle( int v0, int v1, int v2 );
+	void clear();
+
+	int get_num_vertices() const;
+	int get_num_triangles() const;
+
+public:
+	const pvector<LPoint3f> &get_vertices() const;
+	const pvector<unsigned int> &get_indices() const;
+
+private:
+	pvector<LPoint3f> m_Vertices;
+	pvector<unsigned int> m_Indices;
+};
+
+INLINE int CPhysMeshData::get_num_vertices() const
+{
+	return (int)m_Vertices.size();
+}
+
+INLINE int CPhysMeshData::get_num_triangles() const
+{
+	return (int)m_Indices.size() / 3;
+}
+
+INLINE const pvector<LPoint3f> &CPhysMeshData::get_vertices() const
+{
+	return m_Vertices;
+}
+
+INLINE const pvector<unsigned int> &CPhysMeshData::get_indices() const
+{
+	return m_Indices;
+}
+
+/**
+ * Geometry of a cooked triangle mesh. Holds a reference to whatever owns the
+ * memory of the mesh (see CPhysMeshCache).
+ */
+class EXPORT_BPHYSICS CPhysTriangleMesh : public CPhysGeometry
+{
+PUBLISHED:
+	int get_num_triangles() const;
+	int get_num_vertices() const;
+
+public:
+	CPhysTriangleMesh( PxTriangleMesh *pMesh, ReferenceCount *pOwner );
+
+	PxTriangleMesh *get_mesh() const;
+
+private:
+	PxTriangleMesh *m_pMesh;
+	PT( ReferenceCount ) m_pOwner;
+};
+
+INLINE PxTriangleMesh *CPhysTriangleMesh::get_mesh() const
+{
+	return m_pMesh;
+}
+
+/**
+ * Geometry of a cooked convex mesh.
+ */
+class EXPORT_BPHYSICS CPhysConvexMesh : public CPhysGeometry
+{
+PUBLISHED:
+	int get_num_vertices() const;
+
+public:
+	CPhysConvexMesh( PxConvexMesh *pMesh, ReferenceCount *pOwner );
+
+	PxConvexMesh *get_mesh() const;
+
+private:
+	PxConvexMesh *m_pMesh;
+	PT( ReferenceCount ) m_pOwner;
+};
+
+INLINE PxConvexMesh *CPhysConvexMesh::get_mesh() const
+{
+	return m_pMesh;
+}
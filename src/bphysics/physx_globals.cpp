@@ -11,6 +11,29 @@
 
 #include "physx_globals.h"
 
+#include <configVariableInt.h>
+
+#include <algorithm>
+#include <thread>
+
+static ConfigVariableInt physx_worker_threads
+( "physx-worker-threads", 0,
+  PRC_DESC( "Number of worker threads PhysX simulates scenes on. 0 uses one less "
+	    "than the number of CPU cores." ) );
+
+/**
+ * Returns the number of worker threads a dispatcher should be created with.
+ */
+PxU32 GetPxNumWorkerThreads()
+{
+	int threads = physx_worker_threads;
+	if ( threads <= 0 )
+	{
+		threads = (int)std::thread::hardware_concurrency() - 1;
+	}
+	return (PxU32)std::max( threads, 1 );
+}
+
 PxFoundation *GetPxFoundation()
 {
 	static PxFoundation *pFoundation = PxCreateFoundation( PX_PHYSICS_VERSION, *GetPxDefaultAllocator(), *GetPxDefaultErrorCallback() );
@@ -23,9 +46,22 @@ PxPhysics *GetPxPhysics()
 	return pPhysics;
 }
 
+PxCooking *GetPxCooking()
+{
+	static PxCooking *pCooking = PxCreateCooking( PX_PHYSICS_VERSION, *GetPxFoundation(),
+						       PxCookingParams( GetPxPhysics()->getTolerancesScale() ) );
+	return pCooking;
+}
+
+PxSerializationRegistry *GetPxSerializationRegistry()
+{
+	static PxSerializationRegistry *pRegistry = PxSerialization::createSerializationRegistry( *GetPxPhysics() );
+	return pRegistry;
+}
+
 PxDefaultCpuDispatcher *GetPxDefaultCpuDispatcher()
 {
-	static PxDefaultCpuDispatcher *pDispatch = PxDefaultCpuDispatcherCreate( 1 );
+	static PxDefaultCpuDispatcher *pDispatch = PxDefaultCpuDispatcherCreate( GetPxNumWorkerThreads() );
 	return pDispatch;
 }
 
@@ -23,6 +23,9 @@ using namespace physx;
 
 extern PxFoundation *GetPxFoundation();
 extern PxPhysics *GetPxPhysics();
+extern PxCooking *GetPxCooking();
+extern PxSerializationRegistry *GetPxSerializationRegistry();
 extern PxDefaultCpuDispatcher *GetPxDefaultCpuDispatcher();
+extern PxU32 GetPxNumWorkerThreads();
 extern PxDefaultAllocator *GetPxDefaultAllocator();
 extern PxDefaultErrorCallback *GetPxDefaultErrorCallback();
@@ -20,6 +20,12 @@ namespace physx
 	class PxScene;
 	class PxMaterial;
 	class PxGeometry;
+	class PxActor;
+	class PxCpuDispatcher;
+	class PxTriangleMesh;
+	class PxConvexMesh;
+	class PxCollection;
+	class PxBase;
 };
 
 using namespace physx;
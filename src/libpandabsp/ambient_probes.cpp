@@ -53,6 +53,7 @@ static PStatCollector ambientboost_collector( "AmbientProbes:UpdateNodes:BoostAm
 static PStatCollector xformlight_collector( "AmbientProbes:XformLight" );
 static PStatCollector loadcubemap_collector( "AmbientProbes:UpdateNodes:LoadCubemap" );
 static PStatCollector findcubemap_collector( "AmbientProbes:UpdateNodes:FindCubemap" );
+static PStatCollector rank_lights_collector( "AmbientProbes:UpdateNodes:UpdateLocalLights:Rank" );
 
 static ConfigVariableBool cfg_lightaverage
 ( "light-average", true, "Activates/deactivate light averaging" );
@@ -68,6 +69,12 @@ static ConfigVariableDouble r_ambientfraction
 static ConfigVariableDouble r_ambientfactor
 ( "r_ambientfactor", 5.0, "Boost ambient cube by no more than this factor." );
 
+static ConfigVariableDouble light_cull_threshold
+( "light-cull-threshold", 1.0 / 255.0,
+  PRC_DESC( "Lights are not assigned to leafs or models where their intensity has "
+            "fallen below this value. Light colors are in the 0-1 range, so the "
+            "default is one step of an 8-bit color." ) );
+
 using std::cos;
 using std::sin;
 
@@ -75,6 +82,10 @@ using std::sin;
 #define GARBAGECOLLECT_TIME 10.0
 //#define VISUALIZE_AMBPROBES
 
+// Max lights considered for a model, the rest are too dim to make the cut
+// even if some of the brighter ones are occluded.
+#define MAX_CANDIDATE_LIGHTS ( MAX_TOTAL_LIGHTS * 2 )
+
 static light_t *dummy_light = new light_t;
 
 AmbientProbeManager::AmbientProbeManager() :
@@ -87,6 +98,7 @@ AmbientProbeManager::AmbientProbeManager() :
         dummy_light->id = -1;
         dummy_light->leaf = 0;
         dummy_light->type = 0;
+        dummy_light->radius = -1;
 }
 
 AmbientProbeManager::AmbientProbeManager( BSPLoader *loader ) :
@@ -116,6 +128,79 @@ INLINE int lighttype_from_classname( const char *classname )
         return LIGHTTYPE_POINT;
 }
 
+/**
+ * Returns the distance at which the light's intensity falls below the cull
+ * threshold, or -1 if it never does.
+ */
+static float calc_light_radius( const light_t *light )
+{
+        if ( light->type == LIGHTTYPE_SUN )
+        {
+                return -1;
+        }
+
+        float c = light->falloff[0];
+        float l = light->falloff[1];
+        float q = light->falloff[2];
+        float intensity = std::max( light->color[0], std::max( light->color[1], light->color[2] ) );
+
+        // Solve intensity / ( c + l*d + q*d^2 ) = threshold for d. With the default
+        // threshold a 200 brightness light with quadratic falloff reaches about
+        // 1400 units, and a _fifty_percent_distance light a little past its
+        // _zero_percent_distance.
+        float threshold = (float)light_cull_threshold;
+        float k = intensity / std::max( threshold, 0.0001f );
+        float radius = -1;
+        if ( threshold <= 0.0 )
+        {
+                // culled by the end fade only
+        }
+        else if ( q > 0.0 )
+        {
+                float disc = l * l - 4 * q * ( c - k );
+                radius = disc > 0.0 ? ( -l + std::sqrt( disc ) ) / ( 2 * q ) : 0.0f;
+        }
+        else if ( l > 0.0 )
+        {
+                radius = std::max( ( k - c ) / l, 0.0f );
+        }
+
+        // _hardfalloff lights are zero past the end fade.
+        float end_fade = light->falloff2[1];
+        if ( end_fade > 0.0 && ( radius < 0.0 || end_fade < radius ) )
+        {
+                radius = end_fade;
+        }
+
+        return radius;
+}
+
+/**
+ * Returns the brightest channel of the light at the point, ignoring spotlight
+ * cones and occlusion. Used to rank lights, not to shade.
+ */
+INLINE float calc_light_contribution( const light_t *light, const LPoint3 &point )
+{
+        LVector3 lvec = ( light->pos - point ) * 16.0; // lighting falloff parameters in hammer space
+        float d2 = lvec.dot( lvec );
+        if ( light->radius >= 0.0 && d2 > light->radius * light->radius )
+        {
+                return 0.0;
+        }
+
+        float d = std::sqrt( d2 );
+        float atten = 1.0;
+        float denom = light->falloff[0] +
+                light->falloff[1] * d +
+                light->falloff[2] * d2;
+        if ( denom > 0.00001 )
+        {
+                atten = 1.0 / denom;
+        }
+
+        return std::max( light->color[0], std::max( light->color[1], light->color[2] ) ) * atten;
+}
+
 void AmbientProbeManager::process_ambient_probes()
 {
 
@@ -219,6 +304,8 @@ void AmbientProbeManager::process_ambient_probes()
                                 }
                         }
 
+                        light->radius = calc_light_radius( light );
+
                         _all_lights.push_back( light );
                         if ( light->type == LIGHTTYPE_SUN )
                         {
@@ -252,6 +339,8 @@ void AmbientProbeManager::process_ambient_probes()
                 }
         }
 
+        build_light_clusters();
+
         for ( size_t i = 0; i < _loader->_bspdata->leafambientindex.size(); i++ )
         {
                 dleafambientindex_t *ambidx = &_loader->_bspdata->leafambientindex[i];
@@ -318,6 +407,61 @@ void AmbientProbeManager::process_ambient_probes()
         
 }
 
+/**
+ * Builds the list of lights that can affect each leaf: the lights in the PVS of
+ * the leaf whose radius reaches its bounds. Lights are static, so this is done
+ * once per level and a model only has to rank the few lights of its leaf.
+ */
+void AmbientProbeManager::build_light_clusters()
+{
+        int numleafs = _loader->_bspdata->dmodels[0].visleafs + 1;
+        _light_clusters.clear();
+        _light_clusters.resize( numleafs );
+
+        for ( int leafnum = 0; leafnum < numleafs; leafnum++ )
+        {
+                const dleaf_t *leaf = _loader->_bspdata->dleafs + leafnum;
+                LPoint3 mins( leaf->mins[0], leaf->mins[1], leaf->mins[2] );
+                LPoint3 maxs( leaf->maxs[0], leaf->maxs[1], leaf->maxs[2] );
+                LPoint3 center = ( mins + maxs ) / 32.0;
+
+                pvector<std::pair<float, light_t *>> cluster;
+                const pvector<light_t *> &pvs = _light_pvs[leafnum];
+                for ( size_t i = 0; i < pvs.size(); i++ )
+                {
+                        light_t *light = pvs[i];
+                        if ( light->radius >= 0.0 )
+                        {
+                                // Distance from the light to the closest point of the leaf.
+                                LPoint3 pos = light->pos * 16.0;
+                                LVector3 closest( std::max( mins[0], std::min( pos[0], maxs[0] ) ),
+                                                  std::max( mins[1], std::min( pos[1], maxs[1] ) ),
+                                                  std::max( mins[2], std::min( pos[2], maxs[2] ) ) );
+                                if ( ( closest - pos ).length_squared() > light->radius * light->radius )
+                                {
+                                        continue;
+                                }
+                        }
+
+                        float key = ( light->pos - center ).length_squared();
+                        cluster.push_back( std::make_pair( key, light ) );
+                }
+
+                std::sort( cluster.begin(), cluster.end(),
+                           []( const std::pair<float, light_t *> &a, const std::pair<float, light_t *> &b )
+                {
+                        return a.first < b.first;
+                } );
+
+                pvector<light_t *> &lights = _light_clusters[leafnum];
+                lights.reserve( cluster.size() );
+                for ( size_t i = 0; i < cluster.size(); i++ )
+                {
+                        lights.push_back( cluster[i].second );
+                }
+        }
+}
+
 void AmbientProbeManager::load_cubemaps()
 {
         std::cout << _loader->_bspdata->cubemaps.size() << " cubemaps " << std::endl;
@@ -605,14 +749,35 @@ const RenderState *AmbientProbeManager::update_node( PandaNode *node,
         {
                 input->occluded_lights.reset();
 
-                // Update local light sources
-                input->locallights = _light_pvs[leaf_id];
-                // Sort local lights from closest to furthest distance from node, we will choose the two closest lights.
-                std::sort( input->locallights.begin(), input->locallights.end(), [curr_net]( const light_t *a, const light_t *b )
+                // Update local light sources.
+                // The leaf's light list is already culled, so only the lights that reach
+                // this leaf get ranked by how much they contribute to the node.
+                rank_lights_collector.start();
+                const pvector<light_t *> &cluster = _light_clusters[leaf_id];
+                _light_scores.clear();
+                for ( size_t i = 0; i < cluster.size(); i++ )
                 {
-                        return ( a->pos - curr_net ).length_squared() < ( b->pos - curr_net ).length_squared();
+                        float score = calc_light_contribution( cluster[i], curr_net );
+                        if ( score > 0.0 )
+                        {
+                                _light_scores.push_back( std::make_pair( score, cluster[i] ) );
+                        }
+                }
+
+                size_t num_candidates = std::min( _light_scores.size(), (size_t)MAX_CANDIDATE_LIGHTS );
+                std::partial_sort( _light_scores.begin(), _light_scores.begin() + num_candidates, _light_scores.end(),
+                                   []( const std::pair<float, light_t *> &a, const std::pair<float, light_t *> &b )
+                {
+                        return a.first > b.first;
                 } );
 
+                input->locallights.clear();
+                for ( size_t i = 0; i < num_candidates; i++ )
+                {
+                        input->locallights.push_back( _light_scores[i].second );
+                }
+                rank_lights_collector.stop();
+
                 int sky_idx = -1;
                 if ( is_sky_visible( curr_net ) )
                 {
@@ -899,6 +1064,7 @@ void AmbientProbeManager::cleanup()
         _probes.clear();
         _all_probes.clear();
         _light_pvs.clear();
+        _light_clusters.clear();
         _all_lights.clear();
         _cubemaps.clear();
 }
@@ -63,6 +63,10 @@ struct light_t : public ReferenceCount
         LVector4 falloff2;
         LVector4 falloff3;
 
+        // Distance in hammer units past which the light is too dim to matter,
+        // or -1 if it reaches everywhere.
+        float radius;
+
         // If the light is potentially visible, updated each frame.
         LVector4 eye_pos;
         LVector4 eye_direction;
@@ -75,6 +79,9 @@ struct light_t : public ReferenceCount
 
 #define LIGHTING_UNINITIALIZED -1
 
+// Number of shader attribs a node remembers having its inputs applied to.
+#define NODE_INPUT_CACHE_SIZE 4
+
 #ifndef CPPPARSER
 class CNodeShaderInput : public TypedReferenceCount
 {
@@ -113,6 +120,12 @@ public:
 
         int active_lights;
 
+        // Shader attribs with this node's inputs applied, by the attrib they were
+        // applied to. The input arrays are updated in place, so these stay valid.
+        CPT( RenderAttrib ) applied_from[NODE_INPUT_CACHE_SIZE];
+        CPT( RenderAttrib ) applied_to[NODE_INPUT_CACHE_SIZE];
+        int next_applied;
+
         INLINE void copy_needed( const CNodeShaderInput *other )
         {
                 light_count.set_data( other->light_count.get_data() );
@@ -123,7 +136,8 @@ public:
         }
 
         INLINE CNodeShaderInput( const CNodeShaderInput *other ) :
-                TypedReferenceCount()
+                TypedReferenceCount(),
+                next_applied( 0 )
         {
                 copy_needed( other );
         }
@@ -147,6 +161,7 @@ public:
                 cubemap_tex->clear_image();
                 sky_idx = -1;
                 active_lights = 0;
+                next_applied = 0;
                 ambient_boost = false;
                 memset( boxcolor, 0, sizeof( LVector3 ) * 6 );
                 memset( boxcolor_boosted, 0, sizeof( LVector3 ) * 6 );
@@ -165,7 +180,8 @@ public:
                 occluded_lights( other.occluded_lights ),
                 cubemap_tex( other.cubemap_tex ),
                 state_with_input( other.state_with_input ),
-                last_transform( other.last_transform )
+                last_transform( other.last_transform ),
+                next_applied( 0 )
         {
                 //ambient_cube = PTA_LVecBase3::empty_array( 6 );
                 //light_count = PTA_int::empty_array( 1 );
@@ -241,6 +257,8 @@ private:
         INLINE bool is_sky_visible( const LPoint3 &point );
         INLINE bool is_light_visible( const LPoint3 &point, const light_t *light );
 
+        void build_light_clusters();
+
 private:
         BSPLoader *_loader;
 
@@ -251,6 +269,8 @@ private:
         pvector<PT( light_t )> _all_lights;
         pvector<PT( cubemap_t )> _cubemaps;
         pvector<pvector<light_t *>> _light_pvs;
+        // Lights in the PVS of each leaf whose radius reaches the leaf, nearest to its center first.
+        pvector<pvector<light_t *>> _light_clusters;
         light_t *_sunlight;
 
        // PT( KDTree ) _light_kdtree;
@@ -264,6 +284,9 @@ private:
 
         Mutex _cache_mutex;
 
+        // Scratch space for ranking the lights of a node.
+        pvector<std::pair<float, light_t *>> _light_scores;
+
 public:
         friend class NodeWeakCallback;
 };
@@ -10,12 +10,35 @@
  */
 
 #include "audio_3d_manager.h"
+#include "bsploader.h"
 
 #include <asyncTaskManager.h>
 #include <audioManager.h>
 #include <clockObject.h>
 #include <pStatCollector.h>
 #include <pStatTimer.h>
+#include <configVariableBool.h>
+#include <configVariableDouble.h>
+
+static ConfigVariableBool audio_pvs_cull
+( "audio-pvs-cull", true,
+  PRC_DESC( "Don't update sounds attached to nodes in leafs that aren't potentially visible from the listener." ) );
+
+static ConfigVariableDouble audio_cull_interval
+( "audio-cull-interval", 0.25,
+  PRC_DESC( "How often, in seconds, a node whose sounds were culled is checked again." ) );
+
+static ConfigVariableBool audio_occlusion
+( "audio-occlusion", false,
+  PRC_DESC( "Quiet sounds that are blocked from the listener by world geometry." ) );
+
+static ConfigVariableDouble audio_occlusion_volume
+( "audio-occlusion-volume", 0.5,
+  PRC_DESC( "Volume scale of a sound that is occluded from the listener." ) );
+
+static ConfigVariableDouble audio_occlusion_interval
+( "audio-occlusion-interval", 0.2,
+  PRC_DESC( "How often, in seconds, the occlusion of a node is traced again." ) );
 
 struct audio3d_nodecallbackdata_t
 {
@@ -46,8 +69,10 @@ void Audio3DNodeWeakCallback::wp_callback( void *data )
 static PStatCollector attach_collector( "App:Audio3DManager:AttachSound" );
 static PStatCollector detach_collector( "App:Audio3DManager:DetachSound" );
 static PStatCollector update_collector( "App:Audio3DManager:Update" );
+static PStatCollector occlusion_collector( "App:Audio3DManager:Update:Occlusion" );
 
-Audio3DManager::Audio3DManager( AudioManager *mgr, const NodePath &listener_target, const NodePath &root )
+Audio3DManager::Audio3DManager( AudioManager *mgr, const NodePath &listener_target, const NodePath &root ) :
+	_num_updated( 0 )
 {
 	_root = root;
 	attach_listener( listener_target );
@@ -75,13 +100,23 @@ void Audio3DManager::attach_sound_to_object( AudioSound *sound, const NodePath &
 
 	PandaNode *node = object.node();
 
+	soundentry_t sound_entry;
+	sound_entry.sound = sound;
+	sound_entry.base_volume = sound->get_volume();
+	sound_entry.applied_volume = sound_entry.base_volume;
+
 	int itr = _nodes.find( node );
 	if ( itr == -1 )
 	{
 		nodeentry_t new_entry;
 		new_entry.node = node;
 		new_entry.last_pos = object.get_pos( _root );
-		new_entry.sounds.push_back( sound );
+		new_entry.sounds.push_back( sound_entry );
+		new_entry.last_update = ClockObject::get_global_clock()->get_frame_time();
+		new_entry.next_check = 0.0;
+		new_entry.num_playing = 0;
+		new_entry.occlusion = 1.0f;
+		new_entry.next_occlusion_check = 0.0;
 		_nodes[node] = new_entry;
 
 		// Add a callback to remove this node when the reference count
@@ -95,7 +130,10 @@ void Audio3DManager::attach_sound_to_object( AudioSound *sound, const NodePath &
 	}
 	else
 	{
-		_nodes[node].sounds.push_back( sound );
+		nodeentry_t &entry = _nodes[node];
+		entry.sounds.push_back( sound_entry );
+		// Get the new sound positioned right away.
+		entry.next_check = 0.0;
 	}
 }
 
@@ -103,35 +141,110 @@ void Audio3DManager::detach_sound( AudioSound *sound )
 {
 }
 
-void Audio3DManager::update()
+/**
+ * Returns true if any sound on the node is playing, within its max distance
+ * of the listener, and in a leaf that is potentially visible from the listener's.
+ */
+bool Audio3DManager::is_audible( nodeentry_t &entry, const LPoint3 &pos, int listener_leaf ) const
 {
-	PStatTimer timer( update_collector );
+	PN_stdfloat max_dist = 0.0f;
+	bool playing = false;
+	for ( size_t i = 0; i < entry.sounds.size(); i++ )
+	{
+		AudioSound *sound = entry.sounds[i].sound;
+		if ( sound->status() == AudioSound::PLAYING )
+		{
+			playing = true;
+			max_dist = std::max( max_dist, sound->get_3d_max_distance() );
+		}
+	}
 
-	if ( !_mgr || !_mgr->get_active() )
+	if ( !playing )
 	{
-		return;
+		return false;
 	}
 
-	double dt = ClockObject::get_global_clock()->get_dt();
+	if ( ( pos - _listener_last_pos ).length_squared() > max_dist * max_dist )
+	{
+		return false;
+	}
 
-	for ( size_t i = 0; i < _nodes.get_num_entries(); i++ )
+	if ( listener_leaf != -1 )
 	{
-		nodeentry_t &entry = _nodes[_nodes.get_key( i )];
-		NodePath object = NodePath( entry.node );
-		
+		BSPLoader *loader = BSPLoader::get_global_ptr();
+		if ( !loader->is_cluster_visible( listener_leaf, loader->find_leaf( pos ) ) )
+		{
+			return false;
+		}
+	}
 
-		LPoint3 pos = object.get_pos( _root );
-		object.clear();
-		LVector3 vel = ( pos - entry.last_pos ) / dt;
-		entry.last_pos = pos;
+	return true;
+}
 
-		for ( size_t j = 0; j < entry.sounds.size(); j++ )
+/**
+ * Traces from the listener to the node if the last trace is too old, then
+ * applies the resulting occlusion to its sounds.
+ */
+void Audio3DManager::update_occlusion( nodeentry_t &entry, const LPoint3 &pos, double now )
+{
+	PN_stdfloat occlusion = entry.occlusion;
+
+	if ( now >= entry.next_occlusion_check )
+	{
+		PStatTimer timer( occlusion_collector );
+
+		// Offset by a random fraction so nodes attached at the same
+		// time don't all trace on the same frame.
+		entry.next_occlusion_check = now + audio_occlusion_interval * ( 0.75 + 0.5 * ( rand() / (double)RAND_MAX ) );
+
+		BSPLoader *loader = BSPLoader::get_global_ptr();
+		occlusion = loader->trace_line( _listener_last_pos, pos ) ? 1.0f : (PN_stdfloat)audio_occlusion_volume;
+	}
+
+	apply_occlusion( entry, occlusion );
+}
+
+/**
+ * Sets the volume of every sound on the node to the volume the game gave it
+ * scaled by occlusion. A volume the game set since the last call becomes the
+ * new base volume, so game volume changes are kept and never compounded.
+ */
+void Audio3DManager::apply_occlusion( nodeentry_t &entry, PN_stdfloat occlusion )
+{
+	for ( size_t i = 0; i < entry.sounds.size(); i++ )
+	{
+		soundentry_t &sound_entry = entry.sounds[i];
+		PN_stdfloat volume = sound_entry.sound->get_volume();
+		if ( volume != sound_entry.applied_volume )
 		{
-			AudioSound *sound = entry.sounds[j];
-			sound->set_3d_attributes( pos[0], pos[1], pos[2], vel[0], vel[1], vel[2] );
+			sound_entry.base_volume = volume;
 		}
+
+		sound_entry.applied_volume = sound_entry.base_volume * occlusion;
+		if ( volume != sound_entry.applied_volume )
+		{
+			sound_entry.sound->set_volume( sound_entry.applied_volume );
+		}
+	}
+	entry.occlusion = occlusion;
+}
+
+void Audio3DManager::update()
+{
+	PStatTimer timer( update_collector );
+
+	_num_updated = 0;
+
+	if ( !_mgr || !_mgr->get_active() )
+	{
+		return;
 	}
 
+	ClockObject *clock = ClockObject::get_global_clock();
+	double dt = clock->get_dt();
+	double now = clock->get_frame_time();
+
+	// The listener goes first so the nodes are culled against where it is now.
 	if ( !_listener_target.is_empty() )
 	{
 		LPoint3 pos = _listener_target.get_pos( _root );
@@ -154,4 +267,76 @@ void Audio3DManager::update()
 			0, 1, 0,
 			0, 0, 1 );
 	}
+
+	// Culling against the level only makes sense with a listener in it.
+	BSPLoader *loader = BSPLoader::get_global_ptr();
+	bool in_level = !_listener_target.is_empty() && loader && loader->has_active_level();
+	int listener_leaf = -1;
+	if ( in_level && audio_pvs_cull && loader->has_visibility() )
+	{
+		listener_leaf = loader->find_leaf( _listener_last_pos );
+	}
+	bool occlusion = in_level && audio_occlusion;
+
+	for ( size_t i = 0; i < _nodes.get_num_entries(); i++ )
+	{
+		nodeentry_t &entry = _nodes.modify_data( i );
+
+		int num_playing = 0;
+		for ( size_t j = 0; j < entry.sounds.size(); j++ )
+		{
+			if ( entry.sounds[j].sound->status() == AudioSound::PLAYING )
+			{
+				num_playing++;
+			}
+		}
+
+		// A sound that started since the node was culled must not
+		// play from a stale position, so don't wait out the interval.
+		bool started = num_playing > entry.num_playing;
+		entry.num_playing = num_playing;
+		if ( now < entry.next_check && !started )
+		{
+			continue;
+		}
+
+		NodePath object = NodePath( entry.node );
+		LPoint3 pos = object.get_pos( _root );
+		object.clear();
+
+		if ( !_listener_target.is_empty() && !is_audible( entry, pos, listener_leaf ) )
+		{
+			// Nobody can hear it, check again in a little while.
+			entry.next_check = now + audio_cull_interval;
+			if ( entry.occlusion != 1.0f )
+			{
+				apply_occlusion( entry, 1.0f );
+			}
+			continue;
+		}
+		entry.next_check = 0.0;
+
+		if ( occlusion )
+		{
+			update_occlusion( entry, pos, now );
+		}
+		else if ( entry.occlusion != 1.0f )
+		{
+			// Occlusion was turned off or the listener left the level.
+			apply_occlusion( entry, 1.0f );
+		}
+
+		// The node may have been culled for a while, so use the time since its last update.
+		double elapsed = now - entry.last_update;
+		LVector3 vel = elapsed > 0.0 ? LVector3( ( pos - entry.last_pos ) / elapsed ) : LVector3::zero();
+		entry.last_pos = pos;
+		entry.last_update = now;
+
+		for ( size_t j = 0; j < entry.sounds.size(); j++ )
+		{
+			AudioSound *sound = entry.sounds[j].sound;
+			sound->set_3d_attributes( pos[0], pos[1], pos[2], vel[0], vel[1], vel[2] );
+		}
+		_num_updated += (int)entry.sounds.size();
+	}
 }
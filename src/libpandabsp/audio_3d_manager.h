@@ -22,11 +22,33 @@
 #include <weakPointerCallback.h>
 #include <referenceCount.h>
 
+struct soundentry_t
+{
+	PT( AudioSound ) sound;
+
+	// Volume the game set on the sound, and the volume last set on it
+	// for occlusion. A mismatch means the game changed the volume since.
+	PN_stdfloat base_volume;
+	PN_stdfloat applied_volume;
+};
+
 struct nodeentry_t
 {
 	PandaNode *node;
 	LPoint3 last_pos;
-	pvector<PT( AudioSound )> sounds;
+	pvector<soundentry_t> sounds;
+
+	// Time the position was last sent to the sounds.
+	double last_update;
+	// Time the node may be considered for an update again, used to
+	// check culled nodes less often. A sound that starts playing
+	// before then gets the node updated right away.
+	double next_check;
+	int num_playing;
+
+	// Volume scale currently applied for occlusion, and when to trace again.
+	PN_stdfloat occlusion;
+	double next_occlusion_check;
 };
 
 class EXPCL_PANDABSP Audio3DManager : public ReferenceCount
@@ -101,15 +123,26 @@ PUBLISHED:
 	void print_audio_digest();
 
 	void update();
-	
+
+	INLINE int get_num_updated_sounds() const
+	{
+		return _num_updated;
+	}
 
 private:
+	bool is_audible( nodeentry_t &entry, const LPoint3 &pos, int listener_leaf ) const;
+	void update_occlusion( nodeentry_t &entry, const LPoint3 &pos, double now );
+	void apply_occlusion( nodeentry_t &entry, PN_stdfloat occlusion );
+
 	PT( AudioManager ) _mgr;
 	NodePath _listener_target;
 	LPoint3 _listener_last_pos;
 	NodePath _root;
 	SimpleHashMap<PandaNode *, nodeentry_t, pointer_hash> _nodes;
 
+	// Number of sounds whose attributes were updated last frame.
+	int _num_updated;
+
 	friend class Audio3DNodeWeakCallback;
 };
 
@@ -107,45 +107,276 @@ TextureStage *TextureStages::get_glowmap()
 //====================================================================//
 
 #include "keyvalues.h"
+#include "shader_spec.h"
+#include "material_cache.h"
 #include <virtualFileSystem.h>
+#include <texturePool.h>
+#include <genericThread.h>
+#include <configVariableInt.h>
+#include <pset.h>
+
+#include <atomic>
 
 NotifyCategoryDef( bspmaterial, "" );
 
+static ConfigVariableInt material_load_threads
+( "material-load-threads", 4,
+  PRC_DESC( "Number of threads used to load the materials of a level." ) );
+
 TypeHandle BSPMaterial::_type_handle;
 
-BSPMaterial::materialcache_t BSPMaterial::_material_cache;
+MaterialParams::MaterialParams() :
+        features( 0 ),
+        translucent( false ),
+        alpha( -1 ),
+        ao( 1.0 ),
+        roughness( 0.0 ),
+        metallic( 0.0 ),
+        emissive( 0.0 ),
+        rimlight_boost( 1.0 ),
+        rimlight_exponent( 4.0 ),
+        detail_factor( 1.0 ),
+        detail_scale( 1.0 ),
+        detail_tint( 1.0 ),
+        envmap_tint( 1.0 ),
+        selfillum_tint( 1.0, 1.0, 1.0 )
+{
+}
 
-const BSPMaterial *BSPMaterial::get_from_file( const Filename &file )
+/**
+ * Applies a `clamp` or `repeat` keyvalue to the given texture wrap mode.
+ */
+static void apply_wrap_mode( const std::string &wrapmode, Texture *tex, bool u, bool v )
 {
-        LightMutexHolder holder( g_matmutex );
+        SamplerState::WrapMode mode;
+        if ( wrapmode == "clamp" )
+        {
+                mode = SamplerState::WM_clamp;
+        }
+        else if ( wrapmode == "repeat" )
+        {
+                mode = SamplerState::WM_repeat;
+        }
+        else
+        {
+                bspmaterial_cat.warning()
+                        << "BaseTextureFeature: unknown wrap mode `" << wrapmode << "`\n";
+                return;
+        }
 
-        int idx = _material_cache.find( file );
-        if ( idx != -1 )
+        if ( u )
+                tex->set_wrap_u( mode );
+        if ( v )
+                tex->set_wrap_v( mode );
+}
+
+/**
+ * Returns the compiled parameter block of this material, compiling it first
+ * if the keyvalues changed since it was last compiled. Compiling loads every
+ * texture the material references, so it is put off until a shader asks; the
+ * compile tools only read the material's properties and never pay for it.
+ */
+const MaterialParams &BSPMaterial::get_params() const
+{
+        if ( AtomicAdjust::get( _params_dirty ) )
         {
-                // We've already loaded this material file.
-                return _material_cache.get_data( idx );
+                LightMutexHolder holder( _params_lock );
+                if ( AtomicAdjust::get( _params_dirty ) )
+                {
+                        compile_params();
+                }
         }
-        
-        VirtualFileSystem *vfs = VirtualFileSystem::get_global_ptr();
-        if ( !vfs->exists( file ) )
+
+        return _params;
+}
+
+/**
+ * Parses the keyvalues of the material into _params.
+ */
+void BSPMaterial::compile_params() const
+{
+        MaterialParams params;
+
+        int idx;
+
+        if ( ( idx = _shader_keyvalues.find( "$basetexture" ) ) != -1 )
         {
-                bspmaterial_cat.error()
-                        << "Could not find material file " << file.get_fullpath() << "\n";
-                return nullptr;
+                params.features |= MF_basetexture;
+
+                int alpha_idx = _shader_keyvalues.find( "$basetexture_alpha" );
+                if ( alpha_idx != -1 )
+                {
+                        // alpha channel supplied in a separate texture,
+                        // common in Toontown
+                        params.textures[MT_basetexture] = TexturePool::load_texture( _shader_keyvalues.get_data( idx ),
+                                                                                     _shader_keyvalues.get_data( alpha_idx ) );
+                }
+                else
+                {
+                        params.textures[MT_basetexture] = TexturePool::load_texture( _shader_keyvalues.get_data( idx ) );
+                }
+
+                Texture *base_texture = params.textures[MT_basetexture];
+                if ( base_texture )
+                {
+                        // Convert color texture from gamma to linear when reading in shader
+                        enable_srgb_read( base_texture, true );
+
+                        if ( ( idx = _shader_keyvalues.find( "$basetexture_wrap" ) ) != -1 )
+                        {
+                                apply_wrap_mode( _shader_keyvalues.get_data( idx ), base_texture, true, true );
+                        }
+                        else
+                        {
+                                if ( ( idx = _shader_keyvalues.find( "$basetexture_wrapu" ) ) != -1 )
+                                        apply_wrap_mode( _shader_keyvalues.get_data( idx ), base_texture, true, false );
+                                if ( ( idx = _shader_keyvalues.find( "$basetexture_wrapv" ) ) != -1 )
+                                        apply_wrap_mode( _shader_keyvalues.get_data( idx ), base_texture, false, true );
+                        }
+                }
         }
 
-        bspmaterial_cat.info()
-                << "Loading material " << file.get_fullpath() << "\n";
+        if ( ( idx = _shader_keyvalues.find( "$bumpmap" ) ) != -1 )
+        {
+                params.features |= MF_bumpmap;
+                params.textures[MT_bumpmap] = TexturePool::load_texture( _shader_keyvalues.get_data( idx ) );
+        }
 
-        PT( BSPMaterial ) mat = new BSPMaterial;
-        mat->_file = file;
+        if ( ( idx = _shader_keyvalues.find( "$envmap" ) ) != -1 )
+        {
+                params.features |= MF_envmap;
+
+                const std::string &envmap = _shader_keyvalues.get_data( idx );
+                if ( envmap == "env_cubemap" )
+                {
+                        params.features |= MF_env_cubemap;
+                }
+                else
+                {
+                        Texture *envmap_texture = TexturePool::load_cube_map( envmap );
+                        params.textures[MT_envmap] = envmap_texture;
+                        if ( envmap_texture )
+                        {
+                                envmap_texture->set_minfilter( SamplerState::FT_linear_mipmap_linear );
+                                enable_srgb_read( envmap_texture, true );
+                        }
+                }
+
+                if ( ( idx = _shader_keyvalues.find( "$envmaptint" ) ) != -1 )
+                        params.envmap_tint = CKeyValues::to_3f( _shader_keyvalues.get_data( idx ) );
+        }
+
+        if ( ( idx = _shader_keyvalues.find( "$detail" ) ) != -1 )
+        {
+                params.features |= MF_detail;
+                params.textures[MT_detail] = TexturePool::load_texture( _shader_keyvalues.get_data( idx ) );
+
+                if ( ( idx = _shader_keyvalues.find( "$detailfactor" ) ) != -1 )
+                        params.detail_factor = atof( _shader_keyvalues.get_data( idx ).c_str() );
+                if ( ( idx = _shader_keyvalues.find( "$detailscale" ) ) != -1 )
+                        params.detail_scale = atof( _shader_keyvalues.get_data( idx ).c_str() );
+                if ( ( idx = _shader_keyvalues.find( "$detailtint" ) ) != -1 )
+                        params.detail_tint = CKeyValues::to_3f( _shader_keyvalues.get_data( idx ) );
+        }
+
+        if ( ( idx = _shader_keyvalues.find( "$lightwarp" ) ) != -1 )
+        {
+                params.features |= MF_lightwarp;
+
+                Texture *lightwarp_tex = TexturePool::load_texture( _shader_keyvalues.get_data( idx ) );
+                params.textures[MT_lightwarp] = lightwarp_tex;
+                if ( lightwarp_tex )
+                {
+                        lightwarp_tex->set_wrap_u( SamplerState::WM_clamp );
+                        lightwarp_tex->set_wrap_v( SamplerState::WM_clamp );
+                        enable_srgb_read( lightwarp_tex, true );
+                }
+        }
+
+        if ( ( idx = _shader_keyvalues.find( "$arme" ) ) != -1 )
+        {
+                params.features |= MF_arme;
+                params.textures[MT_arme] = TexturePool::load_texture( _shader_keyvalues.get_data( idx ) );
+        }
+        else
+        {
+                if ( ( idx = _shader_keyvalues.find( "$ao" ) ) != -1 )
+                        params.ao = atof( _shader_keyvalues.get_data( idx ).c_str() );
+                if ( ( idx = _shader_keyvalues.find( "$roughness" ) ) != -1 )
+                        params.roughness = atof( _shader_keyvalues.get_data( idx ).c_str() );
+                if ( ( idx = _shader_keyvalues.find( "$metallic" ) ) != -1 )
+                        params.metallic = atof( _shader_keyvalues.get_data( idx ).c_str() );
+                if ( ( idx = _shader_keyvalues.find( "$emissive" ) ) != -1 )
+                        params.emissive = atof( _shader_keyvalues.get_data( idx ).c_str() );
+        }
+
+        if ( ( idx = _shader_keyvalues.find( "$selfillum" ) ) != -1 &&
+             atoi( _shader_keyvalues.get_data( idx ).c_str() ) != 0 )
+        {
+                params.features |= MF_selfillum;
+
+                if ( ( idx = _shader_keyvalues.find( "$selfillumtint" ) ) != -1 )
+                        params.selfillum_tint = CKeyValues::to_3f( _shader_keyvalues.get_data( idx ) );
+        }
+
+        if ( ( idx = _shader_keyvalues.find( "$rimlight" ) ) != -1 &&
+             atoi( _shader_keyvalues.get_data( idx ).c_str() ) != 0 )
+        {
+                params.features |= MF_rimlight;
+
+                if ( ( idx = _shader_keyvalues.find( "$rimlightboost" ) ) != -1 )
+                        params.rimlight_boost = atof( _shader_keyvalues.get_data( idx ).c_str() );
+                if ( ( idx = _shader_keyvalues.find( "$rimlightexponent" ) ) != -1 )
+                        params.rimlight_exponent = atof( _shader_keyvalues.get_data( idx ).c_str() );
+        }
+
+        if ( ( idx = _shader_keyvalues.find( "$halflambert" ) ) != -1 &&
+             atoi( _shader_keyvalues.get_data( idx ).c_str() ) != 0 )
+        {
+                params.features |= MF_halflambert;
+        }
+
+        if ( ( idx = _shader_keyvalues.find( "$alpha" ) ) != -1 )
+        {
+                params.features |= MF_alpha;
+                params.alpha = atof( _shader_keyvalues.get_data( idx ).c_str() );
+        }
+        else if ( ( idx = _shader_keyvalues.find( "$translucent" ) ) != -1 )
+        {
+                params.features |= MF_translucent;
+                params.translucent = atoi( _shader_keyvalues.get_data( idx ).c_str() ) != 0;
+        }
+
+        if ( ( idx = _shader_keyvalues.find( "$planarreflection" ) ) != -1 &&
+             atoi( _shader_keyvalues.get_data( idx ).c_str() ) != 0 )
+        {
+                params.features |= MF_planarreflection;
+        }
 
+        if ( ( idx = _shader_keyvalues.find( "$lightmapped" ) ) != -1 &&
+             atoi( _shader_keyvalues.get_data( idx ).c_str() ) == 0 )
+        {
+                params.features |= MF_not_lightmapped;
+        }
+
+        _params = params;
+        AtomicAdjust::set( _params_dirty, 0 );
+}
+
+BSPMaterial::materialcache_t BSPMaterial::_material_cache;
+
+/**
+ * Parses the material file into this material, pulling in the keyvalues of the
+ * material it $include's if it is a patch material.
+ */
+bool BSPMaterial::read_keyvalues( const Filename &file )
+{
         PT( CKeyValues ) kv = CKeyValues::load( file );
         if ( !kv )
         {
                 bspmaterial_cat.error()
                         << "Problem loading " << file.get_fullpath() << "\n";
-                return nullptr;
+                return false;
         }
         CKeyValues *mat_kv = kv->get_child( 0 );
 	if ( mat_kv->get_name() == "patch" )
@@ -160,56 +391,235 @@ const BSPMaterial *BSPMaterial::get_from_file( const Filename &file )
 				bspmaterial_cat.error()
 					<< "Could not load $include material `" << include_file
 					<< "` referenced by patch material `" << file << "`\n";
-				return nullptr;
+				return false;
 			}
 
 			// Use the shader from the included material
-			mat->set_shader( include_mat->get_shader() );
+			set_shader( include_mat->get_shader() );
 
 			// Put the included material's properties in front of the patch.
 			// This way, the patch material's properties will be iterated over last
 			// and be able to override the include material.
 			for ( size_t i = 0; i < include_mat->get_num_keyvalues(); i++ )
 			{
-				mat->set_keyvalue( include_mat->get_key( i ), include_mat->get_value( i ) );
+				set_keyvalue( include_mat->get_key( i ), include_mat->get_value( i ) );
 			}
+
+                        _includes.push_back( include_file );
+                        _includes.insert( _includes.end(), include_mat->_includes.begin(), include_mat->_includes.end() );
 		}
 		else
 		{
 			bspmaterial_cat.error()
 				<< "Patch material " << file << " didn't provide an $include\n";
-			return nullptr;
+			return false;
 		}
 	}
 	else
 	{
-		mat->set_shader( mat_kv->get_name() ); // ->VertexLitGeneric<- {...}
+		set_shader( mat_kv->get_name() ); // ->VertexLitGeneric<- {...}
 	}
 
         for ( size_t i = 0; i < mat_kv->get_num_keys(); i++ )
         {
-                mat->set_keyvalue( mat_kv->get_key( i ), mat_kv->get_value( i ) ); // "$basetexture"   "phase_3/maps/desat_shirt_1.jpg"
+                set_keyvalue( mat_kv->get_key( i ), mat_kv->get_value( i ) ); // "$basetexture"   "phase_3/maps/desat_shirt_1.jpg"
         }
 
-        // Figure out these values and store
-        // for fast and easy access elsewhere.
-        mat->_has_env_cubemap = ( mat->has_keyvalue( "$envmap" ) && mat->get_keyvalue( "$envmap" ) == "env_cubemap" );
-        if ( mat->has_keyvalue( "$surfaceprop" ) )
-                mat->_surfaceprop = mat->get_keyvalue( "$surfaceprop" );
-        if ( mat->has_keyvalue( "$contents" ) )
-                mat->_contents = mat->get_keyvalue( "$contents" );
-        mat->_has_transparency = ( mat->has_keyvalue( "$translucent" ) && atoi( mat->get_keyvalue( "$translucent" ).c_str() ) == 1 ) ||
-                ( mat->has_keyvalue( "$alpha" ) && atof( mat->get_keyvalue( "$alpha" ).c_str() ) < 1.0 );
-	mat->_has_bumpmap = mat->has_keyvalue( "$bumpmap" );
+        return true;
+}
+
+/**
+ * Figures out the values that are stored for fast and easy access elsewhere.
+ */
+void BSPMaterial::setup_properties()
+{
+        _has_env_cubemap = ( has_keyvalue( "$envmap" ) && get_keyvalue( "$envmap" ) == "env_cubemap" );
+        if ( has_keyvalue( "$surfaceprop" ) )
+                _surfaceprop = get_keyvalue( "$surfaceprop" );
+        if ( has_keyvalue( "$contents" ) )
+                _contents = get_keyvalue( "$contents" );
+        _has_transparency = ( has_keyvalue( "$translucent" ) && atoi( get_keyvalue( "$translucent" ).c_str() ) == 1 ) ||
+                ( has_keyvalue( "$alpha" ) && atof( get_keyvalue( "$alpha" ).c_str() ) < 1.0 );
+	_has_bumpmap = has_keyvalue( "$bumpmap" );
 	// UNDONE: This is hardcoded, maybe define a global list of lightmapped shaders?
-	mat->_lightmapped = mat->get_shader() == "LightmappedGeneric";
-	mat->_skybox = mat->get_shader() == "SkyBox";
+	_lightmapped = get_shader() == "LightmappedGeneric";
+	_skybox = get_shader() == "SkyBox";
+}
+
+/**
+ * Returns the material described by the given .mat file, loading it the first
+ * time it is requested. Materials are shared, do not modify the returned material.
+ *
+ * The parsed keyvalues come from the on-disk MaterialCache when the file hasn't
+ * changed since it was cached. The material lock is not held while the file is
+ * read, so several materials may load at once (see precache_materials()).
+ */
+const BSPMaterial *BSPMaterial::get_from_file( const Filename &file )
+{
+        {
+                LightMutexHolder holder( g_matmutex );
+
+                int idx = _material_cache.find( file );
+                if ( idx != -1 )
+                {
+                        // We've already loaded this material file.
+                        return _material_cache.get_data( idx );
+                }
+        }
+        
+        VirtualFileSystem *vfs = VirtualFileSystem::get_global_ptr();
+        PT( VirtualFile ) vfile = vfs->get_file( file );
+        if ( !vfile )
+        {
+                bspmaterial_cat.error()
+                        << "Could not find material file " << file.get_fullpath() << "\n";
+                return nullptr;
+        }
+
+        PT( BSPMaterial ) mat = new BSPMaterial;
+        mat->_file = file;
+
+        MaterialCache *disk_cache = MaterialCache::get_global_ptr();
+        MaterialCacheEntry entry;
+        time_t timestamp = vfile->get_timestamp();
+
+        if ( disk_cache->find( file, timestamp, entry ) )
+        {
+                if ( bspmaterial_cat.is_debug() )
+                {
+                        bspmaterial_cat.debug()
+                                << "Loading material " << file.get_fullpath() << " from cache\n";
+                }
+
+                mat->set_shader( entry.shader );
+                for ( size_t i = 0; i < entry.keyvalues.size(); i++ )
+                {
+                        mat->set_keyvalue( entry.keyvalues[i].first, entry.keyvalues[i].second );
+                }
+                for ( size_t i = 0; i < entry.dependencies.size(); i++ )
+                {
+                        mat->_includes.push_back( entry.dependencies[i].file );
+                }
+        }
+        else
+        {
+                bspmaterial_cat.info()
+                        << "Loading material " << file.get_fullpath() << "\n";
+
+                entry = MaterialCacheEntry();
+                if ( !mat->read_keyvalues( file ) )
+                {
+                        return nullptr;
+                }
+
+                entry.shader = mat->get_shader();
+                for ( size_t i = 0; i < mat->get_num_keyvalues(); i++ )
+                {
+                        entry.keyvalues.push_back( std::make_pair( mat->get_key( i ), mat->get_value( i ) ) );
+                }
+                for ( size_t i = 0; i < mat->_includes.size(); i++ )
+                {
+                        PT( VirtualFile ) include_file = vfs->get_file( mat->_includes[i] );
+                        MaterialCacheEntry::Dependency dep;
+                        dep.file = mat->_includes[i];
+                        dep.timestamp = include_file ? include_file->get_timestamp() : 0;
+                        entry.dependencies.push_back( dep );
+                }
+                disk_cache->store( file, timestamp, entry );
+        }
+
+        mat->setup_properties();
+
+        LightMutexHolder holder( g_matmutex );
+
+        int idx = _material_cache.find( file );
+        if ( idx != -1 )
+        {
+                // Another thread loaded it while we were.
+                return _material_cache.get_data( idx );
+        }
 
         _material_cache[file] = mat;
 
         return mat;
 }
 
+struct MaterialLoadJob
+{
+        const vector_string *files;
+        std::atomic<int> next_file;
+};
+
+static void load_materials( void *data )
+{
+        MaterialLoadJob *job = (MaterialLoadJob *)data;
+        int num_files = (int)job->files->size();
+
+        int i;
+        while ( ( i = job->next_file.fetch_add( 1 ) ) < num_files )
+        {
+                const BSPMaterial *mat = BSPMaterial::get_from_file( ( *job->files )[i] );
+                if ( mat )
+                {
+                        // The level is about to render these, resolve their textures while
+                        // we're spread across threads.
+                        mat->get_params();
+                }
+        }
+}
+
+/**
+ * Loads all of the given material files at once, spread across
+ * material-load-threads threads, and then writes any newly parsed
+ * materials to the material cache.
+ */
+void BSPMaterial::precache_materials( const vector_string &files )
+{
+        vector_string unique_files;
+        {
+                LightMutexHolder holder( g_matmutex );
+
+                pset<std::string> seen;
+                for ( size_t i = 0; i < files.size(); i++ )
+                {
+                        if ( _material_cache.find( files[i] ) == -1 && seen.insert( files[i] ).second )
+                        {
+                                unique_files.push_back( files[i] );
+                        }
+                }
+        }
+
+        if ( !unique_files.empty() )
+        {
+                MaterialLoadJob job;
+                job.files = &unique_files;
+                job.next_file = 0;
+
+                int num_threads = std::min( (int)material_load_threads, (int)unique_files.size() );
+                if ( !Thread::is_threading_supported() )
+                        num_threads = 1;
+
+                pvector<PT( GenericThread )> threads;
+                for ( int i = 1; i < num_threads; i++ )
+                {
+                        PT( GenericThread ) thread = new GenericThread( "material-load", "material-load",
+                                                                        load_materials, &job );
+                        if ( thread->start( TP_normal, true ) )
+                                threads.push_back( thread );
+                }
+
+                // the calling thread works too
+                load_materials( &job );
+
+                for ( size_t i = 0; i < threads.size(); i++ )
+                {
+                        threads[i]->join();
+                }
+        }
+
+        MaterialCache::get_global_ptr()->flush();
+}
+
 //====================================================================//
 
 TypeHandle BSPMaterialAttrib::_type_handle;
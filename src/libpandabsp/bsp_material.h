@@ -19,6 +19,10 @@
 #include <pmap.h>
 #include <textureStage.h>
 #include <renderAttrib.h>
+#include <texture.h>
+#include <vector_string.h>
+#include <lightMutex.h>
+#include <atomicAdjust.h>
 
 #define DEFAULT_SHADER	"UnlitNoMat"
 
@@ -58,6 +62,76 @@ private:
 
 NotifyCategoryDeclNoExport(bspmaterial);
 
+/**
+ * Bits of MaterialParams::features.
+ */
+enum MaterialFeature
+{
+        MF_basetexture          = 1 << 0,
+        MF_bumpmap              = 1 << 1,
+        MF_envmap               = 1 << 2,
+        MF_env_cubemap          = 1 << 3,       // $envmap is `env_cubemap`, the closest one in the level is used
+        MF_detail               = 1 << 4,
+        MF_lightwarp            = 1 << 5,
+        MF_arme                 = 1 << 6,
+        MF_selfillum            = 1 << 7,
+        MF_rimlight             = 1 << 8,
+        MF_halflambert          = 1 << 9,
+        MF_alpha                = 1 << 10,
+        MF_translucent          = 1 << 11,      // $translucent was specified, see MaterialParams::translucent
+        MF_planarreflection     = 1 << 12,
+        MF_not_lightmapped      = 1 << 13,      // $lightmapped 0
+};
+
+enum MaterialTexture
+{
+        MT_basetexture,
+        MT_bumpmap,
+        MT_envmap,
+        MT_detail,
+        MT_lightwarp,
+        MT_arme,
+
+        MT_COUNT,
+};
+
+/**
+ * The parameters of a material that the shader features care about, compiled
+ * once from the keyvalues of the material. Textures are loaded and have their
+ * sampler state applied at compile time, and values are already parsed, so
+ * synthesizing a shader for the material doesn't touch any strings.
+ */
+struct EXPCL_PANDABSP MaterialParams
+{
+        MaterialParams();
+
+        INLINE bool has( unsigned int features ) const
+        {
+                return ( this->features & features ) != 0;
+        }
+
+        unsigned int features;
+        PT( Texture ) textures[MT_COUNT];
+
+        bool translucent;
+        float alpha;
+
+        float ao;
+        float roughness;
+        float metallic;
+        float emissive;
+
+        float rimlight_boost;
+        float rimlight_exponent;
+
+        float detail_factor;
+        float detail_scale;
+        LVector3 detail_tint;
+
+        LVector3 envmap_tint;
+        LVector3 selfillum_tint;
+};
+
 #ifdef CPPPARSER
 class BSPMaterial : public TypedReferenceCount
 #else
@@ -75,7 +149,8 @@ PUBLISHED:
 		_contents( "solid" ),
 		_has_bumpmap( false ),
 		_lightmapped( false ),
-		_skybox( false )
+		_skybox( false ),
+		_params_dirty( 1 )
         {
         }
 
@@ -91,7 +166,10 @@ PUBLISHED:
 		_has_transparency( copy._has_transparency ),
 		_lightmapped( copy._lightmapped ),
 		_has_bumpmap( copy._has_bumpmap ),
-		_skybox( copy._skybox )
+		_skybox( copy._skybox ),
+		_params( copy._params ),
+		_params_dirty( AtomicAdjust::get( copy._params_dirty ) ),
+		_includes( copy._includes )
         {
         }
 
@@ -109,11 +187,15 @@ PUBLISHED:
 		_lightmapped = copy._lightmapped;
 		_has_bumpmap = copy._has_bumpmap;
 		_skybox = copy._skybox;
+                _params = copy._params;
+                AtomicAdjust::set( _params_dirty, AtomicAdjust::get( copy._params_dirty ) );
+                _includes = copy._includes;
         }
 
         INLINE void set_keyvalue( const std::string &key, const std::string &value )
         {
                 _shader_keyvalues[key] = value;
+                AtomicAdjust::set( _params_dirty, 1 );
         }
         INLINE std::string get_keyvalue( const std::string &key ) const
         {
@@ -196,8 +278,16 @@ PUBLISHED:
 	}
 
         static const BSPMaterial *get_from_file( const Filename &file );
+        static void precache_materials( const vector_string &files );
+
+public:
+        const MaterialParams &get_params() const;
 
 private:
+        bool read_keyvalues( const Filename &file );
+        void setup_properties();
+        void compile_params() const;
+
         Filename _file;
         std::string _shader_name;
         bool _has_env_cubemap;
@@ -210,6 +300,14 @@ private:
         std::string _contents;
         SimpleHashMap<std::string, std::string, string_hash> _shader_keyvalues;
 
+        // Compiled on the first get_params() after the keyvalues change.
+        mutable MaterialParams _params;
+        mutable AtomicAdjust::Integer _params_dirty;
+        mutable LightMutex _params_lock;
+
+        // Every file $include'd into this material, directly or not.
+        vector_string _includes;
+
         typedef SimpleHashMap<std::string, CPT( BSPMaterial ), string_hash> materialcache_t;
         static materialcache_t _material_cache;
 
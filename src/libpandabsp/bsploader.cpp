@@ -838,10 +838,10 @@ void BSPLoader::make_faces()
                         texref_t *texref = &_bspdata->dtexrefs[texinfo->texref];
 
                         CPT( BSPMaterial ) bspmat = BSPMaterial::get_from_file( std::string( texref->name ) );
+			const MaterialParams &matparams = bspmat->get_params();
 			if ( bspmat->is_lightmapped() &&
-			     bspmat->has_keyvalue( "$planarreflection" ) &&
-			     bspmat->get_keyvalue_int( "$planarreflection" ) != 0 &&
-			     !bspmat->has_keyvalue( "$envmap" ) )
+			     matparams.has( MF_planarreflection ) &&
+			     !matparams.has( MF_envmap ) )
 			{
 				dplane_t *plane = _bspdata->dplanes + face->planenum;
 				LVector3 planevec = LVector3( plane->normal[0],
@@ -857,12 +857,10 @@ void BSPLoader::make_faces()
 
                         bool skip = false;
 
-                        bool mat_normalmap = bspmat->has_keyvalue( "$bumpmap" );
+                        bool mat_normalmap = matparams.has( MF_bumpmap );
 
                         bool has_lighting = ( face->lightofs != -1 && _want_lightmaps ) && !skip && bspmat->get_shader() == "LightmappedGeneric";
-                        if ( has_lighting &&
-                             bspmat->has_keyvalue( "$lightmapped" ) &&
-                             atoi( bspmat->get_keyvalue( "$lightmapped" ).c_str() ) == 0 )
+                        if ( has_lighting && matparams.has( MF_not_lightmapped ) )
                         {
                                 has_lighting = false;
                         }
@@ -873,11 +871,7 @@ void BSPLoader::make_faces()
                         // Read the material's $basetexture and alpha to determine
                         // if a TransparencyAttrib is needed, and to get the size of the
                         // texture for brush face texcoords
-                        PT( Texture ) tex = nullptr;
-                        if ( bspmat->has_keyvalue( "$basetexture" ) )
-                        {
-                                tex = TexturePool::load_texture( bspmat->get_keyvalue( "$basetexture" ) );
-                        }
+                        Texture *tex = matparams.textures[MT_basetexture];
                         bool has_transparency = bspmat->has_transparency();
 
 			dface_lightmap_info_t lminfo;
@@ -943,7 +937,7 @@ void BSPLoader::make_faces()
 
                         if ( has_lighting )
                         {
-                                if ( face->bumped_lightmap && bspmat->has_keyvalue( "$bumpmap" ) )
+                                if ( face->bumped_lightmap && mat_normalmap )
                                 {
 					faceroot.set_texture( TextureStages::get_bumped_lightmap(),
 						lminfo.palette_entry->palette->palette_tex );
@@ -1053,6 +1047,17 @@ void BSPLoader::get_model_bounds( int modelnum, LPoint3 &mins, LPoint3 &maxs )
         maxs /= 16.0;
 }
 
+/**
+ * Returns a checksum of the lumps that collision meshes are built from, so that
+ * cooked meshes cached for the level can be thrown out when the geometry changes.
+ */
+unsigned int BSPLoader::get_collision_checksum() const
+{
+        nassertr( _bspdata != nullptr, 0 );
+
+        return CollisionChecksum( _bspdata );
+}
+
 void BuildGeomNodes_r( PandaNode *node, pvector<PT( GeomNode )> &list )
 {
         if ( node->is_of_type( GeomNode::get_class_type() ) )
@@ -1574,6 +1579,22 @@ void BSPLoader::read_materials_file()
         }
 }
 
+/**
+ * Loads the material of every texref in the level in one go, so the
+ * materials can be read in parallel before the geometry asks for them.
+ */
+void BSPLoader::load_materials()
+{
+        vector_string files;
+        files.reserve( _bspdata->numtexrefs );
+        for ( int i = 0; i < _bspdata->numtexrefs; i++ )
+        {
+                files.push_back( _bspdata->dtexrefs[i].name );
+        }
+
+        BSPMaterial::precache_materials( files );
+}
+
 bool BSPLoader::read( const Filename &file, bool is_transition )
 {
 	cleanup( is_transition );
@@ -1662,6 +1683,8 @@ bool BSPLoader::read( const Filename &file, bool is_transition )
         }
         _leaf_aabb_lock.release();
 
+        load_materials();
+
 	load_geometry();
 
         load_entities();
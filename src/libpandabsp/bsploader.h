@@ -270,6 +270,7 @@ PUBLISHED:
 
         int extract_modelnum( int entnum );
         void get_model_bounds( int modelnum, LPoint3 &mins, LPoint3 &maxs );
+        unsigned int get_collision_checksum() const;
 
         void set_ai( bool ai );
         INLINE bool is_ai() const
@@ -412,6 +413,7 @@ protected:
         void load_cubemaps();
 
 	void read_materials_file();
+        void load_materials();
 
         void remove_model( int modelnum );
 
@@ -4,6 +4,7 @@
 //
 
 #include "interpolatedvar.h"
+#include "mathlib/ssemath.h"
 
 CInterpolationContext *CInterpolationContext::s_pHead = NULL;
 bool CInterpolationContext::s_bAllowExtrapolation = false;
@@ -13,4 +14,56 @@ float g_flLastPacketTimestamp = 0;
 
 ConfigVariableDouble cl_extrapolate_amount(
 	"cl_extrapolate_amount", 0.25,
-	"Set how many seconds the client will extrapolate entities for." );
\ No newline at end of file
+	"Set how many seconds the client will extrapolate entities for." );
+
+// Function statics, variables may be constructed during static initialization.
+static LightMutex &GetBlocksLock()
+{
+	static LightMutex lock( "CInterpolatedVarSystem" );
+	return lock;
+}
+
+static pvector<CInterpolatedVarSystem::BlockFunc> &GetBlocks()
+{
+	static pvector<CInterpolatedVarSystem::BlockFunc> blocks;
+	return blocks;
+}
+
+void CInterpolatedVarSystem::RegisterBlock( BlockFunc func )
+{
+	LightMutexHolder holder( GetBlocksLock() );
+	GetBlocks().push_back( func );
+}
+
+void CInterpolatedVarSystem::InterpolateAll( float currentTime )
+{
+	LightMutexHolder holder( GetBlocksLock() );
+
+	pvector<BlockFunc> &blocks = GetBlocks();
+	for ( size_t i = 0; i < blocks.size(); i++ )
+	{
+		blocks[i]( currentTime );
+	}
+}
+
+void CInterpolatedVarSystem::BlendLanes( int components, int stride, const float *w0, const float *w2,
+					 const float *p0, const float *p1, const float *p2, float *out )
+{
+	for ( int i = 0; i < stride; i += 4 )
+	{
+		fltx4 weight0 = LoadUnalignedSIMD( w0 + i );
+		fltx4 weight2 = LoadUnalignedSIMD( w2 + i );
+
+		for ( int c = 0; c < components; c++ )
+		{
+			int ofs = c * stride + i;
+			fltx4 start = LoadUnalignedSIMD( p1 + ofs );
+			fltx4 to_end = SubSIMD( LoadUnalignedSIMD( p2 + ofs ), start );
+			fltx4 to_prev = SubSIMD( LoadUnalignedSIMD( p0 + ofs ), start );
+
+			fltx4 result = MaddSIMD( to_end, weight2, start );
+			result = MaddSIMD( to_prev, weight0, result );
+			StoreUnalignedSIMD( out + ofs, result );
+		}
+	}
+}
@@ -7,6 +7,9 @@
 #include <aa_luse.h>
 #include <configVariableDouble.h>
 #include <clockObject.h>
+#include <lightMutex.h>
+#include <lightMutexHolder.h>
+#include <pvector.h>
 #include "config_bsp.h"
 #include "mathlib.h"
 #ifndef CPPPARSER
@@ -16,7 +19,7 @@ typedef uint8_t byte;
 #endif
 
 #define COMPARE_HISTORY( a, b )                                           \
-	( memcmp( m_VarHistory[a].GetValue(), m_VarHistory[b].GetValue(), \
+	( memcmp( m_VarHistory.Value( a ), m_VarHistory.Value( b ),       \
 		  sizeof( Type ) * GetMaxCount() ) == 0 )
 
 // Define this to have it measure whether or not the interpolated entity list
@@ -464,6 +467,426 @@ private:
 	unsigned short m_growSize;
 };
 
+// --------------------------------------------------------------------------------------------------------------
+// // CInterpolatedVarSystem - interpolates every variable at once.
+// --------------------------------------------------------------------------------------------------------------
+// //
+//
+// The history of every CInterpolatedVar lives in the CInterpolatedVarBlock of its
+// type, structure-of-arrays style: a page holds the change times of 64 variables
+// in one array and their values in another. The variable itself only keeps a
+// handle to its slot.
+//
+// Once a frame, InterpolateAll() walks each block, finds the history samples and
+// blend weights of every variable, writes them out as one array per component
+// with one lane per variable, blends the whole block in a single SIMD pass and
+// scatters the results back to the values.
+//
+// Variables that can't be expressed as a blend of up to three samples (looping
+// values, extrapolation, types without float components) go through their
+// regular Interpolate(). CInterpolatedVarArray keeps its history in a ring
+// buffer of its own and isn't part of the batch.
+//
+
+class EXPCL_PANDABSP CInterpolatedVarSystem
+{
+PUBLISHED:
+	// Interpolates every variable that isn't EXCLUDE_AUTO_INTERPOLATE. Use it
+	// instead of calling Interpolate() on each variable.
+	static void InterpolateAll( float currentTime );
+
+public:
+	typedef void ( *BlockFunc )( float currentTime );
+	static void RegisterBlock( BlockFunc func );
+
+	// out = p1 + ( p2 - p1 ) * w2 + ( p0 - p1 ) * w0, for `components` arrays of
+	// `stride` lanes each. stride must be a multiple of 4.
+	static void BlendLanes( int components, int stride, const float *w0, const float *w2,
+				const float *p0, const float *p1, const float *p2, float *out );
+};
+
+// Describes how the batch interpolator treats a type: the number of floats in it
+// (0 means the type is never batched) and whether it does hermite interpolation.
+template <typename Type>
+struct InterpolatedVarTraits
+{
+	enum
+	{
+		COMPONENTS = 0,
+		HERMITE = 1
+	};
+};
+
+template <>
+struct InterpolatedVarTraits<float>
+{
+	enum
+	{
+		COMPONENTS = 1,
+		HERMITE = 1
+	};
+};
+
+template <>
+struct InterpolatedVarTraits<LVector2f>
+{
+	enum
+	{
+		COMPONENTS = 2,
+		HERMITE = 1
+	};
+};
+
+// Lerp_Hermite<LVector3> is a plain lerp, see lerp_functions.h.
+template <>
+struct InterpolatedVarTraits<LVector3f>
+{
+	enum
+	{
+		COMPONENTS = 3,
+		HERMITE = 0
+	};
+};
+
+template <>
+struct InterpolatedVarTraits<LVector4f>
+{
+	enum
+	{
+		COMPONENTS = 4,
+		HERMITE = 1
+	};
+};
+
+template <typename Type, bool IS_ARRAY>
+class CInterpolatedVarArrayBase;
+
+// One history entry as the interpolation code sees it, pointing into whichever
+// storage the history uses.
+template <typename Type>
+struct CInterpolatedVarSample
+{
+	const Type *GetValue() const
+	{
+		return value;
+	}
+
+	float changetime;
+	const Type *value;
+};
+
+// The histories of all CInterpolatedVars of one type.
+template <typename Type>
+class CInterpolatedVarBlock
+{
+public:
+	typedef CInterpolatedVarArrayBase<Type, false> Var;
+
+	enum
+	{
+		PAGE_SLOTS = 64,
+		MIN_CAPACITY = 8
+	};
+
+	// The histories of up to PAGE_SLOTS variables with room for `capacity`
+	// entries each. Slot s owns entries [s * capacity, ( s + 1 ) * capacity) of
+	// times and values, used as a ring starting at first[s].
+	struct Page
+	{
+		int capacity;
+		int used;
+		float *times;
+		Type *values;
+		unsigned short first[PAGE_SLOTS];
+		unsigned short count[PAGE_SLOTS];
+		Var *vars[PAGE_SLOTS];
+	};
+
+	static void Alloc( Var *var, Page *&page, int &slot );
+	static void Free( Page *page, int slot );
+
+	// Moves the history in the slot to a page with twice the capacity.
+	static void Grow( Page *&page, int &slot );
+
+	static void InterpolateAll( float currentTime );
+
+private:
+	CInterpolatedVarBlock();
+
+	static CInterpolatedVarBlock &Get();
+
+	Page *AllocSlot( Var *var, int capacity, int &slot );
+	void FreeSlot( Page *page, int slot );
+
+	LightMutex m_Lock;
+	pvector<Page *> m_Pages;
+
+	// Lanes, kept between frames to avoid reallocating.
+	pvector<float> m_w0, m_w2;
+	pvector<float> m_p0, m_p1, m_p2, m_out;
+	pvector<Type *> m_dest;
+};
+
+// The history of a CInterpolatedVarArray: a ring buffer of entries that each
+// own an array of values.
+template <typename Type, bool IS_ARRAY>
+class CInterpolatedVarHistory
+{
+public:
+	typedef CInterpolatedVarEntryBase<Type, IS_ARRAY> CInterpolatedVarEntry;
+	typedef CInterpolatedVarSample<Type> CVarSample;
+
+	void SetOwner( CInterpolatedVarArrayBase<Type, IS_ARRAY> *owner )
+	{
+	}
+
+	int Count() const
+	{
+		return m_Entries.Count();
+	}
+	int Head() const
+	{
+		return m_Entries.Head();
+	}
+	bool IsIdxValid( int i ) const
+	{
+		return m_Entries.IsIdxValid( i );
+	}
+	bool IsValidIndex( int i ) const
+	{
+		return m_Entries.IsValidIndex( i );
+	}
+	static int InvalidIndex()
+	{
+		return -1;
+	}
+
+	float Time( int i ) const
+	{
+		return m_Entries[i].changetime;
+	}
+	Type *Value( int i )
+	{
+		return m_Entries[i].GetValue();
+	}
+	const Type *Value( int i ) const
+	{
+		return m_Entries[i].GetValue();
+	}
+	CVarSample GetSample( int i ) const
+	{
+		CVarSample sample;
+		sample.changetime = Time( i );
+		sample.value = Value( i );
+		return sample;
+	}
+
+	int AddToHead()
+	{
+		return m_Entries.AddToHead();
+	}
+	int AddToTail()
+	{
+		m_Entries.AddToTail();
+		return m_Entries.Count() - 1;
+	}
+	void Set( int i, float changetime, const Type *values, int count )
+	{
+		m_Entries[i].NewEntry( values, count, changetime );
+	}
+	void Move( int dest, int src )
+	{
+		m_Entries[dest].FastTransferFrom( m_Entries[src] );
+	}
+
+	void RemoveAll()
+	{
+		m_Entries.RemoveAll();
+	}
+	void Purge()
+	{
+		for ( int i = 0; i < m_Entries.Count(); i++ )
+		{
+			m_Entries[i].DeleteEntry();
+		}
+		m_Entries.RemoveAll();
+	}
+	void RemoveAtHead()
+	{
+		m_Entries.RemoveAtHead();
+	}
+	void Truncate( int newLength )
+	{
+		m_Entries.Truncate( newLength );
+	}
+
+private:
+	CSimpleRingBuffer<CInterpolatedVarEntry> m_Entries;
+};
+
+// The history of a CInterpolatedVar: a handle to its slot in the
+// CInterpolatedVarBlock of the type. The slot is taken when the first entry is
+// added.
+template <typename Type>
+class CInterpolatedVarHistory<Type, false>
+{
+public:
+	typedef CInterpolatedVarBlock<Type> Block;
+	typedef typename Block::Page Page;
+	typedef CInterpolatedVarSample<Type> CVarSample;
+
+	CInterpolatedVarHistory()
+	{
+		m_pOwner = NULL;
+		m_pPage = NULL;
+		m_iSlot = 0;
+	}
+	~CInterpolatedVarHistory()
+	{
+		if ( m_pPage )
+		{
+			Block::Free( m_pPage, m_iSlot );
+		}
+	}
+
+	void SetOwner( CInterpolatedVarArrayBase<Type, false> *owner )
+	{
+		m_pOwner = owner;
+	}
+
+	int Count() const
+	{
+		return m_pPage ? m_pPage->count[m_iSlot] : 0;
+	}
+	int Head() const
+	{
+		return ( Count() > 0 ) ? 0 : InvalidIndex();
+	}
+	bool IsIdxValid( int i ) const
+	{
+		return ( i >= 0 && i < Count() ) ? true : false;
+	}
+	bool IsValidIndex( int i ) const
+	{
+		return IsIdxValid( i );
+	}
+	static int InvalidIndex()
+	{
+		return -1;
+	}
+
+	float Time( int i ) const
+	{
+		return m_pPage->times[Index( i )];
+	}
+	Type *Value( int i )
+	{
+		return &m_pPage->values[Index( i )];
+	}
+	const Type *Value( int i ) const
+	{
+		return &m_pPage->values[Index( i )];
+	}
+	CVarSample GetSample( int i ) const
+	{
+		int index = Index( i );
+		CVarSample sample;
+		sample.changetime = m_pPage->times[index];
+		sample.value = &m_pPage->values[index];
+		return sample;
+	}
+
+	int AddToHead()
+	{
+		Reserve( Count() + 1 );
+		unsigned short &first = m_pPage->first[m_iSlot];
+		first = (unsigned short)( first ? first - 1 : m_pPage->capacity - 1 );
+		m_pPage->count[m_iSlot]++;
+		return 0;
+	}
+	int AddToTail()
+	{
+		Reserve( Count() + 1 );
+		return m_pPage->count[m_iSlot]++;
+	}
+	void Set( int i, float changetime, const Type *values, int count )
+	{
+		assert( count == 1 );
+		int index = Index( i );
+		m_pPage->times[index] = changetime;
+		memcpy( &m_pPage->values[index], values, sizeof( Type ) );
+	}
+	void Move( int dest, int src )
+	{
+		int from = Index( src );
+		int to = Index( dest );
+		m_pPage->times[to] = m_pPage->times[from];
+		m_pPage->values[to] = m_pPage->values[from];
+	}
+
+	void RemoveAll()
+	{
+		if ( m_pPage )
+		{
+			m_pPage->first[m_iSlot] = 0;
+			m_pPage->count[m_iSlot] = 0;
+		}
+	}
+	void Purge()
+	{
+		RemoveAll();
+	}
+	void RemoveAtHead()
+	{
+		if ( Count() > 0 )
+		{
+			unsigned short &first = m_pPage->first[m_iSlot];
+			first = (unsigned short)( ( first + 1 < m_pPage->capacity ) ? first + 1 : 0 );
+			m_pPage->count[m_iSlot]--;
+		}
+	}
+	void Truncate( int newLength )
+	{
+		if ( newLength < Count() )
+		{
+			assert( newLength >= 0 );
+			m_pPage->count[m_iSlot] = (unsigned short)newLength;
+		}
+	}
+
+private:
+	int Index( int i ) const
+	{
+		assert( IsIdxValid( i ) );
+		i += m_pPage->first[m_iSlot];
+		if ( i >= m_pPage->capacity )
+		{
+			i -= m_pPage->capacity;
+		}
+		return m_iSlot * m_pPage->capacity + i;
+	}
+
+	void Reserve( int count )
+	{
+		if ( !m_pPage )
+		{
+			Block::Alloc( m_pOwner, m_pPage, m_iSlot );
+		}
+		while ( count > m_pPage->capacity )
+		{
+			Block::Grow( m_pPage, m_iSlot );
+		}
+	}
+
+	// The slot belongs to exactly one variable.
+	CInterpolatedVarHistory( const CInterpolatedVarHistory &copy );
+	CInterpolatedVarHistory &operator=( const CInterpolatedVarHistory &copy );
+
+	CInterpolatedVarArrayBase<Type, false> *m_pOwner;
+	Page *m_pPage;
+	int m_iSlot;
+};
+
 // --------------------------------------------------------------------------------------------------------------
 // // CInterpolatedVarArrayBase - the main implementation of IInterpolatedVar.
 // --------------------------------------------------------------------------------------------------------------
@@ -474,6 +897,7 @@ class CInterpolatedVarArrayBase : public IInterpolatedVar
 {
 PUBLISHED:
 	friend class CInterpolatedVarPrivate;
+	friend class CInterpolatedVarBlock<Type>;
 
 	CInterpolatedVarArrayBase( const char *pDebugName = "no debug name" );
 	virtual ~CInterpolatedVarArrayBase();
@@ -551,7 +975,8 @@ PUBLISHED:
 
 protected:
 	typedef CInterpolatedVarEntryBase<Type, IS_ARRAY> CInterpolatedVarEntry;
-	typedef CSimpleRingBuffer<CInterpolatedVarEntry> CVarHistory;
+	typedef CInterpolatedVarHistory<Type, IS_ARRAY> CVarHistory;
+	typedef CInterpolatedVarSample<Type> CVarSample;
 	friend class CInterpolationInfo;
 
 	class CInterpolationInfo
@@ -571,38 +996,31 @@ protected:
 	bool GetInterpolationInfo( CInterpolationInfo *pInfo, float currentTime,
 				   float interpolation_amount, int *pNoMoreChanges );
 
-	void TimeFixup_Hermite( CInterpolatedVarEntry &fixup,
-				CInterpolatedVarEntry *&prev,
-				CInterpolatedVarEntry *&start,
-				CInterpolatedVarEntry *&end );
+	void TimeFixup_Hermite( CInterpolatedVarEntry &fixup, CVarSample &prev,
+				const CVarSample &start, const CVarSample &end );
 
 	// Force the time between prev and start to be dt (and extend prev out farther
 	// if necessary).
-	void TimeFixup2_Hermite( CInterpolatedVarEntry &fixup,
-				 CInterpolatedVarEntry *&prev,
-				 CInterpolatedVarEntry *&start, float dt );
+	void TimeFixup2_Hermite( CInterpolatedVarEntry &fixup, CVarSample &prev,
+				 const CVarSample &start, float dt );
 
-	void _Extrapolate( Type *pOut, CInterpolatedVarEntry *pOld,
-			   CInterpolatedVarEntry *pNew, float flDestinationTime,
+	void _Extrapolate( Type *pOut, const CVarSample &pOld,
+			   const CVarSample &pNew, float flDestinationTime,
 			   float flMaxExtrapolationAmount );
 
-	void _Interpolate( Type *out, float frac, CInterpolatedVarEntry *start,
-			   CInterpolatedVarEntry *end );
-	void _Interpolate_Hermite( Type *out, float frac,
-				   CInterpolatedVarEntry *pOriginalPrev,
-				   CInterpolatedVarEntry *start,
-				   CInterpolatedVarEntry *end, bool looping = false );
-
-	void _Derivative_Hermite( Type *out, float frac,
-				  CInterpolatedVarEntry *pOriginalPrev,
-				  CInterpolatedVarEntry *start,
-				  CInterpolatedVarEntry *end );
+	void _Interpolate( Type *out, float frac, const CVarSample &start,
+			   const CVarSample &end );
+	void _Interpolate_Hermite( Type *out, float frac, CVarSample prev,
+				   const CVarSample &start, const CVarSample &end,
+				   bool looping = false );
+
+	void _Derivative_Hermite( Type *out, float frac, CVarSample prev,
+				  const CVarSample &start, const CVarSample &end );
 	void _Derivative_Hermite_SmoothVelocity( Type *out, float frac,
-						 CInterpolatedVarEntry *b,
-						 CInterpolatedVarEntry *c,
-						 CInterpolatedVarEntry *d );
-	void _Derivative_Linear( Type *out, CInterpolatedVarEntry *start,
-				 CInterpolatedVarEntry *end );
+						 CVarSample b, const CVarSample &c,
+						 const CVarSample &d );
+	void _Derivative_Linear( Type *out, const CVarSample &start,
+				 const CVarSample &end );
 
 	bool ValidOrder();
 
@@ -633,6 +1051,7 @@ inline CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarArrayBase(
 	m_LastNetworkedTime = 0;
 	m_LastNetworkedValue = NULL;
 	m_bLooping = NULL;
+	m_VarHistory.SetOwner( this );
 }
 
 template <typename Type, bool IS_ARRAY>
@@ -684,7 +1103,7 @@ inline bool CInterpolatedVarArrayBase<Type, IS_ARRAY>::NoteChanged(
 	bool bRet = true;
 	if ( m_VarHistory.Count() )
 	{
-		if ( memcmp( m_pValue, m_VarHistory[0].GetValue(),
+		if ( memcmp( m_pValue, m_VarHistory.Value( 0 ),
 			     sizeof( Type ) * m_nMaxCount ) == 0 )
 		{
 			bRet = false;
@@ -741,11 +1160,7 @@ CInterpolatedVarArrayBase<Type, IS_ARRAY>::RestoreToLastNetworked()
 template <typename Type, bool IS_ARRAY>
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::ClearHistory()
 {
-	for ( int i = 0; i < m_VarHistory.Count(); i++ )
-	{
-		m_VarHistory[i].DeleteEntry();
-	}
-	m_VarHistory.RemoveAll();
+	m_VarHistory.Purge();
 }
 
 template <typename Type, bool IS_ARRAY>
@@ -762,7 +1177,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::AddToHead(
 		// changeTime is less than a changeTime we added samples during previously.
 		while ( m_VarHistory.Count() )
 		{
-			if ( ( m_VarHistory[0].changetime + 0.0001f ) > changeTime )
+			if ( ( m_VarHistory.Time( 0 ) + 0.0001f ) > changeTime )
 			{
 				m_VarHistory.RemoveAtHead();
 			}
@@ -779,15 +1194,14 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::AddToHead(
 		newslot = m_VarHistory.AddToHead();
 		for ( int i = 1; i < m_VarHistory.Count(); i++ )
 		{
-			if ( m_VarHistory[i].changetime <= changeTime )
+			if ( m_VarHistory.Time( i ) <= changeTime )
 				break;
-			m_VarHistory[newslot].FastTransferFrom( m_VarHistory[i] );
+			m_VarHistory.Move( newslot, i );
 			newslot = i;
 		}
 	}
 
-	CInterpolatedVarEntry *e = &m_VarHistory[newslot];
-	e->NewEntry( values, m_nMaxCount, changeTime );
+	m_VarHistory.Set( newslot, changeTime, values, m_nMaxCount );
 }
 
 template <typename Type, bool IS_ARRAY>
@@ -813,7 +1227,7 @@ inline float CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetOldestEntry()
 	float lastVal = 0;
 	if ( m_VarHistory.Count() )
 	{
-		lastVal = m_VarHistory[m_VarHistory.Count() - 1].changetime;
+		lastVal = m_VarHistory.Time( m_VarHistory.Count() - 1 );
 	}
 	return lastVal;
 }
@@ -825,7 +1239,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::RemoveOldEntries(
 	int newCount = m_VarHistory.Count();
 	for ( int i = m_VarHistory.Count(); --i > 2; )
 	{
-		if ( m_VarHistory[i].changetime > oldesttime )
+		if ( m_VarHistory.Time( i ) > oldesttime )
 			break;
 		newCount = i;
 	}
@@ -838,7 +1252,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::RemoveEntriesPreviousTo(
 {
 	for ( int i = 0; i < m_VarHistory.Count(); i++ )
 	{
-		if ( m_VarHistory[i].changetime < flTime )
+		if ( m_VarHistory.Time( i ) < flTime )
 		{
 			// We need to preserve this sample (ie: the one right before this
 			// timestamp) and the sample right before it (for hermite blending), and
@@ -869,7 +1283,7 @@ inline bool CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetInterpolationInfo(
 	{
 		pInfo->older = i;
 
-		float older_change_time = m_VarHistory[i].changetime;
+		float older_change_time = varHistory.Time( i );
 		if ( older_change_time == 0.0f )
 			break;
 
@@ -891,7 +1305,7 @@ inline bool CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetInterpolationInfo(
 			return true;
 		}
 
-		float newer_change_time = varHistory[pInfo->newer].changetime;
+		float newer_change_time = varHistory.Time( pInfo->newer );
 		float dt = newer_change_time - older_change_time;
 		if ( dt > 0.0001f )
 		{
@@ -905,7 +1319,7 @@ inline bool CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetInterpolationInfo(
 			     varHistory.IsIdxValid( oldestindex ) )
 			{
 				pInfo->oldest = oldestindex;
-				float oldest_change_time = varHistory[oldestindex].changetime;
+				float oldest_change_time = varHistory.Time( oldestindex );
 				float dt2 = older_change_time - oldest_change_time;
 				if ( dt2 > 0.0001f )
 				{
@@ -978,8 +1392,9 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::DebugInterpolate(
 	if ( info.m_bHermite )
 	{
 		// base cast, we have 3 valid sample point
-		_Interpolate_Hermite( pOut, info.frac, &history[info.oldest],
-				      &history[info.older], &history[info.newer] );
+		_Interpolate_Hermite( pOut, info.frac, history.GetSample( info.oldest ),
+				      history.GetSample( info.older ),
+				      history.GetSample( info.newer ) );
 	}
 	else if ( info.newer == info.older )
 	{
@@ -987,7 +1402,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::DebugInterpolate(
 		// the value here based on its previous velocity (out to a certain amount).
 		int realOlder = info.newer + 1;
 		if ( CInterpolationContext::IsExtrapolationAllowed() &&
-		     IsValidIndex( realOlder ) && history[realOlder].changetime != 0.0 &&
+		     IsValidIndex( realOlder ) && history.Time( realOlder ) != 0.0 &&
 		     interpolation_amount > 0.000001f &&
 		     CInterpolationContext::GetLastTimeStamp() <= m_LastNetworkedTime )
 		{
@@ -1011,18 +1426,21 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::DebugInterpolate(
 			// The End
 
 			// Use the velocity here (extrapolate up to 1/4 of a second).
-			_Extrapolate( pOut, &history[realOlder], &history[info.newer],
+			_Extrapolate( pOut, history.GetSample( realOlder ),
+				      history.GetSample( info.newer ),
 				      currentTime - interpolation_amount,
 				      cl_extrapolate_amount );
 		}
 		else
 		{
-			_Interpolate( pOut, info.frac, &history[info.older], &history[info.newer] );
+			_Interpolate( pOut, info.frac, history.GetSample( info.older ),
+				      history.GetSample( info.newer ) );
 		}
 	}
 	else
 	{
-		_Interpolate( pOut, info.frac, &history[info.older], &history[info.newer] );
+		_Interpolate( pOut, info.frac, history.GetSample( info.older ),
+			      history.GetSample( info.newer ) );
 	}
 }
 
@@ -1047,8 +1465,9 @@ inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate(
 	if ( info.m_bHermite )
 	{
 		// base cast, we have 3 valid sample point
-		_Interpolate_Hermite( m_pValue, info.frac, &history[info.oldest],
-				      &history[info.older], &history[info.newer] );
+		_Interpolate_Hermite( m_pValue, info.frac, history.GetSample( info.oldest ),
+				      history.GetSample( info.older ),
+				      history.GetSample( info.newer ) );
 	}
 	else if ( info.newer == info.older )
 	{
@@ -1056,7 +1475,7 @@ inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate(
 		// the value here based on its previous velocity (out to a certain amount).
 		int realOlder = info.newer + 1;
 		if ( CInterpolationContext::IsExtrapolationAllowed() &&
-		     IsValidIndex( realOlder ) && history[realOlder].changetime != 0.0 &&
+		     IsValidIndex( realOlder ) && history.Time( realOlder ) != 0.0 &&
 		     interpolation_amount > 0.000001f &&
 		     CInterpolationContext::GetLastTimeStamp() <= m_LastNetworkedTime )
 		{
@@ -1080,20 +1499,21 @@ inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::Interpolate(
 			// The End
 
 			// Use the velocity here (extrapolate up to 1/4 of a second).
-			_Extrapolate( m_pValue, &history[realOlder], &history[info.newer],
+			_Extrapolate( m_pValue, history.GetSample( realOlder ),
+				      history.GetSample( info.newer ),
 				      currentTime - interpolation_amount,
 				      cl_extrapolate_amount );
 		}
 		else
 		{
-			_Interpolate( m_pValue, info.frac, &history[info.older],
-				      &history[info.newer] );
+			_Interpolate( m_pValue, info.frac, history.GetSample( info.older ),
+				      history.GetSample( info.newer ) );
 		}
 	}
 	else
 	{
-		_Interpolate( m_pValue, info.frac, &history[info.older],
-			      &history[info.newer] );
+		_Interpolate( m_pValue, info.frac, history.GetSample( info.older ),
+			      history.GetSample( info.newer ) );
 	}
 
 #ifdef INTERPOLATEDVAR_PARANOID_MEASUREMENT
@@ -1132,13 +1552,14 @@ void CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetDerivative(
 
 	if ( info.m_bHermite )
 	{
-		_Derivative_Hermite( pOut, info.frac, &m_VarHistory[info.oldest],
-				     &m_VarHistory[info.older], &m_VarHistory[info.newer] );
+		_Derivative_Hermite( pOut, info.frac, m_VarHistory.GetSample( info.oldest ),
+				     m_VarHistory.GetSample( info.older ),
+				     m_VarHistory.GetSample( info.newer ) );
 	}
 	else
 	{
-		_Derivative_Linear( pOut, &m_VarHistory[info.older],
-				    &m_VarHistory[info.newer] );
+		_Derivative_Linear( pOut, m_VarHistory.GetSample( info.older ),
+				    m_VarHistory.GetSample( info.newer ) );
 	}
 }
 
@@ -1156,9 +1577,10 @@ void CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetDerivative_SmoothVelocity(
 
 	if ( info.m_bHermite )
 	{
-		_Derivative_Hermite_SmoothVelocity( pOut, info.frac, &history[info.oldest],
-						    &history[info.older],
-						    &history[info.newer] );
+		_Derivative_Hermite_SmoothVelocity( pOut, info.frac,
+						    history.GetSample( info.oldest ),
+						    history.GetSample( info.older ),
+						    history.GetSample( info.newer ) );
 		return;
 	}
 	else if ( info.newer == info.older &&
@@ -1167,7 +1589,7 @@ void CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetDerivative_SmoothVelocity(
 		// This means the server clock got way behind the client clock. Extrapolate
 		// the value here based on its previous velocity (out to a certain amount).
 		realOlder = info.newer + 1;
-		if ( IsValidIndex( realOlder ) && history[realOlder].changetime != 0.0 )
+		if ( IsValidIndex( realOlder ) && history.Time( realOlder ) != 0.0 )
 		{
 			// At this point, we know we're out of data and we have the ability to get
 			// a velocity to extrapolate with.
@@ -1197,11 +1619,12 @@ void CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetDerivative_SmoothVelocity(
 	if ( bExtrapolate )
 	{
 		// Get the velocity from the last segment.
-		_Derivative_Linear( pOut, &history[realOlder], &history[info.newer] );
+		_Derivative_Linear( pOut, history.GetSample( realOlder ),
+				    history.GetSample( info.newer ) );
 
 		// Now ramp it to zero after cl_extrapolate_amount..
 		float flDestTime = currentTime - m_InterpolationAmount;
-		float diff = flDestTime - history[info.newer].changetime;
+		float diff = flDestTime - history.Time( info.newer );
 		diff = clamp( diff, 0.0f, (float)cl_extrapolate_amount.get_value() * 2.0f );
 		if ( diff > cl_extrapolate_amount )
 		{
@@ -1215,7 +1638,8 @@ void CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetDerivative_SmoothVelocity(
 	}
 	else
 	{
-		_Derivative_Linear( pOut, &history[info.older], &history[info.newer] );
+		_Derivative_Linear( pOut, history.GetSample( info.older ),
+				    history.GetSample( info.newer ) );
 	}
 }
 
@@ -1257,10 +1681,8 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::Copy(
 	for ( int i = 0; i < pSrc->m_VarHistory.Count(); i++ )
 	{
 		int newslot = m_VarHistory.AddToTail();
-
-		CInterpolatedVarEntry *dest = &m_VarHistory[newslot];
-		CInterpolatedVarEntry *src = &pSrc->m_VarHistory[i];
-		dest->NewEntry( src->GetValue(), m_nMaxCount, src->changetime );
+		m_VarHistory.Set( newslot, pSrc->m_VarHistory.Time( i ),
+				  pSrc->m_VarHistory.Value( i ), m_nMaxCount );
 	}
 }
 
@@ -1273,7 +1695,7 @@ inline const Type &CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetPrev(
 
 	if ( m_VarHistory.Count() > 1 )
 	{
-		return m_VarHistory[1].GetValue()[iArrayIndex];
+		return m_VarHistory.Value( 1 )[iArrayIndex];
 	}
 	return m_pValue[iArrayIndex];
 }
@@ -1287,7 +1709,7 @@ inline const Type &CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetCurrent(
 
 	if ( m_VarHistory.Count() > 0 )
 	{
-		return m_VarHistory[0].GetValue()[iArrayIndex];
+		return m_VarHistory.Value( 0 )[iArrayIndex];
 	}
 	return m_pValue[iArrayIndex];
 }
@@ -1297,7 +1719,7 @@ inline float CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetInterval() const
 {
 	if ( m_VarHistory.Count() > 1 )
 	{
-		return m_VarHistory[0].changetime - m_VarHistory[1].changetime;
+		return m_VarHistory.Time( 0 ) - m_VarHistory.Time( 1 );
 	}
 
 	return 0.0f;
@@ -1316,9 +1738,8 @@ inline Type *CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetHistoryValue(
 	assert( iArrayIndex >= 0 && iArrayIndex < m_nMaxCount );
 	if ( m_VarHistory.IsIdxValid( index ) )
 	{
-		CInterpolatedVarEntry *entry = &m_VarHistory[index];
-		changetime = entry->changetime;
-		return &entry->GetValue()[iArrayIndex];
+		changetime = m_VarHistory.Time( index );
+		return &m_VarHistory.Value( index )[iArrayIndex];
 	}
 	else
 	{
@@ -1335,8 +1756,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetHistoryValuesForItem(
 
 	for ( int i = 0; i < m_VarHistory.Count(); i++ )
 	{
-		CInterpolatedVarEntry *entry = &m_VarHistory[i];
-		entry->GetValue()[item] = value;
+		m_VarHistory.Value( i )[item] = value;
 	}
 }
 
@@ -1379,18 +1799,17 @@ inline int CInterpolatedVarArrayBase<Type, IS_ARRAY>::GetMaxCount() const
 
 template <typename Type, bool IS_ARRAY>
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate(
-	Type *out, float frac, CInterpolatedVarEntry *start,
-	CInterpolatedVarEntry *end )
+	Type *out, float frac, const CVarSample &start, const CVarSample &end )
 {
-	assert( start );
-	assert( end );
+	assert( start.value );
+	assert( end.value );
 
-	if ( start == end )
+	if ( start.value == end.value )
 	{
 		// quick exit
 		for ( int i = 0; i < m_nMaxCount; i++ )
 		{
-			out[i] = end->GetValue()[i];
+			out[i] = end.GetValue()[i];
 			Lerp_Clamp( out[i] );
 		}
 		return;
@@ -1404,11 +1823,11 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate(
 	{
 		if ( m_bLooping[i] )
 		{
-			out[i] = LoopingLerp( frac, start->GetValue()[i], end->GetValue()[i] );
+			out[i] = LoopingLerp( frac, start.GetValue()[i], end.GetValue()[i] );
 		}
 		else
 		{
-			out[i] = TLerp( frac, start->GetValue()[i], end->GetValue()[i] );
+			out[i] = TLerp( frac, start.GetValue()[i], end.GetValue()[i] );
 		}
 		Lerp_Clamp( out[i] );
 	}
@@ -1416,25 +1835,25 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate(
 
 template <typename Type, bool IS_ARRAY>
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Extrapolate(
-	Type *pOut, CInterpolatedVarEntry *pOld, CInterpolatedVarEntry *pNew,
+	Type *pOut, const CVarSample &pOld, const CVarSample &pNew,
 	float flDestinationTime, float flMaxExtrapolationAmount )
 {
-	if ( fabs( pOld->changetime - pNew->changetime ) < 0.001f ||
-	     flDestinationTime <= pNew->changetime )
+	if ( fabs( pOld.changetime - pNew.changetime ) < 0.001f ||
+	     flDestinationTime <= pNew.changetime )
 	{
 		for ( int i = 0; i < m_nMaxCount; i++ )
-			pOut[i] = pNew->GetValue()[i];
+			pOut[i] = pNew.GetValue()[i];
 	}
 	else
 	{
-		float flExtrapolationAmount = std::min( flDestinationTime - pNew->changetime,
+		float flExtrapolationAmount = std::min( flDestinationTime - pNew.changetime,
 							flMaxExtrapolationAmount );
 
-		float divisor = 1.0f / ( pNew->changetime - pOld->changetime );
+		float divisor = 1.0f / ( pNew.changetime - pOld.changetime );
 		for ( int i = 0; i < m_nMaxCount; i++ )
 		{
-			pOut[i] = ExtrapolateInterpolatedVarType( pOld->GetValue()[i],
-								  pNew->GetValue()[i], divisor,
+			pOut[i] = ExtrapolateInterpolatedVarType( pOld.GetValue()[i],
+								  pNew.GetValue()[i], divisor,
 								  flExtrapolationAmount );
 		}
 	}
@@ -1444,13 +1863,11 @@ template <typename Type, bool IS_ARRAY>
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::TimeFixup2_Hermite(
 	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarEntry
 	&fixup,
-	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarEntry *
-	&prev,
-	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarEntry *
-	&start,
+	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CVarSample &prev,
+	const typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CVarSample &start,
 	float dt1 )
 {
-	float dt2 = start->changetime - prev->changetime;
+	float dt2 = start.changetime - prev.changetime;
 
 	// If times are not of the same interval renormalize the earlier sample to
 	// allow for uniform hermite spline interpolation
@@ -1460,24 +1877,25 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::TimeFixup2_Hermite(
 		float frac = dt1 / dt2;
 
 		// Fixed interval into past
-		fixup.changetime = start->changetime - dt1;
+		fixup.changetime = start.changetime - dt1;
 
 		for ( int i = 0; i < m_nMaxCount; i++ )
 		{
 			if ( m_bLooping[i] )
 			{
 				fixup.GetValue()[i] =
-					LoopingLerp( 1 - frac, prev->GetValue()[i], start->GetValue()[i] );
+					LoopingLerp( 1 - frac, prev.GetValue()[i], start.GetValue()[i] );
 			}
 			else
 			{
 				fixup.GetValue()[i] =
-					TLerp( 1 - frac, prev->GetValue()[i], start->GetValue()[i] );
+					TLerp( 1 - frac, prev.GetValue()[i], start.GetValue()[i] );
 			}
 		}
 
 		// Point previous sample at fixed version
-		prev = &fixup;
+		prev.changetime = fixup.changetime;
+		prev.value = fixup.GetValue();
 	}
 }
 
@@ -1485,23 +1903,20 @@ template <typename Type, bool IS_ARRAY>
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::TimeFixup_Hermite(
 	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarEntry
 	&fixup,
-	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarEntry *
-	&prev,
-	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarEntry *
-	&start,
-	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CInterpolatedVarEntry *
-	&end )
-{
-	TimeFixup2_Hermite( fixup, prev, start, end->changetime - start->changetime );
+	typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CVarSample &prev,
+	const typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CVarSample &start,
+	const typename CInterpolatedVarArrayBase<Type, IS_ARRAY>::CVarSample &end )
+{
+	TimeFixup2_Hermite( fixup, prev, start, end.changetime - start.changetime );
 }
 
 template <typename Type, bool IS_ARRAY>
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate_Hermite(
-	Type *out, float frac, CInterpolatedVarEntry *prev,
-	CInterpolatedVarEntry *start, CInterpolatedVarEntry *end, bool looping )
+	Type *out, float frac, CVarSample prev, const CVarSample &start,
+	const CVarSample &end, bool looping )
 {
-	assert( start );
-	assert( end );
+	assert( start.value );
+	assert( end.value );
 
 	// Disable range checks because we can produce weird values here and it's not
 	// an error. After interpolation, we will clamp the values.
@@ -1517,13 +1932,13 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate_Hermite(
 		// interpolation here...
 		if ( m_bLooping[i] )
 		{
-			out[i] = LoopingLerp_Hermite( frac, prev->GetValue()[i],
-						      start->GetValue()[i], end->GetValue()[i] );
+			out[i] = LoopingLerp_Hermite( frac, prev.GetValue()[i],
+						      start.GetValue()[i], end.GetValue()[i] );
 		}
 		else
 		{
-			out[i] = Lerp_Hermite( frac, prev->GetValue()[i], start->GetValue()[i],
-					       end->GetValue()[i] );
+			out[i] = Lerp_Hermite( frac, prev.GetValue()[i], start.GetValue()[i],
+					       end.GetValue()[i] );
 		}
 
 		// Clamp the output from interpolation. There are edge cases where something
@@ -1537,11 +1952,11 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate_Hermite(
 
 template <typename Type, bool IS_ARRAY>
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Derivative_Hermite(
-	Type *out, float frac, CInterpolatedVarEntry *prev,
-	CInterpolatedVarEntry *start, CInterpolatedVarEntry *end )
+	Type *out, float frac, CVarSample prev, const CVarSample &start,
+	const CVarSample &end )
 {
-	assert( start );
-	assert( end );
+	assert( start.value );
+	assert( end.value );
 
 	// Disable range checks because we can produce weird values here and it's not
 	// an error. After interpolation, we will clamp the values.
@@ -1551,13 +1966,13 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Derivative_Hermite(
 	fixup.Init( m_nMaxCount );
 	TimeFixup_Hermite( fixup, prev, start, end );
 
-	float divisor = 1.0f / ( end->changetime - start->changetime );
+	float divisor = 1.0f / ( end.changetime - start.changetime );
 
 	for ( int i = 0; i < m_nMaxCount; i++ )
 	{
 		assert( !m_bLooping[i] );
-		out[i] = Derivative_Hermite( frac, prev->GetValue()[i], start->GetValue()[i],
-					     end->GetValue()[i] );
+		out[i] = Derivative_Hermite( frac, prev.GetValue()[i], start.GetValue()[i],
+					     end.GetValue()[i] );
 		out[i] *= divisor;
 	}
 }
@@ -1565,8 +1980,8 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Derivative_Hermite(
 template <typename Type, bool IS_ARRAY>
 inline void
 CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Derivative_Hermite_SmoothVelocity(
-	Type *out, float frac, CInterpolatedVarEntry *b, CInterpolatedVarEntry *c,
-	CInterpolatedVarEntry *d )
+	Type *out, float frac, CVarSample b, const CVarSample &c,
+	const CVarSample &d )
 {
 	CInterpolatedVarEntry fixup;
 	fixup.Init( m_nMaxCount );
@@ -1574,30 +1989,30 @@ CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Derivative_Hermite_SmoothVelocity(
 	for ( int i = 0; i < m_nMaxCount; i++ )
 	{
 		Type prevVel =
-			( c->GetValue()[i] - b->GetValue()[i] ) / ( c->changetime - b->changetime );
+			( c.GetValue()[i] - b.GetValue()[i] ) / ( c.changetime - b.changetime );
 		Type curVel =
-			( d->GetValue()[i] - c->GetValue()[i] ) / ( d->changetime - c->changetime );
+			( d.GetValue()[i] - c.GetValue()[i] ) / ( d.changetime - c.changetime );
 		out[i] = TLerp( frac, prevVel, curVel );
 	}
 }
 
 template <typename Type, bool IS_ARRAY>
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Derivative_Linear(
-	Type *out, CInterpolatedVarEntry *start, CInterpolatedVarEntry *end )
+	Type *out, const CVarSample &start, const CVarSample &end )
 {
-	if ( start == end || fabs( start->changetime - end->changetime ) < 0.0001f )
+	if ( start.value == end.value || fabs( start.changetime - end.changetime ) < 0.0001f )
 	{
 		for ( int i = 0; i < m_nMaxCount; i++ )
 		{
-			out[i] = start->GetValue()[i] * 0;
+			out[i] = start.GetValue()[i] * 0;
 		}
 	}
 	else
 	{
-		float divisor = 1.0f / ( end->changetime - start->changetime );
+		float divisor = 1.0f / ( end.changetime - start.changetime );
 		for ( int i = 0; i < m_nMaxCount; i++ )
 		{
-			out[i] = ( end->GetValue()[i] - start->GetValue()[i] ) * divisor;
+			out[i] = ( end.GetValue()[i] - start.GetValue()[i] ) * divisor;
 		}
 	}
 }
@@ -1609,27 +2024,294 @@ inline bool CInterpolatedVarArrayBase<Type, IS_ARRAY>::ValidOrder()
 	bool first = true;
 	for ( int i = 0; i < m_VarHistory.Count(); i++ )
 	{
-		CInterpolatedVarEntry *entry = &m_VarHistory[i];
+		float changetime = m_VarHistory.Time( i );
 		if ( first )
 		{
 			first = false;
-			newestchangetime = entry->changetime;
+			newestchangetime = changetime;
 			continue;
 		}
 
 		// They should get older as wel walk backwards
-		if ( entry->changetime > newestchangetime )
+		if ( changetime > newestchangetime )
 		{
 			assert( 0 );
 			return false;
 		}
 
-		newestchangetime = entry->changetime;
+		newestchangetime = changetime;
 	}
 
 	return true;
 }
 
+// --------------------------------------------------------------------------------------------------------------
+// // CInterpolatedVarBlock - the histories of one type, interpolated as a batch.
+// --------------------------------------------------------------------------------------------------------------
+// //
+
+template <typename Type>
+inline CInterpolatedVarBlock<Type>::CInterpolatedVarBlock() :
+	m_Lock( "CInterpolatedVarBlock" )
+{
+	CInterpolatedVarSystem::RegisterBlock( &InterpolateAll );
+}
+
+template <typename Type>
+inline CInterpolatedVarBlock<Type> &CInterpolatedVarBlock<Type>::Get()
+{
+	// Never freed, variables may be destroyed during static destruction.
+	static CInterpolatedVarBlock *block = new CInterpolatedVarBlock;
+	return *block;
+}
+
+template <typename Type>
+inline typename CInterpolatedVarBlock<Type>::Page *CInterpolatedVarBlock<Type>::AllocSlot(
+	Var *var, int capacity, int &slot )
+{
+	Page *page = NULL;
+	for ( size_t i = 0; i < m_Pages.size(); i++ )
+	{
+		if ( m_Pages[i]->capacity == capacity && m_Pages[i]->used < PAGE_SLOTS )
+		{
+			page = m_Pages[i];
+			break;
+		}
+	}
+
+	if ( !page )
+	{
+		page = new Page;
+		page->capacity = capacity;
+		page->used = 0;
+		page->times = new float[PAGE_SLOTS * capacity];
+		page->values = new Type[PAGE_SLOTS * capacity];
+		memset( page->times, 0, sizeof( float ) * PAGE_SLOTS * capacity );
+		memset( page->vars, 0, sizeof( page->vars ) );
+		m_Pages.push_back( page );
+	}
+
+	slot = 0;
+	while ( page->vars[slot] )
+	{
+		slot++;
+	}
+
+	page->vars[slot] = var;
+	page->first[slot] = 0;
+	page->count[slot] = 0;
+	page->used++;
+	return page;
+}
+
+template <typename Type>
+inline void CInterpolatedVarBlock<Type>::FreeSlot( Page *page, int slot )
+{
+	page->vars[slot] = NULL;
+	page->used--;
+	if ( page->used > 0 )
+	{
+		return;
+	}
+
+	for ( size_t i = 0; i < m_Pages.size(); i++ )
+	{
+		if ( m_Pages[i] == page )
+		{
+			m_Pages.erase( m_Pages.begin() + i );
+			break;
+		}
+	}
+	delete[] page->times;
+	delete[] page->values;
+	delete page;
+}
+
+template <typename Type>
+inline void CInterpolatedVarBlock<Type>::Alloc( Var *var, Page *&page, int &slot )
+{
+	CInterpolatedVarBlock &block = Get();
+	LightMutexHolder holder( block.m_Lock );
+	page = block.AllocSlot( var, MIN_CAPACITY, slot );
+}
+
+template <typename Type>
+inline void CInterpolatedVarBlock<Type>::Free( Page *page, int slot )
+{
+	CInterpolatedVarBlock &block = Get();
+	LightMutexHolder holder( block.m_Lock );
+	block.FreeSlot( page, slot );
+}
+
+template <typename Type>
+inline void CInterpolatedVarBlock<Type>::Grow( Page *&page, int &slot )
+{
+	CInterpolatedVarBlock &block = Get();
+	LightMutexHolder holder( block.m_Lock );
+
+	assert( page->capacity * 2 <= 0xFFFF );
+
+	int new_slot;
+	Page *new_page = block.AllocSlot( page->vars[slot], page->capacity * 2, new_slot );
+
+	// Unwrap the ring while copying it.
+	int count = page->count[slot];
+	for ( int i = 0; i < count; i++ )
+	{
+		int from = page->first[slot] + i;
+		if ( from >= page->capacity )
+		{
+			from -= page->capacity;
+		}
+		from += slot * page->capacity;
+		int to = new_slot * new_page->capacity + i;
+		new_page->times[to] = page->times[from];
+		new_page->values[to] = page->values[from];
+	}
+	new_page->count[new_slot] = (unsigned short)count;
+
+	block.FreeSlot( page, slot );
+	page = new_page;
+	slot = new_slot;
+}
+
+template <typename Type>
+inline void CInterpolatedVarBlock<Type>::InterpolateAll( float currentTime )
+{
+	typedef typename Var::CInterpolationInfo CInterpolationInfo;
+
+	const int components = InterpolatedVarTraits<Type>::COMPONENTS;
+
+	CInterpolatedVarBlock &block = Get();
+	LightMutexHolder holder( block.m_Lock );
+
+	int num_vars = 0;
+	for ( size_t i = 0; i < block.m_Pages.size(); i++ )
+	{
+		num_vars += block.m_Pages[i]->used;
+	}
+	int stride = ( num_vars + 3 ) & ~3;
+
+	if ( components > 0 )
+	{
+		block.m_w0.resize( stride );
+		block.m_w2.resize( stride );
+		block.m_p0.resize( stride * components );
+		block.m_p1.resize( stride * components );
+		block.m_p2.resize( stride * components );
+		block.m_out.resize( stride * components );
+	}
+	block.m_dest.clear();
+
+	// Gather the samples and weights of every variable.
+	for ( size_t p = 0; p < block.m_Pages.size(); p++ )
+	{
+		Page *page = block.m_Pages[p];
+		for ( int slot = 0; slot < PAGE_SLOTS; slot++ )
+		{
+			Var *var = page->vars[slot];
+			if ( !var || !var->m_pValue || ( var->m_fType & EXCLUDE_AUTO_INTERPOLATE ) )
+			{
+				continue;
+			}
+
+			if ( components == 0 || var->m_bLooping[0] )
+			{
+				var->Interpolate( currentTime );
+				continue;
+			}
+
+			float interpolation_amount = var->m_InterpolationAmount;
+
+			CInterpolationInfo info;
+			if ( !var->GetInterpolationInfo( &info, currentTime, interpolation_amount, NULL ) )
+			{
+				continue;
+			}
+
+			if ( info.newer == info.older && CInterpolationContext::IsExtrapolationAllowed() )
+			{
+				// Might extrapolate.
+				var->Interpolate( currentTime );
+				continue;
+			}
+
+			const CInterpolatedVarHistory<Type, false> &history = var->m_VarHistory;
+			const float *start = (const float *)history.Value( info.older );
+			const float *end = (const float *)history.Value( info.newer );
+			const float *prev = start;
+			float w0 = 0.0f;
+			float w2 = info.frac;
+
+			if ( info.m_bHermite && InterpolatedVarTraits<Type>::HERMITE )
+			{
+				// Lerp_Hermite() written as a blend of three samples, including the
+				// renormalization TimeFixup_Hermite() does to the oldest sample.
+				float t = info.frac;
+				float tSqr = t * t;
+				float tCube = t * tSqr;
+				w0 = -( tCube - 2 * tSqr + t );
+				w2 = -tCube + 2 * tSqr;
+
+				float dt1 = history.Time( info.newer ) - history.Time( info.older );
+				float dt2 = history.Time( info.older ) - history.Time( info.oldest );
+				if ( fabs( dt1 - dt2 ) > 0.0001f && dt2 > 0.0001f )
+				{
+					w0 *= dt1 / dt2;
+				}
+				prev = (const float *)history.Value( info.oldest );
+			}
+
+			int lane = (int)block.m_dest.size();
+			block.m_w0[lane] = w0;
+			block.m_w2[lane] = w2;
+			for ( int c = 0; c < components; c++ )
+			{
+				block.m_p0[c * stride + lane] = prev[c];
+				block.m_p1[c * stride + lane] = start[c];
+				block.m_p2[c * stride + lane] = end[c];
+			}
+			block.m_dest.push_back( var->m_pValue );
+
+			// Same as Interpolate(), the samples were copied into the lanes already.
+			var->RemoveEntriesPreviousTo( currentTime - interpolation_amount -
+						      EXTRA_INTERPOLATION_HISTORY_STORED );
+		}
+	}
+
+	if ( block.m_dest.empty() )
+	{
+		return;
+	}
+
+	// Zero the unused lanes at the end so they blend to something harmless.
+	for ( int lane = (int)block.m_dest.size(); lane < stride; lane++ )
+	{
+		block.m_w0[lane] = 0.0f;
+		block.m_w2[lane] = 0.0f;
+		for ( int c = 0; c < components; c++ )
+		{
+			block.m_p0[c * stride + lane] = 0.0f;
+			block.m_p1[c * stride + lane] = 0.0f;
+			block.m_p2[c * stride + lane] = 0.0f;
+		}
+	}
+
+	CInterpolatedVarSystem::BlendLanes( components, stride, &block.m_w0[0], &block.m_w2[0],
+					    &block.m_p0[0], &block.m_p1[0], &block.m_p2[0],
+					    &block.m_out[0] );
+
+	// Scatter the results back to the variables.
+	for ( size_t lane = 0; lane < block.m_dest.size(); lane++ )
+	{
+		float *dest = (float *)block.m_dest[lane];
+		for ( int c = 0; c < components; c++ )
+		{
+			dest[c] = block.m_out[c * stride + lane];
+		}
+	}
+}
+
 template <typename Type, int COUNT>
 class CInterpolatedVarArray : public CInterpolatedVarArrayBase<Type, true>
 {
@@ -13,7 +13,14 @@
 #include "bspfile.h"
 #include "bsploader.h"
 #include "TexturePacker.h"
+#include "bc6h.h"
+#include "mathlib/ssemath.h"
 
+#include <genericThread.h>
+#include <configVariableInt.h>
+#include <trueClock.h>
+
+#include <atomic>
 #include <bitset>
 #include <cstdio>
 
@@ -22,6 +29,13 @@ NotifyCategoryDef( lightmapPalettizer, "" );
 // Max size per palette before making a new one.
 static const int max_palette = 1024;
 
+static ConfigVariableInt lightmap_palette_threads
+( "lightmap-palette-threads", 4,
+  PRC_DESC( "Number of threads used to decode the lightmaps into the palette textures at level load." ) );
+
+// Size of the area packed for a face with a 0 size lightmap.
+static const int fullbright_size = 16;
+
 // Currently we pack every single lightmap into one texture,
 // no matter how big. The way to split the lightmap palettes
 // is verrry slow atm.
@@ -32,53 +46,352 @@ LightmapPalettizer::LightmapPalettizer( const BSPLoader *loader ) :
 {
 }
 
-INLINE PNMImage lightmap_img_for_face( const BSPLoader *loader, const dface_t *face, int lmnum = 0, bool bounced = false )
+// 2^exponent / 255, scaled to the range of an unsigned short, indexed by exponent + 128.
+static float exponent_scale[256];
+
+static void init_exponent_scale()
+{
+        static bool initialized = false;
+        if ( initialized )
+                return;
+
+        for ( int i = 0; i < 256; i++ )
+        {
+                exponent_scale[i] = (float)( ldexp( 1.0, i - 128 ) / 255.0 * USHRT_MAX );
+        }
+        initialized = true;
+}
+
+/**
+ * Decodes a run of RGBE luxels into linear 16-bit BGR pixels, four luxels at a time.
+ * Consecutive luxels are written `stride` shorts apart.
+ */
+static void decode_luxels( const colorrgbexp32_t *src, int count, unsigned short *dst, int stride )
+{
+        const fltx4 maxval = ReplicateX4( (float)USHRT_MAX );
+        const fltx4 half = ReplicateX4( 0.5f );
+
+        for ( int i = 0; i < count; i += 4 )
+        {
+                int n = std::min( 4, count - i );
+
+                float r[4] = { 0 };
+                float g[4] = { 0 };
+                float b[4] = { 0 };
+                float s[4] = { 0 };
+                for ( int j = 0; j < n; j++ )
+                {
+                        const colorrgbexp32_t &luxel = src[i + j];
+                        r[j] = luxel.r;
+                        g[j] = luxel.g;
+                        b[j] = luxel.b;
+                        s[j] = exponent_scale[luxel.exponent + 128];
+                }
+
+                // Luxel is in linear-space.
+                fltx4 scale = LoadUnalignedSIMD( s );
+                StoreUnalignedSIMD( r, AddSIMD( MinSIMD( MulSIMD( LoadUnalignedSIMD( r ), scale ), maxval ), half ) );
+                StoreUnalignedSIMD( g, AddSIMD( MinSIMD( MulSIMD( LoadUnalignedSIMD( g ), scale ), maxval ), half ) );
+                StoreUnalignedSIMD( b, AddSIMD( MinSIMD( MulSIMD( LoadUnalignedSIMD( b ), scale ), maxval ), half ) );
+
+                for ( int j = 0; j < n; j++ )
+                {
+                        unsigned short *pixel = dst + ( i + j ) * stride;
+                        pixel[0] = (unsigned short)b[j];
+                        pixel[1] = (unsigned short)g[j];
+                        pixel[2] = (unsigned short)r[j];
+                }
+        }
+}
+
+/**
+ * Decodes one lightmap of a face straight into a page of the palette's RAM image.
+ * Texture RAM images are stored bottom-up in BGR order.
+ */
+static void fill_lightmap( const colorrgbexp32_t *src, const LightmapSource *lmsrc, const TextureLocation &tloc,
+                           unsigned short *page, int palette_width, int palette_height )
+{
+        int row_stride = palette_width * 3;
+
+        for ( int y = 0; y < lmsrc->height; y++ )
+        {
+                const colorrgbexp32_t *row = src + y * lmsrc->width;
+
+                if ( !tloc.get_rotated() )
+                {
+                        // The row lands in one contiguous run of the palette.
+                        int py = palette_height - 1 - ( tloc.get_y() + y );
+                        decode_luxels( row, lmsrc->width, page + py * row_stride + tloc.get_x() * 3, 3 );
+                }
+                else
+                {
+                        // Rotated 90 degrees, the row becomes a column.
+                        int px = tloc.get_x() + y;
+                        int py = palette_height - 1 - tloc.get_y();
+                        decode_luxels( row, lmsrc->width, page + py * row_stride + px * 3, -row_stride );
+                }
+        }
+}
+
+/**
+ * Fills the area of a face in a page of the palette's RAM image with white.
+ */
+static void fill_fullbright( const TextureLocation &tloc, unsigned short *page, int palette_width, int palette_height )
+{
+        int row_stride = palette_width * 3;
+
+        for ( int y = 0; y < tloc.get_height(); y++ )
+        {
+                int py = palette_height - 1 - ( tloc.get_y() + y );
+                std::fill_n( page + py * row_stride + tloc.get_x() * 3, tloc.get_width() * 3, (unsigned short)USHRT_MAX );
+        }
+}
+
+struct PaletteFillJob
 {
-        int width = face->lightmap_size[0] + 1;
-        int height = face->lightmap_size[1] + 1;
-        int num_luxels = width * height;
+        const BSPLoader *loader;
+        Palette *pal;
+        unsigned short *ram;
+        size_t page_size;
+        int width, height;
+        std::atomic<int> next_source;
+};
+
+static void fill_palette_sources( void *data )
+{
+        PaletteFillJob *job = (PaletteFillJob *)data;
+        bspdata_t *bspdata = job->loader->get_bspdata();
+        int num_sources = (int)job->pal->sources.size();
+
+        int i;
+        while ( ( i = job->next_source.fetch_add( 1 ) ) < num_sources )
+        {
+                const LightmapSource *src = job->pal->sources[i];
+                const TextureLocation &tloc = job->pal->locations[i];
+                const dface_t *face = bspdata->dfaces + src->facenum;
+
+                if ( src->fullbright )
+                {
+                        int numpages = face->bumped_lightmap ? NUM_BUMP_VECTS + 2 : 2;
+                        for ( int n = 0; n < numpages; n++ )
+                        {
+                                fill_fullbright( tloc, job->ram + n * job->page_size, job->width, job->height );
+                        }
+                        continue;
+                }
+
+                // Bounced
+                fill_lightmap( SampleBouncedLightmap( bspdata, face, 0 ), src, tloc,
+                               job->ram, job->width, job->height );
+
+                if ( face->bumped_lightmap )
+                {
+                        for ( int n = 0; n < NUM_BUMP_VECTS + 1; n++ )
+                        {
+                                fill_lightmap( SampleLightmap( bspdata, face, 0, 0, n ), src, tloc,
+                                               job->ram + ( n + 1 ) * job->page_size, job->width, job->height );
+                        }
+                }
+                else
+                {
+                        fill_lightmap( SampleLightmap( bspdata, face, 0, 0, 0 ), src, tloc,
+                                       job->ram + job->page_size, job->width, job->height );
+                }
+        }
+}
+
+/**
+ * Writes the lightmaps of every face in the palette directly into the RAM image of
+ * the palette texture. Faces are spread across threads; they never overlap in the
+ * palette so no locking is needed.
+ */
+void LightmapPalettizer::fill_palette( Palette *pal, Texture *tex )
+{
+        init_exponent_scale();
+
+        PTA_uchar ram_image = tex->make_ram_image();
 
-        if ( num_luxels <= 0 )
+        PaletteFillJob job;
+        job.loader = _loader;
+        job.pal = pal;
+        job.ram = (unsigned short *)ram_image.p();
+        job.page_size = tex->get_expected_ram_page_size() / sizeof( unsigned short );
+        job.width = tex->get_x_size();
+        job.height = tex->get_y_size();
+        job.next_source = 0;
+
+        int num_threads = std::min( (int)lightmap_palette_threads, (int)pal->sources.size() );
+        if ( !Thread::is_threading_supported() )
+                num_threads = 1;
+
+        pvector<PT( GenericThread )> threads;
+        for ( int i = 1; i < num_threads; i++ )
+        {
+                PT( GenericThread ) thread = new GenericThread( "lightmap-palette", "lightmap-palette",
+                                                                fill_palette_sources, &job );
+                if ( thread->start( TP_normal, true ) )
+                        threads.push_back( thread );
+        }
+
+        // the calling thread works too
+        fill_palette_sources( &job );
+
+        for ( size_t i = 0; i < threads.size(); i++ )
         {
-                lightmapPalettizer_cat.warning()
-                        << "Face has 0 size lightmap, will appear fullbright" << std::endl;
-                PNMImage img( 16, 16 );
-                img.fill( 1.0 );
-                return img;
+                threads[i]->join();
         }
+}
 
-        PNMImage img( width, height );
-	img.fill( 0 );
-	img.set_color_space( ColorSpace::CS_linear );
-	img.set_maxval( USHRT_MAX ); // ensure we get 16-bit color depth
+// Half float bits to the unsigned short range of the palette, clamped to [0, 1].
+static unsigned short half_to_ushort[65536];
 
-        int luxel = 0;
+static void init_half_to_ushort()
+{
+        static bool initialized = false;
+        if ( initialized )
+                return;
 
-        for ( int y = 0; y < height; y++ )
+        for ( int i = 0; i < 65536; i++ )
         {
-                for ( int x = 0; x < width; x++ )
+                float value = std::min( std::max( HalfToFloat( (unsigned short)i ), 0.0f ), 1.0f );
+                half_to_ushort[i] = (unsigned short)( value * USHRT_MAX + 0.5f );
+        }
+        initialized = true;
+}
+
+struct PaletteDecodeJob
+{
+        const dlightmappalette_t *palette;
+        unsigned short *ram;
+        size_t page_size;
+        std::atomic<int> next_row;
+};
+
+static void decode_palette_rows( void *data )
+{
+        PaletteDecodeJob *job = (PaletteDecodeJob *)data;
+        const dlightmappalette_t *palette = job->palette;
+        int blocks_x = palette->width / 4;
+        int blocks_y = palette->height / 4;
+        int row_stride = palette->width * 3;
+        int num_rows = blocks_y * palette->numpages;
+
+        int row;
+        while ( ( row = job->next_row.fetch_add( 1 ) ) < num_rows )
+        {
+                int page = row / blocks_y;
+                int by = row % blocks_y;
+                const byte *blocks = GetLightmapPaletteBlocks( palette, page ) + (size_t)by * blocks_x * BC6H_BLOCK_SIZE;
+
+                for ( int bx = 0; bx < blocks_x; bx++ )
                 {
-                        colorrgbexp32_t *sample;
-                        if ( !bounced )
-                                sample = SampleLightmap( loader->get_bspdata(), face, luxel, 0, lmnum );
-                        else
-                                sample = SampleBouncedLightmap( loader->get_bspdata(), face, luxel );
-
-			// Luxel is in linear-space.
-			LVector3 luxel_col;
-			ColorRGBExp32ToVector( *sample, luxel_col );
-			luxel_col /= 255.0f;
-
-                        img.set_xel( x, y, luxel_col );
-                        luxel++;
+                        unsigned short halfs[BC6H_BLOCK_TEXELS * 3];
+                        BC6HDecodeBlock( blocks, halfs );
+                        blocks += BC6H_BLOCK_SIZE;
+
+                        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+                        {
+                                // The palette is stored top-down, the RAM image bottom-up in BGR order.
+                                int px = bx * 4 + ( i & 3 );
+                                int py = palette->height - 1 - ( by * 4 + ( i >> 2 ) );
+                                unsigned short *pixel = job->ram + page * job->page_size + py * row_stride + px * 3;
+                                pixel[0] = half_to_ushort[halfs[i * 3 + 2]];
+                                pixel[1] = half_to_ushort[halfs[i * 3 + 1]];
+                                pixel[2] = half_to_ushort[halfs[i * 3]];
+                        }
                 }
         }
+}
+
+/**
+ * Decodes the BC6H blocks of every page of a palette written by p3rad into the RAM
+ * image of the palette texture. Rows of blocks are spread across threads like the
+ * faces are in fill_palette().
+ */
+static void decode_compressed_palette( const dlightmappalette_t *palette, Texture *tex )
+{
+        init_half_to_ushort();
+
+        PTA_uchar ram_image = tex->make_ram_image();
+
+        PaletteDecodeJob job;
+        job.palette = palette;
+        job.ram = (unsigned short *)ram_image.p();
+        job.page_size = tex->get_expected_ram_page_size() / sizeof( unsigned short );
+        job.next_row = 0;
+
+        int num_threads = std::min( (int)lightmap_palette_threads, palette->height / 4 * palette->numpages );
+        if ( !Thread::is_threading_supported() )
+                num_threads = 1;
+
+        pvector<PT( GenericThread )> threads;
+        for ( int i = 1; i < num_threads; i++ )
+        {
+                PT( GenericThread ) thread = new GenericThread( "lightmap-palette", "lightmap-palette",
+                                                                decode_palette_rows, &job );
+                if ( thread->start( TP_normal, true ) )
+                        threads.push_back( thread );
+        }
+
+        // the calling thread works too
+        decode_palette_rows( &job );
+
+        for ( size_t i = 0; i < threads.size(); i++ )
+        {
+                threads[i]->join();
+        }
+}
+
+/**
+ * Builds the palette directory from the palette p3rad packed and compressed into the
+ * BSP (-compresslightmaps), so nothing has to be packed at load.
+ */
+LightmapPaletteDirectory LightmapPalettizer::load_compressed_palette( const dlightmappalette_t *palette )
+{
+        LightmapPaletteDirectory dir;
+
+        PT( LightmapPaletteDirectory::LightmapPaletteEntry ) entry = new LightmapPaletteDirectory::LightmapPaletteEntry;
+
+        entry->palette_tex = new Texture;
+        entry->palette_tex->setup_2d_texture_array( palette->width, palette->height, NUM_LIGHTMAPS, Texture::T_unsigned_short, Texture::F_rgb16 );
+        entry->palette_tex->set_minfilter( SamplerState::FT_linear_mipmap_linear );
+        entry->palette_tex->set_magfilter( SamplerState::FT_linear );
+
+        const dlightmappaletteface_t *faces = GetLightmapPaletteFaces( palette );
+        for ( int i = 0; i < palette->numfaces; i++ )
+        {
+                PT( LightmapPaletteDirectory::LightmapFacePaletteEntry ) face_entry = new LightmapPaletteDirectory::LightmapFacePaletteEntry;
+                face_entry->palette = entry;
+                face_entry->flipped = faces[i].flipped != 0;
+                face_entry->xshift = faces[i].xshift;
+                face_entry->yshift = faces[i].yshift;
+                face_entry->palette_size[0] = palette->width;
+                face_entry->palette_size[1] = palette->height;
+
+                dir.face_index[faces[i].facenum] = face_entry;
+                dir.face_entries.push_back( face_entry );
+        }
+
+        double start = TrueClock::get_global_ptr()->get_short_time();
+        decode_compressed_palette( palette, entry->palette_tex );
+
+        lightmapPalettizer_cat.info()
+                << "Decoded compressed lightmap palette " << palette->width << "x" << palette->height
+                << " in " << ( TrueClock::get_global_ptr()->get_short_time() - start ) * 1000.0 << " ms\n";
 
-        return img;
+        dir.entries.push_back( entry );
+
+        return dir;
 }
 
 LightmapPaletteDirectory LightmapPalettizer::palettize_lightmaps()
 {
+        const dlightmappalette_t *compressed = GetLightmapPalette( _loader->get_bspdata() );
+        if ( compressed && compressed->numpages == NUM_LIGHTMAPS )
+        {
+                return load_compressed_palette( compressed );
+        }
+
         LightmapPaletteDirectory dir;
 
         pvector<Palette> result_vec;
@@ -86,7 +399,7 @@ LightmapPaletteDirectory LightmapPalettizer::palettize_lightmaps()
         pal.packer = TexturePacker::createTexturePacker();
         result_vec.push_back( pal );
 
-        // First step, build sources.
+        // First step, find the faces with lightmaps.
         for ( int facenum = 0; facenum < _loader->get_bspdata()->numfaces; facenum++ )
         {
                 dface_t *face = _loader->get_bspdata()->dfaces + facenum;
@@ -98,26 +411,22 @@ LightmapPaletteDirectory LightmapPalettizer::palettize_lightmaps()
 
                 LightmapSource src;
                 src.facenum = facenum;
-                src.lightmap_img[0] = lightmap_img_for_face( _loader, face, 0, true ); // bounced lightmap
-                if ( face->bumped_lightmap )
+                src.width = face->lightmap_size[0] + 1;
+                src.height = face->lightmap_size[1] + 1;
+                src.fullbright = src.width <= 0 || src.height <= 0;
+                if ( src.fullbright )
                 {
-                        for ( int n = 0; n < NUM_BUMP_VECTS + 1; n++ )
-                        {
-                                src.lightmap_img[n + 1] = lightmap_img_for_face( _loader, face, n );
-                        }
+                        lightmapPalettizer_cat.warning()
+                                << "Face has 0 size lightmap, will appear fullbright" << std::endl;
+                        src.width = fullbright_size;
+                        src.height = fullbright_size;
                 }
-                else
-                {
-                        src.lightmap_img[1] = lightmap_img_for_face( _loader, face, 0 );
-                }
-                
+
                 _sources.push_back( src );
         }
 
         for ( size_t i = 0; i < _sources.size(); i++ )
         {
-                dface_t *face = _loader->get_bspdata()->dfaces + _sources[i].facenum;
-
 #ifdef LMPALETTE_SPLIT
                 bool any_fit = false;
                 // See if this lightmap can fit in any palette.
@@ -125,9 +434,9 @@ LightmapPaletteDirectory LightmapPalettizer::palettize_lightmaps()
                 {
                         Palette *ppal = &result_vec[j];
                             
-                        if ( ppal->packer->wouldTextureFit( face->lightmap_size[0] + 1, face->lightmap_size[1] + 1, true, false, max_palette, max_palette ) )
+                        if ( ppal->packer->wouldTextureFit( _sources[i].width, _sources[i].height, true, false, max_palette, max_palette ) )
                         {
-                                ppal->packer->addNewTexture( face->lightmap_size[0] + 1, face->lightmap_size[1] + 1 );
+                                ppal->packer->addNewTexture( _sources[i].width, _sources[i].height );
                                 ppal->sources.push_back( &_sources[i] );
                                 any_fit = true;
                                 break;
@@ -139,12 +448,12 @@ LightmapPaletteDirectory LightmapPalettizer::palettize_lightmaps()
                         // We need to make a new palette for this lightmap, it won't fit in the current ones.
                         Palette newpal;
                         newpal.packer = TexturePacker::createTexturePacker();
-                        newpal.packer->addNewTexture( face->lightmap_size[0] + 1, face->lightmap_size[1] + 1 );
+                        newpal.packer->addNewTexture( _sources[i].width, _sources[i].height );
                         newpal.sources.push_back( &_sources[i] );
                         result_vec.push_back( newpal );
                 }
 #else
-                result_vec[0].packer->addNewTexture( face->lightmap_size[0] + 1, face->lightmap_size[1] + 1 );
+                result_vec[0].packer->addNewTexture( _sources[i].width, _sources[i].height );
                 result_vec[0].sources.push_back( &_sources[i] );
 #endif
         }
@@ -162,29 +471,19 @@ LightmapPaletteDirectory LightmapPalettizer::palettize_lightmaps()
 
                 PT( LightmapPaletteDirectory::LightmapPaletteEntry ) entry = new LightmapPaletteDirectory::LightmapPaletteEntry;
 
-                for ( int n = 0; n < NUM_LIGHTMAPS; n++ )
-                {
-                        pal->palette_img[n] = PNMImage( width, height );
-			pal->palette_img[n].set_color_space( ColorSpace::CS_linear );
-			pal->palette_img[n].set_maxval( USHRT_MAX );
-                        pal->palette_img[n].fill( 0.0 );
-                }
-
                 entry->palette_tex = new Texture;
-                entry->palette_tex->setup_2d_texture_array( width, height, NUM_LIGHTMAPS, Texture::T_unsigned_short, Texture::F_rgb );
+                entry->palette_tex->setup_2d_texture_array( width, height, NUM_LIGHTMAPS, Texture::T_unsigned_short, Texture::F_rgb16 );
                 entry->palette_tex->set_minfilter( SamplerState::FT_linear_mipmap_linear );
                 entry->palette_tex->set_magfilter( SamplerState::FT_linear );
 
                 for ( size_t j = 0; j < pal->sources.size(); j++ )
                 {
                         LightmapSource *src = pal->sources[j];
-                        int xshift, yshift, lmwidth, lmheight;
+                        int xshift, yshift;
                         bool rotated;
                         TextureLocation tloc = pal->packer->getTextureLocation( j );
                         xshift = tloc.get_x();
                         yshift = tloc.get_y();
-                        lmwidth = tloc.get_width();
-                        lmheight = tloc.get_height();
                         rotated = tloc.get_rotated();
 
                         PT( LightmapPaletteDirectory::LightmapFacePaletteEntry ) face_entry = new LightmapPaletteDirectory::LightmapFacePaletteEntry;
@@ -195,58 +494,18 @@ LightmapPaletteDirectory LightmapPalettizer::palettize_lightmaps()
                         face_entry->palette_size[0] = width;
                         face_entry->palette_size[1] = height;
 
-                        // Bounced
-                        for ( int y = 0; y < lmheight; y++ )
-                        {
-                                for ( int x = 0; x < lmwidth; x++ )
-                                {
-                                        pal->palette_img[0].set_xel( x + xshift, y + yshift,
-                                                rotated ? src->lightmap_img[0].get_xel( y, x ) :
-                                                src->lightmap_img[0].get_xel( x, y ) );
-                                }
-                        }
-
-                        if ( _loader->get_bspdata()->dfaces[src->facenum].bumped_lightmap )
-                        {
-                                for ( int n = 0; n < NUM_BUMP_VECTS + 1; n++ )
-                                {
-                                        for ( int y = 0; y < lmheight; y++ )
-                                        {
-                                                for ( int x = 0; x < lmwidth; x++ )
-                                                {
-                                                        pal->palette_img[n + 1].set_xel( x + xshift, y + yshift,
-                                                                                     rotated ? src->lightmap_img[n + 1].get_xel( y, x ) :
-                                                                                     src->lightmap_img[n + 1].get_xel( x, y ) );
-                                                }
-                                        }
-                                }
-                                
-                        }
-                        else
-                        {
-                                for ( int y = 0; y < lmheight; y++ )
-                                {
-                                        for ( int x = 0; x < lmwidth; x++ )
-                                        {
-                                                pal->palette_img[1].set_xel( x + xshift, y + yshift,
-                                                                             rotated ? src->lightmap_img[1].get_xel( y, x ) :
-                                                                             src->lightmap_img[1].get_xel( x, y ) );
-                                        }
-                                }
-                        }
-                        
-                        
+                        pal->locations.push_back( tloc );
 
-                        
                         dir.face_index[src->facenum] = face_entry;
                         dir.face_entries.push_back( face_entry );
                 }
 
-                // load all palette images into our array texture
-                for ( int n = 0; n < NUM_LIGHTMAPS; n++ )
-                {
-                        entry->palette_tex->load( pal->palette_img[n], n, 0 );
-                }
+                double start = TrueClock::get_global_ptr()->get_short_time();
+                fill_palette( pal, entry->palette_tex );
+
+                lightmapPalettizer_cat.info()
+                        << "Filled lightmap palette " << width << "x" << height
+                        << " in " << ( TrueClock::get_global_ptr()->get_short_time() - start ) * 1000.0 << " ms\n";
 
                 dir.entries.push_back( entry );
 
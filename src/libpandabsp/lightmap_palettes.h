@@ -12,7 +12,7 @@
 #ifndef LIGHTMAP_PALETTES_H
 #define LIGHTMAP_PALETTES_H
 
-#include <pnmImage.h>
+#include <texture.h>
 #include <pvector.h>
 #include <notifyCategoryProxy.h>
 #include <aa_luse.h>
@@ -24,6 +24,7 @@
 
 class BSPLoader;
 class TexturePacker;
+struct dlightmappalette_t;
 
 //#define NUM_LIGHTMAPS 1 + ((NUM_BUMP_VECTS + 1) * 2)
 #define NUM_LIGHTMAPS 1 + (NUM_BUMP_VECTS + 1)
@@ -51,29 +52,17 @@ struct LightmapPaletteDirectory
 struct LightmapSource
 {
         int facenum;
-        PNMImage lightmap_img[NUM_LIGHTMAPS];
-
-        LightmapSource()
-        {
-                for ( int i = 0; i < NUM_LIGHTMAPS; i++ )
-                {
-                        lightmap_img[i] = PNMImage( 1, 1 );
-                }
-        }
+        // Size of the area packed into the palette.
+        int width, height;
+        // Face has a 0 size lightmap, its area is filled white.
+        bool fullbright;
 };
 
 struct Palette
 {
         pvector<LightmapSource *> sources;
-        PNMImage palette_img[NUM_LIGHTMAPS];
+        pvector<TextureLocation> locations;
         TexturePacker *packer;
-        Palette()
-        {
-                for ( int i = 0; i < NUM_LIGHTMAPS; i++ )
-                {
-                        palette_img[i] = PNMImage( 1, 1 );
-                }
-        }
 };
 
 NotifyCategoryDeclNoExport(lightmapPalettizer);
@@ -100,6 +89,9 @@ public:
         LightmapPaletteDirectory palettize_lightmaps();
 
 private:
+        void fill_palette( Palette *pal, Texture *tex );
+        LightmapPaletteDirectory load_compressed_palette( const dlightmappalette_t *palette );
+
         const BSPLoader *_loader;
         pvector<LightmapSource> _sources;
 };
@@ -0,0 +1,496 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file material_cache.cpp
+ * @author Brian Lach
+ * @date October 18, 2026
+ */
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "material_cache.h"
+#include "bsp_material.h"
+
+#include <bamCache.h>
+#include <configVariableBool.h>
+#include <lightMutexHolder.h>
+#include <virtualFileSystem.h>
+
+#include <fstream>
+
+static ConfigVariableBool material_cache
+( "material-cache", true,
+  PRC_DESC( "Cache parsed material files in the model-cache-dir so they load faster next time." ) );
+
+#define MATCACHE_IDENT          (('C'<<24)+('T'<<16)+('M'<<8)+'P')     // "PMTC"
+#define MATCACHE_VERSION        1
+
+// Cache file layout, native-endian:
+//
+//      header
+//      records, each:
+//              string path
+//              int64 timestamp
+//              uint32 numdependencies, then per dependency: string path, int64 timestamp
+//              string shader
+//              uint32 numkeyvalues, then per keyvalue: string key, string value
+//
+// Strings are a uint32 length followed by the characters.
+
+struct MaterialCacheHeader
+{
+        int ident;
+        int version;
+        unsigned int num_records;
+};
+
+MaterialCache *MaterialCache::_global_ptr = nullptr;
+
+MaterialCache *MaterialCache::get_global_ptr()
+{
+        if ( !_global_ptr )
+        {
+                _global_ptr = new MaterialCache;
+        }
+
+        return _global_ptr;
+}
+
+MaterialCache::MaterialCache() :
+        _lock( "MaterialCache" ),
+        _opened( false ),
+        _base( nullptr ),
+        _size( 0 )
+#ifdef _WIN32
+        , _file_handle( nullptr ),
+        _map_handle( nullptr )
+#endif
+{
+}
+
+//====================================================================//
+
+/**
+ * Reads from a bounds-checked cursor into the mapped file.
+ */
+class CacheReader
+{
+public:
+        INLINE CacheReader( const unsigned char *data, size_t size ) :
+                _data( data ),
+                _size( size ),
+                _pos( 0 ),
+                _ok( true )
+        {
+        }
+
+        template <class T>
+        INLINE T get()
+        {
+                T val = T();
+                if ( _ok && _size - _pos >= sizeof( T ) )
+                {
+                        memcpy( &val, _data + _pos, sizeof( T ) );
+                        _pos += sizeof( T );
+                }
+                else
+                {
+                        _ok = false;
+                }
+                return val;
+        }
+
+        INLINE std::string get_string()
+        {
+                unsigned int len = get<unsigned int>();
+                if ( !_ok || _size - _pos < len )
+                {
+                        _ok = false;
+                        return std::string();
+                }
+
+                std::string str( (const char *)_data + _pos, len );
+                _pos += len;
+                return str;
+        }
+
+        INLINE void skip_string()
+        {
+                unsigned int len = get<unsigned int>();
+                if ( !_ok || _size - _pos < len )
+                {
+                        _ok = false;
+                        return;
+                }
+                _pos += len;
+        }
+
+        INLINE size_t get_pos() const
+        {
+                return _pos;
+        }
+
+        INLINE bool is_ok() const
+        {
+                return _ok;
+        }
+
+private:
+        const unsigned char *_data;
+        size_t _size;
+        size_t _pos;
+        bool _ok;
+};
+
+template <class T>
+INLINE static void add_value( std::string &out, T val )
+{
+        out.append( (const char *)&val, sizeof( T ) );
+}
+
+INLINE static void add_string( std::string &out, const std::string &str )
+{
+        add_value<unsigned int>( out, (unsigned int)str.size() );
+        out.append( str );
+}
+
+//====================================================================//
+
+/**
+ * Maps the cache file into memory and indexes its records. Called with the lock held.
+ */
+void MaterialCache::open()
+{
+        _opened = true;
+
+        if ( !material_cache )
+        {
+                return;
+        }
+
+        BamCache *bam_cache = BamCache::get_global_ptr();
+        if ( bam_cache->get_root().empty() )
+        {
+                return;
+        }
+
+        _filename = Filename( bam_cache->get_root(), "bspmaterials.cache" );
+        _filename.set_binary();
+
+        std::string os_file = _filename.to_os_specific();
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA( os_file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL, NULL );
+        if ( file == INVALID_HANDLE_VALUE )
+        {
+                return;
+        }
+
+        LARGE_INTEGER filesize;
+        if ( !GetFileSizeEx( file, &filesize ) || filesize.QuadPart < (LONGLONG)sizeof( MaterialCacheHeader ) )
+        {
+                CloseHandle( file );
+                return;
+        }
+
+        HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if ( !mapping )
+        {
+                CloseHandle( file );
+                return;
+        }
+
+        _base = (const unsigned char *)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+        if ( !_base )
+        {
+                CloseHandle( mapping );
+                CloseHandle( file );
+                return;
+        }
+
+        _file_handle = file;
+        _map_handle = mapping;
+        _size = (size_t)filesize.QuadPart;
+#else
+        int fd = ::open( os_file.c_str(), O_RDONLY );
+        if ( fd == -1 )
+        {
+                return;
+        }
+
+        struct stat filestat;
+        if ( fstat( fd, &filestat ) != 0 || filestat.st_size < (off_t)sizeof( MaterialCacheHeader ) )
+        {
+                ::close( fd );
+                return;
+        }
+
+        void *base = mmap( NULL, (size_t)filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        // the mapping stays valid after the descriptor is closed
+        ::close( fd );
+        if ( base == MAP_FAILED )
+        {
+                return;
+        }
+
+        _base = (const unsigned char *)base;
+        _size = (size_t)filestat.st_size;
+#endif
+
+        if ( !index_records() )
+        {
+                bspmaterial_cat.warning()
+                        << "Material cache " << _filename << " is invalid, ignoring it\n";
+                close();
+        }
+        else
+        {
+                bspmaterial_cat.info()
+                        << "Opened material cache with " << _records.size() << " materials\n";
+        }
+}
+
+void MaterialCache::close()
+{
+        if ( _base )
+        {
+#ifdef _WIN32
+                UnmapViewOfFile( _base );
+                CloseHandle( (HANDLE)_map_handle );
+                CloseHandle( (HANDLE)_file_handle );
+                _map_handle = _file_handle = nullptr;
+#else
+                munmap( (void *)_base, _size );
+#endif
+        }
+
+        _base = nullptr;
+        _size = 0;
+        _records.clear();
+}
+
+/**
+ * Validates the layout of every record and builds the path index.
+ */
+bool MaterialCache::index_records()
+{
+        CacheReader reader( _base, _size );
+
+        MaterialCacheHeader header = reader.get<MaterialCacheHeader>();
+        if ( header.ident != MATCACHE_IDENT || header.version != MATCACHE_VERSION )
+        {
+                return false;
+        }
+
+        for ( unsigned int i = 0; i < header.num_records; i++ )
+        {
+                size_t start = reader.get_pos();
+
+                std::string path = reader.get_string();
+                reader.get<PN_int64>();
+                unsigned int num_deps = reader.get<unsigned int>();
+                for ( unsigned int j = 0; j < num_deps && reader.is_ok(); j++ )
+                {
+                        reader.skip_string();
+                        reader.get<PN_int64>();
+                }
+                reader.skip_string();
+                unsigned int num_kvs = reader.get<unsigned int>();
+                for ( unsigned int j = 0; j < num_kvs && reader.is_ok(); j++ )
+                {
+                        reader.skip_string();
+                        reader.skip_string();
+                }
+
+                if ( !reader.is_ok() )
+                {
+                        return false;
+                }
+
+                Record rec;
+                rec.offset = start;
+                rec.length = reader.get_pos() - start;
+                _records[path] = rec;
+        }
+
+        return reader.get_pos() == _size;
+}
+
+bool MaterialCache::read_entry( size_t offset, time_t &timestamp, MaterialCacheEntry &entry ) const
+{
+        // the record was validated by index_records()
+        CacheReader reader( _base + offset, _size - offset );
+
+        reader.skip_string();
+        timestamp = (time_t)reader.get<PN_int64>();
+
+        unsigned int num_deps = reader.get<unsigned int>();
+        entry.dependencies.resize( num_deps );
+        for ( unsigned int i = 0; i < num_deps; i++ )
+        {
+                entry.dependencies[i].file = reader.get_string();
+                entry.dependencies[i].timestamp = (time_t)reader.get<PN_int64>();
+        }
+
+        entry.shader = reader.get_string();
+
+        unsigned int num_kvs = reader.get<unsigned int>();
+        entry.keyvalues.resize( num_kvs );
+        for ( unsigned int i = 0; i < num_kvs; i++ )
+        {
+                entry.keyvalues[i].first = reader.get_string();
+                entry.keyvalues[i].second = reader.get_string();
+        }
+
+        return reader.is_ok();
+}
+
+/**
+ * Fills in the entry for the given material file if the cache has an up-to-date
+ * record of it. Safe to call from several threads.
+ */
+bool MaterialCache::find( const Filename &file, time_t timestamp, MaterialCacheEntry &entry )
+{
+        {
+                LightMutexHolder holder( _lock );
+
+                if ( !_opened )
+                {
+                        open();
+                }
+
+                int idx = _records.find( file.get_fullpath() );
+                if ( idx == -1 )
+                {
+                        return false;
+                }
+
+                // Copied out under the lock, flush() may replace the mapping.
+                time_t cached_timestamp;
+                if ( !read_entry( _records.get_data( idx ).offset, cached_timestamp, entry ) ||
+                     cached_timestamp != timestamp )
+                {
+                        return false;
+                }
+        }
+
+        VirtualFileSystem *vfs = VirtualFileSystem::get_global_ptr();
+        for ( size_t i = 0; i < entry.dependencies.size(); i++ )
+        {
+                PT( VirtualFile ) dep = vfs->get_file( entry.dependencies[i].file );
+                if ( !dep || dep->get_timestamp() != entry.dependencies[i].timestamp )
+                {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+/**
+ * Remembers a freshly parsed material, to be written out by the next flush().
+ */
+void MaterialCache::store( const Filename &file, time_t timestamp, const MaterialCacheEntry &entry )
+{
+        std::string record;
+        add_string( record, file.get_fullpath() );
+        add_value<PN_int64>( record, (PN_int64)timestamp );
+        add_value<unsigned int>( record, (unsigned int)entry.dependencies.size() );
+        for ( size_t i = 0; i < entry.dependencies.size(); i++ )
+        {
+                add_string( record, entry.dependencies[i].file );
+                add_value<PN_int64>( record, (PN_int64)entry.dependencies[i].timestamp );
+        }
+        add_string( record, entry.shader );
+        add_value<unsigned int>( record, (unsigned int)entry.keyvalues.size() );
+        for ( size_t i = 0; i < entry.keyvalues.size(); i++ )
+        {
+                add_string( record, entry.keyvalues[i].first );
+                add_string( record, entry.keyvalues[i].second );
+        }
+
+        LightMutexHolder holder( _lock );
+        _pending[file.get_fullpath()] = record;
+}
+
+/**
+ * Rewrites the cache file with the stored records merged into it.
+ */
+void MaterialCache::flush()
+{
+        LightMutexHolder holder( _lock );
+
+        if ( _pending.is_empty() || _filename.empty() )
+        {
+                return;
+        }
+
+        std::string data;
+        MaterialCacheHeader header;
+        header.ident = MATCACHE_IDENT;
+        header.version = MATCACHE_VERSION;
+        header.num_records = 0;
+        add_value( data, header );
+
+        // keep the records that weren't replaced
+        for ( size_t i = 0; i < _records.size(); i++ )
+        {
+                if ( _pending.find( _records.get_key( i ) ) != -1 )
+                {
+                        continue;
+                }
+                const Record &rec = _records.get_data( i );
+                data.append( (const char *)_base + rec.offset, rec.length );
+                header.num_records++;
+        }
+        for ( size_t i = 0; i < _pending.size(); i++ )
+        {
+                data.append( _pending.get_data( i ) );
+                header.num_records++;
+        }
+        memcpy( &data[0], &header, sizeof( header ) );
+
+        close();
+
+        Filename temp_file = _filename.get_fullpath() + ".tmp";
+        temp_file.set_binary();
+        temp_file.make_dir();
+
+        std::ofstream out;
+        if ( !temp_file.open_write( out ) )
+        {
+                bspmaterial_cat.warning()
+                        << "Could not write material cache " << temp_file << "\n";
+                _pending.clear();
+                _opened = false;
+                return;
+        }
+        out.write( data.data(), data.size() );
+        out.close();
+
+        if ( !temp_file.rename_to( _filename ) )
+        {
+                _filename.unlink();
+                temp_file.rename_to( _filename );
+        }
+
+        bspmaterial_cat.info()
+                << "Wrote material cache with " << header.num_records << " materials\n";
+
+        _pending.clear();
+
+        // map the new file next time a material is requested
+        _opened = false;
+}
@@ -0,0 +1,93 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file material_cache.h
+ * @author Brian Lach
+ * @date October 18, 2026
+ */
+
+#ifndef MATERIAL_CACHE_H
+#define MATERIAL_CACHE_H
+
+#include "config_bsp.h"
+
+#include <filename.h>
+#include <lightMutex.h>
+#include <pvector.h>
+#include <simpleHashMap.h>
+
+/**
+ * The flattened contents of a .mat file: the shader name and the keyvalues in
+ * the order they are applied (an $include'd material's keyvalues come first).
+ */
+struct MaterialCacheEntry
+{
+        struct Dependency
+        {
+                std::string file;
+                time_t timestamp;
+        };
+
+        std::string shader;
+        pvector<std::pair<std::string, std::string>> keyvalues;
+
+        // Files the entry was built from besides the material itself ($include's).
+        pvector<Dependency> dependencies;
+};
+
+/**
+ * An on-disk cache of parsed material files, so that loading a material does not
+ * have to tokenize the KeyValues text again.
+ *
+ * The cache is a single binary file in the model-cache-dir. It is memory-mapped the
+ * first time a material is requested and every record is bounds-checked before
+ * it is used. A record is only returned if the timestamp of the material file, and
+ * of every file it $include's, still match.
+ *
+ * New records are kept in memory until flush() rewrites the file.
+ */
+class MaterialCache
+{
+public:
+        static MaterialCache *get_global_ptr();
+
+        bool find( const Filename &file, time_t timestamp, MaterialCacheEntry &entry );
+        void store( const Filename &file, time_t timestamp, const MaterialCacheEntry &entry );
+        void flush();
+
+private:
+        MaterialCache();
+
+        void open();
+        void close();
+        bool index_records();
+        bool read_entry( size_t offset, time_t &timestamp, MaterialCacheEntry &entry ) const;
+
+        struct Record
+        {
+                size_t offset;
+                size_t length;
+        };
+
+        LightMutex _lock;
+        bool _opened;
+        Filename _filename;
+
+        // mapped cache file
+        const unsigned char *_base;
+        size_t _size;
+#ifdef _WIN32
+        void *_file_handle;
+        void *_map_handle;
+#endif
+
+        SimpleHashMap<std::string, Record, string_hash> _records;
+        SimpleHashMap<std::string, std::string, string_hash> _pending;
+
+        static MaterialCache *_global_ptr;
+};
+
+#endif // MATERIAL_CACHE_H
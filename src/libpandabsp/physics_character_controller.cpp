@@ -15,6 +15,8 @@
 #include <bulletSphereShape.h>
 #include <eventHandler.h>
 
+#include <algorithm>
+
 #include "bsploader.h"
 
 PhysicsCharacterController::PhysicsCharacterController( BSPLoader *loader, BulletWorld *world, const NodePath &render,
@@ -393,22 +395,36 @@ void PhysicsCharacterController::update_eye_ray()
 	// TODO
 }
 
+/**
+ * Finds what the event sphere is touching and fires the enter/exit events by
+ * merging the sorted contact set of this frame with the one of last frame.
+ */
 void PhysicsCharacterController::update_event_sphere()
 {
 	EventHandler *evh = EventHandler::get_global_event_handler();
 
-	NodePathCollection overlapping;
-
+	// Gather the touched nodes, sorted by pointer with duplicates removed.
+	// The set holds a reference to each node, so the pointer stays a stable
+	// id until the node is removed from the set.
+	_overlapping.clear();
 	BulletContactResult result = _world->contact_test( _event_sphere );
 	for ( int i = 0; i < result.get_num_contacts(); i++ )
 	{
 		BulletContact contact = result.get_contact( i );
-		PandaNode *node = contact.get_node1();
-		NodePath np( node );
+		_overlapping.push_back( contact.get_node1() );
+	}
+	std::sort( _overlapping.begin(), _overlapping.end() );
+	_overlapping.erase( std::unique( _overlapping.begin(), _overlapping.end() ), _overlapping.end() );
 
-		if ( !_prev_overlapping.has_path( np ) )
+	size_t curr = 0;
+	size_t prev = 0;
+	while ( curr < _overlapping.size() || prev < _prev_overlapping.size() )
+	{
+		if ( prev == _prev_overlapping.size() ||
+		     ( curr < _overlapping.size() && _overlapping[curr] < _prev_overlapping[prev] ) )
 		{
 			// The avatar has entered this node.
+			NodePath np( _overlapping[curr] );
 #ifdef HAVE_PYTHON
 			if ( _event_enter_callback )
 			{
@@ -420,17 +436,12 @@ void PhysicsCharacterController::update_event_sphere()
 				//PyObject_CallObject( _event_enter_callback, args );
 			}
 #endif
+			curr++;
 		}
-
-		overlapping.add_path( np );
-	}
-
-	for ( int i = 0; i < _prev_overlapping.get_num_paths(); i++ )
-	{
-		NodePath np = _prev_overlapping[i];
-		if ( !overlapping.has_path( np ) )
+		else if ( curr == _overlapping.size() || _prev_overlapping[prev] < _overlapping[curr] )
 		{
 			// The avatar has exited this node.
+			NodePath np( _prev_overlapping[prev] );
 #ifdef HAVE_PYTHON
 			if ( _event_exit_callback )
 			{
@@ -442,11 +453,18 @@ void PhysicsCharacterController::update_event_sphere()
 				//PyObject_CallObject( _event_exit_callback, args );
 			}
 #endif
+			prev++;
+		}
+		else
+		{
+			// Still touching.
+			curr++;
+			prev++;
 		}
 	}
 
-	// Remember who we overlapped with.
-	_prev_overlapping = overlapping;
+	// Remember who we overlapped with. The old set becomes next frame's scratch buffer.
+	_prev_overlapping.swap( _overlapping );
 }
 
 void PhysicsCharacterController::update_foot_contact()
@@ -270,7 +270,9 @@ private:
 	PT( BulletGhostNode ) _event_sphere;
 	NodePath _event_sphere_np;
 
-	NodePathCollection _prev_overlapping;
+	// Nodes touched by the event sphere, sorted by pointer.
+	pvector<PT( PandaNode )> _prev_overlapping;
+	pvector<PT( PandaNode )> _overlapping;
 
 	// The brush material we are standing on.
 	std::string _current_material;
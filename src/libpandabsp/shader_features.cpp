@@ -40,19 +40,12 @@ INLINE static std::string convert_to_string( float value )
 
 SHADERFEATURE_PARSE_FUNC( RimLightFeature )
 {
-        if ( mat->has_keyvalue( "$rimlight" ) &&
-                (bool)mat->get_keyvalue_int( "$rimlight" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_rimlight ) )
         {
                 has_feature = true;
-
-                if ( mat->has_keyvalue( "$rimlightboost" ) )
-                {
-                        boost = mat->get_keyvalue_float( "$rimlightboost" );
-                }
-                if ( mat->has_keyvalue( "$rimlightexponent" ) )
-                {
-                        exponent = mat->get_keyvalue_float( "$rimlightexponent" );
-                }
+                boost = params.rimlight_boost;
+                exponent = params.rimlight_exponent;
         }
 }
 
@@ -69,73 +62,11 @@ SHADERFEATURE_SETUP_FUNC( RimLightFeature )
 
 SHADERFEATURE_PARSE_FUNC( BaseTextureFeature )
 {
-        if ( mat->has_keyvalue( "$basetexture" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_basetexture ) )
         {
                 has_feature = true;
-
-                if ( mat->has_keyvalue( "$basetexture_alpha" ) )
-                {
-                        // alpha channel supplied in a separate texture,
-                        // common in Toontown
-                        base_texture = TexturePool::load_texture( mat->get_keyvalue( "$basetexture" ),
-                                                                  mat->get_keyvalue( "$basetexture_alpha" ) );
-                }
-                else
-                {
-                        base_texture = TexturePool::load_texture( mat->get_keyvalue( "$basetexture" ) );
-                }
-
-		// Convert color texture from gamma to linear when reading in shader
-		enable_srgb_read( base_texture, true );
-
-                if ( mat->has_keyvalue( "$basetexture_wrap" ) )
-                {
-                        const std::string &wrapmode = mat->get_keyvalue( "$basetexture_wrap" );
-                        if ( wrapmode == "clamp" )
-                        {
-                                base_texture->set_wrap_u( SamplerState::WM_clamp );
-                                base_texture->set_wrap_v( SamplerState::WM_clamp );
-                        }
-                        else if ( wrapmode == "repeat" )
-                        {
-                                base_texture->set_wrap_u( SamplerState::WM_repeat );
-                                base_texture->set_wrap_v( SamplerState::WM_repeat );
-                        }
-                        else
-                        {
-                                bspmaterial_cat.warning()
-                                        << "BaseTextureFeature: unknown wrap mode `" << wrapmode << "`\n";
-                        }
-                }
-                else
-                {
-                        if ( mat->has_keyvalue( "$basetexture_wrapu" ) )
-                        {
-                                const std::string &wrapmode = mat->get_keyvalue( "$basetexture_wrapu" );
-                                if ( wrapmode == "clamp" )
-                                        base_texture->set_wrap_u( SamplerState::WM_clamp );
-                                else if ( wrapmode == "repeat" )
-                                        base_texture->set_wrap_u( SamplerState::WM_repeat );
-                                else
-                                {
-                                        bspmaterial_cat.warning()
-                                                << "BaseTextureFeature: unknown wrap mode `" << wrapmode << "`\n";
-                                }
-                        }
-                        if ( mat->has_keyvalue( "$basetexture_wrapv" ) )
-                        {
-                                const std::string &wrapmode = mat->get_keyvalue( "$basetexture_wrapv" );
-                                if ( wrapmode == "clamp" )
-                                        base_texture->set_wrap_v( SamplerState::WM_clamp );
-                                else if ( wrapmode == "repeat" )
-                                        base_texture->set_wrap_v( SamplerState::WM_repeat );
-                                else
-                                {
-                                        bspmaterial_cat.warning()
-                                                << "BaseTextureFeature: unknown wrap mode `" << wrapmode << "`\n";
-                                }
-                        }
-                }
+                base_texture = params.textures[MT_basetexture];
         }
 }
 
@@ -152,15 +83,16 @@ SHADERFEATURE_SETUP_FUNC( BaseTextureFeature )
 
 SHADERFEATURE_PARSE_FUNC( AlphaFeature )
 {
-        if ( mat->has_keyvalue( "$alpha" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_alpha ) )
         {
-                alpha = mat->get_keyvalue_float( "$alpha" );
+                alpha = params.alpha;
 
                 has_feature = true;
         }
-        else if ( mat->has_keyvalue( "$translucent" ) )
+        else if ( params.has( MF_translucent ) )
         {
-                translucent = (bool)mat->get_keyvalue_int( "$translucent" );
+                translucent = params.translucent;
 
                 has_feature = true;
         }
@@ -185,24 +117,15 @@ SHADERFEATURE_SETUP_FUNC( AlphaFeature )
 
 SHADERFEATURE_PARSE_FUNC( EnvmapFeature )
 {
-        if ( mat->has_keyvalue( "$envmap" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_envmap ) )
         {
                 has_feature = true;
 
-                std::string envmap = mat->get_keyvalue( "$envmap" );
-                if ( envmap != "env_cubemap" )
-                {
-                        envmap_texture = TexturePool::load_cube_map( envmap );
-                        envmap_texture->set_minfilter( SamplerState::FT_linear_mipmap_linear );
-			enable_srgb_read( envmap_texture, true );
-                }
-
-                if ( mat->has_keyvalue( "$envmaptint" ) )
-                {
-                        envmap_tint = CKeyValues::to_3f( mat->get_keyvalue( "$envmaptint" ) );
-                }
+                // null for env_cubemap, filled in by the closest cubemap in the level
+                envmap_texture = params.textures[MT_envmap];
+                envmap_tint = params.envmap_tint;
         }
-        
 }
 
 SHADERFEATURE_SETUP_FUNC( EnvmapFeature )
@@ -226,25 +149,16 @@ SHADERFEATURE_SETUP_FUNC( EnvmapFeature )
 
 SHADERFEATURE_PARSE_FUNC( DetailFeature )
 {
-        if ( mat->has_keyvalue( "$detail" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_detail ) )
         {
                 has_feature = true;
 
-                detail_texture = TexturePool::load_texture( mat->get_keyvalue( "$detail" ) );
-                if ( mat->has_keyvalue( "$detailfactor" ) )
-                {
-                        detail_factor = mat->get_keyvalue_float( "$detailfactor" );
-                }
-                if ( mat->has_keyvalue( "$detailscale" ) )
-                {
-                        detail_scale = mat->get_keyvalue_float( "$detailscale" );
-                }
-                if ( mat->has_keyvalue( "$detailtint" ) )
-                {
-                        detail_tint = CKeyValues::to_3f
-                        ( mat->get_keyvalue( "$detailtint" ) );
-                }
-        }  
+                detail_texture = params.textures[MT_detail];
+                detail_factor = params.detail_factor;
+                detail_scale = params.detail_scale;
+                detail_tint = params.detail_tint;
+        }
 }
 
 SHADERFEATURE_SETUP_FUNC( DetailFeature )
@@ -264,19 +178,9 @@ SHADERFEATURE_SETUP_FUNC( DetailFeature )
 
 SHADERFEATURE_PARSE_FUNC( HalfLambertFeature )
 {
-        if ( mat->has_keyvalue( "$halflambert" ) )
-        {
-                if ( (bool)mat->get_keyvalue_int( "$halflambert" ) )
-                {
-                        has_feature = true;
-                        halflambert = true;
-                }
-                else
-                {
-                        has_feature = false;
-                        halflambert = false;
-                }
-        }
+        const MaterialParams &params = mat->get_params();
+        has_feature = params.has( MF_halflambert );
+        halflambert = has_feature;
 }
 
 SHADERFEATURE_SETUP_FUNC( HalfLambertFeature )
@@ -291,11 +195,12 @@ SHADERFEATURE_SETUP_FUNC( HalfLambertFeature )
 
 SHADERFEATURE_PARSE_FUNC( BumpmapFeature )
 {
-        if ( mat->has_keyvalue( "$bumpmap" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_bumpmap ) )
         {
                 has_feature = true;
 
-                bump_tex = TexturePool::load_texture( mat->get_keyvalue( "$bumpmap" ) );
+                bump_tex = params.textures[MT_bumpmap];
         }
 }
 
@@ -312,14 +217,12 @@ SHADERFEATURE_SETUP_FUNC( BumpmapFeature )
 
 SHADERFEATURE_PARSE_FUNC( LightwarpFeature )
 {
-        if ( mat->has_keyvalue( "$lightwarp" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_lightwarp ) )
         {
                 has_feature = true;
 
-                lightwarp_tex = TexturePool::load_texture( mat->get_keyvalue( "$lightwarp" ) );
-                lightwarp_tex->set_wrap_u( SamplerState::WM_clamp );
-                lightwarp_tex->set_wrap_v( SamplerState::WM_clamp );
-		enable_srgb_read( lightwarp_tex, true );
+                lightwarp_tex = params.textures[MT_lightwarp];
         }
 }
 
@@ -336,15 +239,11 @@ SHADERFEATURE_SETUP_FUNC( LightwarpFeature )
 
 SHADERFEATURE_PARSE_FUNC( SelfIllumFeature )
 {
-        if ( mat->has_keyvalue( "$selfillum" ) &&
-                (bool)mat->get_keyvalue_int( "$selfillum" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_selfillum ) )
         {
                 has_feature = true;
-
-                if ( mat->has_keyvalue( "$selfillumtint" ) )
-                {
-                        selfillumtint = CKeyValues::to_3f( mat->get_keyvalue( "$selfillumtint" ) );
-                }
+                selfillumtint = params.selfillum_tint;
         }
 }
 
@@ -361,28 +260,17 @@ SHADERFEATURE_SETUP_FUNC( SelfIllumFeature )
 
 SHADERFEATURE_PARSE_FUNC( ARME_Feature )
 {
-        if ( mat->has_keyvalue( "$arme" ) )
+        const MaterialParams &params = mat->get_params();
+        if ( params.has( MF_arme ) )
         {
-                arme_texture = TexturePool::load_texture( mat->get_keyvalue( "$arme" ) );
+                arme_texture = params.textures[MT_arme];
         }
         else
         {
-                if ( mat->has_keyvalue( "$ao" ) )
-                {
-                        ao = mat->get_keyvalue_float( "$ao" );
-                }
-                if ( mat->has_keyvalue( "$roughness" ) )
-                {
-                        roughness = mat->get_keyvalue_float( "$roughness" );
-                }
-                if ( mat->has_keyvalue( "$metallic" ) )
-                {
-                        metallic = mat->get_keyvalue_float( "$metallic" );
-                }
-                if ( mat->has_keyvalue( "$emissive" ) )
-                {
-                        emissive = mat->get_keyvalue_float( "$emissive" );
-                }
+                ao = params.ao;
+                roughness = params.roughness;
+                metallic = params.metallic;
+                emissive = params.emissive;
         }
 }
 
@@ -262,50 +262,126 @@ void BSPShaderGenerator::update()
 	}
 }
 
+/**
+ * Names and default values of the per-node inputs, made once so that applying
+ * them doesn't look up InternalNames or allocate arrays.
+ */
+struct NodeInputDefaults
+{
+        NodeInputDefaults() :
+                light_count_name( InternalName::make( "lightCount" ) ),
+                light_data_name( InternalName::make( "lightData" ) ),
+                light_data2_name( InternalName::make( "lightData2" ) ),
+                light_types_name( InternalName::make( "lightTypes" ) ),
+                ambient_cube_name( InternalName::make( "ambientCube" ) ),
+                envmap_sampler_name( InternalName::make( "envmapSampler" ) ),
+                light_count( PTA_int::empty_array( 1 ) ),
+                light_data( PTA_LMatrix4::empty_array( MAX_TOTAL_LIGHTS ) ),
+                light_data2( PTA_LMatrix4::empty_array( MAX_TOTAL_LIGHTS ) ),
+                light_types( PTA_int::empty_array( MAX_TOTAL_LIGHTS ) ),
+                ambient_cube( PTA_LVecBase3::empty_array( 6 ) )
+        {
+        }
+
+        CPT_InternalName light_count_name;
+        CPT_InternalName light_data_name;
+        CPT_InternalName light_data2_name;
+        CPT_InternalName light_types_name;
+        CPT_InternalName ambient_cube_name;
+        CPT_InternalName envmap_sampler_name;
+
+        // Never written to, so every node without inputs can share them.
+        PTA_int light_count;
+        PTA_LMatrix4 light_data;
+        PTA_LMatrix4 light_data2;
+        PTA_int light_types;
+        PTA_LVecBase3 ambient_cube;
+
+        // Shader attribs with the default inputs applied, by the attrib they were applied to.
+        SimpleHashMap<CPT( RenderAttrib ), CPT( RenderAttrib ), pointer_hash> applied;
+};
+
+static NodeInputDefaults &get_node_input_defaults()
+{
+        static NodeInputDefaults defaults;
+        return defaults;
+}
+
+/**
+ * Applies the lighting inputs of the node the state belongs to onto the shader
+ * attrib. The node's input arrays are updated in place by the AmbientProbeManager,
+ * so once they are bound to an attrib the result is kept on the node and reused
+ * until the node's shader changes.
+ *
+ * Must be called with the synthesize_mutex held.
+ */
 CPT( RenderAttrib ) apply_node_inputs( const RenderState *rs, CPT( RenderAttrib ) shattr )
 {
-        bool inputs_supplied = false;
+        NodeInputDefaults &defaults = get_node_input_defaults();
 
         const AuxDataAttrib *ada;
         rs->get_attrib_def( ada );
-        if ( ada->has_data() )
+        if ( ada->has_data() &&
+             ada->get_data()->is_exact_type( CNodeShaderInput::get_class_type() ) )
         {
-                if ( ada->get_data()->is_exact_type( CNodeShaderInput::get_class_type() ) )
+                CNodeShaderInput *bsp_node_input = DCAST( CNodeShaderInput, ada->get_data() );
+
+                for ( int i = 0; i < NODE_INPUT_CACHE_SIZE; i++ )
                 {
-                        CNodeShaderInput *bsp_node_input = DCAST( CNodeShaderInput, ada->get_data() );
-                        shattr = DCAST( ShaderAttrib, shattr )->set_shader_inputs(
-                                {
-                                        ShaderInput( "lightCount", bsp_node_input->light_count ),
-                                        ShaderInput( "lightData", bsp_node_input->light_data ),
-                                        ShaderInput( "lightData2", bsp_node_input->light_data2 ),
-                                        ShaderInput( "lightTypes", bsp_node_input->light_type ),
-                                        ShaderInput( "ambientCube", bsp_node_input->ambient_cube ),
-                                        ShaderInput( "envmapSampler", bsp_node_input->cubemap_tex )
-                                } );
-                        inputs_supplied = true;
+                        if ( bsp_node_input->applied_from[i] == shattr )
+                        {
+                                return bsp_node_input->applied_to[i];
+                        }
                 }
+
+                CPT( RenderAttrib ) result = DCAST( ShaderAttrib, shattr )->set_shader_inputs(
+                        {
+                                ShaderInput( defaults.light_count_name, bsp_node_input->light_count ),
+                                ShaderInput( defaults.light_data_name, bsp_node_input->light_data ),
+                                ShaderInput( defaults.light_data2_name, bsp_node_input->light_data2 ),
+                                ShaderInput( defaults.light_types_name, bsp_node_input->light_type ),
+                                ShaderInput( defaults.ambient_cube_name, bsp_node_input->ambient_cube ),
+                                ShaderInput( defaults.envmap_sampler_name, bsp_node_input->cubemap_tex )
+                        } );
+
+                int slot = bsp_node_input->next_applied;
+                bsp_node_input->applied_from[slot] = shattr;
+                bsp_node_input->applied_to[slot] = result;
+                bsp_node_input->next_applied = ( slot + 1 ) % NODE_INPUT_CACHE_SIZE;
+
+                return result;
         }
-        if ( !inputs_supplied )
+
+        int itr = defaults.applied.find( shattr );
+        if ( itr != -1 )
         {
-                // Fill in default empty values so we don't crash.
-                pvector<ShaderInput> inputs = {
-                                ShaderInput( "lightCount", PTA_int::empty_array( 1 ) ),
-                                ShaderInput( "lightData", PTA_LMatrix4::empty_array( MAX_TOTAL_LIGHTS ) ),
-                                ShaderInput( "lightData2", PTA_LMatrix4::empty_array( MAX_TOTAL_LIGHTS ) ),
-                                ShaderInput( "lightTypes", PTA_int::empty_array( MAX_TOTAL_LIGHTS ) ),
-                                ShaderInput( "ambientCube", PTA_LVecBase3::empty_array( 6 ) )
-                };
-                // Do we have an envmap sampler already?
-                if ( DCAST( ShaderAttrib, shattr )->get_shader_input( "envmapSampler" ) == ShaderInput::get_blank() )
-                {
-                        // Nope, give it the default envmap
-                        inputs.push_back( ShaderInput( "envmapSampler", BSPShaderGenerator::get_identity_cubemap() ) );
-                }
+                return defaults.applied.get_data( itr );
+        }
+
+        // Fill in default empty values so we don't crash.
+        pvector<ShaderInput> inputs = {
+                        ShaderInput( defaults.light_count_name, defaults.light_count ),
+                        ShaderInput( defaults.light_data_name, defaults.light_data ),
+                        ShaderInput( defaults.light_data2_name, defaults.light_data2 ),
+                        ShaderInput( defaults.light_types_name, defaults.light_types ),
+                        ShaderInput( defaults.ambient_cube_name, defaults.ambient_cube )
+        };
+        // Do we have an envmap sampler already?
+        if ( DCAST( ShaderAttrib, shattr )->get_shader_input( defaults.envmap_sampler_name ) == ShaderInput::get_blank() )
+        {
+                // Nope, give it the default envmap
+                inputs.push_back( ShaderInput( defaults.envmap_sampler_name, BSPShaderGenerator::get_identity_cubemap() ) );
+        }
+
+        CPT( RenderAttrib ) result = DCAST( ShaderAttrib, shattr )->set_shader_inputs( inputs );
 
-                shattr = DCAST( ShaderAttrib, shattr )->set_shader_inputs( inputs );
+        // Only cached shader attribs are worth remembering, the others won't come back.
+        if ( cache_shaders )
+        {
+                defaults.applied[shattr] = result;
         }
 
-        return shattr;
+        return result;
 }
 
 CPT( ShaderAttrib ) BSPShaderGenerator::synthesize_shader( const RenderState *rs,
@@ -427,8 +503,12 @@ CPT( ShaderAttrib ) BSPShaderGenerator::synthesize_shader( const RenderState *rs
 
 void BSPShaderGenerator::set_identity_cubemap( Texture *tex )
 {
+	LightMutexHolder synth_holder( synthesize_mutex );
 	LightMutexHolder holder( cubemap_mutex );
 
+	// The default node inputs were applied with the old cubemap.
+	get_node_input_defaults().applied.clear();
+
         _identity_cubemap = tex;
 	enable_srgb_read( tex, true );
 }
@@ -30,9 +30,9 @@ void LMGConfig::parse_from_material_keyvalues( const BSPMaterial *mat )
         bumpmap.parse_from_material_keyvalues( mat, this );
         detail.parse_from_material_keyvalues( mat, this );
 
-	_uses_planar_reflection = mat->has_keyvalue( "$planarreflection" ) &&
-		mat->get_keyvalue_int( "$planarreflection" ) != 0 &&
-		!mat->has_keyvalue( "$envmap" );
+	const MaterialParams &params = mat->get_params();
+	_uses_planar_reflection = params.has( MF_planarreflection ) &&
+		!params.has( MF_envmap );
 }
 
 LightmappedGenericSpec::LightmappedGenericSpec() :
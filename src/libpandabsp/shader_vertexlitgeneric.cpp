@@ -222,5 +222,5 @@ void VertexLitGenericSpec::add_precache_combos( ShaderPrecacheCombos &combos )
 	combos.add_bool( "COLOR_VERTEX" );
 	combos.add_bool( "COLOR_FLAT" );
 
-	combos.add( "NUM_LIGHTS", 8, 8 );
+	combos.add( "NUM_LIGHTS", MAX_TOTAL_LIGHTS, MAX_TOTAL_LIGHTS );
 }
@@ -0,0 +1,513 @@
+// bc6h.cpp - CPU encoder and reference decoder for BC6H (unsigned half float) blocks.
+
+#include "bc6h.h"
+#include "log.h"
+
+#include <math.h>
+#include <string.h>
+
+#define BC6H_MODE_11            0x03                    // one region, 10 bit endpoints, no transform
+#define BC6H_ENDPOINT_BITS      10
+#define BC6H_NUM_INDICES        16
+
+static const int s_weights[BC6H_NUM_INDICES] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// =====================================================================================
+//  Half floats
+// =====================================================================================
+unsigned short FloatToHalfUF16( float value )
+{
+        // negative and NaN
+        if ( !( value > 0.0f ) )
+                return 0;
+        if ( value >= 65504.0f )
+                return 0x7BFF;
+
+        int exponent;
+        float mantissa = frexpf( value, &exponent );            // value = mantissa * 2^exponent, mantissa in [0.5, 1)
+
+        int hexponent = exponent + 14;
+        if ( hexponent <= 0 )
+        {
+                // denormal, rounding up to 1024 gives the smallest normal
+                return (unsigned short)( value * 16777216.0f + 0.5f );
+        }
+
+        int hmantissa = (int)( ( 2.0f * mantissa - 1.0f ) * 1024.0f + 0.5f );
+        if ( hmantissa == 1024 )
+        {
+                hmantissa = 0;
+                hexponent++;
+        }
+        if ( hexponent >= 31 )
+                return 0x7BFF;
+
+        return (unsigned short)( ( hexponent << 10 ) | hmantissa );
+}
+
+float HalfToFloat( unsigned short value )
+{
+        int exponent = ( value >> 10 ) & 31;
+        int mantissa = value & 1023;
+
+        float result;
+        if ( exponent == 0 )
+                result = ldexpf( (float)mantissa, -24 );
+        else if ( exponent == 31 )
+                result = 65504.0f;
+        else
+                result = ldexpf( (float)( 1024 + mantissa ), exponent - 25 );
+
+        return ( value & 0x8000 ) ? -result : result;
+}
+
+// =====================================================================================
+//  Endpoints
+//      Endpoints are quantized to 10 bits and expanded to 16 bits before they are
+//      interpolated. The interpolated value is scaled by 31/64 into half float bits.
+// =====================================================================================
+static int Unquantize( int comp )
+{
+        if ( comp == 0 )
+                return 0;
+        if ( comp == ( 1 << BC6H_ENDPOINT_BITS ) - 1 )
+                return 0xFFFF;
+        return ( ( comp << 16 ) + 0x8000 ) >> BC6H_ENDPOINT_BITS;
+}
+
+// Closest 10 bit endpoint for a value in the 16 bit interpolation range.
+static int Quantize( float value )
+{
+        int comp = (int)floorf( value / 64.0f );
+        if ( comp < 0 )
+                return 0;
+        if ( comp > ( 1 << BC6H_ENDPOINT_BITS ) - 1 )
+                return ( 1 << BC6H_ENDPOINT_BITS ) - 1;
+        return comp;
+}
+
+static int Interpolate( int a, int b, int index )
+{
+        return ( ( 64 - s_weights[index] ) * a + s_weights[index] * b + 32 ) >> 6;
+}
+
+static int FinishUnquantize( int comp )
+{
+        return ( comp * 31 ) >> 6;
+}
+
+// =====================================================================================
+//  SelectIndices
+//      Picks the closest palette entry for every texel. Returns the squared error in
+//      half float bits of the texels in mask, which is close to a relative error.
+// =====================================================================================
+static double SelectIndices( const int halfs[BC6H_BLOCK_TEXELS][3], const bool *mask,
+                             const int endpoints[2][3], int *indices )
+{
+        int palette[BC6H_NUM_INDICES][3];
+        for ( int c = 0; c < 3; c++ )
+        {
+                int a = Unquantize( endpoints[0][c] );
+                int b = Unquantize( endpoints[1][c] );
+                for ( int k = 0; k < BC6H_NUM_INDICES; k++ )
+                {
+                        palette[k][c] = FinishUnquantize( Interpolate( a, b, k ) );
+                }
+        }
+
+        double total = 0.0;
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                double best = -1.0;
+                for ( int k = 0; k < BC6H_NUM_INDICES; k++ )
+                {
+                        double error = 0.0;
+                        for ( int c = 0; c < 3; c++ )
+                        {
+                                double d = palette[k][c] - halfs[i][c];
+                                error += d * d;
+                        }
+                        if ( best < 0.0 || error < best )
+                        {
+                                best = error;
+                                indices[i] = k;
+                        }
+                }
+                if ( mask[i] )
+                        total += best;
+        }
+
+        return total;
+}
+
+// =====================================================================================
+//  FitEndpoints
+//      Spans the endpoints along the principal axis of the texels in mask.
+// =====================================================================================
+static void FitEndpoints( const float target[BC6H_BLOCK_TEXELS][3], const bool *mask, int endpoints[2][3] )
+{
+        int count = 0;
+        float mean[3] = { 0, 0, 0 };
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                if ( !mask[i] )
+                        continue;
+                for ( int c = 0; c < 3; c++ )
+                {
+                        mean[c] += target[i][c];
+                }
+                count++;
+        }
+        for ( int c = 0; c < 3; c++ )
+        {
+                mean[c] /= count;
+        }
+
+        float cov[3][3];
+        memset( cov, 0, sizeof( cov ) );
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                if ( !mask[i] )
+                        continue;
+                float d[3] = { target[i][0] - mean[0], target[i][1] - mean[1], target[i][2] - mean[2] };
+                for ( int r = 0; r < 3; r++ )
+                {
+                        for ( int c = 0; c < 3; c++ )
+                        {
+                                cov[r][c] += d[r] * d[c];
+                        }
+                }
+        }
+
+        // power iteration
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for ( int iter = 0; iter < 8; iter++ )
+        {
+                float next[3];
+                for ( int r = 0; r < 3; r++ )
+                {
+                        next[r] = cov[r][0] * axis[0] + cov[r][1] * axis[1] + cov[r][2] * axis[2];
+                }
+                float length = sqrtf( next[0] * next[0] + next[1] * next[1] + next[2] * next[2] );
+                if ( length < 1e-6f )
+                        break;
+                for ( int r = 0; r < 3; r++ )
+                {
+                        axis[r] = next[r] / length;
+                }
+        }
+
+        float minp = 0.0f;
+        float maxp = 0.0f;
+        bool first = true;
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                if ( !mask[i] )
+                        continue;
+                float p = ( target[i][0] - mean[0] ) * axis[0] + ( target[i][1] - mean[1] ) * axis[1] +
+                        ( target[i][2] - mean[2] ) * axis[2];
+                if ( first || p < minp )
+                        minp = p;
+                if ( first || p > maxp )
+                        maxp = p;
+                first = false;
+        }
+
+        for ( int c = 0; c < 3; c++ )
+        {
+                endpoints[0][c] = Quantize( mean[c] + axis[c] * minp );
+                endpoints[1][c] = Quantize( mean[c] + axis[c] * maxp );
+        }
+}
+
+// =====================================================================================
+//  RefineEndpoints
+//      Least squares fit of the endpoints to the texels in mask for the chosen indices.
+// =====================================================================================
+static bool RefineEndpoints( const float target[BC6H_BLOCK_TEXELS][3], const bool *mask,
+                             const int *indices, int endpoints[2][3] )
+{
+        double s00 = 0.0, s01 = 0.0, s11 = 0.0;
+        double r0[3] = { 0, 0, 0 };
+        double r1[3] = { 0, 0, 0 };
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                if ( !mask[i] )
+                        continue;
+                double b = s_weights[indices[i]] / 64.0;
+                double a = 1.0 - b;
+                s00 += a * a;
+                s01 += a * b;
+                s11 += b * b;
+                for ( int c = 0; c < 3; c++ )
+                {
+                        r0[c] += a * target[i][c];
+                        r1[c] += b * target[i][c];
+                }
+        }
+
+        double det = s00 * s11 - s01 * s01;
+        if ( fabs( det ) < 1e-9 )
+                return false;
+
+        for ( int c = 0; c < 3; c++ )
+        {
+                endpoints[0][c] = Quantize( (float)( ( r0[c] * s11 - r1[c] * s01 ) / det ) );
+                endpoints[1][c] = Quantize( (float)( ( r1[c] * s00 - r0[c] * s01 ) / det ) );
+        }
+
+        return true;
+}
+
+// =====================================================================================
+//  Bits
+// =====================================================================================
+static void WriteBits( unsigned char *block, int &pos, int value, int count )
+{
+        for ( int b = 0; b < count; b++, pos++ )
+        {
+                if ( ( value >> b ) & 1 )
+                        block[pos >> 3] |= (unsigned char)( 1 << ( pos & 7 ) );
+        }
+}
+
+// Reads up to 16 bits at once, block must have two bytes of padding past the end.
+static int ReadBits( const unsigned char *block, int &pos, int count )
+{
+        const unsigned char *bytes = block + ( pos >> 3 );
+        unsigned int word = bytes[0] | ( bytes[1] << 8 ) | ( bytes[2] << 16 );
+        int value = ( word >> ( pos & 7 ) ) & ( ( 1 << count ) - 1 );
+        pos += count;
+        return value;
+}
+
+// =====================================================================================
+//  BC6HEncodeBlock
+// =====================================================================================
+void BC6HEncodeBlock( const float *texels, unsigned char *block, const bool *mask )
+{
+        bool all[BC6H_BLOCK_TEXELS];
+        if ( !mask )
+        {
+                for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+                        all[i] = true;
+                mask = all;
+        }
+
+        memset( block, 0, BC6H_BLOCK_SIZE );
+        int pos = 0;
+        WriteBits( block, pos, BC6H_MODE_11, 5 );
+
+        bool any = false;
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+                any |= mask[i];
+        if ( !any )
+        {
+                // black, with zero endpoints and indices
+                return;
+        }
+
+        int halfs[BC6H_BLOCK_TEXELS][3];
+        float target[BC6H_BLOCK_TEXELS][3];
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                for ( int c = 0; c < 3; c++ )
+                {
+                        halfs[i][c] = FloatToHalfUF16( texels[i * 3 + c] );
+                        target[i][c] = halfs[i][c] * ( 64.0f / 31.0f );
+                }
+        }
+
+        int endpoints[2][3];
+        int indices[BC6H_BLOCK_TEXELS];
+        FitEndpoints( target, mask, endpoints );
+        double error = SelectIndices( halfs, mask, endpoints, indices );
+
+        for ( int iter = 0; iter < 2 && error > 0.0; iter++ )
+        {
+                int refined[2][3];
+                int refined_indices[BC6H_BLOCK_TEXELS];
+                if ( !RefineEndpoints( target, mask, indices, refined ) )
+                        break;
+
+                double refined_error = SelectIndices( halfs, mask, refined, refined_indices );
+                if ( refined_error >= error )
+                        break;
+
+                error = refined_error;
+                memcpy( endpoints, refined, sizeof( endpoints ) );
+                memcpy( indices, refined_indices, sizeof( indices ) );
+        }
+
+        // the high bit of the first index is implied to be zero
+        if ( indices[0] & 8 )
+        {
+                for ( int c = 0; c < 3; c++ )
+                {
+                        int temp = endpoints[0][c];
+                        endpoints[0][c] = endpoints[1][c];
+                        endpoints[1][c] = temp;
+                }
+                for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+                {
+                        indices[i] = BC6H_NUM_INDICES - 1 - indices[i];
+                }
+        }
+
+        for ( int e = 0; e < 2; e++ )
+        {
+                for ( int c = 0; c < 3; c++ )
+                {
+                        WriteBits( block, pos, endpoints[e][c], BC6H_ENDPOINT_BITS );
+                }
+        }
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                WriteBits( block, pos, indices[i], i == 0 ? 3 : 4 );
+        }
+}
+
+// =====================================================================================
+//  BC6HDecodeBlock
+// =====================================================================================
+bool BC6HDecodeBlock( const unsigned char *data, unsigned short *texels )
+{
+        unsigned char block[BC6H_BLOCK_SIZE + 2];
+        memcpy( block, data, BC6H_BLOCK_SIZE );
+        block[BC6H_BLOCK_SIZE] = 0;
+        block[BC6H_BLOCK_SIZE + 1] = 0;
+
+        int pos = 0;
+        int mode = ReadBits( block, pos, 2 );
+        if ( mode >= 2 )
+        {
+                mode |= ReadBits( block, pos, 3 ) << 2;
+        }
+
+        if ( mode != BC6H_MODE_11 )
+        {
+                memset( texels, 0, BC6H_BLOCK_TEXELS * 3 * sizeof( unsigned short ) );
+                return false;
+        }
+
+        int endpoints[2][3];
+        for ( int e = 0; e < 2; e++ )
+        {
+                for ( int c = 0; c < 3; c++ )
+                {
+                        endpoints[e][c] = Unquantize( ReadBits( block, pos, BC6H_ENDPOINT_BITS ) );
+                }
+        }
+
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                int index = ReadBits( block, pos, i == 0 ? 3 : 4 );
+                for ( int c = 0; c < 3; c++ )
+                {
+                        texels[i * 3 + c] = (unsigned short)FinishUnquantize( Interpolate( endpoints[0][c], endpoints[1][c], index ) );
+                }
+        }
+
+        return true;
+}
+
+// =====================================================================================
+//  BC6H_test
+//      Encodes and decodes a set of known blocks and checks the PSNR of each against
+//      a floor, relative to the brightest texel of the block. The blocks are the kind
+//      a lightmap palette holds: flat, smooth ramps in one and in all channels, a
+//      bright HDR ramp, and a lightmap edge next to black padding that is masked out.
+// =====================================================================================
+#define BC6H_TEST_CASES         5
+
+static void BC6HTestTexels( int testcase, float *texels, bool *mask )
+{
+        for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+        {
+                float x = ( i & 3 ) / 3.0f;
+                float y = ( i >> 2 ) / 3.0f;
+                float *texel = &texels[i * 3];
+                mask[i] = true;
+
+                switch ( testcase )
+                {
+                case 0:         // flat
+                        texel[0] = 0.5f;
+                        texel[1] = 0.25f;
+                        texel[2] = 0.125f;
+                        break;
+                case 1:         // ramp in one channel
+                        texel[0] = 0.2f + 0.6f * x;
+                        texel[1] = 0.2f;
+                        texel[2] = 0.2f;
+                        break;
+                case 2:         // diagonal ramp in all channels
+                        texel[0] = 0.1f + 0.4f * ( x + y );
+                        texel[1] = 0.05f + 0.3f * ( x + y );
+                        texel[2] = 0.02f + 0.2f * ( x + y );
+                        break;
+                case 3:         // HDR ramp
+                        texel[0] = 1.0f + 15.0f * x * y;
+                        texel[1] = 0.8f + 12.0f * x * y;
+                        texel[2] = 0.5f + 8.0f * x * y;
+                        break;
+                default:        // edge of a lightmap, the right half is padding
+                        mask[i] = ( i & 3 ) < 2;
+                        texel[0] = mask[i] ? 0.6f + 0.2f * y : 0.0f;
+                        texel[1] = mask[i] ? 0.5f + 0.2f * y : 0.0f;
+                        texel[2] = mask[i] ? 0.4f + 0.2f * y : 0.0f;
+                        break;
+                }
+        }
+}
+
+bool BC6H_test()
+{
+        // a little below what the encoder reaches, the ramps over several octaves
+        // suffer from the interpolation in half float space
+        static const double floor_db[BC6H_TEST_CASES] = { 58.0, 43.0, 30.0, 35.0, 38.0 };
+        bool ok = true;
+
+        for ( int testcase = 0; testcase < BC6H_TEST_CASES; testcase++ )
+        {
+                float texels[BC6H_BLOCK_TEXELS * 3];
+                bool mask[BC6H_BLOCK_TEXELS];
+                BC6HTestTexels( testcase, texels, mask );
+
+                unsigned char block[BC6H_BLOCK_SIZE];
+                unsigned short halfs[BC6H_BLOCK_TEXELS * 3];
+                BC6HEncodeBlock( texels, block, mask );
+                if ( !BC6HDecodeBlock( block, halfs ) )
+                {
+                        Warning( "internal error: BC6H_test case %d decoded as the wrong mode.", testcase );
+                        ok = false;
+                        continue;
+                }
+
+                double peak = 0.0;
+                double error = 0.0;
+                int count = 0;
+                for ( int i = 0; i < BC6H_BLOCK_TEXELS * 3; i++ )
+                {
+                        if ( !mask[i / 3] )
+                                continue;
+                        double d = HalfToFloat( halfs[i] ) - texels[i];
+                        error += d * d;
+                        peak = texels[i] > peak ? texels[i] : peak;
+                        count++;
+                }
+
+                if ( error <= 0.0 )
+                        continue;
+
+                double psnr = 10.0 * log10( peak * peak * count / error );
+                if ( psnr < floor_db[testcase] )
+                {
+                        Warning( "internal error: BC6H_test case %d has a PSNR of %.2f db, below %.2f db.",
+                                 testcase, psnr, floor_db[testcase] );
+                        ok = false;
+                }
+        }
+
+        return ok;
+}
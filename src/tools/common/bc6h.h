@@ -0,0 +1,34 @@
+// bc6h.h - CPU encoder and reference decoder for BC6H (unsigned half float) blocks.
+//
+// A block holds 4x4 RGB texels in 16 bytes. The encoder only emits mode 11 blocks:
+// one region with two 10 bit endpoints and a 4 bit index per texel, which is the
+// mode that suits smooth lightmaps best. The decoder understands the same mode and
+// is what the compile tools use to measure the quality of what they wrote.
+//
+// Texels are linear, non-negative floats. Values are stored as half floats, so
+// anything above 65504 saturates.
+
+#ifndef BC6H_H
+#define BC6H_H
+
+#include "common_config.h"
+
+#define BC6H_BLOCK_SIZE         16
+#define BC6H_BLOCK_TEXELS       16
+
+// texels are in row order, three floats each. If mask is given, only the texels it
+// marks are fit and the others come out as whatever is closest; a block with none of
+// them marked is black.
+extern _BSPEXPORT void  BC6HEncodeBlock( const float *texels, unsigned char *block, const bool *mask = nullptr );
+
+// Writes out 16 texels of three half floats. Returns false and writes out black
+// if the block uses a mode other than the one BC6HEncodeBlock emits.
+extern _BSPEXPORT bool  BC6HDecodeBlock( const unsigned char *block, unsigned short *texels );
+
+extern _BSPEXPORT unsigned short FloatToHalfUF16( float value );
+extern _BSPEXPORT float HalfToFloat( unsigned short value );
+
+// Round trips a set of known blocks, false if any of them loses too much.
+extern _BSPEXPORT bool  BC6H_test();
+
+#endif // BC6H_H
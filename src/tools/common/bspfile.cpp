@@ -37,6 +37,31 @@ int FastChecksum( const void* const buffer, int bytes )
         return checksum;
 }
 
+/*
+* ===============
+* CollisionChecksum
+* ===============
+*/
+
+// Checksum of the lumps that collision meshes are built from, used as the key
+// of the cooked mesh cache of a level. The brush lumps don't get a checksum
+// when the file is loaded.
+unsigned int CollisionChecksum( const bspdata_t *data )
+{
+        int lumps[] = { data->dmodels_checksum, data->dvertexes_checksum, data->dplanes_checksum,
+                        data->dfaces_checksum, data->dedges_checksum, data->dsurfedges_checksum,
+                        data->texinfo_checksum,
+                        FastChecksum( data->dbrushes.data(), (int)( data->dbrushes.size() * sizeof( dbrush_t ) ) ),
+                        FastChecksum( data->dbrushsides.data(), (int)( data->dbrushsides.size() * sizeof( dbrushside_t ) ) ) };
+
+        unsigned int checksum = 0;
+        for ( size_t i = 0; i < sizeof( lumps ) / sizeof( lumps[0] ); i++ )
+        {
+                checksum = ( checksum * 31 ) ^ (unsigned int)lumps[i];
+        }
+        return checksum;
+}
+
 /*
 * ===============
 * CompressVis
@@ -390,22 +415,28 @@ bspdata_t            *LoadBSPImage( dheader_t* const header )
 {
         unsigned int     i;
 
-        // swap the header
-        for ( i = 0; i < sizeof( dheader_t ) / 4; i++ )
-        {
-                ( (int*)header )[i] = LittleLong( ( (int*)header )[i] );
-        }
+        header->ident = LittleLong( header->ident );
+        header->version = LittleLong( header->version );
 
         if ( header->ident != PBSP_MAGIC )
         {
                 Error( "Not a valid PBSP file. Ident of file is %i, not %i", header->ident, PBSP_MAGIC );
         }
 
-        if ( header->version != BSPVERSION )
+        if ( header->version != BSPVERSION && header->version != BSPVERSION_NOPALETTE )
         {
                 Error( "BSP is version %i, not %i", header->version, BSPVERSION );
         }
 
+        // swap the lumps, an older header is shorter and the lumps it doesn't have
+        // overlap the data of the first lump
+        int numlumps = BSP_HEADER_LUMPS( header->version );
+        for ( i = 0; i < (unsigned int)numlumps; i++ )
+        {
+                header->lumps[i].fileofs = LittleLong( header->lumps[i].fileofs );
+                header->lumps[i].filelen = LittleLong( header->lumps[i].filelen );
+        }
+
         bspdata_t *data = new bspdata_t;
 
         data->nummodels = CopyLump( LUMP_MODELS, data->dmodels, sizeof( dmodel_t ), header );
@@ -439,6 +470,14 @@ bspdata_t            *LoadBSPImage( dheader_t* const header )
         CopyLump( LUMP_VERTNORMALINDICES, data->vertnormalindices, header );
         CopyLump( LUMP_CUBEMAPDATA, data->cubemapdata, header );
         CopyLump( LUMP_CUBEMAPS, data->cubemaps, header );
+        if ( numlumps > LUMP_LIGHTMAPPALETTE )
+        {
+                CopyLump( LUMP_LIGHTMAPPALETTE, data->lightmappalette, header );
+        }
+        else
+        {
+                data->lightmappalette.clear();
+        }
 
         Free( header );                                          // everything has been copied out
 
@@ -503,11 +542,15 @@ void            WriteBSPFile( bspdata_t *data, const char* const filename )
 
         SwapBSPFile( data, true );
 
+        // files without a compressed lightmap palette stay readable by older tools
+        int version = data->lightmappalette.empty() ? BSPVERSION_NOPALETTE : BSPVERSION;
+        int headersize = (int)BSP_HEADER_SIZE( version );
+
         header->ident = LittleLong( PBSP_MAGIC );
-        header->version = LittleLong( BSPVERSION );
+        header->version = LittleLong( version );
 
         bspfile = SafeOpenWrite( filename );
-        SafeWrite( bspfile, header, sizeof( dheader_t ) );         // overwritten later
+        SafeWrite( bspfile, header, headersize );                  // overwritten later
 
                                                                    //      LUMP TYPE       DATA            LENGTH                              HEADER  BSPFILE   
         AddLump( LUMP_PLANES, data->dplanes, data->numplanes * sizeof( dplane_t ), header, bspfile );
@@ -542,9 +585,13 @@ void            WriteBSPFile( bspdata_t *data, const char* const filename )
         AddLump( LUMP_VERTNORMALINDICES, data->vertnormalindices, header, bspfile );
         AddLump( LUMP_CUBEMAPDATA, data->cubemapdata, header, bspfile );
         AddLump( LUMP_CUBEMAPS, data->cubemaps, header, bspfile );
+        if ( version != BSPVERSION_NOPALETTE )
+        {
+                AddLump( LUMP_LIGHTMAPPALETTE, data->lightmappalette, header, bspfile );
+        }
 
         fseek( bspfile, 0, SEEK_SET );
-        SafeWrite( bspfile, header, sizeof( dheader_t ) );
+        SafeWrite( bspfile, header, headersize );
 
         fclose( bspfile );
 }
@@ -1692,6 +1739,35 @@ colorrgbexp32_t *SampleBouncedLightmap( bspdata_t *data, const dface_t *face, in
 	return &data->bouncedlightdata[face->bouncedlightofs + luxel];
 }
 
+const dlightmappalette_t *GetLightmapPalette( const bspdata_t *data )
+{
+        size_t size = data->lightmappalette.size();
+        if ( size < sizeof( dlightmappalette_t ) )
+                return nullptr;
+
+        const dlightmappalette_t *palette = (const dlightmappalette_t *)data->lightmappalette.data();
+        if ( palette->format != LMPALETTE_FORMAT_BC6H || palette->width <= 0 || palette->height <= 0 ||
+             ( palette->width & 3 ) || ( palette->height & 3 ) || palette->numpages <= 0 || palette->numfaces < 0 )
+                return nullptr;
+
+        size_t blocks = (size_t)( palette->width / 4 ) * ( palette->height / 4 ) * palette->numpages;
+        if ( size != sizeof( dlightmappalette_t ) + palette->numfaces * sizeof( dlightmappaletteface_t ) + blocks * 16 )
+                return nullptr;
+
+        return palette;
+}
+
+const dlightmappaletteface_t *GetLightmapPaletteFaces( const dlightmappalette_t *palette )
+{
+        return (const dlightmappaletteface_t *)( palette + 1 );
+}
+
+const byte *GetLightmapPaletteBlocks( const dlightmappalette_t *palette, int page )
+{
+        size_t page_size = (size_t)( palette->width / 4 ) * ( palette->height / 4 ) * 16;
+        return (const byte *)( GetLightmapPaletteFaces( palette ) + palette->numfaces ) + page * page_size;
+}
+
 int GetNumWorldLeafs( bspdata_t *bspdata )
 {
         return bspdata->dmodels[0].visleafs;
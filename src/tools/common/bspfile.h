@@ -101,7 +101,8 @@
 #define MAX_LIGHTSTYLES 64
 //=============================================================================
 
-#define BSPVERSION  33
+#define BSPVERSION  34
+#define BSPVERSION_NOPALETTE 33 // before LUMP_LIGHTMAPPALETTE, still read, and written when that lump is empty
 #define TOOLVERSION 4
 
 // One hammer unit is 1/16th of a foot.
@@ -150,6 +151,7 @@ enum
         LUMP_VERTNORMALINDICES,
         LUMP_CUBEMAPDATA,
         LUMP_CUBEMAPS,
+        LUMP_LIGHTMAPPALETTE,
 
 	HEADER_LUMPS,
 };
@@ -170,6 +172,10 @@ typedef struct
         lump_t          lumps[HEADER_LUMPS];
 } dheader_t;
 
+// Number of lumps in the header of a file of the given version.
+#define BSP_HEADER_LUMPS( version )     ( ( version ) == BSPVERSION_NOPALETTE ? LUMP_LIGHTMAPPALETTE : HEADER_LUMPS )
+#define BSP_HEADER_SIZE( version )      ( sizeof( dheader_t ) - ( HEADER_LUMPS - BSP_HEADER_LUMPS( version ) ) * sizeof( lump_t ) )
+
 typedef struct texref_s
 {
         char            name[MAX_TEXTURE_NAME];
@@ -409,6 +415,33 @@ struct dcubemap_t
         float pos[3];
 };
 
+//
+// LUMP_LIGHTMAPPALETTE
+//
+// The style 0 lightmaps of every face packed into one block compressed palette by
+// p3rad (-compresslightmaps). The lump starts with a dlightmappalette_t, followed by
+// numfaces dlightmappaletteface_t's and the blocks of every page. Page 0 holds the
+// bounced light, pages 1-4 the flat and bumped direct light.
+//
+
+#define LMPALETTE_FORMAT_BC6H   1
+#define LMPALETTE_PAGES         ( 1 + NUM_BUMP_VECTS + 1 )
+
+struct dlightmappalette_t
+{
+        int format;
+        int width, height; // multiples of 4
+        int numpages;
+        int numfaces;
+};
+
+struct dlightmappaletteface_t
+{
+        int facenum;
+        unsigned short xshift, yshift;
+        int flipped; // rotated 90 degrees, lightmap rows are palette columns
+};
+
 typedef struct epair_s
 {
         struct epair_s* next;
@@ -511,6 +544,8 @@ struct bspdata_t
 	pvector<colorrgbexp32_t> lightdata;
 	int      dlightdata_checksum;
 
+        pvector<byte> lightmappalette;
+
         int      numentities;
         entity_t entities[MAX_MAP_ENTITIES];
 };
@@ -557,6 +592,7 @@ extern _BSPEXPORT epair_t* ParseEpair();
 extern _BSPEXPORT entity_t* EntityForModel( bspdata_t *data, int modnum );
 
 extern _BSPEXPORT int FastChecksum( const void* const buffer, int bytes );
+extern _BSPEXPORT unsigned int CollisionChecksum( const bspdata_t *data );
 
 //
 // Texture Related Stuff
@@ -580,4 +616,9 @@ extern _BSPEXPORT colorrgbexp32_t *SampleLightmap( bspdata_t *data, const dface_
 _BSPEXPORT colorrgbexp32_t *SampleSunLightmap( bspdata_t *data, const dface_t *face, int luxel, int style, int bump = 0 );
 _BSPEXPORT colorrgbexp32_t *SampleBouncedLightmap( bspdata_t *data, const dface_t *face, int luxel );
 
+// Returns nullptr if the BSP has no lightmap palette or the lump is malformed.
+extern _BSPEXPORT const dlightmappalette_t *GetLightmapPalette( const bspdata_t *data );
+extern _BSPEXPORT const dlightmappaletteface_t *GetLightmapPaletteFaces( const dlightmappalette_t *palette );
+extern _BSPEXPORT const byte *GetLightmapPaletteBlocks( const dlightmappalette_t *palette, int page );
+
 #endif //BSPFILE_H__
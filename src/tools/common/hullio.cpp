@@ -0,0 +1,229 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "hullio.h"
+#include "filelib.h"
+#include "messages.h"
+#include "log.h"
+
+// =====================================================================================
+//  HullFileOpenWrite
+//      Opens a hull file for writing and stamps the header.
+// =====================================================================================
+FILE*           HullFileOpenWrite( const char* const filename )
+{
+        FILE*           f;
+        hullfileheader_t header;
+
+        f = SafeOpenWrite( filename );
+
+        header.ident = HULLFILE_IDENT;
+        header.version = HULLFILE_VERSION;
+        SafeWrite( f, &header, sizeof( header ) );
+
+        return f;
+}
+
+// =====================================================================================
+//  HullFileWriteFace
+// =====================================================================================
+void            HullFileWriteFace( FILE* f, const hullface_t* face, const vec3_t* points )
+{
+        SafeWrite( f, face, sizeof( hullface_t ) );
+        SafeWrite( f, points, face->numpoints * sizeof( vec3_t ) );
+}
+
+// =====================================================================================
+//  HullFileWriteEndModel
+// =====================================================================================
+void            HullFileWriteEndModel( FILE* f )
+{
+        hullface_t      face;
+
+        memset( &face, -1, sizeof( face ) );
+        SafeWrite( f, &face, sizeof( face ) );
+}
+
+// =====================================================================================
+//  HullFileWriteBrushBegin
+// =====================================================================================
+void            HullFileWriteBrushBegin( FILE* f )
+{
+        int             brushinfo = 0;
+        SafeWrite( f, &brushinfo, sizeof( int ) );
+}
+
+// =====================================================================================
+//  HullFileWriteBrushSide
+// =====================================================================================
+void            HullFileWriteBrushSide( FILE* f, int planenum, int numpoints, const vec3_t* points )
+{
+        hullbrushside_t side;
+
+        side.planenum = planenum;
+        side.numpoints = numpoints;
+        SafeWrite( f, &side, sizeof( side ) );
+        SafeWrite( f, points, numpoints * sizeof( vec3_t ) );
+}
+
+// =====================================================================================
+//  HullFileWriteBrushEnd
+// =====================================================================================
+void            HullFileWriteBrushEnd( FILE* f )
+{
+        hullbrushside_t side;
+
+        side.planenum = -1;
+        side.numpoints = -1;
+        SafeWrite( f, &side, sizeof( side ) );
+}
+
+// =====================================================================================
+//  HullFileWriteBrushEndModel
+// =====================================================================================
+void            HullFileWriteBrushEndModel( FILE* f )
+{
+        int             brushinfo = -1;
+        SafeWrite( f, &brushinfo, sizeof( int ) );
+}
+
+// =====================================================================================
+//  HullFileOpenRead
+//      Maps a hull file into memory and validates the header.
+// =====================================================================================
+bool            HullFileOpenRead( const char* const filename, hullfile_t* hf )
+{
+        size_t          size;
+
+        memset( hf, 0, sizeof( hullfile_t ) );
+        safe_strncpy( hf->filename, filename, _MAX_PATH );
+
+#ifdef _WIN32
+        HANDLE          file;
+        HANDLE          mapping;
+        LARGE_INTEGER   filesize;
+
+        file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+        if ( file == INVALID_HANDLE_VALUE )
+        {
+                return false;
+        }
+        if ( !GetFileSizeEx( file, &filesize ) || filesize.QuadPart < (LONGLONG)sizeof( hullfileheader_t ) )
+        {
+                CloseHandle( file );
+                Error( "%s: not a valid hull file", filename );
+        }
+        size = (size_t)filesize.QuadPart;
+
+        mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if ( !mapping )
+        {
+                CloseHandle( file );
+                Error( "%s: CreateFileMapping failed", filename );
+        }
+        hf->base = (const byte*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+        if ( !hf->base )
+        {
+                CloseHandle( mapping );
+                CloseHandle( file );
+                Error( "%s: MapViewOfFile failed", filename );
+        }
+        hf->filehandle = file;
+        hf->maphandle = mapping;
+#else
+        struct stat     filestat;
+        void*           base;
+
+        hf->fd = open( filename, O_RDONLY );
+        if ( hf->fd == -1 )
+        {
+                return false;
+        }
+        if ( fstat( hf->fd, &filestat ) != 0 || filestat.st_size < (off_t)sizeof( hullfileheader_t ) )
+        {
+                close( hf->fd );
+                Error( "%s: not a valid hull file", filename );
+        }
+        size = (size_t)filestat.st_size;
+
+        base = mmap( NULL, size, PROT_READ, MAP_PRIVATE, hf->fd, 0 );
+        if ( base == MAP_FAILED )
+        {
+                close( hf->fd );
+                Error( "%s: mmap failed: %s", filename, strerror( errno ) );
+        }
+        madvise( base, size, MADV_SEQUENTIAL );
+        hf->base = (const byte*)base;
+        hf->size = size;
+#endif
+
+        hf->cursor = hf->base;
+        hf->end = hf->base + size;
+
+        const hullfileheader_t* header = (const hullfileheader_t*)HullFileRead( hf, sizeof( hullfileheader_t ) );
+        if ( header->ident != HULLFILE_IDENT )
+        {
+                Error( "%s: not a hull file. Rerun p3csg with this version of the tools.", filename );
+        }
+        if ( header->version != HULLFILE_VERSION )
+        {
+                Error( "%s: hull file version %i, expected %i. Rerun p3csg with this version of the tools.",
+                       filename, header->version, HULLFILE_VERSION );
+        }
+
+        return true;
+}
+
+// =====================================================================================
+//  HullFileClose
+// =====================================================================================
+void            HullFileClose( hullfile_t* hf )
+{
+        if ( !hf->base )
+        {
+                return;
+        }
+
+#ifdef _WIN32
+        UnmapViewOfFile( hf->base );
+        CloseHandle( (HANDLE)hf->maphandle );
+        CloseHandle( (HANDLE)hf->filehandle );
+#else
+        munmap( (void*)hf->base, hf->size );
+        close( hf->fd );
+#endif
+
+        hf->base = hf->cursor = hf->end = NULL;
+}
+
+// =====================================================================================
+//  HullFileAtEnd
+// =====================================================================================
+bool            HullFileAtEnd( const hullfile_t* hf )
+{
+        return hf->cursor >= hf->end;
+}
+
+// =====================================================================================
+//  HullFileRead
+// =====================================================================================
+const void*     HullFileRead( hullfile_t* hf, size_t size )
+{
+        const byte*     data = hf->cursor;
+
+        if ( (size_t)( hf->end - hf->cursor ) < size )
+        {
+                Error( "%s: unexpected end of file at offset %li", hf->filename, (long)( hf->cursor - hf->base ) );
+        }
+        hf->cursor += size;
+
+        return data;
+}
@@ -0,0 +1,106 @@
+#ifndef HULLIO_H__
+#define HULLIO_H__
+#include "cmdlib.h"
+
+#if _MSC_VER >= 1000
+#pragma once
+#endif
+
+#include "mathtypes.h"
+
+//
+// Binary intermediate files passed from p3csg to p3bsp.
+//
+// mapname.p0-p3 (faces), mapname.b0-b3 (detail brushes) and mapname.hsz (hull sizes)
+// used to be written with fprintf and read back with fscanf. They are now written as
+// packed native-endian records with full vec_t precision, and p3bsp maps them into memory.
+//
+// .p file:  hullfileheader_t, then per model a run of hullface_t records, each followed
+//           by numpoints vec3_t's. A record with planenum == -1 ends the model.
+// .b file:  hullfileheader_t, then per model a run of brushes. Each brush starts with
+//           an int 0, followed by hullbrushside_t records (each followed by numpoints
+//           vec3_t's) and is closed by a side with planenum == -1. An int -1 ends the model.
+// .hsz file: hullfileheader_t, then NUM_HULLS * 2 vec3_t's (mins, maxs).
+//
+
+#define HULLFILE_IDENT          (('L'<<24)+('U'<<16)+('H'<<8)+'P')     // "PHUL"
+#define HULLFILE_VERSION        1
+
+typedef struct
+{
+        int             ident;
+        int             version;
+} hullfileheader_t;
+
+typedef struct
+{
+        int             detaillevel;
+        int             planenum;
+        int             texinfo;
+        int             contents;
+        int             brushnum;
+        int             brushside;
+        int             numpoints;
+} hullface_t;
+
+typedef struct
+{
+        int             planenum;
+        int             numpoints;
+} hullbrushside_t;
+
+//
+// Writing
+//
+
+extern _BSPEXPORT FILE*    HullFileOpenWrite( const char* const filename );
+extern _BSPEXPORT void     HullFileWriteFace( FILE* f, const hullface_t* face, const vec3_t* points );
+extern _BSPEXPORT void     HullFileWriteEndModel( FILE* f );
+extern _BSPEXPORT void     HullFileWriteBrushBegin( FILE* f );
+extern _BSPEXPORT void     HullFileWriteBrushSide( FILE* f, int planenum, int numpoints, const vec3_t* points );
+extern _BSPEXPORT void     HullFileWriteBrushEnd( FILE* f );
+extern _BSPEXPORT void     HullFileWriteBrushEndModel( FILE* f );
+
+//
+// Reading
+//
+
+// A read-only view of a hull file, mapped into memory.
+typedef struct
+{
+        const byte*     base;
+        const byte*     cursor;
+        const byte*     end;
+        char            filename[_MAX_PATH];
+#ifdef _WIN32
+        void*           filehandle;
+        void*           maphandle;
+#else
+        int             fd;
+        size_t          size;
+#endif
+} hullfile_t;
+
+extern _BSPEXPORT bool     HullFileOpenRead( const char* const filename, hullfile_t* hf );
+extern _BSPEXPORT void     HullFileClose( hullfile_t* hf );
+
+// Returns true once every byte of the mapped file has been consumed.
+extern _BSPEXPORT bool     HullFileAtEnd( const hullfile_t* hf );
+
+// Returns a pointer into the mapped file and advances the cursor by size bytes.
+// Errors out if the file is truncated.
+extern _BSPEXPORT const void* HullFileRead( hullfile_t* hf, size_t size );
+
+inline int HullFileReadInt( hullfile_t* hf )
+{
+        int val;
+        memcpy( &val, HullFileRead( hf, sizeof( int ) ), sizeof( int ) );
+        return val;
+}
+
+inline void HullFileReadPoints( hullfile_t* hf, vec3_t* points, int numpoints )
+{
+        memcpy( points, HullFileRead( hf, numpoints * sizeof( vec3_t ) ), numpoints * sizeof( vec3_t ) );
+}
+
+#endif // HULLIO_H__
@@ -0,0 +1,185 @@
+#ifndef OBJECTPOOL_H__
+#define OBJECTPOOL_H__
+#include "cmdlib.h"
+
+#if _MSC_VER >= 1000
+#pragma once
+#endif
+
+#include <lightMutex.h>
+#include <lightMutexHolder.h>
+
+//
+// ObjectPool<T>
+//
+// Fixed-size allocator for the small structs that the compile tools create and
+// destroy by the million (faces, surfaces, portals, brushes, ...).
+//
+// Memory is carved out of large blocks. Every thread gets its own free list and
+// current block, so Alloc/Free never take a lock except when a thread needs a new
+// block. An object may be freed on a different thread than the one that allocated
+// it; it simply goes onto the freeing thread's list.
+//
+// Blocks are only returned to the system by ReleaseAll(), which must be called
+// from a single thread once every object from the pool is dead (end of a phase).
+//
+// There is one pool per type.
+//
+
+#define OBJECTPOOL_BLOCK_OBJECTS 1024
+
+template <class T>
+class ObjectPool
+{
+public:
+        // Returns a zero-filled object.
+        static T*       Alloc();
+        static void     Free( T* object );
+
+        static void     ReleaseAll();
+
+        // Statistics since the last ReleaseAll().
+        static size_t   GetNumAllocs();
+        static size_t   GetNumBlocks();
+
+private:
+        union Node
+        {
+                Node*   next;
+                unsigned char data[sizeof( T )];
+                double  align;
+        };
+
+        struct Cache
+        {
+                Node*   freelist;
+                Node*   cursor;
+                Node*   end;
+                size_t  numallocs;
+        };
+
+        static Cache*   GetCache();
+
+        static LightMutex       s_lock;
+        static vector<Node*>    s_blocks;
+        static vector<Cache*>   s_caches;
+        static unsigned int     s_generation;
+
+        static thread_local Cache*       t_cache;
+        static thread_local unsigned int t_generation;
+};
+
+template <class T> LightMutex                    ObjectPool<T>::s_lock;
+template <class T> vector<typename ObjectPool<T>::Node*>  ObjectPool<T>::s_blocks;
+template <class T> vector<typename ObjectPool<T>::Cache*> ObjectPool<T>::s_caches;
+template <class T> unsigned int                  ObjectPool<T>::s_generation = 1;
+template <class T> thread_local typename ObjectPool<T>::Cache* ObjectPool<T>::t_cache = NULL;
+template <class T> thread_local unsigned int     ObjectPool<T>::t_generation = 0;
+
+template <class T>
+typename ObjectPool<T>::Cache* ObjectPool<T>::GetCache()
+{
+        if ( t_cache && t_generation == s_generation )
+        {
+                return t_cache;
+        }
+
+        // first allocation on this thread since the pool was last released
+        Cache* cache = new Cache;
+        memset( cache, 0, sizeof( Cache ) );
+        {
+                LightMutexHolder holder( s_lock );
+                s_caches.push_back( cache );
+        }
+        t_cache = cache;
+        t_generation = s_generation;
+        return cache;
+}
+
+template <class T>
+T* ObjectPool<T>::Alloc()
+{
+        Cache* cache = GetCache();
+        Node* node;
+
+        if ( cache->freelist )
+        {
+                node = cache->freelist;
+                cache->freelist = node->next;
+        }
+        else
+        {
+                if ( cache->cursor == cache->end )
+                {
+                        Node* block = new Node[OBJECTPOOL_BLOCK_OBJECTS];
+                        {
+                                LightMutexHolder holder( s_lock );
+                                s_blocks.push_back( block );
+                        }
+                        cache->cursor = block;
+                        cache->end = block + OBJECTPOOL_BLOCK_OBJECTS;
+                }
+                node = cache->cursor++;
+        }
+
+        cache->numallocs++;
+        memset( node, 0, sizeof( Node ) );
+        return (T*)node->data;
+}
+
+template <class T>
+void ObjectPool<T>::Free( T* object )
+{
+        if ( !object )
+        {
+                return;
+        }
+
+        Cache* cache = GetCache();
+        Node* node = (Node*)object;
+        node->next = cache->freelist;
+        cache->freelist = node;
+}
+
+template <class T>
+void ObjectPool<T>::ReleaseAll()
+{
+        LightMutexHolder holder( s_lock );
+
+        for ( size_t i = 0; i < s_blocks.size(); i++ )
+        {
+                delete[] s_blocks[i];
+        }
+        s_blocks.clear();
+
+        for ( size_t i = 0; i < s_caches.size(); i++ )
+        {
+                delete s_caches[i];
+        }
+        s_caches.clear();
+
+        // invalidates the thread-local cache pointers of every thread
+        s_generation++;
+}
+
+template <class T>
+size_t ObjectPool<T>::GetNumAllocs()
+{
+        LightMutexHolder holder( s_lock );
+
+        size_t total = 0;
+        for ( size_t i = 0; i < s_caches.size(); i++ )
+        {
+                total += s_caches[i]->numallocs;
+        }
+        return total;
+}
+
+template <class T>
+size_t ObjectPool<T>::GetNumBlocks()
+{
+        LightMutexHolder holder( s_lock );
+        return s_blocks.size();
+}
+
+#endif // OBJECTPOOL_H__
@@ -245,10 +245,10 @@ Winding::Winding()
 Winding::Winding( vec3_t *points, UINT32 numpoints )
 {
         hlassert( numpoints >= 3 );
+        m_Points = NULL;
+        allocPoints( numpoints );
         m_NumPoints = numpoints;
-        m_MaxPoints = ( m_NumPoints + 3 ) & ~3;	// groups of 4
 
-        m_Points = new vec3_t[m_MaxPoints];
         memcpy( m_Points, points, sizeof( vec3_t ) * m_NumPoints );
 }
 
@@ -258,20 +258,22 @@ void			Winding::initFromPoints( vec3_t *points, UINT32 numpoints )
 
         Reset();
 
+        allocPoints( numpoints );
         m_NumPoints = numpoints;
-        m_MaxPoints = ( m_NumPoints + 3 ) & ~3;	// groups of 4
 
-        m_Points = new vec3_t[m_MaxPoints];
         memcpy( m_Points, points, sizeof( vec3_t ) * m_NumPoints );
 }
 
 Winding&      Winding::operator=( const Winding& other )
 {
-        delete[] m_Points;
+        if ( this == &other )
+        {
+                return *this;
+        }
+
+        allocPoints( other.m_NumPoints );
         m_NumPoints = other.m_NumPoints;
-        m_MaxPoints = ( m_NumPoints + 3 ) & ~3;   // groups of 4
 
-        m_Points = new vec3_t[m_MaxPoints];
         memcpy( m_Points, other.m_Points, sizeof( vec3_t ) * m_NumPoints );
         return *this;
 }
@@ -280,25 +282,74 @@ Winding&      Winding::operator=( const Winding& other )
 Winding::Winding( UINT32 numpoints )
 {
         hlassert( numpoints >= 3 );
+        m_Points = NULL;
+        allocPoints( numpoints );
         m_NumPoints = numpoints;
-        m_MaxPoints = ( m_NumPoints + 3 ) & ~3;   // groups of 4
 
-        m_Points = new vec3_t[m_MaxPoints];
         memset( m_Points, 0, sizeof( vec3_t ) * m_NumPoints );
 }
 
 Winding::Winding( const Winding& other )
 {
+        m_Points = NULL;
+        allocPoints( other.m_NumPoints );
         m_NumPoints = other.m_NumPoints;
-        m_MaxPoints = ( m_NumPoints + 3 ) & ~3;   // groups of 4
 
-        m_Points = new vec3_t[m_MaxPoints];
         memcpy( m_Points, other.m_Points, sizeof( vec3_t ) * m_NumPoints );
 }
 
 Winding::~Winding()
 {
-        delete[] m_Points;
+        freePoints();
+}
+
+// Windings of up to WINDING_INLINE_POINTS points keep their points in m_InlinePoints
+// and never touch the heap. Any points already in the winding are discarded.
+void Winding::allocPoints( UINT32 maxpoints )
+{
+        freePoints();
+
+        maxpoints = ( maxpoints + 3 ) & ~3;   // groups of 4
+        if ( maxpoints <= WINDING_INLINE_POINTS )
+        {
+                m_Points = m_InlinePoints;
+                m_MaxPoints = WINDING_INLINE_POINTS;
+        }
+        else
+        {
+                m_Points = new vec3_t[maxpoints];
+                m_MaxPoints = maxpoints;
+        }
+}
+
+void Winding::freePoints()
+{
+        if ( m_Points != m_InlinePoints )
+        {
+                delete[] m_Points;
+        }
+        m_Points = NULL;
+        m_MaxPoints = 0;
+}
+
+// Moves the points of other into this winding, stealing the heap buffer when there is one.
+void Winding::takePoints( Winding& other )
+{
+        if ( other.m_Points == other.m_InlinePoints )
+        {
+                allocPoints( other.m_NumPoints );
+                memcpy( m_Points, other.m_Points, sizeof( vec3_t ) * other.m_NumPoints );
+        }
+        else
+        {
+                freePoints();
+                m_Points = other.m_Points;
+                m_MaxPoints = other.m_MaxPoints;
+                other.m_Points = NULL;
+                other.m_MaxPoints = 0;
+        }
+        m_NumPoints = other.m_NumPoints;
+        other.m_NumPoints = 0;
 }
 
 
@@ -350,8 +401,8 @@ void Winding::initFromPlane( const vec3_t normal, const vec_t dist )
         VectorScale( vright, BOGUS_RANGE, vright );
 
         // project a really big     axis aligned box onto the plane
+        allocPoints( 4 );
         m_NumPoints = 4;
-        m_Points = new vec3_t[m_NumPoints];
 
         VectorSubtract( org, vright, m_Points[0] );
         VectorAdd( m_Points[0], vup, m_Points[0] );
@@ -368,6 +419,7 @@ void Winding::initFromPlane( const vec3_t normal, const vec_t dist )
 
 Winding::Winding( const vec3_t normal, const vec_t dist )
 {
+        m_Points = NULL;
         initFromPlane( normal, dist );
 }
 
@@ -381,8 +433,9 @@ Winding::Winding( const dface_t& face,
         dvertex_t*      dv;
         int             v;
 
+        m_Points = NULL;
+        allocPoints( face.numedges );
         m_NumPoints = face.numedges;
-        m_Points = new vec3_t[m_NumPoints];
 
         unsigned i;
         for ( i = 0; i < face.numedges; i++ )
@@ -413,6 +466,7 @@ Winding::Winding( const dplane_t& plane )
 
         VectorCopy( plane.normal, normal );
         dist = plane.dist;
+        m_Points = NULL;
         initFromPlane( normal, dist );
 }
 
@@ -644,18 +698,14 @@ bool          Winding::Chop( const vec3_t normal, const vec_t dist
 
         if ( f )
         {
-                delete[] m_Points;
-                m_NumPoints = f->m_NumPoints;
-                m_Points = f->m_Points;
-                f->m_Points = NULL;
+                takePoints( *f );
                 delete f;
                 return true;
         }
         else
         {
                 m_NumPoints = 0;
-                delete[] m_Points;
-                m_Points = NULL;
+                freePoints();
                 return false;
         }
 }
@@ -778,8 +828,7 @@ bool Winding::Clip( const dplane_t& split, bool keepon
 
         if ( !counts[0] )
         {
-                delete[] m_Points;
-                m_Points = NULL;
+                freePoints();
                 m_NumPoints = 0;
                 return false;
         }
@@ -791,8 +840,7 @@ bool Winding::Clip( const dplane_t& split, bool keepon
 
         unsigned maxpts = m_NumPoints + 4;                            // can't use counts[0]+2 because of fp grouping errors
         unsigned newNumPoints = 0;
-        vec3_t* newPoints = new vec3_t[maxpts];
-        memset( newPoints, 0, sizeof( vec3_t ) * maxpts );
+        vec3_t newPoints[MAX_POINTS_ON_WINDING + 4];
 
         for ( i = 0; i < m_NumPoints; i++ )
         {
@@ -843,8 +891,11 @@ bool Winding::Clip( const dplane_t& split, bool keepon
                 Error( "Winding::Clip : points exceeded estimate" );
         }
 
-        delete[] m_Points;
-        m_Points = newPoints;
+        if ( newNumPoints > m_MaxPoints )
+        {
+                allocPoints( newNumPoints );
+        }
+        memcpy( m_Points, newPoints, sizeof( vec3_t ) * newNumPoints );
         m_NumPoints = newNumPoints;
 
         RemoveColinearPoints(
@@ -852,8 +903,7 @@ bool Winding::Clip( const dplane_t& split, bool keepon
         );
         if ( m_NumPoints == 0 )
         {
-                delete[] m_Points;
-                m_Points = NULL;
+                freePoints();
                 m_NumPoints = 0;
                 return false;
         }
@@ -1072,10 +1122,22 @@ void            Winding::resize( UINT32 newsize )
 {
         newsize = ( newsize + 3 ) & ~3;   // groups of 4
 
-        vec3_t* newpoints = new vec3_t[newsize];
         m_NumPoints = qmin( newsize, m_NumPoints );
-        memcpy( newpoints, m_Points, m_NumPoints );
-        delete[] m_Points;
+        if ( newsize <= WINDING_INLINE_POINTS )
+        {
+                if ( m_Points != m_InlinePoints )
+                {
+                        memcpy( m_InlinePoints, m_Points, sizeof( vec3_t ) * m_NumPoints );
+                        delete[] m_Points;
+                        m_Points = m_InlinePoints;
+                }
+                m_MaxPoints = WINDING_INLINE_POINTS;
+                return;
+        }
+
+        vec3_t* newpoints = new vec3_t[newsize];
+        memcpy( newpoints, m_Points, sizeof( vec3_t ) * m_NumPoints );
+        freePoints();
         m_Points = newpoints;
         m_MaxPoints = newsize;
 }
@@ -1095,11 +1157,7 @@ void			Winding::CopyPoints( vec3_t *points, int &numpoints )
 
 void			Winding::Reset( void )
 {
-        if ( m_Points )
-        {
-                delete[] m_Points;
-                m_Points = NULL;
-        }
+        freePoints();
 
-        m_NumPoints = m_MaxPoints = 0;
+        m_NumPoints = 0;
 }
\ No newline at end of file
@@ -17,6 +17,12 @@
 
 #define BASE_WINDING_DISTANCE 9000
 
+// Windings with up to this many points store them inside the Winding itself.
+// Almost every face, portal and patch winding fits, so splits, copies and clips
+// don't allocate. Kept at 8 so the common 3-8 point winding costs no more memory
+// than the heap buffer it replaces.
+#define WINDING_INLINE_POINTS 8
+
 #define	SIDE_FRONT		0
 #define	SIDE_ON			2
 #define	SIDE_BACK		1
@@ -71,6 +77,9 @@ public:
 
 protected:
         void            resize( UINT32 newsize );
+        void            allocPoints( UINT32 maxpoints );
+        void            freePoints();
+        void            takePoints( Winding& other );
 
 public:
         // Construction
@@ -97,6 +106,7 @@ public:
         vec3_t* m_Points;
 protected:
         UINT32  m_MaxPoints;
+        vec3_t  m_InlinePoints[WINDING_INLINE_POINTS];
 };
 
 #endif
\ No newline at end of file
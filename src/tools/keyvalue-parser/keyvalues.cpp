@@ -32,46 +32,96 @@ enum
 	KVTOKEN_MACROS,
 };
 
+/**
+ * A token is a view into the source buffer, nothing is copied until the parser
+ * stores the string into its final place with assign_to().
+ */
 struct KeyValueToken_t
 {
 	int type;
-	std::string data;
+	const char *data;
+	size_t length;
+
+	// True if the string has escape sequences or line breaks that have to be
+	// filtered out, otherwise it can be copied as is.
+	bool needs_filter;
 
 	bool invalid() const
 	{
 		return type == KVTOKEN_NONE;
 	}
+
+	void assign_to( std::string &out ) const;
 };
 
+void KeyValueToken_t::assign_to( std::string &out ) const
+{
+	if ( !needs_filter )
+	{
+		out.assign( data, length );
+		return;
+	}
+
+	out.clear();
+	out.reserve( length );
+
+	bool escape = false;
+	for ( size_t i = 0; i < length; i++ )
+	{
+		char c = data[i];
+		if ( escape )
+		{
+			escape = false;
+
+			if ( c == '"' )
+			{
+				out += '"';
+			}
+			else if ( c == '\\' )
+			{
+				out += '\\';
+			}
+		}
+		else if ( c == '\\' )
+		{
+			escape = true;
+		}
+		else if ( c != '\n' && c != '\r' )
+		{
+			out += c;
+		}
+	}
+}
+
 class CKeyValuesTokenizer
 {
 public:
-	CKeyValuesTokenizer( const std::string &buffer );
+	CKeyValuesTokenizer( const char *buffer, size_t length );
 
 	KeyValueToken_t next_token();
 
 private:
 	void ignore_whitespace();
 	bool ignore_comment();
-	std::string get_string();
+	void get_string( KeyValueToken_t &token );
 
-	char current();
+	char current() const;
 	bool forward();
-	char next();
+	char next() const;
 	std::string location();
 
 private:
-	std::string _buffer;
+	const char *_buffer;
 	size_t _buflen;
 	size_t _position;
 	int _last_line_break;
 	int _line;
 };
 
-CKeyValuesTokenizer::CKeyValuesTokenizer( const std::string &buffer )
+CKeyValuesTokenizer::CKeyValuesTokenizer( const char *buffer, size_t length )
 {
 	_buffer = buffer;
-	_buflen = buffer.size();
+	_buflen = length;
 	_position = 0;
 	_last_line_break = 0;
 	_line = 1;
@@ -80,6 +130,9 @@ CKeyValuesTokenizer::CKeyValuesTokenizer( const std::string &buffer )
 KeyValueToken_t CKeyValuesTokenizer::next_token()
 {
 	KeyValueToken_t token;
+	token.data = nullptr;
+	token.length = 0;
+	token.needs_filter = false;
 
 	while ( 1 )
 	{
@@ -113,16 +166,15 @@ KeyValueToken_t CKeyValuesTokenizer::next_token()
 	}
 	else
 	{
-		token.data = get_string();
+		get_string( token );
 		token.type = KVTOKEN_STRING;
 		return token;
 	}
 }
 
-std::string CKeyValuesTokenizer::get_string()
+void CKeyValuesTokenizer::get_string( KeyValueToken_t &token )
 {
 	bool escape = false;
-	std::string result = "";
 
 	bool quoted = false;
 	if ( current() == '"' )
@@ -131,6 +183,8 @@ std::string CKeyValuesTokenizer::get_string()
 		forward();
 	}
 
+	token.data = _buffer + _position;
+
 	while ( 1 )
 	{
 		char c = current();
@@ -153,38 +207,29 @@ std::string CKeyValuesTokenizer::get_string()
 			break;
 		}
 
-		// Add the character or escape sequence to the result
 		if ( escape )
 		{
 			escape = false;
-
-			if ( c == '"' )
-			{
-				result += '"';
-			}
-			else if ( c == '\\' )
-			{
-				result += '\\';
-			}
 		}
 		else if ( c == '\\' )
 		{
 			escape = true;
+			token.needs_filter = true;
 		}
-		else if ( c != '\n' && c != '\r' )
+		else if ( c == '\n' || c == '\r' )
 		{
-			result += c;
+			token.needs_filter = true;
 		}
 
 		forward();
 	}
 
+	token.length = ( _buffer + _position ) - token.data;
+
 	if ( quoted )
 	{
 		forward();
 	}
-
-	return result;
 }
 
 void CKeyValuesTokenizer::ignore_whitespace()
@@ -218,7 +263,8 @@ bool CKeyValuesTokenizer::ignore_comment()
 {
 	if ( current() == '/' && next() == '/' )
 	{
-		while ( current() != '\n' )
+		// A comment on the last line may not end with a line break.
+		while ( _position < _buflen && _buffer[_position] != '\n' )
 		{
 			forward();
 		}
@@ -229,7 +275,7 @@ bool CKeyValuesTokenizer::ignore_comment()
 	return false;
 }
 
-char CKeyValuesTokenizer::current()
+char CKeyValuesTokenizer::current() const
 {
 	if ( _position >= _buflen )
 	{
@@ -245,7 +291,7 @@ bool CKeyValuesTokenizer::forward()
 	return _position < _buflen;
 }
 
-char CKeyValuesTokenizer::next()
+char CKeyValuesTokenizer::next() const
 {
 	if ( ( _position + 1 ) >= _buflen )
 	{
@@ -298,6 +344,8 @@ pvector<CKeyValues *> CKeyValues::get_children_with_name( const std::string &nam
 void CKeyValues::parse( CKeyValuesTokenizer *tokenizer )
 {
 	bool has_key = false;
+
+	// Reused for every key of the block.
 	std::string key;
 
 	while ( 1 )
@@ -321,7 +369,7 @@ void CKeyValues::parse( CKeyValuesTokenizer *tokenizer )
 			}
 			else if ( token.type == KVTOKEN_STRING )
 			{
-				_keyvalues[key] = token.data;
+				token.assign_to( _keyvalues[key] );
 			}
 			else
 			{
@@ -344,7 +392,7 @@ void CKeyValues::parse( CKeyValuesTokenizer *tokenizer )
 				break;
 			}
 			has_key = true;
-			key = token.data;
+			token.assign_to( key );
 		}
 	}
 }
@@ -352,16 +400,17 @@ void CKeyValues::parse( CKeyValuesTokenizer *tokenizer )
 PT( CKeyValues ) CKeyValues::load( const Filename &filename )
 {
 	VirtualFileSystem *vfs = VirtualFileSystem::get_global_ptr();
-	if ( !vfs->exists( filename ) )
+
+	std::string buffer;
+	if ( !vfs->read_file( filename, buffer, true ) )
 	{
 		keyvalues_cat.error()
 			<< "Unable to find `" << filename.get_fullpath() << "`\n";
 		return nullptr;
 	}
 
-	std::string buffer = vfs->read_file( filename, true );
-
-	CKeyValuesTokenizer tokenizer( buffer );
+	// The tokens point into the buffer, it must outlive the parse.
+	CKeyValuesTokenizer tokenizer( buffer.data(), buffer.size() );
 
 	PT( CKeyValues ) kv = new CKeyValues( "__root" );
 	kv->_filename = filename;
@@ -382,30 +431,65 @@ PT( CKeyValues ) CKeyValues::load( const Filename &filename )
 // Helper functions for parsing string values that represent numbers.
 //------------------------------------------------------------------------------------------------
 
-pvector<float> CKeyValues::parse_float_list_str( const std::string &str )
+/**
+ * Parses up to max_count whitespace separated floats straight out of the
+ * string into out. Returns the number of floats that were parsed.
+ */
+int CKeyValues::parse_floats( const std::string &str, float *out, int max_count )
 {
-	pvector<float> result;
-	std::string curr_num_string;
-	int current = 0;
-	while ( current < str.length() )
+	const char *p = str.c_str();
+	int count = 0;
+	while ( count < max_count )
 	{
-		char let = str[current];
-		if ( let == ' ' )
+		char *end;
+		float val = strtof( p, &end );
+		if ( end == p )
 		{
-			result.push_back( stof( curr_num_string ) );
-			curr_num_string = "";
+			break;
 		}
-		else
+		out[count++] = val;
+		p = end;
+	}
+
+	return count;
+}
+
+/**
+ * Integer version of parse_floats().
+ */
+int CKeyValues::parse_ints( const std::string &str, int *out, int max_count )
+{
+	const char *p = str.c_str();
+	int count = 0;
+	while ( count < max_count )
+	{
+		char *end;
+		long val = strtol( p, &end, 10 );
+		if ( end == p )
 		{
-			curr_num_string += let;
+			break;
 		}
-		current++;
+		out[count++] = (int)val;
+		p = end;
+	}
 
-		if ( current >= str.length() )
+	return count;
+}
+
+pvector<float> CKeyValues::parse_float_list_str( const std::string &str )
+{
+	pvector<float> result;
+	const char *p = str.c_str();
+	while ( 1 )
+	{
+		char *end;
+		float val = strtof( p, &end );
+		if ( end == p )
 		{
-			result.push_back( stof( curr_num_string ) );
-			curr_num_string = "";
+			break;
 		}
+		result.push_back( val );
+		p = end;
 	}
 
 	return result;
@@ -414,27 +498,17 @@ pvector<float> CKeyValues::parse_float_list_str( const std::string &str )
 pvector<int> CKeyValues::parse_num_list_str( const std::string &str )
 {
 	pvector<int> result;
-	std::string curr_num_string;
-	int current = 0;
-	while ( current < str.length() )
+	const char *p = str.c_str();
+	while ( 1 )
 	{
-		char let = str[current];
-		if ( let == ' ' )
+		char *end;
+		long val = strtol( p, &end, 10 );
+		if ( end == p )
 		{
-			result.push_back( stoi( curr_num_string ) );
-			curr_num_string = "";
-		}
-		else
-		{
-			curr_num_string += let;
-		}
-		current++;
-
-		if ( current >= str.length() )
-		{
-			result.push_back( stoi( curr_num_string ) );
-			curr_num_string = "";
+			break;
 		}
+		result.push_back( (int)val );
+		p = end;
 	}
 
 	return result;
@@ -532,23 +606,26 @@ pvector<pvector<float>> CKeyValues::parse_num_array_str( const std::string &str
 
 LVecBase2f CKeyValues::to_2f( const std::string &str )
 {
-	pvector<float> vec = CKeyValues::parse_float_list_str( str );
-	nassertr( vec.size() >= 2, LVecBase2f( 0 ) );
-	return LVecBase2f( vec[0], vec[1] );
+	LVecBase2f vec( 0 );
+	int count = parse_floats( str, vec.get_data(), 2 );
+	nassertr( count == 2, LVecBase2f( 0 ) );
+	return vec;
 }
 
 LVecBase3f CKeyValues::to_3f( const std::string &str )
 {
-	pvector<float> vec = CKeyValues::parse_float_list_str( str );
-	nassertr( vec.size() >= 3, LVecBase3f( 0 ) );
-	return LVecBase3f( vec[0], vec[1], vec[2] );
+	LVecBase3f vec( 0 );
+	int count = parse_floats( str, vec.get_data(), 3 );
+	nassertr( count == 3, LVecBase3f( 0 ) );
+	return vec;
 }
 
 LVecBase4f CKeyValues::to_4f( const std::string &str )
 {
-	pvector<float> vec = CKeyValues::parse_float_list_str( str );
-	nassertr( vec.size() >= 4, LVecBase4f( 0 ) );
-	return LVecBase4f( vec[0], vec[1], vec[2], vec[3] );
+	LVecBase4f vec( 0 );
+	int count = parse_floats( str, vec.get_data(), 4 );
+	nassertr( count == 4, LVecBase4f( 0 ) );
+	return vec;
 }
 
 template<class T>
@@ -52,6 +52,8 @@ public:
 	int find_key( const std::string &name ) const;
 	const std::string &get_key( size_t n ) const;
 	const std::string &get_value( size_t n ) const;
+	int get_value_int( size_t n ) const;
+	float get_value_float( size_t n ) const;
 
 	const Filename &get_filename() const;
 
@@ -61,6 +63,9 @@ private:
 public:
 	static PT( CKeyValues ) load( const Filename &filename );
 
+	static int parse_floats( const std::string &str, float *out, int max_count );
+	static int parse_ints( const std::string &str, int *out, int max_count );
+
 	static pvector<int> parse_num_list_str( const std::string &str );
 	static pvector<float> parse_float_list_str( const std::string &str );
 	static pvector<pvector<int>> parse_int_tuple_list_str( const std::string &str );
@@ -159,6 +164,16 @@ inline const std::string &CKeyValues::get_value( size_t n ) const
 	return _keyvalues.get_data( n );
 }
 
+inline int CKeyValues::get_value_int( size_t n ) const
+{
+	return atoi( _keyvalues.get_data( n ).c_str() );
+}
+
+inline float CKeyValues::get_value_float( size_t n ) const
+{
+	return (float)atof( _keyvalues.get_data( n ).c_str() );
+}
+
 inline const Filename &CKeyValues::get_filename() const
 {
 	return _filename;
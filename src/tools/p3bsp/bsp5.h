@@ -14,6 +14,8 @@
 #include "bspfile.h"
 #include "blockmem.h"
 #include "filelib.h"
+#include "hullio.h"
+#include "objectpool.h"
 #include "threads.h"
 #include "winding.h"
 #include "cmdlinecfg.h"
@@ -182,6 +184,8 @@ extern void     SubdivideFace( face_t* f, face_t** prevptr );
 extern node_t*  SolidBSP( const surfchain_t* const surfhead,
                           brush_t *detailbrushes,
                           brush_t *surfbrushes,
+                          node_t* outside_node,
+                          int modnum,
                           bool report_progress );
 
 //=============================================================================
@@ -206,11 +210,9 @@ typedef struct portal_s
 }
 portal_t;
 
-extern node_t   g_outside_node;                            // portals outside the world face this
-
 extern void     AddPortalToNodes( portal_t* p, node_t* front, node_t* back );
 extern void     RemovePortalFromNode( portal_t* portal, node_t* l );
-extern void     MakeHeadnodePortals( node_t* node, const vec3_t mins, const vec3_t maxs );
+extern void     MakeHeadnodePortals( node_t* node, node_t* outside_node, const vec3_t mins, const vec3_t maxs );
 
 extern void     FreePortals( node_t* node );
 extern void     WritePortalfile( node_t* headnode );
@@ -228,10 +230,10 @@ extern void     FinishBSPFile();
 
 //=============================================================================
 // outside.c
-extern node_t*  FillOutside( node_t* node, bool leakfile, unsigned hullnum );
+extern node_t*  FillOutside( node_t* node, node_t* outside_node, bool leakfile, unsigned hullnum );
 extern void     LoadAllowableOutsideList( const char* const filename );
 extern void     FreeAllowableOutsideList();
-extern void		FillInside( node_t* node );
+extern void		FillInside( node_t* node, node_t* outside_node );
 
 //=============================================================================
 // misc functions
@@ -257,6 +259,7 @@ extern brush_t *BrushFromBox( const vec3_t mins, const vec3_t maxs );
 extern void		CalcBrushBounds( const brush_t *b, vec3_t &mins, vec3_t &maxs );
 
 extern node_t*  AllocNode();
+extern void     FreeNode( node_t* n );
 
 extern bool     CheckFaceForHint( const face_t* const f );
 extern bool     CheckFaceForSkip( const face_t* const f );
@@ -121,7 +121,7 @@ static void FreeDetailNode_r( node_t *n )
         for ( i = 0; i < 2; i++ )
         {
                 FreeDetailNode_r( n->children[i] );
-                free( n->children[i] );
+                FreeNode( n->children[i] );
                 n->children[i] = NULL;
         }
         face_t *f, *next;
@@ -430,7 +430,7 @@ void            LoadAllowableOutsideList( const char* const filename )
 // =====================================================================================
 //  FillOutside
 // =====================================================================================
-node_t*         FillOutside( node_t* node, const bool leakfile, const unsigned hullnum )
+node_t*         FillOutside( node_t* node, node_t* outside_node, const bool leakfile, const unsigned hullnum )
 {
         int             s;
         int             i;
@@ -503,13 +503,13 @@ gotit:;
                 return node;
         }
 
-        if ( !g_outside_node.portals )
+        if ( !outside_node->portals )
         {
                 Warning( "No outside node portal found in hull %i, no filling performed for this hull", hullnum );
                 return node;
         }
 
-        s = !( g_outside_node.portals->nodes[1] == &g_outside_node );
+        s = !( outside_node->portals->nodes[1] == outside_node );
 
         // first check to see if an occupied leaf is hit
         outleafs = 0;
@@ -532,7 +532,7 @@ gotit:;
                 }
         }
 
-        ret = RecursiveFillOutside( g_outside_node.portals->nodes[s], false );
+        ret = RecursiveFillOutside( outside_node->portals->nodes[s], false );
 
         if ( leakfile )
         {
@@ -582,7 +582,7 @@ gotit:;
 
         // now go back and fill things in
         valid++;
-        RecursiveFillOutside( g_outside_node.portals->nodes[s], true );
+        RecursiveFillOutside( outside_node->portals->nodes[s], true );
 
         // remove faces and nodes from filled in leafs  
         c_falsenodes = 0;
@@ -652,10 +652,10 @@ void			RemoveUnused_r( node_t* node )
                 RemoveUnused_r( node->children[1] );
         }
 }
-void			FillInside( node_t* node )
+void			FillInside( node_t* node, node_t* outside_node )
 {
         int i;
-        g_outside_node.empty = 0;
+        outside_node->empty = 0;
         ResetMark_r( node );
         for ( i = 1; i < g_bspdata->numentities; i++ )
         {
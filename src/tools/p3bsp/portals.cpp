@@ -2,8 +2,6 @@
 
 #include "bsp5.h"
 
-node_t          g_outside_node;                            // portals outside the world face this
-
                                                            //=============================================================================
 
                                                            /*
@@ -84,10 +82,10 @@ void            RemovePortalFromNode( portal_t* portal, node_t* l )
 * ================
 * MakeHeadnodePortals
 *
-* The created portals will face the global g_outside_node
+* The created portals will face outside_node, which every model tree has its own of
 * ================
 */
-void            MakeHeadnodePortals( node_t* node, const vec3_t mins, const vec3_t maxs )
+void            MakeHeadnodePortals( node_t* node, node_t* outside_node, const vec3_t mins, const vec3_t maxs )
 {
         vec3_t          bounds[2];
         int             i, j, n;
@@ -103,8 +101,8 @@ void            MakeHeadnodePortals( node_t* node, const vec3_t mins, const vec3
                 bounds[1][i] = maxs[i] + SIDESPACE;
         }
 
-        g_outside_node.contents = CONTENTS_SOLID;
-        g_outside_node.portals = NULL;
+        outside_node->contents = CONTENTS_SOLID;
+        outside_node->portals = NULL;
 
         for ( i = 0; i < 3; i++ )
         {
@@ -129,7 +127,7 @@ void            MakeHeadnodePortals( node_t* node, const vec3_t mins, const vec3
                         }
                         p->plane = *pl;
                         p->winding = new Winding( *pl );
-                        AddPortalToNodes( p, node, &g_outside_node );
+                        AddPortalToNodes( p, node, outside_node );
                 }
         }
 
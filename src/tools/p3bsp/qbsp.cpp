@@ -30,8 +30,8 @@ vec3_t          g_hull_size[NUM_HULLS][2] =
                 { 0, 0, 0 },{ 0, 0, 0 }
         }
 };
-static FILE*    polyfiles[NUM_HULLS];
-static FILE*    brushfiles[NUM_HULLS];
+static hullfile_t polyfiles[NUM_HULLS];
+static hullfile_t brushfiles[NUM_HULLS];
 int             g_hullnum = 0;
 
 static face_t*  validfaces[MAX_INTERNAL_MAP_PLANES];
@@ -416,8 +416,7 @@ face_t*         AllocFace()
 {
         face_t*         f;
 
-        f = (face_t*)malloc( sizeof( face_t ) );
-        memset( f, 0, sizeof( face_t ) );
+        f = ObjectPool<face_t>::Alloc();
 
         f->planenum = -1;
 
@@ -429,7 +428,7 @@ face_t*         AllocFace()
 // =====================================================================================
 void            FreeFace( face_t* f )
 {
-        free( f );
+        ObjectPool<face_t>::Free( f );
 }
 
 // =====================================================================================
@@ -439,8 +438,7 @@ surface_t*      AllocSurface()
 {
         surface_t*      s;
 
-        s = (surface_t*)malloc( sizeof( surface_t ) );
-        memset( s, 0, sizeof( surface_t ) );
+        s = ObjectPool<surface_t>::Alloc();
 
         return s;
 }
@@ -450,7 +448,7 @@ surface_t*      AllocSurface()
 // =====================================================================================
 void            FreeSurface( surface_t* s )
 {
-        free( s );
+        ObjectPool<surface_t>::Free( s );
 }
 
 // =====================================================================================
@@ -460,8 +458,7 @@ portal_t*       AllocPortal()
 {
         portal_t*       p;
 
-        p = (portal_t*)malloc( sizeof( portal_t ) );
-        memset( p, 0, sizeof( portal_t ) );
+        p = ObjectPool<portal_t>::Alloc();
 
         return p;
 }
@@ -471,15 +468,14 @@ portal_t*       AllocPortal()
 // =====================================================================================
 void            FreePortal( portal_t* p ) // consider: inline
 {
-        free( p );
+        ObjectPool<portal_t>::Free( p );
 }
 
 
 side_t *AllocSide()
 {
         side_t *s;
-        s = (side_t *)malloc( sizeof( side_t ) );
-        memset( s, 0, sizeof( side_t ) );
+        s = ObjectPool<side_t>::Alloc();
         return s;
 }
 
@@ -489,7 +485,7 @@ void FreeSide( side_t *s )
         {
                 delete s->w;
         }
-        free( s );
+        ObjectPool<side_t>::Free( s );
         return;
 }
 
@@ -505,8 +501,7 @@ side_t *NewSideFromSide( const side_t *s )
 brush_t *AllocBrush()
 {
         brush_t *b;
-        b = (brush_t *)malloc( sizeof( brush_t ) );
-        memset( b, 0, sizeof( brush_t ) );
+        b = ObjectPool<brush_t>::Alloc();
         return b;
 }
 
@@ -521,7 +516,7 @@ void FreeBrush( brush_t *b )
                         FreeSide( s );
                 }
         }
-        free( b );
+        ObjectPool<brush_t>::Free( b );
         return;
 }
 
@@ -690,12 +685,19 @@ node_t*         AllocNode()
 {
         node_t*         n;
 
-        n = (node_t *)malloc( sizeof( node_t ) );
-        memset( n, 0, sizeof( node_t ) );
+        n = ObjectPool<node_t>::Alloc();
 
         return n;
 }
 
+// =====================================================================================
+//  FreeNode
+// =====================================================================================
+void            FreeNode( node_t* n )
+{
+        ObjectPool<node_t>::Free( n );
+}
+
 // =====================================================================================
 //  AddPointToBounds
 // =====================================================================================
@@ -801,9 +803,7 @@ static surfchain_t* SurflistFromValidFaces()
                 validfaces[i + 1] = NULL;
         }
 
-        // merge all possible polygons
-
-        MergeAll( sc->surfaces );
+        // polygons are merged later by BuildModelTree, which runs on the worker threads
 
         return sc;
 }
@@ -925,121 +925,94 @@ static          facestyle_e SetFaceType( face_t* f )
 // =====================================================================================
 //  ReadSurfs
 // =====================================================================================
-static surfchain_t* ReadSurfs( FILE* file )
+static surfchain_t* ReadSurfs( hullfile_t* file )
 {
-        int             r;
-        int				detaillevel;
-        int             planenum, g_texinfo, contents, numpoints, brushnum, brushside;
+        const hullface_t* rec;
+        hullface_t      hf;
         face_t*         f;
         int             i;
-        double          v[3];
-        int             line = 0;
+        int             facenum = 0;
         double			inaccuracy, inaccuracy_count = 0.0, inaccuracy_total = 0.0, inaccuracy_max = 0.0;
 
         // read in the polygons
         while ( 1 )
         {
-                if ( file == polyfiles[2] && g_nohull2 )
+                if ( file == &polyfiles[2] && g_nohull2 )
                         break;
-                line++;
-                r = fscanf( file, "%i %i %i %i %i %i %i\n",
-                            &detaillevel, &planenum, &g_texinfo,
-                            &contents, &brushnum, &brushside, &numpoints );
-                if ( r == 0 || r == -1 )
+                if ( HullFileAtEnd( file ) )
                 {
                         return NULL;
                 }
-                if ( planenum == -1 )                                // end of model
+                facenum++;
+                rec = (const hullface_t*)HullFileRead( file, sizeof( hullface_t ) );
+                memcpy( &hf, rec, sizeof( hullface_t ) );
+                if ( hf.planenum == -1 )                                // end of model
                 {
                         Developer( DEVELOPER_LEVEL_MEGASPAM, "inaccuracy: average %.8f max %.8f\n", inaccuracy_total / inaccuracy_count, inaccuracy_max );
                         break;
                 }
-                if ( r != 7 )
-                {
-                        Error( "ReadSurfs (line %i): scanf failure", line );
-                }
-                if ( numpoints > MAXPOINTS )
+                if ( hf.numpoints < 0 || hf.numpoints > MAXPOINTS )
                 {
-                        Error( "ReadSurfs (line %i): %i > MAXPOINTS\nThis is caused by a face with too many verticies (typically found on end-caps of high-poly cylinders)\n", line, numpoints );
+                        Error( "ReadSurfs (face %i): %i > MAXPOINTS\nThis is caused by a face with too many verticies (typically found on end-caps of high-poly cylinders)\n", facenum, hf.numpoints );
                 }
-                if ( planenum > g_bspdata->numplanes )
+                if ( hf.planenum > g_bspdata->numplanes )
                 {
-                        Error( "ReadSurfs (line %i): %i > g_numplanes\n", line, planenum );
+                        Error( "ReadSurfs (face %i): %i > g_numplanes\n", facenum, hf.planenum );
                 }
-                if ( g_texinfo > g_bspdata->numtexinfo )
+                if ( hf.texinfo > g_bspdata->numtexinfo )
                 {
-                        Error( "ReadSurfs (line %i): %i > g_numtexinfo", line, g_texinfo );
+                        Error( "ReadSurfs (face %i): %i > g_numtexinfo", facenum, hf.texinfo );
                 }
-                if ( detaillevel < 0 )
+                if ( hf.detaillevel < 0 )
                 {
-                        Error( "ReadSurfs (line %i): detaillevel %i < 0", line, detaillevel );
+                        Error( "ReadSurfs (face %i): detaillevel %i < 0", facenum, hf.detaillevel );
                 }
 
-                if ( !strcasecmp( GetTextureByNumber( g_bspdata, g_texinfo ), "skip" ) )
+                if ( !strcasecmp( GetTextureByNumber( g_bspdata, hf.texinfo ), "skip" ) )
                 {
-                        Verbose( "ReadSurfs (line %i): skipping a surface", line );
-
-                        for ( i = 0; i < numpoints; i++ )
-                        {
-                                line++;
-                                //Verbose("skipping line %d", line);
-                                r = fscanf( file, "%lf %lf %lf\n", &v[0], &v[1], &v[2] );
-                                if ( r != 3 )
-                                {
-                                        Error( "::ReadSurfs (face_skip), fscanf of points failed at line %i", line );
-                                }
-                        }
-                        fscanf( file, "\n" );
+                        Verbose( "ReadSurfs (face %i): skipping a surface", facenum );
+                        HullFileRead( file, hf.numpoints * sizeof( vec3_t ) );
                         continue;
                 }
 
                 f = AllocFace();
-                f->detaillevel = detaillevel;
-                f->planenum = planenum;
-                f->texturenum = g_texinfo;
-                f->contents = contents;
-                f->numpoints = numpoints;
-                f->next = validfaces[planenum];
-                f->brushnum = brushnum;
-                f->brushside = brushside;
-                validfaces[planenum] = f;
+                f->detaillevel = hf.detaillevel;
+                f->planenum = hf.planenum;
+                f->texturenum = hf.texinfo;
+                f->contents = hf.contents;
+                f->numpoints = hf.numpoints;
+                f->next = validfaces[hf.planenum];
+                f->brushnum = hf.brushnum;
+                f->brushside = hf.brushside;
+                validfaces[hf.planenum] = f;
 
                 SetFaceType( f );
 
-                for ( i = 0; i < f->numpoints; i++ )
+                HullFileReadPoints( file, f->pts, f->numpoints );
+                if ( DEVELOPER_LEVEL_MEGASPAM <= g_developer )
                 {
-                        line++;
-                        r = fscanf( file, "%lf %lf %lf\n", &v[0], &v[1], &v[2] );
-                        if ( r != 3 )
-                        {
-                                Error( "::ReadSurfs (face_normal), fscanf of points failed at line %i", line );
-                        }
-                        VectorCopy( v, f->pts[i] );
-                        if ( DEVELOPER_LEVEL_MEGASPAM <= g_developer )
+                        const dplane_t *plane = &g_bspdata->dplanes[f->planenum];
+                        for ( i = 0; i < f->numpoints; i++ )
                         {
-                                const dplane_t *plane = &g_bspdata->dplanes[f->planenum];
                                 inaccuracy = fabs( DotProduct( f->pts[i], plane->normal ) - plane->dist );
                                 inaccuracy_count++;
                                 inaccuracy_total += inaccuracy;
                                 inaccuracy_max = qmax( inaccuracy, inaccuracy_max );
                         }
                 }
-                fscanf( file, "\n" );
         }
 
         return SurflistFromValidFaces();
 }
-static brush_t *ReadBrushes( FILE *file )
+static brush_t *ReadBrushes( hullfile_t *file )
 {
         brush_t *brushes = NULL;
         while ( 1 )
         {
-                if ( file == brushfiles[2] && g_nohull2 )
+                if ( file == &brushfiles[2] && g_nohull2 )
                         break;
-                int r;
                 int brushinfo;
-                r = fscanf( file, "%i\n", &brushinfo );
-                if ( r == 0 || r == -1 )
+                if ( HullFileAtEnd( file ) )
                 {
                         if ( brushes == NULL )
                         {
@@ -1050,6 +1023,7 @@ static brush_t *ReadBrushes( FILE *file )
                                 Error( "ReadBrushes: file end" );
                         }
                 }
+                brushinfo = HullFileReadInt( file );
                 if ( brushinfo == -1 )
                 {
                         break;
@@ -1063,31 +1037,28 @@ static brush_t *ReadBrushes( FILE *file )
                 psn = &b->sides;
                 while ( 1 )
                 {
-                        int planenum;
-                        int numpoints;
-                        r = fscanf( file, "%i %u\n", &planenum, &numpoints );
-                        if ( r != 2 )
+                        hullbrushside_t hs;
+                        memcpy( &hs, HullFileRead( file, sizeof( hullbrushside_t ) ), sizeof( hullbrushside_t ) );
+                        if ( hs.planenum == -1 )
                         {
-                                Error( "ReadBrushes: get side failed" );
+                                break;
                         }
-                        if ( planenum == -1 )
+                        if ( hs.numpoints < 0 )
                         {
-                                break;
+                                Error( "ReadBrushes: get side failed" );
                         }
                         side_t *s;
                         s = AllocSide();
-                        s->plane = g_bspdata->dplanes[planenum ^ 1];
-                        s->w = new Winding( numpoints );
-                        int x;
-                        for ( x = 0; x < numpoints; x++ )
+                        s->plane = g_bspdata->dplanes[hs.planenum ^ 1];
+                        s->w = new Winding( hs.numpoints );
+                        HullFileReadPoints( file, s->w->m_Points, hs.numpoints );
+                        // the side faces the other way, so reverse the winding
+                        for ( int x = 0; x < hs.numpoints / 2; x++ )
                         {
-                                double v[3];
-                                r = fscanf( file, "%lf %lf %lf\n", &v[0], &v[1], &v[2] );
-                                if ( r != 3 )
-                                {
-                                        Error( "ReadBrushes: get point failed" );
-                                }
-                                VectorCopy( v, s->w->m_Points[numpoints - 1 - x] );
+                                vec3_t tmp;
+                                VectorCopy( s->w->m_Points[x], tmp );
+                                VectorCopy( s->w->m_Points[hs.numpoints - 1 - x], s->w->m_Points[x] );
+                                VectorCopy( tmp, s->w->m_Points[hs.numpoints - 1 - x] );
                         }
                         s->next = NULL;
                         *psn = s;
@@ -1164,29 +1135,83 @@ brush_t *MakeBrushListFromSurfs(surfchain_t *surfs)
 }
 
 
+// Hull data and finished tree of a single model. The trees of all models are
+// built in parallel; everything that appends to g_bspdata stays serial.
+typedef struct
+{
+        surfchain_t*    surfs;
+        brush_t*        detailbrushes;
+        node_t*         nodes;
+        node_t*         outside_node;                          // the headnode portals of this tree face it
+}
+modelwork_t;
+
+static vector<modelwork_t> g_modelwork;
+
+// =====================================================================================
+//  ReadModel
+//      Reads the faces and detail brushes of the next model from the hull files.
+//      Returns false when all models have been read.
+// =====================================================================================
+static bool     ReadModel()
+{
+        modelwork_t     work;
+
+        work.surfs = ReadSurfs( &polyfiles[0] );
+
+        if ( !work.surfs )
+                return false;                                      // all models are done
+        work.detailbrushes = ReadBrushes( &brushfiles[0] );
+        work.nodes = NULL;
+        work.outside_node = AllocNode();
+
+        hlassume( (int)g_modelwork.size() < MAX_MAP_MODELS, assume_MAX_MAP_MODELS );
+        g_modelwork.push_back( work );
+
+        return true;
+}
+
+// =====================================================================================
+//  BuildModelTree
+//      Thread function. Models do not share any faces, brushes, portals or nodes, so
+//      each tree can be built independently of the others. The result does not depend
+//      on the number of threads.
+// =====================================================================================
+static void     BuildModelTree( int modnum )
+{
+        modelwork_t*    work = &g_modelwork[modnum];
+        brush_t*        surfbrushes;
+
+        // merge all possible polygons
+        MergeAll( work->surfs->surfaces );
+
+        surfbrushes = MakeBrushListFromSurfs( work->surfs );
+
+        // SolidBSP generates a node tree
+        work->nodes = SolidBSP( work->surfs,
+                                work->detailbrushes,
+                                surfbrushes,
+                                work->outside_node,
+                                modnum,
+                                modnum == 0 );
+}
+
 // =====================================================================================
 //  ProcessModel
 // =====================================================================================
-static bool     ProcessModel()
+static void     ProcessModel( int modnum )
 {
         surfchain_t*    surfs;
-        brush_t			*detailbrushes;
-        brush_t                 *surfbrushes;
         node_t*         nodes;
+        node_t*         outside_node;
         dmodel_t*       model;
         int             startleafs;
 
-        surfs = ReadSurfs( polyfiles[0] );
-
-        if ( !surfs )
-                return false;                                      // all models are done
-        detailbrushes = ReadBrushes( brushfiles[0] );
-        surfbrushes = MakeBrushListFromSurfs( surfs );
-
-        hlassume( g_bspdata->nummodels < MAX_MAP_MODELS, assume_MAX_MAP_MODELS );
+        surfs = g_modelwork[modnum].surfs;
+        nodes = g_modelwork[modnum].nodes;
+        outside_node = g_modelwork[modnum].outside_node;
 
         startleafs = g_bspdata->numleafs;
-        int modnum = g_bspdata->nummodels;
         model = &g_bspdata->dmodels[modnum];
         g_bspdata->nummodels++;
 
@@ -1224,19 +1249,13 @@ static bool     ProcessModel()
                 }
         }
 
-        // SolidBSP generates a node tree
-        nodes = SolidBSP( surfs,
-                          detailbrushes,
-                          surfbrushes,
-                          modnum == 0 );
-
         // build all the portals in the bsp tree
         // some portals are solid polygons, and some are paths to other leafs
         if ( g_bspdata->nummodels == 1 && !g_nofill )                       // assume non-world bmodels are simple
         {
                 if ( !g_noinsidefill )
-                        FillInside( nodes );
-                nodes = FillOutside( nodes, ( g_bLeaked != true ), 0 );                  // make a leakfile if bad
+                        FillInside( nodes, outside_node );
+                nodes = FillOutside( nodes, outside_node, ( g_bLeaked != true ), 0 );                  // make a leakfile if bad
         }
 
         FreePortals( nodes );
@@ -1341,7 +1360,6 @@ static bool     ProcessModel()
                          ( ent ? ValueForKey( ent, "targetname" ) : "unknown" ),
                          model->mins[0], model->mins[1], model->mins[2], model->maxs[0], model->maxs[1], model->maxs[2] );
         }
-        return true;
 }
 
 // =====================================================================================
@@ -1445,6 +1463,28 @@ static void     Settings()
         Log( "\n\n" );
 }
 
+// =====================================================================================
+//  ReleaseObjectPools
+//      Every face, surface, portal, brush and node of the compile is dead by now,
+//      so their pools are released in bulk.
+// =====================================================================================
+static void     ReleaseObjectPools()
+{
+        Verbose( "%10u faces allocated in %u blocks\n", (unsigned)ObjectPool<face_t>::GetNumAllocs(), (unsigned)ObjectPool<face_t>::GetNumBlocks() );
+        Verbose( "%10u surfaces allocated in %u blocks\n", (unsigned)ObjectPool<surface_t>::GetNumAllocs(), (unsigned)ObjectPool<surface_t>::GetNumBlocks() );
+        Verbose( "%10u portals allocated in %u blocks\n", (unsigned)ObjectPool<portal_t>::GetNumAllocs(), (unsigned)ObjectPool<portal_t>::GetNumBlocks() );
+        Verbose( "%10u brushes allocated in %u blocks\n", (unsigned)ObjectPool<brush_t>::GetNumAllocs(), (unsigned)ObjectPool<brush_t>::GetNumBlocks() );
+        Verbose( "%10u brush sides allocated in %u blocks\n", (unsigned)ObjectPool<side_t>::GetNumAllocs(), (unsigned)ObjectPool<side_t>::GetNumBlocks() );
+        Verbose( "%10u nodes allocated in %u blocks\n", (unsigned)ObjectPool<node_t>::GetNumAllocs(), (unsigned)ObjectPool<node_t>::GetNumBlocks() );
+
+        ObjectPool<face_t>::ReleaseAll();
+        ObjectPool<surface_t>::ReleaseAll();
+        ObjectPool<portal_t>::ReleaseAll();
+        ObjectPool<brush_t>::ReleaseAll();
+        ObjectPool<side_t>::ReleaseAll();
+        ObjectPool<node_t>::ReleaseAll();
+}
+
 // =====================================================================================
 //  ProcessFile
 // =====================================================================================
@@ -1470,44 +1510,24 @@ static void     ProcessFile( const char* const filename )
         {
                 //mapname.p[0-3]
                 sprintf( name, "%s.p%i", filename, i );
-                polyfiles[i] = fopen( name, "r" );
-
-                if ( !polyfiles[i] )
+                if ( !HullFileOpenRead( name, &polyfiles[i] ) )
                         Error( "Can't open %s", name );
                 sprintf( name, "%s.b%i", filename, i );
-                brushfiles[i] = fopen( name, "r" );
-                if ( !brushfiles[i] )
+                if ( !HullFileOpenRead( name, &brushfiles[i] ) )
                         Error( "Can't open %s", name );
         }
         {
-                FILE			*f;
+                hullfile_t		hsz;
                 char			name[_MAX_PATH];
                 safe_snprintf( name, _MAX_PATH, "%s.hsz", filename );
-                f = fopen( name, "r" );
-                if ( !f )
+                if ( !HullFileOpenRead( name, &hsz ) )
                 {
                         Warning( "Couldn't open %s", name );
                 }
                 else
                 {
-                        float x1, y1, z1;
-                        float x2, y2, z2;
-                        for ( i = 0; i < NUM_HULLS; i++ )
-                        {
-                                int count;
-                                count = fscanf( f, "%f %f %f %f %f %f\n", &x1, &y1, &z1, &x2, &y2, &z2 );
-                                if ( count != 6 )
-                                {
-                                        Error( "Load hull size (line %i): scanf failure", i + 1 );
-                                }
-                                g_hull_size[i][0][0] = x1;
-                                g_hull_size[i][0][1] = y1;
-                                g_hull_size[i][0][2] = z1;
-                                g_hull_size[i][1][0] = x2;
-                                g_hull_size[i][1][1] = y2;
-                                g_hull_size[i][1][2] = z2;
-                        }
-                        fclose( f );
+                        memcpy( g_hull_size, HullFileRead( &hsz, sizeof( g_hull_size ) ), sizeof( g_hull_size ) );
+                        HullFileClose( &hsz );
                 }
         }
 
@@ -1521,23 +1541,30 @@ static void     ProcessFile( const char* const filename )
         // init the tables to be shared by all models
         BeginBSPFile();
 
-        // process each model individually
-        while ( ProcessModel() )
+        // read every model, build all of the trees at once, then emit the models in order
+        while ( ReadModel() )
                 ;
+        RunThreadsOnIndividual( (int)g_modelwork.size(), false, BuildModelTree );
+        CheckFatal();
+        for ( i = 0; i < (int)g_modelwork.size(); i++ )
+        {
+                ProcessModel( i );
+        }
+        g_modelwork.clear();
 
         // write the updated bsp file out
         FinishBSPFile();
 
+        ReleaseObjectPools();
+
         // Because the bsp file has been updated, these polyfiles are no longer valid.
         for ( i = 0; i < NUM_HULLS; i++ )
         {
                 sprintf( name, "%s.p%i", filename, i );
-                fclose( polyfiles[i] );
-                polyfiles[i] = NULL;
+                HullFileClose( &polyfiles[i] );
                 unlink( name );
                 sprintf( name, "%s.b%i", filename, i );
-                fclose( brushfiles[i] );
-                brushfiles[i] = NULL;
+                HullFileClose( &brushfiles[i] );
                 unlink( name );
         }
         safe_snprintf( name, _MAX_PATH, "%s.hsz", filename );
@@ -1575,7 +1602,7 @@ int             main( const int argc, char** argv )
                                 {
                                         if ( i + 1 < argc )	//added "1" .--vluzacn
                                         {
-                                                int             g_numthreads = atoi( argv[++i] );
+                                                g_numthreads = atoi( argv[++i] );
 
                                                 if ( g_numthreads < 1 )
                                                 {
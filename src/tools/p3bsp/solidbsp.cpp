@@ -29,9 +29,12 @@
 
 int             g_maxnode_size = DEFAULT_MAXNODE_SIZE;
 
-static bool g_reportProgress = false;
-static int  g_numProcessed = 0;
-static int  g_numReported = 0;
+// SolidBSP runs on several models at once, so the progress state and the
+// model being built are kept per thread.
+static thread_local bool g_reportProgress = false;
+static thread_local int  g_numProcessed = 0;
+static thread_local int  g_numReported = 0;
+static thread_local int  g_modnum = 0;
 
 static void ResetStatus( bool report_progress )
 {
@@ -1204,15 +1207,15 @@ static void     LinkLeafFaces( surface_t* planelist, node_t* leafnode )
         }
         if ( surf )
         {
-                entity_t *ent = EntityForModel( g_bspdata, g_bspdata->nummodels - 1 );
-                if ( g_bspdata->nummodels - 1 != 0 && ent == &g_bspdata->entities[0] )
+                entity_t *ent = EntityForModel( g_bspdata, g_modnum );
+                if ( g_modnum != 0 && ent == &g_bspdata->entities[0] )
                 {
                         ent = NULL;
                 }
                 Warning( "Ambiguous leafnode content ( %s and %s ) at (%.0f,%.0f,%.0f)-(%.0f,%.0f,%.0f) in hull %d of model %d (entity: classname \"%s\", origin \"%s\", targetname \"%s\")",
                          ContentsToString( ContentsForRank( r ) ), ContentsToString( ContentsForRank( rank ) ),
                          leafnode->mins[0], leafnode->mins[1], leafnode->mins[2], leafnode->maxs[0], leafnode->maxs[1], leafnode->maxs[2],
-                         g_hullnum, g_bspdata->nummodels - 1,
+                         g_hullnum, g_modnum,
                          ( ent ? ValueForKey( ent, "classname" ) : "unknown" ),
                          ( ent ? ValueForKey( ent, "origin" ) : "unknown" ),
                          ( ent ? ValueForKey( ent, "targetname" ) : "unknown" ) );
@@ -1705,10 +1708,13 @@ static void     BuildBspTree_r( node_t* node )
 node_t*         SolidBSP( const surfchain_t* const surfhead,
                           brush_t *detailbrushes,
                           brush_t *surfbrushes,
+                          node_t* outside_node,
+                          int modnum,
                           bool report_progress )
 {
         node_t*         headnode;
 
+        g_modnum = modnum;
         ResetStatus( report_progress );
         double start_time = I_FloatTime();
         if ( report_progress )
@@ -1732,7 +1738,7 @@ node_t*         SolidBSP( const surfchain_t* const surfhead,
 
 
         // generate six portals that enclose the entire world
-        MakeHeadnodePortals( headnode, surfhead->mins, surfhead->maxs );
+        MakeHeadnodePortals( headnode, outside_node, surfhead->mins, surfhead->maxs );
 
         // recursively partition everything
         BuildBspTree_r( headnode );
@@ -333,7 +333,7 @@ static void     FreeDrawNodes_r( node_t* node )
                 FreeFace( f );
         }
 
-        free( node );
+        FreeNode( node );
 }
 
 // =====================================================================================
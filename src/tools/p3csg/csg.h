@@ -22,6 +22,7 @@
 #include "bspfile.h"
 #include "blockmem.h"
 #include "filelib.h"
+#include "hullio.h"
 #include "boundingbox.h"
 // AJM: added in
 //#include "wadpath.h"
@@ -218,18 +218,16 @@ void            WriteFace( const int hull, const bface_t* const f
         // .p0 format
         w = f->w;
 
-        // plane summary
-        fprintf( out[hull], "%i %i %i %i %i %i %i\n", detaillevel, f->planenum, f->texinfo, f->contents, f->brushnum, f->brushside, (int)w->m_NumPoints );
-
-        // for each of the points on the face
-        for ( i = 0; i < w->m_NumPoints; i++ )
-        {
-                // write the co-ords
-                fprintf( out[hull], "%5.8f %5.8f %5.8f\n", w->m_Points[i][0], w->m_Points[i][1], w->m_Points[i][2] );
-        }
-
-        // put in an extra line break
-        fprintf( out[hull], "\n" );
+        // plane summary, followed by the points on the face
+        hullface_t      face;
+        face.detaillevel = detaillevel;
+        face.planenum = f->planenum;
+        face.texinfo = f->texinfo;
+        face.contents = f->contents;
+        face.brushnum = f->brushnum;
+        face.brushside = f->brushside;
+        face.numpoints = (int)w->m_NumPoints;
+        HullFileWriteFace( out[hull], &face, w->m_Points );
         if ( g_viewsurface )
         {
                 static bool side = false;
@@ -259,17 +257,13 @@ void            WriteFace( const int hull, const bface_t* const f
 void WriteDetailBrush( int hull, const bface_t *faces )
 {
         ThreadLock();
-        fprintf( out_detailbrush[hull], "0\n" );
+        HullFileWriteBrushBegin( out_detailbrush[hull] );
         for ( const bface_t *f = faces; f; f = f->next )
         {
                 Winding *w = f->w;
-                fprintf( out_detailbrush[hull], "%i %u\n", f->planenum, w->m_NumPoints );
-                for ( int i = 0; i < w->m_NumPoints; i++ )
-                {
-                        fprintf( out_detailbrush[hull], "%5.8f %5.8f %5.8f\n", w->m_Points[i][0], w->m_Points[i][1], w->m_Points[i][2] );
-                }
+                HullFileWriteBrushSide( out_detailbrush[hull], f->planenum, (int)w->m_NumPoints, w->m_Points );
         }
-        fprintf( out_detailbrush[hull], "-1 -1\n" );
+        HullFileWriteBrushEnd( out_detailbrush[hull] );
         ThreadUnlock();
 }
 
@@ -1230,8 +1224,8 @@ static void     ProcessModels()
                 // write end of model marker
                 for ( j = 0; j < NUM_HULLS; j++ )
                 {
-                        fprintf( out[j], "-1 -1 -1 -1 -1 -1 -1\n" );
-                        fprintf( out_detailbrush[j], "-1\n" );
+                        HullFileWriteEndModel( out[j] );
+                        HullFileWriteBrushEndModel( out_detailbrush[j] );
                 }
         }
 }
@@ -2110,14 +2104,9 @@ int             main( const int argc, char** argv )
 
                                 safe_snprintf( name, _MAX_PATH, "%s.p%i", g_Mapname, i );
 
-                                out[i] = fopen( name, "w" );
-
-                                if ( !out[i] )
-                                        Error( "Couldn't open %s", name );
+                                out[i] = HullFileOpenWrite( name );
                                 safe_snprintf( name, _MAX_PATH, "%s.b%i", g_Mapname, i );
-                                out_detailbrush[i] = fopen( name, "w" );
-                                if ( !out_detailbrush[i] )
-                                        Error( "Couldn't open %s", name );
+                                out_detailbrush[i] = HullFileOpenWrite( name );
                                 if ( g_viewsurface )
                                 {
                                         safe_snprintf( name, _MAX_PATH, "%s_surface%i.pts", g_Mapname, i );
@@ -2130,21 +2119,8 @@ int             main( const int argc, char** argv )
                                 FILE			*f;
                                 char			name[_MAX_PATH];
                                 safe_snprintf( name, _MAX_PATH, "%s.hsz", g_Mapname );
-                                f = fopen( name, "w" );
-                                if ( !f )
-                                        Error( "Couldn't open %s", name );
-                                float x1, y1, z1;
-                                float x2, y2, z2;
-                                for ( i = 0; i < NUM_HULLS; i++ )
-                                {
-                                        x1 = g_hull_size[i][0][0];
-                                        y1 = g_hull_size[i][0][1];
-                                        z1 = g_hull_size[i][0][2];
-                                        x2 = g_hull_size[i][1][0];
-                                        y2 = g_hull_size[i][1][1];
-                                        z2 = g_hull_size[i][1][2];
-                                        fprintf( f, "%g %g %g %g %g %g\n", x1, y1, z1, x2, y2, z2 );
-                                }
+                                f = HullFileOpenWrite( name );
+                                SafeWrite( f, g_hull_size, sizeof( g_hull_size ) );
                                 fclose( f );
                         }
 
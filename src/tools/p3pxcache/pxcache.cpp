@@ -0,0 +1,198 @@
+/*
+
+PHYSX COLLISION MESH CACHE
+
+Cooks the PhysX collision meshes of a compiled level into the .pxcache file next
+to the BSP, so they don't have to be cooked when the level is loaded. The cache
+is then read back from disk and compared with the meshes that were cooked.
+
+*/
+
+#include "cmdlib.h"
+#include "messages.h"
+#include "win32fix.h"
+#include "log.h"
+#include "hlassert.h"
+#include "mathlib.h"
+#include "bspfile.h"
+#include "filelib.h"
+#include "cmdlinecfg.h"
+
+#include "phys_mesh_cache.h"
+
+static bool g_verify = true;
+
+// =====================================================================================
+//  Usage
+// =====================================================================================
+static void     Usage()
+{
+        Banner();
+
+        Log( "\n-= %s Options =-\n\n", g_Program );
+        Log( "    -noverify       : don't read the cache back and compare it\n" );
+        Log( "    -nolog          : don't generate the compile logfiles\n" );
+        Log( "    mapfile         : The mapfile to cook the collision meshes of\n\n" );
+
+        exit( 1 );
+}
+
+// =====================================================================================
+//  BuildModelMesh
+//      The faces of the model as the level loader hands them to the physics
+//      world: in units of 16, relative to the center of brush models.
+// =====================================================================================
+static bool     BuildModelMesh( const bspdata_t *data, int modelnum, CPhysMeshData *mesh )
+{
+        const dmodel_t *model = data->dmodels + modelnum;
+
+        LVector3 center( 0 );
+        if ( modelnum != 0 )
+        {
+                LVector3 origin( model->origin[0], model->origin[1], model->origin[2] );
+                LVector3 mins( model->mins[0], model->mins[1], model->mins[2] );
+                LVector3 maxs( model->maxs[0], model->maxs[1], model->maxs[2] );
+                center = ( ( ( mins + maxs ) / 2.0 ) + origin ) / 16.0f;
+        }
+
+        for ( int facenum = model->firstface; facenum < model->firstface + model->numfaces; facenum++ )
+        {
+                const dface_t *face = data->dfaces + facenum;
+
+                int first = mesh->get_num_vertices();
+                for ( int i = 0; i < face->numedges; i++ )
+                {
+                        mesh->add_vertex( ( VertCoord( data, face, i ) / 16.0f ) - center );
+                }
+
+                for ( int tri = 0; tri < face->numedges - 2; tri++ )
+                {
+                        mesh->add_triangle( first, first + tri + 1, first + tri + 2 );
+                }
+        }
+
+        return mesh->get_num_triangles() > 0;
+}
+
+// =====================================================================================
+//  main
+// =====================================================================================
+int             main( const int argc, char** argv )
+{
+        char            source[_MAX_PATH];
+        int             i;
+        double          start, end;
+        const char*     mapname_from_arg = NULL;
+
+        g_Program = "p3pxcache";
+
+        int argcold = argc;
+        char ** argvold = argv;
+        {
+                int argc;
+                char ** argv;
+                ParseParamFile( argcold, argvold, argc, argv );
+
+                if ( argc == 1 )
+                {
+                        Usage();
+                }
+
+                for ( i = 1; i < argc; i++ )
+                {
+                        if ( !strcasecmp( argv[i], "-noverify" ) )
+                        {
+                                g_verify = false;
+                        }
+                        else if ( !strcasecmp( argv[i], "-nolog" ) )
+                        {
+                                g_log = false;
+                        }
+                        else if ( argv[i][0] == '-' )
+                        {
+                                Log( "Unknown option \"%s\"\n", argv[i] );
+                                Usage();
+                        }
+                        else if ( !mapname_from_arg )
+                        {
+                                mapname_from_arg = argv[i];
+                        }
+                        else
+                        {
+                                Log( "Unknown option \"%s\"\n", argv[i] );
+                                Usage();
+                        }
+                }
+
+                if ( !mapname_from_arg )
+                {
+                        Log( "No mapfile specified\n" );
+                        Usage();
+                }
+
+                safe_strncpy( g_Mapname, mapname_from_arg, _MAX_PATH );
+                FlipSlashes( g_Mapname );
+                StripExtension( g_Mapname );
+                OpenLog( g_clientid );
+                atexit( CloseLog );
+                LogStart( argcold, argvold );
+                CheckForErrorLog();
+
+                dtexdata_init();
+                atexit( dtexdata_free );
+
+                start = I_FloatTime();
+
+                safe_strncpy( source, g_Mapname, _MAX_PATH );
+                safe_strncat( source, ".bsp", _MAX_PATH );
+                g_bspdata = LoadBSPFile( source );
+
+                unsigned int key = CollisionChecksum( g_bspdata );
+                Filename cache_file = CPhysMeshCache::get_cache_filename( Filename::from_os_specific( source ) );
+
+                // Cook every model, the same way the game would on a cache miss.
+                PT( CPhysMeshCache ) cache = new CPhysMeshCache( key );
+                int numcooked = 0;
+                for ( int modelnum = 0; modelnum < g_bspdata->nummodels; modelnum++ )
+                {
+                        PT( CPhysMeshData ) mesh = new CPhysMeshData;
+                        if ( !BuildModelMesh( g_bspdata, modelnum, mesh ) )
+                        {
+                                continue;
+                        }
+
+                        if ( !cache->cook_triangle_mesh( modelnum, mesh ) )
+                        {
+                                Error( "Could not cook the collision mesh of model %i\n", modelnum );
+                        }
+                        numcooked++;
+                }
+                Log( "%i of %i models cooked, key %08x\n", numcooked, g_bspdata->nummodels, key );
+
+                if ( !cache->write( cache_file ) )
+                {
+                        Error( "Could not write %s\n", cache_file.to_os_specific().c_str() );
+                }
+
+                // Read the file back the way the game does and check that every
+                // mesh comes out the same.
+                if ( g_verify )
+                {
+                        PT( CPhysMeshCache ) check = new CPhysMeshCache( key );
+                        if ( !check->read( cache_file ) )
+                        {
+                                Error( "Could not read back %s\n", cache_file.to_os_specific().c_str() );
+                        }
+                        if ( !check->has_same_meshes( cache ) )
+                        {
+                                Error( "%s does not match the cooked meshes\n", cache_file.to_os_specific().c_str() );
+                        }
+                        Log( "%s read back with identical meshes\n", cache_file.to_os_specific().c_str() );
+                }
+
+                end = I_FloatTime();
+                LogTimeElapsed( end - start );
+        }
+
+        return 0;
+}
@@ -66,17 +66,36 @@ public:
                                             LVector3 &sample_pos )
         {
                 dleaf_t *leaf = &g_bspdata->dleafs[leaf_id];
+                LVector3 mins( leaf->mins[0], leaf->mins[1], leaf->mins[2] );
+                LVector3 maxs( leaf->maxs[0], leaf->maxs[1], leaf->maxs[2] );
 
-                float dx = leaf->maxs[0] - leaf->mins[0];
-                float dy = leaf->maxs[1] - leaf->mins[1];
-                float dz = leaf->maxs[2] - leaf->mins[2];
+                if ( !generate_sample_position_in_box( leaf_id, leaf_planes, mins, maxs, sample_pos ) )
+                {
+                        // Didn't generate a valid sample point, just use the center of the leaf bbox
+                        sample_pos = ( mins + maxs ) / 2.0;
+                }
+        }
+
+        /**
+         * Picks a random point inside both the leaf and the given box (which is part
+         * of the leaf's bounds). Returns false if no valid point was found.
+         */
+        bool generate_sample_position_in_box( int leaf_id, const vector_dplane &leaf_planes,
+                                              const LVector3 &mins, const LVector3 &maxs,
+                                              LVector3 &sample_pos )
+        {
+                dleaf_t *leaf = &g_bspdata->dleafs[leaf_id];
+
+                float dx = maxs[0] - mins[0];
+                float dy = maxs[1] - mins[1];
+                float dz = maxs[2] - mins[2];
 
                 bool valid = false;
                 for ( int i = 0; i < 1000 && !valid; i++ )
                 {
-                        sample_pos[0] = leaf->mins[0] + _random.random_real( dx );
-                        sample_pos[1] = leaf->mins[1] + _random.random_real( dy );
-                        sample_pos[2] = leaf->mins[2] + _random.random_real( dz );
+                        sample_pos[0] = mins[0] + _random.random_real( dx );
+                        sample_pos[1] = mins[1] + _random.random_real( dy );
+                        sample_pos[2] = mins[2] + _random.random_real( dz );
                         valid = true;
                         for ( int j = (int)leaf_planes.size() - 1; j >= 0 && valid; j-- )
                         {
@@ -120,11 +139,7 @@ public:
                         }
                 }
 
-                if ( !valid )
-                {
-                        // Didn't generate a valid sample point, just use the center of the leaf bbox
-                        sample_pos = ( LPoint3( leaf->mins[0], leaf->mins[1], leaf->mins[2] ) + LPoint3( leaf->maxs[0], leaf->maxs[1], leaf->maxs[2] ) ) / 2.0;
-                }
+                return valid;
         }
 
 private:
@@ -430,6 +445,253 @@ void add_sample_to_list( vector_ambientsample &list, const LVector3 &sample_pos,
         list.erase( list.begin() + nearest_neighbor_idx );
 }
 
+/**
+ * A box of the leaf's bounds that is covered by one ambient sample.
+ */
+struct AmbientCell
+{
+        LVector3 mins;
+        LVector3 maxs;
+        // Index into the leaf's sample list, -1 if no point of the leaf lies in the cell.
+        int sample;
+};
+
+typedef pvector<AmbientCell> vector_ambientcell;
+
+// Cells are not split below the size of the volume grid used to cap the sample count.
+static const LVector3 min_ambient_cell_size( 32, 32, 64 );
+
+// Differences darker than this are invisible and never cause a refinement.
+static const float min_ambient_error_brightness = 1.0f / 255.0f;
+
+/**
+ * Returns the largest relative difference between two ambient cubes,
+ * per side and per color component.
+ */
+static float ambient_cube_error( const LVector3 *a, const LVector3 *b )
+{
+        float error = 0;
+        for ( int k = 0; k < 6; k++ )
+        {
+                for ( int s = 0; s < 3; s++ )
+                {
+                        float peak = max( max( a[k][s], b[k][s] ), min_ambient_error_brightness );
+                        error = max( error, (float)std::fabs( a[k][s] - b[k][s] ) / peak );
+                }
+        }
+
+        return error;
+}
+
+static bool ambient_cells_touch( const AmbientCell &a, const AmbientCell &b )
+{
+        for ( int i = 0; i < 3; i++ )
+        {
+                if ( a.mins[i] > b.maxs[i] + ON_EPSILON || b.mins[i] > a.maxs[i] + ON_EPSILON )
+                {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+/**
+ * Returns the number of cells the given cell would be split into.
+ * Only axes that leave both halves at least the minimum cell size are split.
+ */
+static int get_ambient_cell_split( const AmbientCell &cell, bool *split_axis )
+{
+        int count = 1;
+        for ( int i = 0; i < 3; i++ )
+        {
+                split_axis[i] = ( cell.maxs[i] - cell.mins[i] ) >= min_ambient_cell_size[i] * 2;
+                if ( split_axis[i] )
+                {
+                        count *= 2;
+                }
+        }
+
+        return count;
+}
+
+/**
+ * Splits the cell in half along each splittable axis and places a sample in every child.
+ * The child that contains the parent's sample keeps it instead of getting a new one.
+ */
+static void split_ambient_cell( int thread, int leaf_id, const vector_dplane &leaf_planes,
+                                LeafSampler &sampler, const AmbientCell &cell,
+                                vector_ambientcell &cells, vector_ambientsample &samples )
+{
+        bool split_axis[3];
+        get_ambient_cell_split( cell, split_axis );
+
+        LVector3 center = ( cell.mins + cell.maxs ) / 2.0;
+
+        for ( int child_idx = 0; child_idx < 8; child_idx++ )
+        {
+                AmbientCell child;
+                bool skip = false;
+                for ( int i = 0; i < 3; i++ )
+                {
+                        bool upper = ( child_idx & ( 1 << i ) ) != 0;
+                        if ( !split_axis[i] )
+                        {
+                                if ( upper )
+                                {
+                                        skip = true;
+                                        break;
+                                }
+                                child.mins[i] = cell.mins[i];
+                                child.maxs[i] = cell.maxs[i];
+                        }
+                        else
+                        {
+                                child.mins[i] = upper ? center[i] : cell.mins[i];
+                                child.maxs[i] = upper ? cell.maxs[i] : center[i];
+                        }
+                }
+
+                if ( skip )
+                {
+                        continue;
+                }
+
+                child.sample = -1;
+
+                if ( cell.sample != -1 )
+                {
+                        const LVector3 &pos = samples[cell.sample].pos;
+                        if ( pos[0] >= child.mins[0] && pos[0] <= child.maxs[0] &&
+                             pos[1] >= child.mins[1] && pos[1] <= child.maxs[1] &&
+                             pos[2] >= child.mins[2] && pos[2] <= child.maxs[2] )
+                        {
+                                child.sample = cell.sample;
+                        }
+                }
+
+                if ( child.sample == -1 )
+                {
+                        AmbientSample sample;
+                        if ( sampler.generate_sample_position_in_box( leaf_id, leaf_planes, child.mins, child.maxs, sample.pos ) )
+                        {
+                                compute_ambient_from_spherical_samples( thread, sample.pos, sample.cube );
+                                child.sample = (int)samples.size();
+                                samples.push_back( sample );
+                        }
+                }
+
+                cells.push_back( child );
+        }
+}
+
+/**
+ * Places ambient samples in the leaf adaptively. The leaf bounds are split into a
+ * coarse set of cells with one sample each. Cells whose ambient cube differs from
+ * a neighboring cell's by more than g_leaf_ambient_error are split again, largest
+ * error first, until the lighting is smooth or the sample budget is spent.
+ * Uniformly lit leafs stop after the coarse pass.
+ */
+static void compute_adaptive_ambient_samples( int thread, int leaf_id, const vector_dplane &leaf_planes,
+                                              LeafSampler &sampler, int max_samples,
+                                              vector_ambientsample &samples )
+{
+        dleaf_t *leaf = &g_bspdata->dleafs[leaf_id];
+
+        AmbientCell root;
+        root.mins.set( leaf->mins[0], leaf->mins[1], leaf->mins[2] );
+        root.maxs.set( leaf->maxs[0], leaf->maxs[1], leaf->maxs[2] );
+        root.sample = -1;
+
+        vector_ambientcell cells;
+        split_ambient_cell( thread, leaf_id, leaf_planes, sampler, root, cells, samples );
+
+        pvector<std::pair<float, int>> refine;
+        pvector<bool> split;
+        bool split_axis[3];
+
+        while ( (int)samples.size() < max_samples )
+        {
+                // Find the cells that disagree with a neighbor.
+                refine.clear();
+                for ( size_t i = 0; i < cells.size(); i++ )
+                {
+                        if ( cells[i].sample == -1 || get_ambient_cell_split( cells[i], split_axis ) == 1 )
+                        {
+                                continue;
+                        }
+
+                        float error = 0;
+                        for ( size_t j = 0; j < cells.size(); j++ )
+                        {
+                                if ( j == i || cells[j].sample == -1 || cells[j].sample == cells[i].sample )
+                                {
+                                        continue;
+                                }
+
+                                if ( !ambient_cells_touch( cells[i], cells[j] ) )
+                                {
+                                        continue;
+                                }
+
+                                error = max( error, ambient_cube_error( samples[cells[i].sample].cube,
+                                                                        samples[cells[j].sample].cube ) );
+                        }
+
+                        if ( error > g_leaf_ambient_error )
+                        {
+                                refine.push_back( std::make_pair( error, (int)i ) );
+                        }
+                }
+
+                if ( refine.empty() )
+                {
+                        break;
+                }
+
+                std::sort( refine.begin(), refine.end(), std::greater<std::pair<float, int>>() );
+
+                // Split the worst cells while we can afford their new samples.
+                // A split cell needs at most one new sample per child, minus the one it keeps.
+                split.assign( cells.size(), false );
+                int budget = max_samples - (int)samples.size();
+                for ( size_t i = 0; i < refine.size(); i++ )
+                {
+                        int cost = get_ambient_cell_split( cells[refine[i].second], split_axis ) - 1;
+                        if ( cost > budget )
+                        {
+                                continue;
+                        }
+
+                        split[refine[i].second] = true;
+                        budget -= cost;
+                }
+
+                vector_ambientcell next_cells;
+                next_cells.reserve( cells.size() * 2 );
+                bool any_split = false;
+                for ( size_t i = 0; i < cells.size(); i++ )
+                {
+                        if ( split[i] )
+                        {
+                                split_ambient_cell( thread, leaf_id, leaf_planes, sampler, cells[i], next_cells, samples );
+                                any_split = true;
+                        }
+                        else
+                        {
+                                next_cells.push_back( cells[i] );
+                        }
+                }
+
+                if ( !any_split )
+                {
+                        break;
+                }
+
+                cells.swap( next_cells );
+        }
+}
+
 void compute_ambient_for_leaf( int thread, int leaf_id,
                                vector_ambientsample &list )
 {
@@ -456,13 +718,29 @@ void compute_ambient_for_leaf( int thread, int leaf_id,
         int volume_count = xsize * ysize * zsize;
         // Don't do any more than 128 samples
         int sample_count = clamp( volume_count, 1, 128 );
-        LVector3 cube[6];
-        for ( int i = 0; i < sample_count; i++ )
+
+        vector_ambientsample samples;
+        if ( g_leaf_ambient_error > 0 )
+        {
+                compute_adaptive_ambient_samples( thread, leaf_id, leaf_planes, sampler, sample_count, samples );
+        }
+
+        if ( samples.empty() )
+        {
+                // Adaptive sampling is disabled or found no point inside the leaf,
+                // fall back to sampling the whole volume.
+                int count = ( g_leaf_ambient_error > 0 ) ? 1 : sample_count;
+                samples.resize( count );
+                for ( int i = 0; i < count; i++ )
+                {
+                        sampler.generate_leaf_sample_position( leaf_id, leaf_planes, samples[i].pos );
+                        compute_ambient_from_spherical_samples( thread, samples[i].pos, samples[i].cube );
+                }
+        }
+
+        for ( size_t i = 0; i < samples.size(); i++ )
         {
-                LVector3 sample_pos;
-                sampler.generate_leaf_sample_position( leaf_id, leaf_planes, sample_pos );
-                compute_ambient_from_spherical_samples( thread, sample_pos, cube );
-                add_sample_to_list( list, sample_pos, cube );
+                add_sample_to_list( list, samples[i].pos, samples[i].cube );
         }
 }
 
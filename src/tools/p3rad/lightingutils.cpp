@@ -21,6 +21,53 @@
 
 #define NEVER_UPDATED -9999
 
+// Average color of every lightmap of every face, by face and lightstyle slot.
+static pvector<LRGBColor> g_face_avg_colors;
+
+static void ComputeFaceAvgLightColor( const int facenum )
+{
+        const dface_t *face = &g_bspdata->dfaces[facenum];
+        LRGBColor *avgs = &g_face_avg_colors[facenum * MAXLIGHTMAPS];
+
+        if ( face->lightofs == -1 )
+        {
+                return;
+        }
+
+        int luxels = ( face->lightmap_size[0] + 1 ) * ( face->lightmap_size[1] + 1 );
+        for ( int maps = 0; maps < MAXLIGHTMAPS && face->styles[maps] != 0xFF; maps++ )
+        {
+                LRGBColor avg( 0 );
+                for ( int i = 0; i < luxels; i++ )
+                {
+                        LVector3 vcol( 0 );
+                        ColorRGBExp32ToVector( *SampleLightmap( g_bspdata, face, i, maps, 0 ), vcol );
+                        avg += vcol;
+                }
+                avgs[maps] = avg / luxels;
+        }
+}
+
+/**
+ * Computes the average lightmap color of every face up front, so the ambient
+ * lighting passes can read them from any thread without locking.
+ * Must run after the final lightmaps are written.
+ */
+void ComputeFaceAvgLightColors()
+{
+        g_face_avg_colors.clear();
+        g_face_avg_colors.resize( g_bspdata->numfaces * MAXLIGHTMAPS, LRGBColor( 0 ) );
+        NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, ComputeFaceAvgLightColor );
+}
+
+/**
+ * Returns the average color of the lightmap in the given lightstyle slot of the face.
+ */
+INLINE const LRGBColor &GetFaceAvgLightColor( const dface_t *face, int maps )
+{
+        return g_face_avg_colors[( face - g_bspdata->dfaces ) * MAXLIGHTMAPS + maps];
+}
+
 static bool test_point_against_surface( const LVector3 &point, dface_t *face, texinfo_t *tex, LTexCoordf &luxel_coord )
 {
         // Specials don't have lightmaps
@@ -271,10 +318,7 @@ static void compute_lightmap_color_from_average( dface_t *face, directlight_t *s
         for ( int maps = 0; maps < MAXLIGHTMAPS && face->styles[maps] != 0xFF; maps++ )
         {
                 int style = face->styles[maps];
-                ThreadLock();
-                LRGBColor avg_color = dface_AvgLightColor( g_bspdata, face, style );
-                ThreadUnlock();
-                LRGBColor color = avg_color;
+                LRGBColor color = GetFaceAvgLightColor( face, maps );
 
                 compute_ambient_from_surface( face, skylight, color );  
                 colors[style] += color * scale;
@@ -614,9 +658,7 @@ void ComputeIndirectLightingAtPoint( const LVector3 &vpos, const LNormalf &vnorm
                         LVector3 lightmap_col;
                         if ( surf.has_luxel.m128_u32[i] == 0 )
                         {
-                                ThreadLock();
-                                lightmap_col = dface_AvgLightColor( g_bspdata, surf.surface[i], 0 );
-                                ThreadUnlock();
+                                lightmap_col = GetFaceAvgLightColor( surf.surface[i], 0 );
                         }
                         else
                         {
@@ -647,10 +689,24 @@ void ComputeIndirectLightingAtPoint( const LVector3 &vpos, const LNormalf &vnorm
         }
 }
 
-void ComputeDirectLightingAtPoint( const LVector3 &vpos, const LNormalf &vnormal, LVector3 &color )
+/**
+ * Computes the direct lighting at up to 4 points at once, one per SIMD lane.
+ * The color of each point is added to colors[i].
+ */
+void ComputeDirectLightingAt4Points( const FourVectors &pos, const FourVectors &normals,
+                                     int num_points, LVector3 *colors )
 {
         SSE_sampleLightOutput_t output;
-        int leaf = PointInLeaf( vpos ) - g_bspdata->dleafs;
+        int thread = GetCurrentThreadNumber();
+
+        int leafs[4];
+        for ( int i = 0; i < num_points; i++ )
+        {
+                leafs[i] = PointInLeaf( pos.Vec( i ) ) - g_bspdata->dleafs;
+        }
+
+        fltx4 fudge_dist = ReplicateX4( 4.0f );
+
         for ( directlight_t *dl = Lights::activelights; dl != nullptr; dl = dl->next )
         {
                 // skip lights with style
@@ -658,40 +714,47 @@ void ComputeDirectLightingAtPoint( const LVector3 &vpos, const LNormalf &vnormal
                         continue;
 
                 // is this light potentially visible?
-                if ( !PVSCheck( dl->pvs, leaf ) )
-                        continue;
-
-                // push the vertex towards the light to avoid surface acne
-                LVector3 adjusted = vpos;
-                float epsilon = 0.0;
-                if ( dl->type != emit_skyambient )
+                fltx4 pvs_mask = Four_Zeros;
+                bool skip = true;
+                for ( int i = 0; i < num_points; i++ )
                 {
-                        // push towards the light
-                        LVector3 fudge;
-                        if ( dl->type == emit_skylight )
+                        if ( PVSCheck( dl->pvs, leafs[i] ) )
                         {
-                                fudge = -( dl->normal );
+                                pvs_mask = SetComponentSIMD( pvs_mask, i, 1.0f );
+                                skip = false;
                         }
-                        else
-                        {
-                                fudge = dl->origin - vpos;
-                                fudge.normalize();
-                        }
-                        fudge *= 4.0;
-                        adjusted += fudge;
+                }
+
+                if ( skip )
+                        continue;
+
+                // push the vertices towards the light to avoid surface acne
+                FourVectors adjusted = pos;
+                FourVectors fudge;
+                if ( dl->type == emit_skyambient )
+                {
+                        fudge = normals;
+                }
+                else if ( dl->type == emit_skylight )
+                {
+                        fudge.DuplicateVector( -( dl->normal ) );
                 }
                 else
                 {
-                        adjusted += 4.0 * vnormal;
+                        fudge.DuplicateVector( dl->origin );
+                        fudge -= pos;
+                        fudge.VectorNormalize();
                 }
+                fudge *= fudge_dist;
+                adjusted += fudge;
 
-                FourVectors adjusted4;
-                FourVectors normal4;
-                adjusted4.DuplicateVector( adjusted );
-                normal4.DuplicateVector( vnormal );
-
-                GatherSampleLightSSE( output, dl, -1, adjusted4, &normal4, 1, 0, 0, epsilon );
+                FourVectors normal4 = normals;
+                GatherSampleLightSSE( output, dl, -1, adjusted, &normal4, 1, thread, 0, 0.0f );
 
-                VectorMA( color, output.falloff.m128_f32[0] * output.dot[0].m128_f32[0], dl->intensity, color );
+                fltx4 amount = MulSIMD( MulSIMD( output.falloff, output.dot[0] ), pvs_mask );
+                for ( int i = 0; i < num_points; i++ )
+                {
+                        VectorMA( colors[i], SubFloat( amount, i ), dl->intensity, colors[i] );
+                }
         }
 }
\ No newline at end of file
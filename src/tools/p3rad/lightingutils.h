@@ -35,7 +35,10 @@ extern void compute_lightmap_color_from_average( dface_t *face, directlight_t *s
                                                  float scale, LVector3 *colors );
 extern void compute_lightmap_color_point_sample( dface_t *face, directlight_t *skylight, LTexCoordf &coord, float scale, LVector3 *colors );
 
+extern void ComputeFaceAvgLightColors();
+
 extern void ComputeIndirectLightingAtPoint( const LVector3 &vpos, const LNormalf &vnormal, LVector3 &color, bool ignore_normals );
-extern void ComputeDirectLightingAtPoint( const LVector3 &vpos, const LNormalf &vnormal, LVector3 &color );
+extern void ComputeDirectLightingAt4Points( const FourVectors &pos, const FourVectors &normals,
+                                            int num_points, LVector3 *colors );
 
 #endif // LIGHTINGUTILS_H
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "anorms.h"
 #include "bsptools.h"
 #include "trace.h"
+#include "radcache.h"
+#include "radcheckpoint.h"
+#include "skyvis.h"
 
 #include <CL/cl.h>
 
@@ -955,9 +958,6 @@ void ComputeIlluminationPointAndNormalsSSE( const lightinfo_t &l, const FourVect
 
 #define CONSTANT_DOT (.7/2)
 
-#define NSAMPLES_SUN_AREA_LIGHT 30							// number of samples to take for an
-                                                            // non-point sun light
-
 /**
  * Gathers light from sun (emit_skylight)
  */
@@ -989,29 +989,53 @@ void GatherSampleSkyLightSSE( SSE_sampleLightInput_t &input, SSE_sampleLightOutp
         fltx4 total_frac_vis = Four_Zeros;
         fltx4 frac_vis = Four_Zeros;
 
+        // share the sun rays with the other samples and sky lights of the cell
+        skyvis_t vis[4];
+        bool cached = SkyVisibilityEnabled() && input.dl == Lights::skylight &&
+                nsamples == GetNumSunDirections();
+        if ( cached )
+        {
+                skyvis_t needed;
+                ClearSkyVisibility( needed );
+                for ( int d = 0; d < nsamples; d++ )
+                {
+                        SetSkyDirection( needed, SKYVIS_SUN_DIR( d ) );
+                }
+                for ( int i = 0; i < 4; i++ )
+                {
+                        GetSkyVisibility( input.pos.Vec( i ), input.normals[0].Vec( i ), needed, vis[i] );
+                }
+        }
+
         DirectionalSampler_t sampler;
 
         for ( int d = 0; d < nsamples; d++ )
         {
-                // determine visibility of skylight
-                // search back to see if we can hit a sky brush
-                LVector3 delta;
-                VectorScale( input.dl->normal, -MAX_TRACE_LENGTH, delta );
-                if ( d )
+                fltx4 this_fraction;
+                if ( cached )
                 {
-                        // jitter light source location
-                        LVector3 ofs = sampler.NextValue();
-                        ofs *= MAX_TRACE_LENGTH * Lights::sun_angular_extent;
-                        delta += ofs;
+                        this_fraction = SkyDirectionVisible4( vis, SKYVIS_SUN_DIR( d ) );
                 }
-                
+                else
+                {
+                        // determine visibility of skylight
+                        // search back to see if we can hit a sky brush
+                        LVector3 delta;
+                        VectorScale( input.dl->normal, -MAX_TRACE_LENGTH, delta );
+                        if ( d )
+                        {
+                                // jitter light source location
+                                LVector3 ofs = sampler.NextValue();
+                                ofs *= MAX_TRACE_LENGTH * Lights::sun_angular_extent;
+                                delta += ofs;
+                        }
 
-                FourVectors delta4;
-                delta4.DuplicateVector( delta );
-                delta4 += input.pos;
+                        FourVectors delta4;
+                        delta4.DuplicateVector( delta );
+                        delta4 += input.pos;
 
-                fltx4 this_fraction;
-                RADTrace::test_four_lines( input.pos, delta4, &this_fraction, CONTENTS_SKY, true );
+                        RADTrace::test_four_lines( input.pos, delta4, &this_fraction, CONTENTS_SKY, true );
+                }
 
                 total_frac_vis = AddSIMD( total_frac_vis, this_fraction );
         }
@@ -1058,6 +1082,49 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightInput_t &input, SSE_sampleLightOu
         else
                 sky_samples *= g_skysamplescale;
 
+        // share the sky rays with the other samples and sky lights of the cell, each
+        // lane only asks for the directions that can light one of its normals
+        skyvis_t vis[4];
+        bool cached = SkyVisibilityEnabled() && input.dl == Lights::ambientlight &&
+                input.epsilon == 0.0f && sky_samples == GetNumSkyAmbientDirections();
+        if ( cached )
+        {
+                skyvis_t needed[4];
+                for ( int i = 0; i < 4; i++ )
+                {
+                        ClearSkyVisibility( needed[i] );
+                }
+
+                DirectionalSampler_t needed_sampler;
+                for ( int j = 0; j < sky_samples; j++ )
+                {
+                        FourVectors anorm;
+                        anorm.DuplicateVector( needed_sampler.NextValue() );
+
+                        fltx4 validity = CmpGtSIMD( NegSIMD( input.normals[0] * anorm ), ReplicateX4( EQUAL_EPSILON ) );
+                        if ( !ignore_normals && !TestSignSIMD( validity ) )
+                                continue;
+
+                        for ( int n = 1; n < input.normal_count; n++ )
+                        {
+                                validity = OrSIMD( validity, CmpGtSIMD( NegSIMD( input.normals[n] * anorm ),
+                                                                        ReplicateX4( EQUAL_EPSILON ) ) );
+                        }
+
+                        int lanes = ignore_normals ? 0xF : TestSignSIMD( validity );
+                        for ( int i = 0; i < 4; i++ )
+                        {
+                                if ( lanes & ( 1 << i ) )
+                                        SetSkyDirection( needed[i], SKYVIS_AMBIENT_DIR( j ) );
+                        }
+                }
+
+                for ( int i = 0; i < 4; i++ )
+                {
+                        GetSkyVisibility( input.pos.Vec( i ), input.normals[0].Vec( i ), needed[i], vis[i] );
+                }
+        }
+
         for ( int j = 0; j < sky_samples; j++ )
         {
                 FourVectors anorm;
@@ -1090,17 +1157,24 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightInput_t &input, SSE_sampleLightOu
                                 possible_hit_count[i] );
                 }
 
-                // search back to see if we can hit a sky brush
-                FourVectors delta = anorm;
-                delta *= -MAX_TRACE_LENGTH;
-                delta += input.pos;
-                FourVectors surface_pos = input.pos;
-                FourVectors offset = anorm;
-                offset *= -input.epsilon;
-                surface_pos -= offset;
-
                 fltx4 fraction_visible4;
-                RADTrace::test_four_lines( surface_pos, delta, &fraction_visible4, CONTENTS_SKY, true );
+                if ( cached )
+                {
+                        fraction_visible4 = SkyDirectionVisible4( vis, SKYVIS_AMBIENT_DIR( j ) );
+                }
+                else
+                {
+                        // search back to see if we can hit a sky brush
+                        FourVectors delta = anorm;
+                        delta *= -MAX_TRACE_LENGTH;
+                        delta += input.pos;
+                        FourVectors surface_pos = input.pos;
+                        FourVectors offset = anorm;
+                        offset *= -input.epsilon;
+                        surface_pos -= offset;
+
+                        RADTrace::test_four_lines( surface_pos, delta, &fraction_visible4, CONTENTS_SKY, true );
+                }
                 for ( int i = 0; i < input.normal_count; i++ )
                 {
                         fltx4 added_amt = MulSIMD( fraction_visible4, dots[i] );
@@ -1358,9 +1432,12 @@ void GatherSampleLightAt4Points( SSE_SampleInfo_t &info, int sample_idx, int num
 {
         SSE_sampleLightOutput_t out;
 
-        // iterate over all direct lights and add them to the particular sapmle
-        for ( directlight_t *dl = Lights::activelights; dl != nullptr; dl = dl->next )
+        // iterate over the direct lights that reach the face and add them to the particular sample
+        size_t numlights = info.lights.size();
+        for ( size_t l = 0; l < numlights; l++ )
         {
+                directlight_t *dl = info.lights[l];
+
                 // is this light in the pvs?
                 fltx4 dot_mask = Four_Zeros;
                 bool skip = true;
@@ -1567,9 +1644,12 @@ void ResampleLightAt4Points( SSE_SampleInfo_t &info, int style, bool ambient, bu
                 }
         }
 
-        // Iterate over all direct lights and add them to the particular sample
-        for ( directlight_t *dl = Lights::activelights; dl != nullptr; dl = dl->next )
+        // Iterate over the direct lights that reach the face and add them to the particular sample
+        size_t numlights = info.lights.size();
+        for ( size_t l = 0; l < numlights; l++ )
         {
+                directlight_t *dl = info.lights[l];
+
                 if ( ambient && dl->type != emit_skyambient )
                         continue;
                 if ( !ambient && dl->type == emit_skyambient )
@@ -2043,6 +2123,42 @@ void DetermineLightmapMemory()
         std::cout << "Lightmaps will take up " << lm_megabytes << " MB of storage" << std::endl;
 }
 
+/**
+ * Finds the lights that can reach the samples of the face, including the
+ * supersamples taken around them.
+ */
+static void FindFaceLights( SSE_SampleInfo_t &info )
+{
+        LVector3 mins( FLT_MAX );
+        LVector3 maxs( -FLT_MAX );
+        float margin = 0.0;
+
+        facelight_t *fl = info.facelight;
+        for ( int i = 0; i < fl->numsamples; i++ )
+        {
+                const sample_t &sample = fl->sample[i];
+                for ( int j = 0; j < 3; j++ )
+                {
+                        mins[j] = std::min( mins[j], (float)sample.pos[j] );
+                        maxs[j] = std::max( maxs[j], (float)sample.pos[j] );
+                }
+                margin = std::max( margin, (float)std::sqrt( sample.area ) );
+        }
+
+        if ( fl->numsamples == 0 )
+        {
+                info.lights.clear();
+                return;
+        }
+
+        // Sample points can get nudged a little off the face.
+        margin += 1.0;
+        mins -= LVector3( margin );
+        maxs += LVector3( margin );
+
+        Lights::GetLightsForBounds( mins, maxs, info.lights );
+}
+
 /**
  * Calculates a lightmap for a particular face, then
  * uses the calculated lightmap to figure out brightness of each patch on the face.
@@ -2084,6 +2200,7 @@ void BuildFacelights( const int facenum )
         InitLightInfo( l, facenum );
         CalcPoints( &l, fl, facenum );
         InitSampleInfo( l, GetCurrentThreadNumber(), sampleinfo );
+        FindFaceLights( sampleinfo );
 
         // allocate sample positions/normals to SSE
         int num_groups = sampleinfo.num_sample_groups;
@@ -2092,6 +2209,10 @@ void BuildFacelights( const int facenum )
         f->styles[0] = 0;
         AllocateLightstyleSamples( fl, 0, sampleinfo.normal_count );
 
+        // reuse the direct lighting from a killed compile or from the last compile if nothing that affects it changed
+        bool cached = ( g_checkpoint && RestoreFacelightFromCheckpoint( facenum, sampleinfo.normal_count ) ) ||
+                ( g_incremental && RestoreFacelightFromRadCache( facenum, sampleinfo.normal_count ) );
+
         // sample the lights at each sample location
         for ( int grp = 0; grp < num_groups; grp++ )
         {
@@ -2124,10 +2245,13 @@ void BuildFacelights( const int facenum )
                 }
 
                 // iterate over all the lights and add their contribution to this group of spots
-                GatherSampleLightAt4Points( sampleinfo, nsample, num_samples );
+                if ( !cached )
+                {
+                        GatherSampleLightAt4Points( sampleinfo, nsample, num_samples );
+                }
         }
 
-        if ( g_extra )
+        if ( g_extra && !cached )
         {
                 // for each lightstyle, perform a supersampling pass
                 for ( i = 0; i < MAXLIGHTMAPS; i++ )
@@ -2148,6 +2272,8 @@ void BuildFacelights( const int facenum )
 
 // =====================================================================================
 //  PrecompLightmapOffsets
+//      Sets aside zeroed space for the lightmaps of every face up front, so the threads
+//      of FinalLightFace can write into it without locking.
 // =====================================================================================
 void PrecompLightmapOffsets()
 {
@@ -2155,8 +2281,8 @@ void PrecompLightmapOffsets()
         dface_t*        f;
         facelight_t*    fl;
         int             lightstyles;
-
-        g_bspdata->lightdata.clear();
+        size_t          lightdatasize = 0;
+        size_t          bouncedlightdatasize = 0;
 
         for ( facenum = 0; facenum < g_bspdata->numfaces; facenum++ )
         {
@@ -2184,24 +2310,18 @@ void PrecompLightmapOffsets()
                 int luxels = ( f->lightmap_size[0] + 1 ) * ( f->lightmap_size[1] + 1 );
 
                 // Direct lighting
-                f->lightofs = g_bspdata->lightdata.size();
-                for ( int i = 0; i < luxels * lightstyles * fl->normal_count; i++ )
-                {
-                        // Initialize all luxels for this face.
-                        colorrgbexp32_t sample;
-                        memset( &sample, 0, sizeof( colorrgbexp32_t ) );
-                        g_bspdata->lightdata.push_back( sample );
-                }
+                f->lightofs = (int)lightdatasize;
+                lightdatasize += (size_t)luxels * lightstyles * fl->normal_count;
 
                 // Bounced lighting
-                f->bouncedlightofs = g_bspdata->bouncedlightdata.size();
-                for ( int i = 0; i < luxels; i++ )
-                {
-                        colorrgbexp32_t sample;
-                        memset( &sample, 0, sizeof( colorrgbexp32_t ) );
-                        g_bspdata->bouncedlightdata.push_back( sample );
-                }
+                f->bouncedlightofs = (int)bouncedlightdatasize;
+                bouncedlightdatasize += luxels;
         }
+
+        colorrgbexp32_t black;
+        memset( &black, 0, sizeof( colorrgbexp32_t ) );
+        g_bspdata->lightdata.assign( lightdatasize, black );
+        g_bspdata->bouncedlightdata.assign( bouncedlightdatasize, black );
 }
 
 void ReduceLightmap()
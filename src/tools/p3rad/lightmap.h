@@ -131,6 +131,8 @@ struct SSE_SampleInfo_t
         int clusters[4];
         FourVectors points;
         FourVectors point_normals[NUM_BUMP_VECTS + 1];
+        // Lights that can reach the face, see Lights::GetLightsForBounds().
+        pvector<directlight_t *> lights;
 };
 
 extern void GatherSampleLightSSE( SSE_sampleLightOutput_t &output, directlight_t *dl, int facenum,
@@ -138,6 +140,7 @@ extern void GatherSampleLightSSE( SSE_sampleLightOutput_t &output, directlight_t
                                   int thread, int lightflags = 0, float epsilon = 0 );
 
 extern void SaveVertexNormals();
+extern void AllocateLightstyleSamples( facelight_t *fl, int style, int normal_count );
 
 extern int EdgeVertex( dface_t *f, int edge );
 
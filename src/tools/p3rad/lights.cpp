@@ -19,6 +19,12 @@ int Lights::numdlights = 0;
 float Lights::sun_angular_extent = 0.0;
 directlight_t *Lights::skylight = nullptr;
 directlight_t *Lights::ambientlight = nullptr;
+pvector<lightbvhnode_t> Lights::bvh_nodes;
+pvector<directlight_t *> Lights::bvh_lights;
+pvector<directlight_t *> Lights::unbounded_lights;
+
+// Max lights in a leaf of the light BVH.
+#define LIGHTBVH_LEAF_SIZE 4
 
 #define VIS_SIZE ( MAX_MAP_LEAFS + 7 ) / 8
 
@@ -593,6 +599,10 @@ void Lights::DeleteDirectLights()
                 }
         }
 
+        bvh_nodes.clear();
+        bvh_lights.clear();
+        unbounded_lights.clear();
+
         activelights = nullptr;
         numdlights = 0;
         skylight = nullptr;
@@ -608,6 +618,249 @@ void Lights::DeleteDirectLights()
         //  3) hlcsg -> hlbsp -> hlvis -> hlrad -> hlcsg -onlyents -> hlrad
 }
 
+// =====================================================================================
+//  CalcLightCullRadius
+//      Distance at which the light's contribution falls below g_light_cull_threshold,
+//      matching the falloff in GatherSampleLightStandardSSE. -1 if it never does.
+// =====================================================================================
+static float CalcLightCullRadius( const directlight_t *dl )
+{
+        if ( dl->type != emit_point && dl->type != emit_spotlight && dl->type != emit_surface )
+        {
+                return -1;
+        }
+
+        float intensity = std::max( dl->intensity[0], std::max( dl->intensity[1], dl->intensity[2] ) );
+        float radius = -1;
+
+        if ( g_light_cull_threshold > 0.0 )
+        {
+                float k = intensity / g_light_cull_threshold;
+
+                if ( dl->type == emit_surface )
+                {
+                        // falloff is 1 / dist^2
+                        radius = std::sqrt( k );
+                }
+                else
+                {
+                        float c = dl->constant_atten;
+                        float l = dl->linear_atten;
+                        float q = dl->quadratic_atten;
+
+                        // Solve 1 / ( c + l*d + q*d^2 ) = 1 / k for d.
+                        if ( q > 0.0 )
+                        {
+                                float disc = l * l - 4 * q * ( c - k );
+                                radius = disc > 0.0 ? ( -l + std::sqrt( disc ) ) / ( 2 * q ) : 0.0f;
+                        }
+                        else if ( l > 0.0 )
+                        {
+                                radius = std::max( ( k - c ) / l, 0.0f );
+                        }
+
+                        // The falloff stops decreasing at the cap distance.
+                        if ( radius > dl->cap_distance )
+                        {
+                                radius = -1;
+                        }
+                }
+
+                // The falloff distance is clamped to 1.
+                if ( radius >= 0.0 )
+                {
+                        radius = std::max( radius, 1.0f );
+                }
+        }
+
+        // Hard falloff lights are black past the end fade.
+        if ( ( dl->type == emit_point || dl->type == emit_spotlight ) &&
+             dl->end_fade_distance > dl->start_fade_distance )
+        {
+                if ( radius < 0.0 || dl->end_fade_distance < radius )
+                {
+                        radius = dl->end_fade_distance;
+                }
+        }
+
+        return radius;
+}
+
+// =====================================================================================
+//  BuildLightBVH_r
+//      Builds the subtree over bvh_lights[first, first + count), returns its root.
+// =====================================================================================
+int Lights::BuildLightBVH_r( int first, int count )
+{
+        int nodenum = (int)bvh_nodes.size();
+        bvh_nodes.push_back( lightbvhnode_t() );
+
+        LVector3 mins( FLT_MAX );
+        LVector3 maxs( -FLT_MAX );
+        LVector3 cmins( FLT_MAX );
+        LVector3 cmaxs( -FLT_MAX );
+        for ( int i = first; i < first + count; i++ )
+        {
+                const directlight_t *dl = bvh_lights[i];
+                LVector3 extent( dl->cull_radius );
+                for ( int j = 0; j < 3; j++ )
+                {
+                        mins[j] = std::min( mins[j], dl->origin[j] - extent[j] );
+                        maxs[j] = std::max( maxs[j], dl->origin[j] + extent[j] );
+                        cmins[j] = std::min( cmins[j], dl->origin[j] );
+                        cmaxs[j] = std::max( cmaxs[j], dl->origin[j] );
+                }
+        }
+
+        bvh_nodes[nodenum].mins = mins;
+        bvh_nodes[nodenum].maxs = maxs;
+
+        if ( count <= LIGHTBVH_LEAF_SIZE )
+        {
+                bvh_nodes[nodenum].first = first;
+                bvh_nodes[nodenum].count = count;
+                bvh_nodes[nodenum].right = -1;
+                return nodenum;
+        }
+
+        // Split at the median light along the longest axis of the light origins.
+        LVector3 size = cmaxs - cmins;
+        int axis = 0;
+        if ( size[1] > size[axis] )
+                axis = 1;
+        if ( size[2] > size[axis] )
+                axis = 2;
+
+        int half = count / 2;
+        std::nth_element( bvh_lights.begin() + first, bvh_lights.begin() + first + half,
+                          bvh_lights.begin() + first + count,
+                          [axis]( const directlight_t *a, const directlight_t *b )
+        {
+                return a->origin[axis] < b->origin[axis];
+        } );
+
+        BuildLightBVH_r( first, half );
+        int right = BuildLightBVH_r( first + half, count - half );
+
+        bvh_nodes[nodenum].first = first;
+        bvh_nodes[nodenum].count = 0;
+        bvh_nodes[nodenum].right = right;
+        return nodenum;
+}
+
+// =====================================================================================
+//  BuildLightBVH
+//      Computes the cull radius of each active light and builds a bounding volume
+//      hierarchy over the lights that have one, so the lights that can reach a face
+//      are found without walking the whole active list.
+// =====================================================================================
+void Lights::BuildLightBVH()
+{
+        bvh_nodes.clear();
+        bvh_lights.clear();
+        unbounded_lights.clear();
+
+        int index = 0;
+        for ( directlight_t *dl = activelights; dl != nullptr; dl = dl->next )
+        {
+                dl->active_index = index++;
+                dl->cull_radius = CalcLightCullRadius( dl );
+                if ( dl->cull_radius < 0.0 )
+                {
+                        unbounded_lights.push_back( dl );
+                }
+                else
+                {
+                        bvh_lights.push_back( dl );
+                }
+        }
+
+        if ( !bvh_lights.empty() )
+        {
+                bvh_nodes.reserve( bvh_lights.size() / 2 + 1 );
+                BuildLightBVH_r( 0, (int)bvh_lights.size() );
+        }
+
+        printf( "%i lights in light BVH (%i nodes), %i unbounded\n",
+             (int)bvh_lights.size(), (int)bvh_nodes.size(), (int)unbounded_lights.size() );
+}
+
+// =====================================================================================
+//  GetLightsForBounds
+//      Fills in every active light that can reach the box, in active list order.
+// =====================================================================================
+void Lights::GetLightsForBounds( const LVector3 &mins, const LVector3 &maxs, pvector<directlight_t *> &lights )
+{
+        lights.clear();
+        lights.insert( lights.end(), unbounded_lights.begin(), unbounded_lights.end() );
+
+        if ( !bvh_nodes.empty() )
+        {
+                int stack[64];
+                int stack_size = 0;
+                stack[stack_size++] = 0;
+
+                while ( stack_size > 0 )
+                {
+                        const lightbvhnode_t *node = &bvh_nodes[stack[--stack_size]];
+
+                        if ( node->mins[0] > maxs[0] || node->maxs[0] < mins[0] ||
+                             node->mins[1] > maxs[1] || node->maxs[1] < mins[1] ||
+                             node->mins[2] > maxs[2] || node->maxs[2] < mins[2] )
+                        {
+                                continue;
+                        }
+
+                        if ( node->right == -1 )
+                        {
+                                for ( int i = node->first; i < node->first + node->count; i++ )
+                                {
+                                        directlight_t *dl = bvh_lights[i];
+
+                                        // distance from the light to the closest point of the box
+                                        float dist2 = 0.0;
+                                        for ( int j = 0; j < 3; j++ )
+                                        {
+                                                float d = std::max( mins[j] - dl->origin[j], dl->origin[j] - maxs[j] );
+                                                if ( d > 0.0 )
+                                                        dist2 += d * d;
+                                        }
+
+                                        if ( dist2 <= dl->cull_radius * dl->cull_radius )
+                                        {
+                                                lights.push_back( dl );
+                                        }
+                                }
+                        }
+                        else
+                        {
+                                nassertd( stack_size + 2 <= 64 )
+                                {
+                                        continue;
+                                }
+                                stack[stack_size++] = node->right;
+                                stack[stack_size++] = (int)( node - &bvh_nodes[0] ) + 1;
+                        }
+                }
+        }
+
+        // Keep the order the lights are accumulated in the same as the active list.
+        // The unbounded lights are already in that order, so only the lights found
+        // through the BVH need sorting before being merged in behind them.
+        pvector<directlight_t *>::iterator bvh_begin = lights.begin() + unbounded_lights.size();
+        if ( bvh_begin == lights.end() )
+        {
+                return;
+        }
+
+        auto by_active_index = []( const directlight_t *a, const directlight_t *b )
+        {
+                return a->active_index < b->active_index;
+        };
+        std::sort( bvh_begin, lights.end(), by_active_index );
+        std::inplace_merge( lights.begin(), bvh_begin, lights.end(), by_active_index );
+}
+
 INLINE bool Lights::HasLightEnvironment()
 {
         return HasSkyLight() && HasAmbientLight();
@@ -3,6 +3,8 @@
 #include "mathlib.h"
 #include "bspfile.h"
 
+#include <pvector.h>
+
 typedef enum
 {
         emit_surface,
@@ -47,8 +49,27 @@ typedef struct directlight_s
 
         int flags;
 
+        // Distance past which the light contributes less than g_light_cull_threshold,
+        // -1 if it reaches everywhere. Set up by Lights::BuildLightBVH().
+        float cull_radius;
+        // Position of the light in the active list, lights are always gathered in this order.
+        int active_index;
+
 } directlight_t;
 
+struct lightbvhnode_t
+{
+        LVector3 mins;
+        LVector3 maxs;
+        // Leaf nodes reference count lights starting at first,
+        // interior nodes have their left child right after them.
+        int first;
+        int count;
+        int right;
+};
+
+extern int GetVisCache( int lastoffset, int cluster, byte *pvs );
+
 class Lights
 {
 public:
@@ -64,8 +85,20 @@ public:
         static void CreateDirectLights();
         static void DeleteDirectLights();
 
+        static void BuildLightBVH();
+        static void GetLightsForBounds( const LVector3 &mins, const LVector3 &maxs,
+                                        pvector<directlight_t *> &lights );
+
         static INLINE bool HasLightEnvironment();
         static INLINE bool HasSkyLight();
         static INLINE bool HasAmbientLight();
 
+private:
+        static int BuildLightBVH_r( int first, int count );
+
+        static pvector<lightbvhnode_t> bvh_nodes;
+        static pvector<directlight_t *> bvh_lights;
+        // Lights without a cull radius, they are returned for every face.
+        static pvector<directlight_t *> unbounded_lights;
+
 };
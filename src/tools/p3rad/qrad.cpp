@@ -53,11 +53,18 @@ A simple summary of RAD goes as follows:
 #include "radstaticprop.h"
 #include "radial.h"
 #include "leaf_ambient_lighting.h"
+#include "lightingutils.h"
 #include "lights.h"
 #include "vismat.h"
 #include "trace.h"
+#include "radcache.h"
+#include "radcheckpoint.h"
+#include "radpalette.h"
+#include "bc6h.h"
+#include "skyvis.h"
 //#include "clhelper.h"
 #include <virtualFileSystem.h>
+#include <randomizer.h>
 #include <simpleHashMap.h>
 #include <load_prc_file.h>
 #include <pStatClient.h>
@@ -98,8 +105,30 @@ size_t g_total_transfer = 0;
 float g_minchop = 4;
 float g_maxchop = 4;
 
-static pvector<LVector3> emitlight;
-static pvector<bumpsample_t> addlight;
+// =====================================================================================
+//  Patch light while bouncing
+//      Kept out of patch_t in structure of arrays form. A transfer only needs the light
+//      its patch sends out times the reflectivity of that patch, so the gather loop
+//      streams three floats per transfer instead of pulling in a whole patch_t.
+// =====================================================================================
+typedef struct
+{
+        pvector<float>  emit[3];                                // light sent out this bounce
+        pvector<float>  radiosity[3];                           // emit * reflectivity
+        pvector<float>  origin[3];                              // for bumped receivers
+        pvector<bumpsample_t> add;                              // light received this bounce
+
+        // Patches sorted by their height in the patch tree, leaves first, and cut into
+        // chunks that never span two heights. Every child is in a lower level than its
+        // parent, so the chunks of one level can be collected in parallel.
+        pvector<int>    levels;
+        pvector<int>    chunkstart;                             // first entry of each chunk in levels, plus the end
+        pvector<int>    chunklevel;                             // height of each chunk
+        pvector<int>    levelchunk;                             // first chunk of each height
+        int             chunksdone;
+} patchlight_t;
+
+static patchlight_t s_patchlight;
 
 vector_string	g_multifiles;
 string		g_mfincludefile;
@@ -111,6 +140,7 @@ float           g_skysamplescale = 1.0;
 int             g_extrapasses = 4;
 
 unsigned        g_numbounce = 100; // max number of bounces
+int             g_bounce_samples = DEFAULT_BOUNCE_SAMPLES; // rays per patch for stochastic bounce, 0 uses transfer lists
 
 static bool     g_dumppatches = DEFAULT_DUMPPATCHES;
 
@@ -120,11 +150,17 @@ bool			g_drawoverload = false;
 
 float           g_lightscale = DEFAULT_LIGHTSCALE;
 float           g_dlight_threshold = DEFAULT_DLIGHT_THRESHOLD;  // was DIRECT_LIGHT constant
+float           g_light_cull_threshold = DEFAULT_LIGHT_CULL_THRESHOLD; // lights dimmer than this at a face are skipped
+float           g_leaf_ambient_error = DEFAULT_LEAF_AMBIENT_ERROR; // leaf ambient cubes are refined while neighbors differ by more than this
+float           g_sky_vis_cell = DEFAULT_SKYVIS_CELL; // samples closer than this share their sky rays
+int             g_sky_vis_memory = DEFAULT_SKYVIS_MEMORY; // megabytes the sky visibility cells may take up
 
 char            g_source[_MAX_PATH] = "";
 
 char            g_vismatfile[_MAX_PATH] = "";
 bool            g_incremental = DEFAULT_INCREMENTAL;
+bool            g_checkpoint = DEFAULT_CHECKPOINT;
+bool            g_compress_lightmaps = DEFAULT_COMPRESS_LIGHTMAPS;
 float           g_indirect_sun = DEFAULT_INDIRECT_SUN;
 bool            g_extra = DEFAULT_EXTRA;
 bool            g_texscale = DEFAULT_TEXSCALE;
@@ -1275,6 +1311,94 @@ static void SubdividePatches()
 
 //=====================================================================
 
+#define COLLECT_CHUNK   1024                                    // patches per work unit of CollectLight
+
+// =====================================================================================
+//  BuildPatchLevels
+// =====================================================================================
+static void     BuildPatchLevels()
+{
+        int count = (int)g_patches.size();
+
+        // children always come after their parent
+        pvector<int> height( count, 0 );
+        int maxheight = 0;
+        for ( int i = count - 1; i >= 0; i-- )
+        {
+                const patch_t *patch = &g_patches[i];
+                if ( patch->child1 != -1 )
+                {
+                        height[i] = 1 + std::max( height[patch->child1], height[patch->child2] );
+                        maxheight = std::max( maxheight, height[i] );
+                }
+        }
+
+        pvector<int> levelstart( maxheight + 2, 0 );
+        for ( int i = 0; i < count; i++ )
+        {
+                levelstart[height[i] + 1]++;
+        }
+        for ( int h = 0; h <= maxheight; h++ )
+        {
+                levelstart[h + 1] += levelstart[h];
+        }
+
+        s_patchlight.levels.resize( count );
+        pvector<int> next( levelstart.begin(), levelstart.end() - 1 );
+        for ( int i = 0; i < count; i++ )
+        {
+                s_patchlight.levels[next[height[i]]++] = i;
+        }
+
+        s_patchlight.chunkstart.clear();
+        s_patchlight.chunklevel.clear();
+        s_patchlight.levelchunk.clear();
+        for ( int h = 0; h <= maxheight; h++ )
+        {
+                s_patchlight.levelchunk.push_back( (int)s_patchlight.chunklevel.size() );
+                for ( int first = levelstart[h]; first < levelstart[h + 1]; first += COLLECT_CHUNK )
+                {
+                        s_patchlight.chunkstart.push_back( first );
+                        s_patchlight.chunklevel.push_back( h );
+                }
+        }
+        s_patchlight.chunkstart.push_back( count );
+}
+
+// =====================================================================================
+//  AllocPatchLight
+// =====================================================================================
+static void     AllocPatchLight()
+{
+        size_t count = g_patches.size();
+
+        for ( int c = 0; c < 3; c++ )
+        {
+                s_patchlight.emit[c].assign( count, 0.0f );
+                s_patchlight.radiosity[c].assign( count, 0.0f );
+                s_patchlight.origin[c].resize( count );
+                for ( size_t i = 0; i < count; i++ )
+                {
+                        s_patchlight.origin[c][i] = g_patches[i].origin[c];
+                }
+        }
+
+        s_patchlight.add.resize( count );
+        memset( s_patchlight.add.data(), 0, count * sizeof( bumpsample_t ) );
+
+        BuildPatchLevels();
+}
+
+static void     SetPatchEmitLight( int i, const LVector3 &emit )
+{
+        const patch_t *patch = &g_patches[i];
+        for ( int c = 0; c < 3; c++ )
+        {
+                s_patchlight.emit[c][i] = emit[c];
+                s_patchlight.radiosity[c][i] = emit[c] * patch->reflectivity[c];
+        }
+}
+
 // =====================================================================================
 //  CollectLight
 // patch's totallight += new light received to each patch
@@ -1282,65 +1406,109 @@ static void SubdividePatches()
 // patch's addlight = 0
 // pull received light from children.
 // =====================================================================================
-static void     CollectLight( LVector3 &total )
+static void     CollectPatchLight( int i )
 {
-        int i, j;
-        patch_t *patch;
-
-        total.set( 0.0, 0.0, 0.0 );
+        int j;
+        patch_t *patch = &g_patches[i];
+        bumpsample_t &addlight = s_patchlight.add[i];
+        int normal_count = patch->bumped ? NUM_BUMP_VECTS + 1 : 1;
 
-        // process patches in reverse order so that children are processed before their parents
-        size_t patch_count = g_patches.size();
-        for ( i = patch_count - 1; i >= 0; i-- )
+        LVector3 emitlight;
+        if ( patch->sky )
         {
-                patch = &g_patches[i];
-                int normal_count = patch->bumped ? NUM_BUMP_VECTS + 1 : 1;
-
-                if ( patch->sky )
+                VectorFill( emitlight, 0 );
+        }
+        else if ( patch->child1 == -1 )
+        {
+                // leaf node in patch tree
+                for ( j = 0; j < normal_count; j++ )
                 {
-                        VectorFill( emitlight[i], 0 );
+                        VectorAdd( patch->totallight.light[j], addlight.light[j], patch->totallight.light[j] );
                 }
-                else if ( patch->child1 == -1 )
+                VectorCopy( addlight.light[0], emitlight );
+        }
+        else
+        {
+                // this is an interior node.
+                // pull received ilght from children
+
+                float s1, s2;
+                patch_t *child1, *child2;
+
+                child1 = &g_patches[patch->child1];
+                child2 = &g_patches[patch->child2];
+
+                s1 = child1->area / ( child1->area + child2->area );
+                s2 = child2->area / ( child1->area + child2->area );
+
+                // patch->totallight = s1 * child1->totallight + s2 * child2->totallight
+                for ( j = 0; j < normal_count; j++ )
                 {
-                        // leaf node in patch tree
-                        for ( j = 0; j < normal_count; j++ )
-                        {
-                                VectorAdd( patch->totallight.light[j], addlight[i].light[j], patch->totallight.light[j] );
-                        }
-                        VectorCopy( addlight[i].light[0], emitlight[i] );
-                        VectorAdd( total, emitlight[i], total );
+                        VectorScale( child1->totallight.light[j], s1, patch->totallight.light[j] );
+                        VectorMA( patch->totallight.light[j], s2, child2->totallight.light[j], patch->totallight.light[j] );
                 }
-                else
-                {
-                        // this is an interior node.
-                        // pull received ilght from children
 
-                        float s1, s2;
-                        patch_t *child1, *child2;
+                // patch->emitlight = s1 * child1->emitlight + s2 * child2->emitlight
+                for ( j = 0; j < 3; j++ )
+                {
+                        emitlight[j] = s_patchlight.emit[j][patch->child1] * s1;
+                }
+        }
 
-                        child1 = &g_patches[patch->child1];
-                        child2 = &g_patches[patch->child2];
+        SetPatchEmitLight( i, emitlight );
 
-                        if ( (int)patch->area != (int)( child1->area + child2->area ) )
-                                s1 = 0;
+        for ( j = 0; j < NUM_BUMP_VECTS + 1; j++ )
+        {
+                VectorFill( addlight.light[j], 0 );
+        }
+}
 
-                        s1 = child1->area / ( child1->area + child2->area );
-                        s2 = child2->area / ( child1->area + child2->area );
+// Work units are handed out in level order. A chunk waits until every chunk of
+// the lower levels is done, those are already being worked on by other threads.
+static void     CollectLight( int threadnum )
+{
+        while ( 1 )
+        {
+                int chunk = GetThreadWork();
+                if ( chunk == -1 )
+                        break;
 
-                        // patch->totallight = s1 * child1->totallight + s2 * child2->totallight
-                        for ( j = 0; j < normal_count; j++ )
-                        {
-                                VectorScale( child1->totallight.light[j], s1, patch->totallight.light[j] );
-                                VectorMA( patch->totallight.light[j], s2, child2->totallight.light[j], patch->totallight.light[j] );
-                        }
+                int below = s_patchlight.levelchunk[s_patchlight.chunklevel[chunk]];
+                while ( 1 )
+                {
+                        ThreadLock();
+                        bool ready = s_patchlight.chunksdone >= below;
+                        ThreadUnlock();
+                        if ( ready )
+                                break;
+                        Thread::force_yield();
+                }
 
-                        // patch->emitlight = s1 * child1->emitlight + s2 * child2->emitlight
-                        VectorScale( emitlight[patch->child1], s1, emitlight[i] );
+                for ( int k = s_patchlight.chunkstart[chunk]; k < s_patchlight.chunkstart[chunk + 1]; k++ )
+                {
+                        CollectPatchLight( s_patchlight.levels[k] );
                 }
 
-                for ( j = 0; j < NUM_BUMP_VECTS + 1; j++ )
+                ThreadLock();
+                s_patchlight.chunksdone++;
+                ThreadUnlock();
+        }
+}
+
+static void     SumCollectedLight( LVector3 &total )
+{
+        total.set( 0.0, 0.0, 0.0 );
+
+        // light is always received to leaf patches
+        for ( int i = (int)g_patches.size() - 1; i >= 0; i-- )
+        {
+                const patch_t *patch = &g_patches[i];
+                if ( !patch->sky && patch->child1 == -1 )
                 {
-                        VectorFill( addlight[i].light[j], 0 );
+                        for ( int c = 0; c < 3; c++ )
+                        {
+                                total[c] += s_patchlight.emit[c][i];
+                        }
                 }
         }
 }
@@ -1355,13 +1523,63 @@ static void     CollectLight( LVector3 &total )
 #pragma warning(disable: 4100)                             // unreferenced formal parameter
 #endif
 
+static void GetPatchBumpNormals( const patch_t *patch, LVector3 *normals )
+{
+        GetPhongNormal( patch->facenum, patch->origin, normals[0] );
+
+        texinfo_t *tinfo = &g_bspdata->texinfo[g_bspdata->dfaces[patch->facenum].texinfo];
+        // use facenormal along with the smooth normal to build the three bump map vectors
+        GetBumpNormals( GetLVector3_2( tinfo->vecs[0] ),
+                        GetLVector3_2( tinfo->vecs[1] ), patch->normal,
+                        normals[0], &normals[1] );
+
+        // force the base lightmap to use the flat normal instead of the phong normal
+        // FIXME: why does the patch not use the phong normal?
+        normals[0] = patch->normal;
+}
+
+// Loads the next four transfers of a list. Missing ones are padded with a copy of
+// the first transfer that carries no light.
+static FORCEINLINE void LoadTransfers4( const transfer_t *trans, int count, int *patches, fltx4 &transfer )
+{
+        transfer = Four_Zeros;
+        for ( int i = 0; i < 4; i++ )
+        {
+                if ( i < count )
+                {
+                        patches[i] = trans[i].patch;
+                        SubFloat( transfer, i ) = trans[i].transfer;
+                }
+                else
+                {
+                        patches[i] = trans[0].patch;
+                }
+        }
+}
+
+static FORCEINLINE fltx4 LoadPatchLight4( const pvector<float> &values, const int *patches )
+{
+        fltx4 result;
+        SubFloat( result, 0 ) = values[patches[0]];
+        SubFloat( result, 1 ) = values[patches[1]];
+        SubFloat( result, 2 ) = values[patches[2]];
+        SubFloat( result, 3 ) = values[patches[3]];
+        return result;
+}
+
+static FORCEINLINE float SumFloats4( const fltx4 &v )
+{
+        return SubFloat( v, 0 ) + SubFloat( v, 1 ) + SubFloat( v, 2 ) + SubFloat( v, 3 );
+}
+
 void GatherLight( int threadnum )
 {
-        int i, j, k;
+        int i, j, k, c;
         transfer_t *trans;
         int num;
         patch_t *patch;
-        LVector3 sum, v;
+        int patches[4];
+        fltx4 transfer;
 
         while ( 1 )
         {
@@ -1378,76 +1596,269 @@ void GatherLight( int threadnum )
                 num = patch->numtransfers;
                 if ( patch->bumped )
                 {
-                        LVector3 delta;
-                        LVector3 bumpsum[NUM_BUMP_VECTS + 1];
                         LVector3 normals[NUM_BUMP_VECTS + 1];
+                        GetPatchBumpNormals( patch, normals );
 
-                        GetPhongNormal( patch->facenum, patch->origin, normals[0] );
-
-                        texinfo_t *tinfo = &g_bspdata->texinfo[g_bspdata->dfaces[patch->facenum].texinfo];
-                        // use facenormal along with the smooth normal to build the three bump map vectors
-                        GetBumpNormals( GetLVector3_2( tinfo->vecs[0] ),
-                                        GetLVector3_2( tinfo->vecs[1] ), patch->normal,
-                                        normals[0], &normals[1] );
-
-                        // force the base lightmap to use the flat normal instead of the phong normal
-                        // FIXME: why does the patch not use the phong normal?
-                        normals[0] = patch->normal;
+                        FourVectors origin, flat_normal;
+                        FourVectors normals4[NUM_BUMP_VECTS + 1];
+                        origin.DuplicateVector( patch->origin );
+                        flat_normal.DuplicateVector( patch->normal );
+                        for ( i = 0; i < NUM_BUMP_VECTS + 1; i++ )
+                        {
+                                normals4[i].DuplicateVector( normals[i] );
+                        }
 
+                        fltx4 bumpsum[NUM_BUMP_VECTS + 1][3];
                         for ( i = 0; i < NUM_BUMP_VECTS + 1; i++ )
                         {
-                                VectorFill( bumpsum[i], 0 );
+                                for ( c = 0; c < 3; c++ )
+                                {
+                                        bumpsum[i][c] = Four_Zeros;
+                                }
                         }
 
-                        float dot;
-                        for ( k = 0; k < num; k++, trans++ )
+                        for ( k = 0; k < num; k += 4 )
                         {
-                                patch_t *patch2 = &g_patches[trans->patch];
+                                LoadTransfers4( trans + k, num - k, patches, transfer );
 
                                 // get vector to other patch
-                                VectorSubtract( patch2->origin, patch->origin, delta );
-                                delta.normalize();
+                                FourVectors delta;
+                                delta.x = LoadPatchLight4( s_patchlight.origin[0], patches );
+                                delta.y = LoadPatchLight4( s_patchlight.origin[1], patches );
+                                delta.z = LoadPatchLight4( s_patchlight.origin[2], patches );
+                                delta -= origin;
+                                delta.VectorNormalize();
+
+                                // remove normal already factored into transfer steradian
+                                fltx4 scale = MulSIMD( transfer, DivSIMD( Four_Ones, delta * flat_normal ) );
+
                                 // find light emitted from other patch
-                                for ( i = 0; i < 3; i++ )
+                                fltx4 v[3];
+                                for ( c = 0; c < 3; c++ )
                                 {
-                                        v[i] = emitlight[trans->patch][i] * patch2->reflectivity[i];
+                                        v[c] = MulSIMD( LoadPatchLight4( s_patchlight.radiosity[c], patches ), scale );
                                 }
-                                // remove normal already factored into transfer steradian
-                                float scale = 1.0f / DotProduct( delta, patch->normal );
-                                VectorScale( v, trans->transfer * scale, v );
 
-                                LVector3 bumpTransfer;
                                 for ( i = 0; i < NUM_BUMP_VECTS + 1; i++ )
                                 {
-                                        dot = DotProduct( delta, normals[i] );
-                                        if ( dot <= 0 )
+                                        // if the flat normal doesn't face the other patch the transfer shouldn't be here
+                                        fltx4 dot = MaxSIMD( delta * normals4[i], Four_Zeros );
+                                        for ( c = 0; c < 3; c++ )
                                         {
-//						Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
-                                                continue;
+                                                bumpsum[i][c] = MaddSIMD( v[c], dot, bumpsum[i][c] );
                                         }
-                                        bumpTransfer = v * dot;
-                                        VectorAdd( bumpsum[i], bumpTransfer, bumpsum[i] );
                                 }
                         }
 
                         for ( i = 0; i < NUM_BUMP_VECTS + 1; i++ )
                         {
-                                VectorCopy( bumpsum[i], addlight[j].light[i] );
+                                for ( c = 0; c < 3; c++ )
+                                {
+                                        s_patchlight.add[j].light[i][c] = SumFloats4( bumpsum[i][c] );
+                                }
                         }
                 }
                 else
                 {
-                        VectorFill( sum, 0 );
-                        for ( k = 0; k < num; k++, trans++ )
+                        fltx4 sum[3] = { Four_Zeros, Four_Zeros, Four_Zeros };
+                        for ( k = 0; k < num; k += 4 )
                         {
-                                for ( i = 0; i < 3; i++ )
+                                LoadTransfers4( trans + k, num - k, patches, transfer );
+                                for ( c = 0; c < 3; c++ )
                                 {
-                                        v[i] = emitlight[trans->patch][i] * g_patches[trans->patch].reflectivity[i];
+                                        sum[c] = MaddSIMD( LoadPatchLight4( s_patchlight.radiosity[c], patches ), transfer, sum[c] );
                                 }
-                                VectorScale( v, trans->transfer, v );
-                                VectorAdd( sum, v, sum );
                         }
-                        VectorCopy( sum, addlight[j].light[0] );
+
+                        for ( c = 0; c < 3; c++ )
+                        {
+                                s_patchlight.add[j].light[0][c] = SumFloats4( sum[c] );
+                        }
+                }
+        }
+}
+
+// =====================================================================================
+//  FindLeafPatch
+//      Returns the leaf patch of the face that contains pos, or the closest one if pos
+//      is just outside of the face. -1 if the face has no patches.
+// =====================================================================================
+static float PatchBoundsDistance( const patch_t *patch, const LVector3 &pos )
+{
+        float dist = 0;
+        for ( int i = 0; i < 3; i++ )
+        {
+                if ( pos[i] < patch->mins[i] )
+                        dist = std::max( dist, patch->mins[i] - pos[i] );
+                else if ( pos[i] > patch->maxs[i] )
+                        dist = std::max( dist, pos[i] - patch->maxs[i] );
+        }
+
+        return dist;
+}
+
+static int FindLeafPatch( int facenum, const LVector3 &pos )
+{
+        int best = -1;
+        float best_dist = FLT_MAX;
+        for ( int root = g_face_parents[facenum]; root != -1; root = g_patches[root].nextparent )
+        {
+                float dist = PatchBoundsDistance( &g_patches[root], pos );
+                if ( dist < best_dist )
+                {
+                        best = root;
+                        best_dist = dist;
+                }
+        }
+
+        if ( best == -1 )
+                return -1;
+
+        // children always split their parent, walk down to the one the point lies in
+        while ( g_patches[best].child1 != -1 )
+        {
+                const patch_t *patch = &g_patches[best];
+                if ( PatchBoundsDistance( &g_patches[patch->child1], pos ) <=
+                     PatchBoundsDistance( &g_patches[patch->child2], pos ) )
+                        best = patch->child1;
+                else
+                        best = patch->child2;
+        }
+
+        return best;
+}
+
+// =====================================================================================
+//  GatherLightStochastic
+//      Get light from other g_patches by tracing cosine distributed rays from each patch
+//      instead of walking its transfer list. With cosine weighting every ray carries the
+//      same share of the form factor, so the gathered light is the average of what the
+//      rays hit. Rays are seeded by patch and bounce so a compile is reproducible.
+//      Run multi-threaded
+// =====================================================================================
+static int bounce_number = 0;
+
+void GatherLightStochastic( int threadnum )
+{
+        int i, j, k;
+        patch_t *patch;
+
+        // four rays are traced at once
+        int num_samples = ( g_bounce_samples + 3 ) & ~3;
+        float sample_scale = 1.0f / num_samples;
+        u32x4 mask = ReplicateIX4( CONTENTS_SOLID | CONTENTS_SKY );
+
+        while ( 1 )
+        {
+                j = GetThreadWork();
+                if ( j == -1 )
+                        break;
+
+                patch = &g_patches[j];
+
+                // light is only received by leaf patches
+                if ( patch->sky || patch->child1 != -1 )
+                        continue;
+
+                int normal_count = patch->bumped ? NUM_BUMP_VECTS + 1 : 1;
+                LVector3 normals[NUM_BUMP_VECTS + 1];
+                LVector3 bumpsum[NUM_BUMP_VECTS + 1];
+                if ( patch->bumped )
+                {
+                        GetPatchBumpNormals( patch, normals );
+                }
+                else
+                {
+                        normals[0] = patch->normal;
+                }
+
+                for ( i = 0; i < normal_count; i++ )
+                {
+                        VectorFill( bumpsum[i], 0 );
+                }
+
+                // tangent frame around the patch normal
+                LVector3 tangent = ( std::fabs( patch->normal[0] ) < 0.9f ) ? LVector3( 1, 0, 0 ) : LVector3( 0, 1, 0 );
+                tangent = tangent.cross( patch->normal ).normalized();
+                LVector3 binormal = patch->normal.cross( tangent );
+
+                LVector3 origin = patch->origin + patch->normal * DIST_EPSILON;
+                FourVectors start;
+                start.DuplicateVector( origin );
+
+                Randomizer random( ( bounce_number * (int)g_patches.size() + j ) + 1 );
+
+                for ( k = 0; k < num_samples; k += 4 )
+                {
+                        LVector3 dir[4], end[4];
+                        for ( i = 0; i < 4; i++ )
+                        {
+                                // stratify the elevation, it matters the most for the cosine falloff
+                                float u1 = ( k + i + random.random_real( 1.0 ) ) * sample_scale;
+                                float u2 = random.random_real( 1.0 );
+                                float r = std::sqrt( u1 );
+                                float phi = 2.0f * Q_PI * u2;
+                                dir[i] = tangent * ( r * std::cos( phi ) ) + binormal * ( r * std::sin( phi ) ) +
+                                        patch->normal * std::sqrt( std::max( 0.0f, 1.0f - u1 ) );
+                                end[i] = origin + dir[i] * ( COORD_EXTENT * 1.74 );
+                        }
+
+                        FourVectors end4;
+                        end4.LoadAndSwizzle( end[0], end[1], end[2], end[3] );
+
+                        RayTraceHitResult4 result;
+                        RADTrace::scene->trace_four_lines( start, end4, mask, &result );
+
+                        for ( i = 0; i < 4; i++ )
+                        {
+                                float fraction = SubFloat( result.hit_fraction, i );
+                                if ( fraction >= 1.0 - EQUAL_EPSILON )
+                                        continue;
+
+                                int geomidx = RADTrace::dface_lookup.find( result.geom_id.m128_u32[i] );
+                                if ( geomidx == -1 )
+                                        continue;
+
+                                int facenum = RADTrace::dface_lookup.get_data( geomidx ) - g_bspdata->dfaces;
+                                LVector3 pos = origin + ( end[i] - origin ) * fraction;
+                                int hit = FindLeafPatch( facenum, pos );
+                                if ( hit == -1 )
+                                        continue;
+
+                                patch_t *patch2 = &g_patches[hit];
+
+                                // sky and the back of faces don't emit anything
+                                if ( patch2->sky || DotProduct( dir[i], patch2->plane->normal ) >= 0 )
+                                        continue;
+
+                                LVector3 v;
+                                for ( int c = 0; c < 3; c++ )
+                                {
+                                        v[c] = s_patchlight.radiosity[c][hit];
+                                }
+
+                                if ( patch->bumped )
+                                {
+                                        // remove normal already factored into the ray distribution
+                                        float scale = 1.0f / std::max( DotProduct( dir[i], patch->normal ), (float)EQUAL_EPSILON );
+                                        for ( int n = 0; n < normal_count; n++ )
+                                        {
+                                                float dot = DotProduct( dir[i], normals[n] );
+                                                if ( dot <= 0 )
+                                                        continue;
+                                                VectorMA( bumpsum[n], dot * scale, v, bumpsum[n] );
+                                        }
+                                }
+                                else
+                                {
+                                        VectorAdd( bumpsum[0], v, bumpsum[0] );
+                                }
+                        }
+                }
+
+                for ( i = 0; i < normal_count; i++ )
+                {
+                        VectorScale( bumpsum[i], sample_scale, s_patchlight.add[j].light[i] );
                 }
         }
 }
@@ -1459,35 +1870,58 @@ void GatherLight( int threadnum )
 // =====================================================================================
 //  BounceLight
 // =====================================================================================
-static void     BounceLight()
+static void     BounceLight( int first_bounce )
 {
         unsigned        i;
         char            name[64];
 
         bool keep_bouncing = g_numbounce > 0;
 
+        // a resumed compile already has the light of the finished bounces
         for ( i = 0; i < g_patches.size(); i++ )
         {
                 patch_t *patch = &g_patches[i];
-                // totallight has a copy of the direct lighting.  Move it to the emitted light and zero it out (to integrate bounces only)
-                VectorCopy( patch->totallight.light[0], emitlight[i] );
-                // NOTE: This means that only the bounced light is integrated into totallight!
-                VectorFill( patch->totallight.light[0], 0 );
+                LVector3 emitlight;
+                if ( first_bounce == 0 )
+                {
+                        // totallight has a copy of the direct lighting.  Move it to the emitted light and zero it out (to integrate bounces only)
+                        VectorCopy( patch->totallight.light[0], emitlight );
+                        // NOTE: This means that only the bounced light is integrated into totallight!
+                        VectorFill( patch->totallight.light[0], 0 );
+                }
+                else
+                {
+                        for ( int c = 0; c < 3; c++ )
+                        {
+                                emitlight[c] = s_patchlight.emit[c][i];
+                        }
+                }
+                SetPatchEmitLight( i, emitlight );
         }
 
         LVector3 last_added( 0 );
-        i = 0;
+        i = first_bounce;
         while ( keep_bouncing )
         {
                 // transfer light from to the leaf patches from other patches via transfers
                 // this moves shooter->emitlight to receiver->addlight
-                NamedRunThreadsOn( g_patches.size(), g_estimate, GatherLight );
+                if ( g_bounce_samples > 0 )
+                {
+                        bounce_number = i;
+                        NamedRunThreadsOn( g_patches.size(), g_estimate, GatherLightStochastic );
+                }
+                else
+                {
+                        NamedRunThreadsOn( g_patches.size(), g_estimate, GatherLight );
+                }
 
                 // move newly received light (addlight) to light to be sent out (emitlight)
                 // start at children and pull light up to parents
-                // light is always received to leaf patches
+                s_patchlight.chunksdone = 0;
+                NamedRunThreadsOn( (int)s_patchlight.chunklevel.size(), g_estimate, CollectLight );
+
                 LVector3 added( 0 );
-                CollectLight( added );
+                SumCollectedLight( added );
 
                 printf( "\tBounce #%i added RGB(%.0f, %.0f, %.0f)\n", i + 1, added[0], added[1], added[2] );
 
@@ -1495,6 +1929,11 @@ static void     BounceLight()
                         keep_bouncing = false;
 
                 i++;
+
+                if ( g_checkpoint )
+                {
+                        SaveBounceCheckpoint( i, !keep_bouncing, s_patchlight.emit );
+                }
         }
 }
 
@@ -1775,59 +2214,149 @@ static void     RadWorld()
 
         // create directlights out of patches and lights
         Lights::CreateDirectLights(); // done
+        Lights::BuildLightBVH();
 
         ScaleDirectLights();
 
-        Log( "\n" );
+        InitSkyVisibility();
 
-        // go!
+        // a killed compile with the same inputs can pick up after its last finished stage
+        bool lit = false;
+        if ( g_checkpoint )
+        {
+                InitRadCheckpoints();
+                lit = RestoreLightdataFromCheckpoint();
+        }
 
-        // generate a position map for each face
-        //NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, FindFacePositions );
+        if ( !lit )
+        {
+                if ( g_incremental )
+                {
+                        LoadRadCache();
+                }
 
-        bfl_collector.start();
-        // build initial facelights
-        lightinfo = (lightinfo_t *)malloc( g_bspdata->numfaces * sizeof( lightinfo_t ) );
-        memset( lightinfo, 0, sizeof( lightinfo ) );
-        NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, BuildFacelights ); // done
-        bfl_collector.stop();
+                Log( "\n" );
 
-        if ( g_numbounce > 0 )
-        {
-                // allocate memory for emitlight/addlight
+                // go!
 
-                // build transfer lists
-                //MakeScalesStub();
+                // generate a position map for each face
+                //NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, FindFacePositions );
 
-                emitlight.resize( g_patches.size() );
-                memset( emitlight.data(), 0, g_patches.size() * sizeof( LVector3 ) );
-                addlight.resize( g_patches.size() );
-                memset( addlight.data(), 0, g_patches.size() * sizeof( bumpsample_t ) );
+                bool restored = g_checkpoint && LoadFacelightCheckpoint();
 
-                MakeAllScales();
+                bfl_collector.start();
+                // build initial facelights
+                lightinfo = (lightinfo_t *)malloc( g_bspdata->numfaces * sizeof( lightinfo_t ) );
+                memset( lightinfo, 0, sizeof( lightinfo ) );
+                NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, BuildFacelights ); // done
+                bfl_collector.stop();
 
-                // spread light around
-                BounceLight();
-        }
+                if ( restored )
+                {
+                        FreeFacelightCheckpoint();
+                }
+                else if ( g_checkpoint )
+                {
+                        SaveFacelightCheckpoint();
+                }
 
-        //FreeTransfers();
-        //FreeStyleArrays();
+                bool bounced = false;
+                if ( g_numbounce > 0 )
+                {
+                        // allocate memory for emitlight/addlight
 
-        //NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, CreateTriangulations );
+                        // build transfer lists
+                        //MakeScalesStub();
 
-        // blend bounced light into direct light and save
-        PrecompLightmapOffsets();
+                        AllocPatchLight();
 
-        NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, FinalLightFace );
-        if ( g_maxdiscardedlight > 0.01 )
-        {
-                Verbose( "Maximum brightness loss (too many light styles on a face) = %f @(%f, %f, %f)\n", g_maxdiscardedlight, g_maxdiscardedpos[0], g_maxdiscardedpos[1], g_maxdiscardedpos[2] );
+                        int first_bounce = 0;
+                        if ( g_checkpoint )
+                        {
+                                RestoreBounceFromCheckpoint( first_bounce, bounced, s_patchlight.emit );
+                        }
+
+                        // the transfers are only needed for the bounces that are left,
+                        // stochastic bounce traces rays instead
+                        if ( !bounced )
+                        {
+                                if ( g_bounce_samples > 0 )
+                                {
+                                        Log( "Stochastic bounce with %d rays per patch, no transfer lists\n", ( g_bounce_samples + 3 ) & ~3 );
+                                }
+                                else if ( !g_checkpoint || !RestoreTransfersFromCheckpoint() )
+                                {
+                                        if ( !g_incremental || !RestoreTransfersFromRadCache() )
+                                        {
+                                                MakeAllScales();
+                                        }
+
+                                        if ( g_checkpoint )
+                                        {
+                                                SaveTransfersCheckpoint();
+                                        }
+                                }
+
+                                // spread light around
+                                BounceLight( first_bounce );
+                        }
+                }
+
+                if ( g_incremental )
+                {
+                        // FinalLightFace modifies the facelights, save them before that.
+                        // If the bounces came from a checkpoint the killed compile already saved
+                        // the cache, and the transfer lists were never loaded.
+                        if ( !bounced )
+                        {
+                                SaveRadCache();
+                        }
+                        FreeRadCache();
+                }
+
+                //FreeTransfers();
+                //FreeStyleArrays();
+
+                //NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, CreateTriangulations );
+
+                // blend bounced light into direct light and save
+                PrecompLightmapOffsets();
+
+                NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, FinalLightFace );
+                if ( g_maxdiscardedlight > 0.01 )
+                {
+                        Verbose( "Maximum brightness loss (too many light styles on a face) = %f @(%f, %f, %f)\n", g_maxdiscardedlight, g_maxdiscardedpos[0], g_maxdiscardedpos[1], g_maxdiscardedpos[2] );
+                }
+
+                if ( g_checkpoint )
+                {
+                        SaveLightdataCheckpoint();
+                }
         }
 
         // misc light computations
-        LeafAmbientLighting::compute_per_leaf_ambient_lighting();
+        ComputeFaceAvgLightColors();
+        if ( !g_checkpoint || !RestoreLeafAmbientFromCheckpoint() )
+        {
+                LeafAmbientLighting::compute_per_leaf_ambient_lighting();
+                if ( g_checkpoint )
+                {
+                        SaveLeafAmbientCheckpoint();
+                }
+        }
         DoComputeStaticPropLighting();
 
+        FreeSkyVisibility();
+
+        if ( g_compress_lightmaps )
+        {
+                BuildLightmapPalette();
+        }
+        else
+        {
+                g_bspdata->lightmappalette.clear();
+        }
+
         // free up the direct lights now that we have facelights
         Lights::DeleteDirectLights();
 
@@ -1848,6 +2377,7 @@ static void     Usage()
         Log( "    -vismatrix value: Set vismatrix method to normal, sparse or off .\n" );
         Log( "    -extra          : Improve lighting quality by doing 9 point oversampling\n" );
         Log( "    -bounce #       : Set number of radiosity bounces\n" );
+        Log( "    -bouncesamples #: Bounce by tracing this many rays per patch instead of building transfer lists\n" );
         Log( "    -ambient r g b  : Set ambient world light (0.0 to 1.0, r g b)\n" );
         Log( "    -limiter #      : Set light clipping threshold (-1=None)\n" );
         Log( "    -circus         : Enable 'circus' mode for locating unlit lightmaps\n" );
@@ -1859,6 +2389,10 @@ static void     Usage()
         Log( "    -notexscale     : Do not scale radiosity patches with texture scale\n" );
         Log( "    -coring #       : Set lighting threshold before blackness\n" );
         Log( "    -dlight #       : Set direct lighting threshold\n" );
+        Log( "    -lightcull #    : Skip lights whose contribution to a face is below this (default 0, off)\n" );
+        Log( "    -ambienterror # : Refine leaf ambient samples while neighbors differ by more than this, 0 to disable\n" );
+        Log( "    -skyviscell #   : Share sky rays between samples in cells of this size (default 0, off)\n" );
+        Log( "    -skyvismem #    : Megabytes the shared sky rays may take up, 0 for no limit\n" );
         Log( "    -nolerp         : Disable radiosity interpolation, nearest point instead\n\n" );
         Log( "    -fade #         : Set global fade (larger values = shorter lights)\n" );
         Log( "    -texlightgap #  : Set global gap distance for texlights\n" );
@@ -1867,7 +2401,9 @@ static void     Usage()
         Log( "    -sky #          : Set ambient sunlight contribution in the shade outside\n" );
         Log( "    -lights file    : Manually specify a lights.rad file to use\n" );
         Log( "    -noskyfix       : Disable light_environment being global\n" );
-        Log( "    -incremental    : Use or create an incremental transfer list file\n\n" );
+        Log( "    -incremental    : Reuse unchanged direct lighting and transfers from the last compile\n" );
+        Log( "    -checkpoint     : Save every finished stage and resume from it if the compile is killed\n" );
+        Log( "    -compresslightmaps : Store a BC6H compressed lightmap palette in the BSP\n\n" );
         Log( "    -dump           : Dumps light patches to a file for hlrad debugging info\n\n" );
         Log( "    -texdata #      : Alter maximum texture memory limit (in kb)\n" );
         Log( "    -lightdata #    : Alter maximum lighting memory limit (in kb)\n" ); //lightdata
@@ -1981,6 +2517,7 @@ static void     Settings()
         );
         Log( "oversampling (-extra)[ %17s ] [ %17s ]\n", g_extra ? "on" : "off", DEFAULT_EXTRA ? "on" : "off" );
         Log( "bounces              [ %17d ] [ %17d ]\n", g_numbounce, DEFAULT_BOUNCE );
+        Log( "bounce samples       [ %17d ] [ %17d ]\n", g_bounce_samples, DEFAULT_BOUNCE_SAMPLES );
 
         safe_snprintf( buf1, sizeof( buf1 ), "%1.3f %1.3f %1.3f", g_ambient[0], g_ambient[1], g_ambient[2] );
         safe_snprintf( buf2, sizeof( buf2 ), "%1.3f %1.3f %1.3f", DEFAULT_AMBIENT_RED, DEFAULT_AMBIENT_GREEN, DEFAULT_AMBIENT_BLUE );
@@ -2001,6 +2538,16 @@ static void     Settings()
         safe_snprintf( buf1, sizeof( buf1 ), "%3.3f", g_dlight_threshold );
         safe_snprintf( buf2, sizeof( buf2 ), "%3.3f", DEFAULT_DLIGHT_THRESHOLD );
         Log( "direct threshold     [ %17s ] [ %17s ]\n", buf1, buf2 );
+        safe_snprintf( buf1, sizeof( buf1 ), "%3.3f", g_light_cull_threshold );
+        safe_snprintf( buf2, sizeof( buf2 ), "%3.3f", DEFAULT_LIGHT_CULL_THRESHOLD );
+        Log( "light cull threshold [ %17s ] [ %17s ]\n", buf1, buf2 );
+        safe_snprintf( buf1, sizeof( buf1 ), "%3.3f", g_leaf_ambient_error );
+        safe_snprintf( buf2, sizeof( buf2 ), "%3.3f", DEFAULT_LEAF_AMBIENT_ERROR );
+        Log( "leaf ambient error   [ %17s ] [ %17s ]\n", buf1, buf2 );
+        safe_snprintf( buf1, sizeof( buf1 ), "%3.3f", g_sky_vis_cell );
+        safe_snprintf( buf2, sizeof( buf2 ), "%3.3f", DEFAULT_SKYVIS_CELL );
+        Log( "sky visibility cell  [ %17s ] [ %17s ]\n", buf1, buf2 );
+        Log( "sky visibility mem   [ %17d ] [ %17d ]\n", g_sky_vis_memory, DEFAULT_SKYVIS_MEMORY );
         safe_snprintf( buf1, sizeof( buf1 ), "%3.3f", g_direct_scale );
         safe_snprintf( buf2, sizeof( buf2 ), "%3.3f", DEFAULT_DLIGHT_SCALE );
         Log( "direct light scale   [ %17s ] [ %17s ]\n", buf1, buf2 );
@@ -2053,6 +2600,8 @@ static void     Settings()
         Log( "spread angles        [ %17s ] [ %17s ]\n", g_allow_spread ? "on" : "off", DEFAULT_ALLOW_SPREAD ? "on" : "off" );
         Log( "sky lighting fix     [ %17s ] [ %17s ]\n", g_sky_lighting_fix ? "on" : "off", DEFAULT_SKY_LIGHTING_FIX ? "on" : "off" );
         Log( "incremental          [ %17s ] [ %17s ]\n", g_incremental ? "on" : "off", DEFAULT_INCREMENTAL ? "on" : "off" );
+        Log( "checkpoint           [ %17s ] [ %17s ]\n", g_checkpoint ? "on" : "off", DEFAULT_CHECKPOINT ? "on" : "off" );
+        Log( "compress lightmaps   [ %17s ] [ %17s ]\n", g_compress_lightmaps ? "on" : "off", DEFAULT_COMPRESS_LIGHTMAPS ? "on" : "off" );
         Log( "dump                 [ %17s ] [ %17s ]\n", g_dumppatches ? "on" : "off", DEFAULT_DUMPPATCHES ? "on" : "off" );
 
         // ------------------------------------------------------------------------
@@ -2360,6 +2909,17 @@ int             main( const int argc, char** argv )
                                 {
                                         g_dumppatches = true;
                                 }
+                                else if ( !strcasecmp( argv[i], "-bouncesamples" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                g_bounce_samples = std::max( atoi( argv[++i] ), 0 );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
                                 else if ( !strcasecmp( argv[i], "-bounce" ) )
                                 {
                                         if ( i + 1 < argc )	//added "1" .--vluzacn
@@ -2510,6 +3070,14 @@ int             main( const int argc, char** argv )
                                 {
                                         g_incremental = true;
                                 }
+                                else if ( !strcasecmp( argv[i], "-checkpoint" ) )
+                                {
+                                        g_checkpoint = true;
+                                }
+                                else if ( !strcasecmp( argv[i], "-compresslightmaps" ) )
+                                {
+                                        g_compress_lightmaps = true;
+                                }
                                 else if ( !strcasecmp( argv[i], "-chart" ) )
                                 {
                                         g_chart = true;
@@ -2537,6 +3105,50 @@ int             main( const int argc, char** argv )
                                                 Usage();
                                         }
                                 }
+                                else if ( !strcasecmp( argv[i], "-lightcull" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                g_light_cull_threshold = (float)atof( argv[++i] );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
+                                else if ( !strcasecmp( argv[i], "-ambienterror" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                g_leaf_ambient_error = (float)atof( argv[++i] );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
+                                else if ( !strcasecmp( argv[i], "-skyviscell" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                g_sky_vis_cell = (float)atof( argv[++i] );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
+                                else if ( !strcasecmp( argv[i], "-skyvismem" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                g_sky_vis_memory = atoi( argv[++i] );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
                                 else if ( !strcasecmp( argv[i], "-extra" ) )
                                 {
                                         g_extra = true;
@@ -2648,6 +3260,10 @@ int             main( const int argc, char** argv )
 #ifdef PLATFORM_CAN_CALC_EXTENT
                         hlassume( CalcFaceExtents_test(), assume_first );
 #endif
+                        if ( g_compress_lightmaps )
+                        {
+                                hlassume( BC6H_test(), assume_first );
+                        }
                         dtexdata_init();
                         atexit( dtexdata_free );
 
@@ -2752,6 +3368,11 @@ int             main( const int argc, char** argv )
 
                         WriteBSPFile( g_bspdata, g_source );
 
+                        if ( g_checkpoint )
+                        {
+                                DeleteRadCheckpoints();
+                        }
+
                         end = I_FloatTime();
                         LogTimeElapsed( end - start );
                         // END RAD
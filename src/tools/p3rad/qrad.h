@@ -51,6 +51,7 @@
 #define DEFAULT_LERP_ENABLED        true
 #define DEFAULT_FADE                1.0
 #define DEFAULT_BOUNCE              8
+#define DEFAULT_BOUNCE_SAMPLES      0
 #define DEFAULT_DUMPPATCHES         false
 #define DEFAULT_AMBIENT_RED         0.0
 #define DEFAULT_AMBIENT_GREEN       0.0
@@ -63,10 +64,16 @@
 #define DEFAULT_TEXCHOP             32.0
 #define DEFAULT_LIGHTSCALE          1.0 //1.0 //vluzacn
 #define DEFAULT_DLIGHT_THRESHOLD	0.1
+#define DEFAULT_LIGHT_CULL_THRESHOLD	0.0
+#define DEFAULT_LEAF_AMBIENT_ERROR	0.05
+#define DEFAULT_SKYVIS_CELL         0.0
+#define DEFAULT_SKYVIS_MEMORY       256
 #define DEFAULT_DLIGHT_SCALE        2.0 //2.0 //vluzacn
 #define DEFAULT_SMOOTHING_VALUE     45.0
 #define DEFAULT_SMOOTHING2_VALUE	-1.0
 #define DEFAULT_INCREMENTAL         false
+#define DEFAULT_CHECKPOINT          false
+#define DEFAULT_COMPRESS_LIGHTMAPS  false
 
 
 // ------------------------------------------------------------------------
@@ -395,6 +402,10 @@ extern vec3_t   g_face_centroids[MAX_MAP_EDGES];
 
 extern float    g_lightscale;
 extern float    g_dlight_threshold;
+extern float    g_light_cull_threshold;
+extern float    g_leaf_ambient_error;
+extern float    g_sky_vis_cell;
+extern int      g_sky_vis_memory;
 extern float    g_coring;
 
 #include <simpleHashMap.h>
@@ -487,6 +498,7 @@ extern float    g_direct_scale;
 extern float	g_limitthreshold;
 extern bool		g_drawoverload;
 extern unsigned g_numbounce;
+extern int      g_bounce_samples;
 extern float    g_qgamma;
 extern float    g_indirect_sun;
 extern float    g_smoothing_threshold;
@@ -498,6 +510,9 @@ extern bool     g_estimate;
 extern char     g_source[_MAX_PATH];
 extern float    g_fade;
 extern bool     g_incremental;
+extern bool     g_checkpoint;
+extern bool     g_compress_lightmaps;
+extern bool     g_texscale;
 extern bool     g_circus;
 extern bool		g_allow_spread;
 extern bool     g_sky_lighting_fix;
@@ -0,0 +1,586 @@
+#include "radcache.h"
+#include "radhash.h"
+#include "qrad.h"
+#include "lightmap.h"
+#include "lights.h"
+
+#include <pmap.h>
+
+#include <atomic>
+
+typedef struct
+{
+        int             ident;
+        int             version;
+        radhash_t       transferkey;                           // 0 if the file has no transfer lists
+        int             numpatches;
+        int             numfaces;
+} radcacheheader_t;
+
+// Followed by numsamples bumpsample_t's of direct light and numsamples bumpsample_t's
+// of sunlight for every used style.
+typedef struct
+{
+        radhash_t       key;
+        int             numsamples;
+        int             normal_count;
+        byte            styles[MAXLIGHTMAPS];
+} radcacheface_t;
+
+static char             s_cachefile[_MAX_PATH];
+static char*            s_buffer = nullptr;
+static int              s_bufferlength = 0;
+static const radcacheheader_t* s_header = nullptr;
+static const byte*      s_transfers = nullptr;
+static pmap<radhash_t, const byte*> s_facerecords;
+
+static pvector<radhash_t> s_facekeys;
+static radhash_t        s_transferkey = 0;
+
+static std::atomic<int> s_numfacehits( 0 );
+static std::atomic<int> s_numfacemisses( 0 );
+
+// =====================================================================================
+//  HashFaceGeometry
+//      Everything about a single face that changes where its samples are and how they
+//      are shaded.
+// =====================================================================================
+static radhash_t HashFaceGeometry( int facenum )
+{
+        const dface_t* f = &g_bspdata->dfaces[facenum];
+        const dplane_t* plane = &g_bspdata->dplanes[f->planenum];
+        const texinfo_t* tex = &g_bspdata->texinfo[f->texinfo];
+        const texref_t* tref = &g_bspdata->dtexrefs[tex->texref];
+
+        radhash_t hash = RADHASH_INIT;
+        hash = HashBytes( hash, plane->normal, sizeof( vec3_t ) );
+        hash = HashValue( hash, plane->dist );
+        hash = HashValue( hash, f->side );
+        hash = HashValue( hash, f->numedges );
+        hash = HashValue( hash, f->bumped_lightmap );
+        for ( int i = 0; i < f->numedges; i++ )
+        {
+                hash = HashValue( hash, VertCoord( g_bspdata, f, i ) );
+        }
+        hash = HashBytes( hash, tex->vecs, sizeof( tex->vecs ) );
+        hash = HashBytes( hash, tex->lightmap_vecs, sizeof( tex->lightmap_vecs ) );
+        hash = HashValue( hash, tex->lightmap_scale );
+        hash = HashValue( hash, tex->flags );
+        hash = HashBytes( hash, tref->name, strlen( tref->name ) );
+        hash = HashBytes( hash, f->lightmap_mins, sizeof( f->lightmap_mins ) );
+        hash = HashBytes( hash, f->lightmap_size, sizeof( f->lightmap_size ) );
+        hash = HashBytes( hash, g_face_offset[facenum], sizeof( vec3_t ) );
+        hash = HashValue( hash, g_smoothvalues[tex->texref] );
+        hash = HashBytes( hash, g_translucenttextures[tex->texref], sizeof( vec3_t ) );
+        hash = HashBytes( hash, g_lightingconeinfo[tex->texref], sizeof( vec3_t ) );
+
+        return MixHash( hash );
+}
+
+// =====================================================================================
+//  HashStaticProps
+//      Static props are traced by the direct lighting of every face, so moving, adding
+//      or removing one can change the shadows on any face.
+// =====================================================================================
+static radhash_t HashStaticProps()
+{
+        radhash_t props = 0;
+        for ( size_t i = 0; i < g_bspdata->dstaticprops.size(); i++ )
+        {
+                const dstaticprop_t* prop = &g_bspdata->dstaticprops[i];
+
+                radhash_t hash = RADHASH_INIT;
+                hash = HashBytes( hash, prop->name, strlen( prop->name ) );
+                hash = HashBytes( hash, prop->pos, sizeof( prop->pos ) );
+                hash = HashBytes( hash, prop->hpr, sizeof( prop->hpr ) );
+                hash = HashBytes( hash, prop->scale, sizeof( prop->scale ) );
+                hash = HashValue( hash, prop->flags );
+                props += MixHash( hash );
+        }
+
+        return props;
+}
+
+// =====================================================================================
+//  HashDirectLight
+// =====================================================================================
+radhash_t HashDirectLight( const directlight_t* dl )
+{
+        radhash_t hash = RADHASH_INIT;
+        hash = HashValue( hash, dl->type );
+        hash = HashValue( hash, dl->style );
+        hash = HashValue( hash, dl->origin );
+        hash = HashValue( hash, dl->intensity );
+        hash = HashValue( hash, dl->normal );
+        hash = HashValue( hash, dl->stopdot );
+        hash = HashValue( hash, dl->stopdot2 );
+        hash = HashValue( hash, dl->exponent );
+        hash = HashValue( hash, dl->start_fade_distance );
+        hash = HashValue( hash, dl->end_fade_distance );
+        hash = HashValue( hash, dl->cap_distance );
+        hash = HashValue( hash, dl->quadratic_atten );
+        hash = HashValue( hash, dl->linear_atten );
+        hash = HashValue( hash, dl->constant_atten );
+        hash = HashValue( hash, dl->radius );
+        hash = HashValue( hash, dl->flags );
+
+        return MixHash( hash );
+}
+
+// =====================================================================================
+//  HashDirectSettings
+//      Command line settings that change the direct lighting of every face.
+// =====================================================================================
+radhash_t HashDirectSettings()
+{
+        radhash_t hash = RADHASH_INIT;
+        hash = HashValue( hash, g_extra );
+        hash = HashValue( hash, g_fastmode );
+        hash = HashValue( hash, g_fade );
+        hash = HashValue( hash, g_dlight_threshold );
+        hash = HashValue( hash, g_light_cull_threshold );
+        hash = HashValue( hash, g_softsky );
+        hash = HashValue( hash, g_skysamplescale );
+        hash = HashValue( hash, g_smoothing_threshold );
+        hash = HashValue( hash, g_smoothing_threshold_2 );
+        hash = HashValue( hash, g_allow_spread );
+        hash = HashValue( hash, g_sky_lighting_fix );
+        hash = HashValue( hash, g_blur );
+        hash = HashValue( hash, g_translucentdepth );
+        hash = HashValue( hash, g_bleedfix );
+        hash = HashValue( hash, g_texlightgap );
+        hash = HashValue( hash, g_noemitterrange );
+        hash = HashBytes( hash, g_jitter_hack, sizeof( vec3_t ) );
+        hash = HashBytes( hash, g_colour_jitter_hack, sizeof( vec3_t ) );
+        hash = HashValue( hash, Lights::sun_angular_extent );
+        hash = HashValue( hash, g_sky_vis_cell );
+        hash = HashValue( hash, g_sky_vis_memory );
+
+        return hash;
+}
+
+// =====================================================================================
+//  HashTransferSettings
+// =====================================================================================
+radhash_t HashTransferSettings()
+{
+        radhash_t hash = RADHASH_INIT;
+        hash = HashValue( hash, g_chop );
+        hash = HashValue( hash, g_texchop );
+        hash = HashValue( hash, g_minchop );
+        hash = HashValue( hash, g_maxchop );
+        hash = HashValue( hash, g_texscale );
+        hash = HashValue( hash, g_rgb_transfers );
+        hash = HashValue( hash, g_transtotal_hack );
+        hash = HashValue( hash, g_customshadow_with_bouncelight );
+
+        return hash;
+}
+
+// =====================================================================================
+//  IsOpaqueModel
+//      Brush models with zhlt_lightflags block light but are not referenced by any leaf.
+// =====================================================================================
+static bool IsOpaqueModel( int mdlnum )
+{
+        if ( mdlnum == 0 )
+        {
+                return true;
+        }
+
+        entity_t* ent = EntityForModel( g_bspdata, mdlnum );
+        return ent && IntForKey( ent, "zhlt_lightflags" ) != 0;
+}
+
+// =====================================================================================
+//  ComputeCacheKeys
+//      A face key covers the face itself, the geometry of every leaf visible from the
+//      leaves the face lies in (anything that can shadow or bleed into its samples) and
+//      every direct light whose pvs includes one of those leaves.
+// =====================================================================================
+static void ComputeCacheKeys()
+{
+        int numfaces = g_bspdata->numfaces;
+        int numleafs = GetNumWorldLeafs( g_bspdata );
+        int i;
+
+        pvector<radhash_t> facegeom( numfaces );
+        for ( i = 0; i < numfaces; i++ )
+        {
+                facegeom[i] = HashFaceGeometry( i );
+        }
+
+        // geometry that isn't referenced by the leaves but still casts shadows
+        radhash_t globalhash = HashDirectSettings();
+        globalhash = HashValue( globalhash, HashStaticProps() );
+        radhash_t worldhash = 0;
+        for ( int mdlnum = 0; mdlnum < g_bspdata->nummodels; mdlnum++ )
+        {
+                const dmodel_t* mdl = &g_bspdata->dmodels[mdlnum];
+                bool opaque = IsOpaqueModel( mdlnum );
+                for ( i = mdl->firstface; i < mdl->firstface + mdl->numfaces; i++ )
+                {
+                        worldhash += facegeom[i];
+                        if ( mdlnum != 0 && opaque )
+                        {
+                                globalhash = HashValue( globalhash, facegeom[i] );
+                        }
+                }
+        }
+
+        // geometry in each leaf, and the leaves each face is in
+        pvector<radhash_t> leafgeom( numleafs + 1, 0 );
+        pvector<pvector<int> > faceleafs( numfaces );
+        for ( int leaf = 1; leaf <= numleafs; leaf++ )
+        {
+                const dleaf_t* dleaf = &g_bspdata->dleafs[leaf];
+                for ( i = 0; i < dleaf->nummarksurfaces; i++ )
+                {
+                        int facenum = g_bspdata->dmarksurfaces[dleaf->firstmarksurface + i];
+                        leafgeom[leaf] += facegeom[facenum];
+                        faceleafs[facenum].push_back( leaf );
+                }
+        }
+
+        radhash_t alllights = 0;
+        pvector<radhash_t> lighthashes;
+        for ( directlight_t* dl = Lights::activelights; dl; dl = dl->next )
+        {
+                lighthashes.push_back( HashDirectLight( dl ) );
+                alllights += lighthashes.back();
+        }
+
+        // per leaf: lights that reach it and the geometry it can see
+        pvector<radhash_t> leafkeys( numleafs + 1, 0 );
+        byte pvs[( MAX_MAP_LEAFS + 7 ) / 8];
+        for ( int leaf = 1; leaf <= numleafs; leaf++ )
+        {
+                radhash_t lights = 0;
+                int l = 0;
+                for ( directlight_t* dl = Lights::activelights; dl; dl = dl->next, l++ )
+                {
+                        if ( PVSCheck( dl->pvs, leaf ) )
+                        {
+                                lights += lighthashes[l];
+                        }
+                }
+
+                GetVisCache( -1, leaf, pvs );
+                radhash_t visgeom = leafgeom[leaf];
+                for ( int other = 1; other <= numleafs; other++ )
+                {
+                        if ( PVSCheck( pvs, other ) )
+                        {
+                                visgeom += leafgeom[other];
+                        }
+                }
+
+                leafkeys[leaf] = MixHash( HashValue( HashValue( RADHASH_INIT, lights ), visgeom ) );
+        }
+
+        s_facekeys.resize( numfaces );
+        for ( i = 0; i < numfaces; i++ )
+        {
+                radhash_t hash = HashValue( globalhash, facegeom[i] );
+                if ( faceleafs[i].empty() )
+                {
+                        // brush model faces aren't in any leaf, assume they can see everything
+                        hash = HashValue( hash, alllights );
+                        hash = HashValue( hash, worldhash );
+                }
+                else
+                {
+                        radhash_t leafs = 0;
+                        for ( size_t j = 0; j < faceleafs[i].size(); j++ )
+                        {
+                                leafs += leafkeys[faceleafs[i][j]];
+                        }
+                        hash = HashValue( hash, leafs );
+                }
+                s_facekeys[i] = hash;
+        }
+
+        // transfers depend on the patch layout of the whole map
+        if ( g_numbounce > 0 )
+        {
+                radhash_t hash = HashTransferSettings();
+                hash = HashValue( hash, worldhash );
+                hash = HashBytes( hash, g_bspdata->dvisdata, g_bspdata->visdatasize );
+                hash = HashValue( hash, g_patches.size() );
+                for ( size_t p = 0; p < g_patches.size(); p++ )
+                {
+                        hash = HashValue( hash, g_patches[p].origin );
+                        hash = HashValue( hash, g_patches[p].area );
+                }
+                s_transferkey = hash ? hash : 1;
+        }
+}
+
+// =====================================================================================
+//  LoadRadCache
+// =====================================================================================
+void LoadRadCache()
+{
+        safe_snprintf( s_cachefile, _MAX_PATH, "%s.rlc", g_Mapname );
+
+        ComputeCacheKeys();
+
+        if ( !q_exists( s_cachefile ) )
+        {
+                Log( "No incremental lighting cache, lighting every face.\n" );
+                return;
+        }
+
+        s_bufferlength = LoadFile( s_cachefile, &s_buffer );
+
+        const byte* cursor = (const byte*)s_buffer;
+        const byte* end = cursor + s_bufferlength;
+
+        if ( s_bufferlength < (int)sizeof( radcacheheader_t ) )
+        {
+                Warning( "%s is not a lighting cache, ignoring it.", s_cachefile );
+                FreeRadCache();
+                return;
+        }
+
+        s_header = (const radcacheheader_t*)cursor;
+        cursor += sizeof( radcacheheader_t );
+        if ( s_header->ident != RADCACHE_IDENT || s_header->version != RADCACHE_VERSION )
+        {
+                Warning( "%s is from a different version of %s, ignoring it.", s_cachefile, g_Program );
+                FreeRadCache();
+                return;
+        }
+
+        if ( s_header->transferkey )
+        {
+                s_transfers = cursor;
+                for ( int p = 0; p < s_header->numpatches; p++ )
+                {
+                        int numtransfers;
+                        if ( end - cursor < (ptrdiff_t)sizeof( int ) )
+                        {
+                                break;
+                        }
+                        memcpy( &numtransfers, cursor, sizeof( int ) );
+                        cursor += sizeof( int ) + numtransfers * sizeof( transfer_t );
+                }
+        }
+
+        for ( int f = 0; f < s_header->numfaces && cursor < end; f++ )
+        {
+                radcacheface_t rec;
+                if ( end - cursor < (ptrdiff_t)sizeof( radcacheface_t ) )
+                {
+                        break;
+                }
+                memcpy( &rec, cursor, sizeof( radcacheface_t ) );
+
+                int numstyles = 0;
+                while ( numstyles < MAXLIGHTMAPS && rec.styles[numstyles] != 255 )
+                {
+                        numstyles++;
+                }
+                size_t size = sizeof( radcacheface_t ) + numstyles * 2 * rec.numsamples * sizeof( bumpsample_t );
+                if ( rec.numsamples < 0 || (size_t)( end - cursor ) < size )
+                {
+                        break;
+                }
+
+                s_facerecords[rec.key] = cursor;
+                cursor += size;
+        }
+
+        if ( cursor != end )
+        {
+                Warning( "%s is truncated, ignoring it.", s_cachefile );
+                FreeRadCache();
+                return;
+        }
+
+        Log( "Loaded incremental lighting cache: %d faces\n", (int)s_facerecords.size() );
+}
+
+// =====================================================================================
+//  RestoreFacelightFromRadCache
+// =====================================================================================
+bool RestoreFacelightFromRadCache( int facenum, int normal_count )
+{
+        bool hit = false;
+
+        if ( !s_facekeys.empty() )
+        {
+                pmap<radhash_t, const byte*>::const_iterator it = s_facerecords.find( s_facekeys[facenum] );
+                if ( it != s_facerecords.end() )
+                {
+                        dface_t* f = &g_bspdata->dfaces[facenum];
+                        facelight_t* fl = &facelight[facenum];
+                        const byte* cursor = it->second;
+                        radcacheface_t rec;
+
+                        memcpy( &rec, cursor, sizeof( radcacheface_t ) );
+                        cursor += sizeof( radcacheface_t );
+
+                        if ( rec.numsamples == fl->numsamples && rec.normal_count == normal_count )
+                        {
+                                size_t size = rec.numsamples * sizeof( bumpsample_t );
+                                for ( int k = 0; k < MAXLIGHTMAPS && rec.styles[k] != 255; k++ )
+                                {
+                                        // style 0 has already been allocated by BuildFacelights
+                                        if ( k != 0 )
+                                        {
+                                                AllocateLightstyleSamples( fl, k, normal_count );
+                                        }
+                                        f->styles[k] = rec.styles[k];
+                                        memcpy( fl->light[k], cursor, size );
+                                        cursor += size;
+                                        memcpy( fl->sunlight[k], cursor, size );
+                                        cursor += size;
+                                }
+                                hit = true;
+                        }
+                }
+        }
+
+        if ( hit )
+        {
+                s_numfacehits++;
+        }
+        else
+        {
+                s_numfacemisses++;
+        }
+
+        return hit;
+}
+
+// =====================================================================================
+//  RestoreTransfersFromRadCache
+// =====================================================================================
+bool RestoreTransfersFromRadCache()
+{
+        if ( !s_transfers || s_header->transferkey != s_transferkey ||
+             s_header->numpatches != (int)g_patches.size() )
+        {
+                Log( "Patch layout changed, rebuilding transfer lists.\n" );
+                return false;
+        }
+
+        const byte* cursor = s_transfers;
+        int maxtransfers = 0;
+        for ( size_t p = 0; p < g_patches.size(); p++ )
+        {
+                patch_t* patch = &g_patches[p];
+
+                memcpy( &patch->numtransfers, cursor, sizeof( int ) );
+                cursor += sizeof( int );
+
+                if ( patch->numtransfers )
+                {
+                        size_t size = patch->numtransfers * sizeof( transfer_t );
+                        patch->transfers = (transfer_t*)malloc( size );
+                        if ( !patch->transfers )
+                        {
+                                Error( "Memory allocation failure" );
+                        }
+                        memcpy( patch->transfers, cursor, size );
+                        cursor += size;
+                }
+
+                g_total_transfer += patch->numtransfers;
+                maxtransfers = std::max( maxtransfers, patch->numtransfers );
+        }
+
+        Log( "transfers %d, max %d (from incremental lighting cache)\n", (int)g_total_transfer, maxtransfers );
+
+        return true;
+}
+
+// =====================================================================================
+//  SaveRadCache
+//      Must run before FinalLightFace, which scales the facelights in place.
+// =====================================================================================
+void SaveRadCache()
+{
+        if ( s_numfacehits || s_numfacemisses )
+        {
+                Log( "Incremental lighting: %d faces reused, %d faces relit\n", s_numfacehits.load(), s_numfacemisses.load() );
+        }
+
+        FILE* f = SafeOpenWrite( s_cachefile );
+
+        radcacheheader_t header;
+        memset( &header, 0, sizeof( header ) );
+        header.ident = RADCACHE_IDENT;
+        header.version = RADCACHE_VERSION;
+        header.numpatches = (int)g_patches.size();
+
+        bool hastransfers = g_numbounce > 0 && g_bounce_samples == 0;
+        header.transferkey = hastransfers ? s_transferkey : 0;
+
+        for ( int facenum = 0; facenum < g_bspdata->numfaces; facenum++ )
+        {
+                if ( facelight[facenum].light[0] )
+                {
+                        header.numfaces++;
+                }
+        }
+
+        SafeWrite( f, &header, sizeof( header ) );
+
+        if ( hastransfers )
+        {
+                for ( size_t p = 0; p < g_patches.size(); p++ )
+                {
+                        const patch_t* patch = &g_patches[p];
+                        SafeWrite( f, &patch->numtransfers, sizeof( int ) );
+                        if ( patch->numtransfers )
+                        {
+                                SafeWrite( f, patch->transfers, patch->numtransfers * sizeof( transfer_t ) );
+                        }
+                }
+        }
+
+        for ( int facenum = 0; facenum < g_bspdata->numfaces; facenum++ )
+        {
+                const dface_t* face = &g_bspdata->dfaces[facenum];
+                const facelight_t* fl = &facelight[facenum];
+                if ( !fl->light[0] )
+                {
+                        continue;
+                }
+
+                radcacheface_t rec;
+                memset( &rec, 0, sizeof( rec ) );
+                rec.key = s_facekeys[facenum];
+                rec.numsamples = fl->numsamples;
+                rec.normal_count = fl->normal_count;
+                memcpy( rec.styles, face->styles, sizeof( rec.styles ) );
+                SafeWrite( f, &rec, sizeof( rec ) );
+
+                size_t size = fl->numsamples * sizeof( bumpsample_t );
+                for ( int k = 0; k < MAXLIGHTMAPS && face->styles[k] != 255; k++ )
+                {
+                        SafeWrite( f, fl->light[k], size );
+                        SafeWrite( f, fl->sunlight[k], size );
+                }
+        }
+
+        fclose( f );
+}
+
+// =====================================================================================
+//  FreeRadCache
+// =====================================================================================
+void FreeRadCache()
+{
+        s_facerecords.clear();
+        s_header = nullptr;
+        s_transfers = nullptr;
+        if ( s_buffer )
+        {
+                Free( s_buffer );
+                s_buffer = nullptr;
+        }
+        s_bufferlength = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef RADCACHE_H
+#define RADCACHE_H
+
+#include "cmdlib.h"
+
+//
+// Incremental relighting (-incremental)
+//
+// The direct lighting of every face and the patch transfer lists are saved to
+// mapname.rlc at the end of a compile. On the next compile each face gets a key
+// built from its own geometry, the geometry of every leaf potentially visible from
+// it and every direct light that can reach it. Faces whose key is unchanged copy
+// their direct lighting out of the cache instead of tracing it again.
+//
+// The transfer lists depend on the patch layout of the whole map, so they are only
+// reused when the world geometry, visibility and chop settings are unchanged.
+//
+// Bounce, lightmap finalization, leaf ambient and static prop lighting are always
+// recomputed.
+//
+
+#define RADCACHE_IDENT          (('C'<<24)+('L'<<16)+('R'<<8)+'P')     // "PRLC"
+#define RADCACHE_VERSION        1
+
+// Must run after the direct lights have been created and scaled.
+extern void     LoadRadCache();
+
+// Called from BuildFacelights once the samples of the face are set up. Returns true
+// if the direct lighting of the face was restored from the cache.
+extern bool     RestoreFacelightFromRadCache( int facenum, int normal_count );
+
+// Returns true if the transfer lists of every patch were restored from the cache.
+extern bool     RestoreTransfersFromRadCache();
+
+extern void     SaveRadCache();
+extern void     FreeRadCache();
+
+#endif // RADCACHE_H
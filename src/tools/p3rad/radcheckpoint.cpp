@@ -0,0 +1,664 @@
+#include "radcheckpoint.h"
+#include "radhash.h"
+#include "qrad.h"
+#include "lightmap.h"
+#include "lights.h"
+
+#include <stdio.h>
+
+typedef struct
+{
+        int             ident;
+        int             version;
+        int             stage;
+        int             count;                                 // faces, patches or leafs the stage covers
+        radhash_t       key;
+} radcheckpointheader_t;
+
+// Followed by numsamples bumpsample_t's of direct light and numsamples bumpsample_t's
+// of sunlight for every used style.
+typedef struct
+{
+        int             numsamples;
+        int             normal_count;
+        byte            styles[MAXLIGHTMAPS];
+} radcheckpointface_t;
+
+typedef struct
+{
+        byte            styles[MAXLIGHTMAPS];
+        int             lightofs;
+        int             bouncedlightofs;
+        int             sunlightofs;
+} radcheckpointlightofs_t;
+
+static const char*      s_stagenames[RADSTAGE_COUNT] =
+{
+        "facelights",
+        "transfers",
+        "bounce",
+        "lightdata",
+        "leafambient"
+};
+
+static radhash_t        s_key = 0;
+
+static char*            s_facebuffer = nullptr;
+static pvector<const byte*> s_facerecords;
+static int              s_numfacesrestored = 0;
+
+// =====================================================================================
+//  ComputeCheckpointKey
+//      Everything a stage's output depends on: the input BSP, the settings of every
+//      stage, the direct lights (which also cover lights.rad) and the patch layout.
+// =====================================================================================
+static radhash_t ComputeCheckpointKey()
+{
+        radhash_t hash = RADHASH_INIT;
+
+        char* buffer;
+        int length = LoadFile( g_source, &buffer );
+        hash = HashBytes( hash, buffer, length );
+        Free( buffer );
+
+        hash = HashValue( hash, HashDirectSettings() );
+        hash = HashValue( hash, HashTransferSettings() );
+
+        // bounce, lightmap finalization and leaf ambient
+        hash = HashValue( hash, g_numbounce );
+        hash = HashValue( hash, g_bounce_samples );
+        hash = HashValue( hash, g_lightscale );
+        hash = HashValue( hash, g_direct_scale );
+        hash = HashValue( hash, g_coring );
+        hash = HashValue( hash, g_qgamma );
+        hash = HashValue( hash, g_indirect_sun );
+        hash = HashValue( hash, g_limitthreshold );
+        hash = HashValue( hash, g_minlight );
+        hash = HashValue( hash, g_drawlerp );
+        hash = HashValue( hash, g_texreflectgamma );
+        hash = HashValue( hash, g_texreflectscale );
+        hash = HashValue( hash, g_leaf_ambient_error );
+        hash = HashBytes( hash, g_ambient, sizeof( g_ambient ) );
+        hash = HashBytes( hash, g_colour_qgamma, sizeof( vec3_t ) );
+        hash = HashBytes( hash, g_colour_lightscale, sizeof( vec3_t ) );
+
+        radhash_t lights = 0;
+        for ( directlight_t* dl = Lights::activelights; dl; dl = dl->next )
+        {
+                lights += HashDirectLight( dl );
+        }
+        hash = HashValue( hash, lights );
+
+        hash = HashValue( hash, g_patches.size() );
+        for ( size_t p = 0; p < g_patches.size(); p++ )
+        {
+                hash = HashValue( hash, g_patches[p].origin );
+                hash = HashValue( hash, g_patches[p].area );
+                hash = HashValue( hash, g_patches[p].reflectivity );
+        }
+
+        hash = MixHash( hash );
+        return hash ? hash : 1;
+}
+
+static void GetCheckpointFile( radstage_t stage, char* filename )
+{
+        safe_snprintf( filename, _MAX_PATH, "%s.%s.rck", g_Mapname, s_stagenames[stage] );
+}
+
+static bool ReadCheckpoint( const byte*& cursor, const byte* end, void* data, size_t size )
+{
+        if ( (size_t)( end - cursor ) < size )
+        {
+                return false;
+        }
+
+        memcpy( data, cursor, size );
+        cursor += size;
+        return true;
+}
+
+// =====================================================================================
+//  OpenCheckpoint
+//      Loads the checkpoint of a stage if it was written by the same compile. Returns
+//      the file buffer, cursor points past the header.
+// =====================================================================================
+static char* OpenCheckpoint( radstage_t stage, int count, const byte*& cursor, const byte*& end )
+{
+        char filename[_MAX_PATH];
+        GetCheckpointFile( stage, filename );
+
+        if ( !q_exists( filename ) )
+        {
+                return nullptr;
+        }
+
+        char* buffer;
+        int length = LoadFile( filename, &buffer );
+        cursor = (const byte*)buffer;
+        end = cursor + length;
+
+        radcheckpointheader_t header;
+        if ( !ReadCheckpoint( cursor, end, &header, sizeof( header ) ) ||
+             header.ident != RADCHECKPOINT_IDENT || header.version != RADCHECKPOINT_VERSION ||
+             header.stage != stage )
+        {
+                Warning( "%s is not a checkpoint of this version of %s, ignoring it.", filename, g_Program );
+                Free( buffer );
+                return nullptr;
+        }
+
+        if ( header.key != s_key || header.count != count )
+        {
+                Log( "%s is from a different compile, ignoring it.\n", filename );
+                Free( buffer );
+                return nullptr;
+        }
+
+        return buffer;
+}
+
+// =====================================================================================
+//  BeginCheckpoint / EndCheckpoint
+//      The stage is written to a temporary file which replaces the checkpoint once it
+//      is complete, so a compile killed while saving leaves the previous one intact.
+// =====================================================================================
+static FILE* BeginCheckpoint( radstage_t stage, int count )
+{
+        char filename[_MAX_PATH];
+        char tempname[_MAX_PATH];
+        GetCheckpointFile( stage, filename );
+        safe_snprintf( tempname, _MAX_PATH, "%s.tmp", filename );
+
+        FILE* f = SafeOpenWrite( tempname );
+
+        radcheckpointheader_t header;
+        memset( &header, 0, sizeof( header ) );
+        header.ident = RADCHECKPOINT_IDENT;
+        header.version = RADCHECKPOINT_VERSION;
+        header.stage = stage;
+        header.count = count;
+        header.key = s_key;
+        SafeWrite( f, &header, sizeof( header ) );
+
+        return f;
+}
+
+static void EndCheckpoint( radstage_t stage, FILE* f )
+{
+        char filename[_MAX_PATH];
+        char tempname[_MAX_PATH];
+        GetCheckpointFile( stage, filename );
+        safe_snprintf( tempname, _MAX_PATH, "%s.tmp", filename );
+
+        fclose( f );
+
+        remove( filename );
+        if ( rename( tempname, filename ) != 0 )
+        {
+                Warning( "Could not write checkpoint %s.", filename );
+                return;
+        }
+
+        Verbose( "Saved %s checkpoint\n", s_stagenames[stage] );
+}
+
+template <class T>
+static void WriteCheckpointVector( FILE* f, const pvector<T>& v )
+{
+        int count = (int)v.size();
+        SafeWrite( f, &count, sizeof( int ) );
+        if ( count )
+        {
+                SafeWrite( f, v.data(), count * sizeof( T ) );
+        }
+}
+
+template <class T>
+static bool ReadCheckpointVector( const byte*& cursor, const byte* end, pvector<T>& v )
+{
+        int count;
+        if ( !ReadCheckpoint( cursor, end, &count, sizeof( int ) ) || count < 0 ||
+             (size_t)( end - cursor ) < count * sizeof( T ) )
+        {
+                return false;
+        }
+
+        v.resize( count );
+        return ReadCheckpoint( cursor, end, v.data(), count * sizeof( T ) );
+}
+
+// =====================================================================================
+//  InitRadCheckpoints
+// =====================================================================================
+void InitRadCheckpoints()
+{
+        s_key = ComputeCheckpointKey();
+}
+
+// =====================================================================================
+//  LoadFacelightCheckpoint
+// =====================================================================================
+bool LoadFacelightCheckpoint()
+{
+        const byte* cursor;
+        const byte* end;
+        s_facebuffer = OpenCheckpoint( RADSTAGE_FACELIGHTS, g_bspdata->numfaces, cursor, end );
+        if ( !s_facebuffer )
+        {
+                return false;
+        }
+
+        bool valid = true;
+        s_facerecords.resize( g_bspdata->numfaces );
+        for ( int facenum = 0; facenum < g_bspdata->numfaces && valid; facenum++ )
+        {
+                radcheckpointface_t rec;
+                s_facerecords[facenum] = cursor;
+                if ( !ReadCheckpoint( cursor, end, &rec, sizeof( rec ) ) || rec.numsamples < 0 )
+                {
+                        valid = false;
+                        break;
+                }
+
+                int numstyles = 0;
+                while ( numstyles < MAXLIGHTMAPS && rec.styles[numstyles] != 255 )
+                {
+                        numstyles++;
+                }
+                size_t size = numstyles * 2 * rec.numsamples * sizeof( bumpsample_t );
+                if ( (size_t)( end - cursor ) < size )
+                {
+                        valid = false;
+                        break;
+                }
+                cursor += size;
+        }
+
+        if ( !valid || cursor != end )
+        {
+                Warning( "The facelights checkpoint is truncated, ignoring it." );
+                FreeFacelightCheckpoint();
+                return false;
+        }
+
+        s_numfacesrestored = 0;
+        Log( "Resuming from facelights checkpoint\n" );
+        return true;
+}
+
+// =====================================================================================
+//  RestoreFacelightFromCheckpoint
+// =====================================================================================
+bool RestoreFacelightFromCheckpoint( int facenum, int normal_count )
+{
+        if ( !s_facebuffer )
+        {
+                return false;
+        }
+
+        dface_t* f = &g_bspdata->dfaces[facenum];
+        facelight_t* fl = &facelight[facenum];
+        const byte* cursor = s_facerecords[facenum];
+        radcheckpointface_t rec;
+
+        memcpy( &rec, cursor, sizeof( radcheckpointface_t ) );
+        cursor += sizeof( radcheckpointface_t );
+
+        if ( rec.numsamples != fl->numsamples || rec.normal_count != normal_count )
+        {
+                return false;
+        }
+
+        size_t size = rec.numsamples * sizeof( bumpsample_t );
+        for ( int k = 0; k < MAXLIGHTMAPS && rec.styles[k] != 255; k++ )
+        {
+                // style 0 has already been allocated by BuildFacelights
+                if ( k != 0 )
+                {
+                        AllocateLightstyleSamples( fl, k, normal_count );
+                }
+                f->styles[k] = rec.styles[k];
+                memcpy( fl->light[k], cursor, size );
+                cursor += size;
+                memcpy( fl->sunlight[k], cursor, size );
+                cursor += size;
+        }
+
+        ThreadLock();
+        s_numfacesrestored++;
+        ThreadUnlock();
+
+        return true;
+}
+
+// =====================================================================================
+//  FreeFacelightCheckpoint
+// =====================================================================================
+void FreeFacelightCheckpoint()
+{
+        if ( s_facebuffer )
+        {
+                Log( "%d faces restored from checkpoint\n", s_numfacesrestored );
+                Free( s_facebuffer );
+                s_facebuffer = nullptr;
+        }
+        s_facerecords.clear();
+}
+
+// =====================================================================================
+//  SaveFacelightCheckpoint
+//      Must run before FinalLightFace, which scales the facelights in place.
+// =====================================================================================
+void SaveFacelightCheckpoint()
+{
+        FILE* f = BeginCheckpoint( RADSTAGE_FACELIGHTS, g_bspdata->numfaces );
+
+        for ( int facenum = 0; facenum < g_bspdata->numfaces; facenum++ )
+        {
+                const dface_t* face = &g_bspdata->dfaces[facenum];
+                const facelight_t* fl = &facelight[facenum];
+
+                radcheckpointface_t rec;
+                memset( &rec, 0, sizeof( rec ) );
+                memset( rec.styles, 255, sizeof( rec.styles ) );
+                if ( fl->light[0] )
+                {
+                        rec.numsamples = fl->numsamples;
+                        rec.normal_count = fl->normal_count;
+                        memcpy( rec.styles, face->styles, sizeof( rec.styles ) );
+                }
+                SafeWrite( f, &rec, sizeof( rec ) );
+
+                size_t size = rec.numsamples * sizeof( bumpsample_t );
+                for ( int k = 0; k < MAXLIGHTMAPS && rec.styles[k] != 255; k++ )
+                {
+                        SafeWrite( f, fl->light[k], size );
+                        SafeWrite( f, fl->sunlight[k], size );
+                }
+        }
+
+        EndCheckpoint( RADSTAGE_FACELIGHTS, f );
+}
+
+// =====================================================================================
+//  RestoreTransfersFromCheckpoint
+// =====================================================================================
+bool RestoreTransfersFromCheckpoint()
+{
+        const byte* cursor;
+        const byte* end;
+        char* buffer = OpenCheckpoint( RADSTAGE_TRANSFERS, (int)g_patches.size(), cursor, end );
+        if ( !buffer )
+        {
+                return false;
+        }
+
+        // validate the whole file before touching the patches
+        const byte* check = cursor;
+        for ( size_t p = 0; p < g_patches.size(); p++ )
+        {
+                int numtransfers;
+                if ( !ReadCheckpoint( check, end, &numtransfers, sizeof( int ) ) || numtransfers < 0 ||
+                     (size_t)( end - check ) < numtransfers * sizeof( transfer_t ) )
+                {
+                        check = nullptr;
+                        break;
+                }
+                check += numtransfers * sizeof( transfer_t );
+        }
+
+        if ( check != end )
+        {
+                Warning( "The transfers checkpoint is truncated, ignoring it." );
+                Free( buffer );
+                return false;
+        }
+
+        int maxtransfers = 0;
+        for ( size_t p = 0; p < g_patches.size(); p++ )
+        {
+                patch_t* patch = &g_patches[p];
+
+                ReadCheckpoint( cursor, end, &patch->numtransfers, sizeof( int ) );
+                if ( patch->numtransfers )
+                {
+                        size_t size = patch->numtransfers * sizeof( transfer_t );
+                        patch->transfers = (transfer_t*)malloc( size );
+                        if ( !patch->transfers )
+                        {
+                                Error( "Memory allocation failure" );
+                        }
+                        ReadCheckpoint( cursor, end, patch->transfers, size );
+                }
+
+                g_total_transfer += patch->numtransfers;
+                maxtransfers = std::max( maxtransfers, patch->numtransfers );
+        }
+
+        Free( buffer );
+
+        Log( "transfers %d, max %d (from checkpoint)\n", (int)g_total_transfer, maxtransfers );
+
+        return true;
+}
+
+// =====================================================================================
+//  SaveTransfersCheckpoint
+// =====================================================================================
+void SaveTransfersCheckpoint()
+{
+        FILE* f = BeginCheckpoint( RADSTAGE_TRANSFERS, (int)g_patches.size() );
+
+        for ( size_t p = 0; p < g_patches.size(); p++ )
+        {
+                const patch_t* patch = &g_patches[p];
+                SafeWrite( f, &patch->numtransfers, sizeof( int ) );
+                if ( patch->numtransfers )
+                {
+                        SafeWrite( f, patch->transfers, patch->numtransfers * sizeof( transfer_t ) );
+                }
+        }
+
+        EndCheckpoint( RADSTAGE_TRANSFERS, f );
+}
+
+// =====================================================================================
+//  RestoreBounceFromCheckpoint
+// =====================================================================================
+bool RestoreBounceFromCheckpoint( int& bounce, bool& done, pvector<float>* emitlight )
+{
+        const byte* cursor;
+        const byte* end;
+        char* buffer = OpenCheckpoint( RADSTAGE_BOUNCE, (int)g_patches.size(), cursor, end );
+        if ( !buffer )
+        {
+                return false;
+        }
+
+        int state[2];
+        size_t size = g_patches.size() * ( sizeof( bumpsample_t ) + sizeof( LVector3 ) );
+        if ( !ReadCheckpoint( cursor, end, state, sizeof( state ) ) || (size_t)( end - cursor ) != size )
+        {
+                Warning( "The bounce checkpoint is truncated, ignoring it." );
+                Free( buffer );
+                return false;
+        }
+
+        for ( size_t p = 0; p < g_patches.size(); p++ )
+        {
+                ReadCheckpoint( cursor, end, &g_patches[p].totallight, sizeof( bumpsample_t ) );
+                LVector3 emit;
+                ReadCheckpoint( cursor, end, &emit, sizeof( LVector3 ) );
+                for ( int c = 0; c < 3; c++ )
+                {
+                        emitlight[c][p] = emit[c];
+                }
+        }
+
+        Free( buffer );
+
+        bounce = state[0];
+        done = state[1] != 0;
+
+        Log( "Resuming after bounce #%i from checkpoint\n", bounce );
+
+        return true;
+}
+
+// =====================================================================================
+//  SaveBounceCheckpoint
+// =====================================================================================
+void SaveBounceCheckpoint( int bounce, bool done, const pvector<float>* emitlight )
+{
+        FILE* f = BeginCheckpoint( RADSTAGE_BOUNCE, (int)g_patches.size() );
+
+        int state[2] = { bounce, done ? 1 : 0 };
+        SafeWrite( f, state, sizeof( state ) );
+
+        for ( size_t p = 0; p < g_patches.size(); p++ )
+        {
+                SafeWrite( f, &g_patches[p].totallight, sizeof( bumpsample_t ) );
+                LVector3 emit( emitlight[0][p], emitlight[1][p], emitlight[2][p] );
+                SafeWrite( f, &emit, sizeof( LVector3 ) );
+        }
+
+        EndCheckpoint( RADSTAGE_BOUNCE, f );
+}
+
+// =====================================================================================
+//  RestoreLightdataFromCheckpoint
+// =====================================================================================
+bool RestoreLightdataFromCheckpoint()
+{
+        const byte* cursor;
+        const byte* end;
+        char* buffer = OpenCheckpoint( RADSTAGE_LIGHTDATA, g_bspdata->numfaces, cursor, end );
+        if ( !buffer )
+        {
+                return false;
+        }
+
+        pvector<radcheckpointlightofs_t> faces;
+        pvector<colorrgbexp32_t> lightdata, bouncedlightdata, sunlightdata;
+        if ( !ReadCheckpointVector( cursor, end, faces ) || (int)faces.size() != g_bspdata->numfaces ||
+             !ReadCheckpointVector( cursor, end, lightdata ) ||
+             !ReadCheckpointVector( cursor, end, bouncedlightdata ) ||
+             !ReadCheckpointVector( cursor, end, sunlightdata ) ||
+             cursor != end )
+        {
+                Warning( "The lightdata checkpoint is truncated, ignoring it." );
+                Free( buffer );
+                return false;
+        }
+
+        Free( buffer );
+
+        for ( int facenum = 0; facenum < g_bspdata->numfaces; facenum++ )
+        {
+                dface_t* f = &g_bspdata->dfaces[facenum];
+                memcpy( f->styles, faces[facenum].styles, sizeof( f->styles ) );
+                f->lightofs = faces[facenum].lightofs;
+                f->bouncedlightofs = faces[facenum].bouncedlightofs;
+                f->sunlightofs = faces[facenum].sunlightofs;
+        }
+
+        g_bspdata->lightdata.swap( lightdata );
+        g_bspdata->bouncedlightdata.swap( bouncedlightdata );
+        g_bspdata->sunlightdata.swap( sunlightdata );
+
+        Log( "Resuming from lightdata checkpoint\n" );
+
+        return true;
+}
+
+// =====================================================================================
+//  SaveLightdataCheckpoint
+// =====================================================================================
+void SaveLightdataCheckpoint()
+{
+        FILE* f = BeginCheckpoint( RADSTAGE_LIGHTDATA, g_bspdata->numfaces );
+
+        pvector<radcheckpointlightofs_t> faces( g_bspdata->numfaces );
+        for ( int facenum = 0; facenum < g_bspdata->numfaces; facenum++ )
+        {
+                const dface_t* face = &g_bspdata->dfaces[facenum];
+                memset( &faces[facenum], 0, sizeof( radcheckpointlightofs_t ) );
+                memcpy( faces[facenum].styles, face->styles, sizeof( face->styles ) );
+                faces[facenum].lightofs = face->lightofs;
+                faces[facenum].bouncedlightofs = face->bouncedlightofs;
+                faces[facenum].sunlightofs = face->sunlightofs;
+        }
+
+        WriteCheckpointVector( f, faces );
+        WriteCheckpointVector( f, g_bspdata->lightdata );
+        WriteCheckpointVector( f, g_bspdata->bouncedlightdata );
+        WriteCheckpointVector( f, g_bspdata->sunlightdata );
+
+        EndCheckpoint( RADSTAGE_LIGHTDATA, f );
+}
+
+// =====================================================================================
+//  RestoreLeafAmbientFromCheckpoint
+// =====================================================================================
+bool RestoreLeafAmbientFromCheckpoint()
+{
+        const byte* cursor;
+        const byte* end;
+        int numleafs = g_bspdata->dmodels[0].visleafs + 1;
+        char* buffer = OpenCheckpoint( RADSTAGE_LEAFAMBIENT, numleafs, cursor, end );
+        if ( !buffer )
+        {
+                return false;
+        }
+
+        pvector<dleafambientindex_t> leafambientindex;
+        pvector<dleafambientlighting_t> leafambientlighting;
+        if ( !ReadCheckpointVector( cursor, end, leafambientindex ) || (int)leafambientindex.size() != numleafs ||
+             !ReadCheckpointVector( cursor, end, leafambientlighting ) ||
+             cursor != end )
+        {
+                Warning( "The leafambient checkpoint is truncated, ignoring it." );
+                Free( buffer );
+                return false;
+        }
+
+        Free( buffer );
+
+        g_bspdata->leafambientindex.swap( leafambientindex );
+        g_bspdata->leafambientlighting.swap( leafambientlighting );
+
+        Log( "Resuming from leafambient checkpoint\n" );
+
+        return true;
+}
+
+// =====================================================================================
+//  SaveLeafAmbientCheckpoint
+// =====================================================================================
+void SaveLeafAmbientCheckpoint()
+{
+        FILE* f = BeginCheckpoint( RADSTAGE_LEAFAMBIENT, (int)g_bspdata->leafambientindex.size() );
+
+        WriteCheckpointVector( f, g_bspdata->leafambientindex );
+        WriteCheckpointVector( f, g_bspdata->leafambientlighting );
+
+        EndCheckpoint( RADSTAGE_LEAFAMBIENT, f );
+}
+
+// =====================================================================================
+//  DeleteRadCheckpoints
+//      Called once the BSP has been written, the checkpoints are no use after that.
+// =====================================================================================
+void DeleteRadCheckpoints()
+{
+        for ( int stage = 0; stage < RADSTAGE_COUNT; stage++ )
+        {
+                char filename[_MAX_PATH];
+                GetCheckpointFile( (radstage_t)stage, filename );
+                if ( q_exists( filename ) )
+                {
+                        remove( filename );
+                }
+        }
+}
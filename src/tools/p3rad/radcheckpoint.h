@@ -0,0 +1,66 @@
+#ifndef RADCHECKPOINT_H
+#define RADCHECKPOINT_H
+
+#include "cmdlib.h"
+#include "mathlib.h"
+
+//
+// Stage checkpoints (-checkpoint)
+//
+// Each finished stage of RadWorld is written to mapname.<stage>.rck, so a compile
+// that was killed can pick up after the last stage it completed:
+//
+//   facelights  direct lighting of every face
+//   transfers   patch transfer lists
+//   bounce      patch light after every bounce
+//   lightdata   the finished lightmaps
+//   leafambient the per leaf ambient cubes
+//
+// Every file carries a key built from the contents of the input BSP, the command
+// line settings, the direct lights and the patch layout. Files with a different key
+// are ignored, so a rerun only resumes when it would have computed the same thing.
+// The checkpoints are deleted once the BSP has been written.
+//
+
+#define RADCHECKPOINT_IDENT     (('K'<<24)+('C'<<16)+('R'<<8)+'P')     // "PRCK"
+#define RADCHECKPOINT_VERSION   1
+
+typedef enum
+{
+        RADSTAGE_FACELIGHTS,
+        RADSTAGE_TRANSFERS,
+        RADSTAGE_BOUNCE,
+        RADSTAGE_LIGHTDATA,
+        RADSTAGE_LEAFAMBIENT,
+
+        RADSTAGE_COUNT
+}
+radstage_t;
+
+// Must run after the direct lights have been created and scaled.
+extern void     InitRadCheckpoints();
+
+extern bool     LoadFacelightCheckpoint();
+// Called from BuildFacelights once the samples of the face are set up. Returns true
+// if the direct lighting of the face was restored from the checkpoint.
+extern bool     RestoreFacelightFromCheckpoint( int facenum, int normal_count );
+extern void     FreeFacelightCheckpoint();
+extern void     SaveFacelightCheckpoint();
+
+extern bool     RestoreTransfersFromCheckpoint();
+extern void     SaveTransfersCheckpoint();
+
+// bounce is the number of bounces done so far, done is set once bouncing has stopped.
+// emitlight holds the red, green and blue light sent out by every patch.
+extern bool     RestoreBounceFromCheckpoint( int& bounce, bool& done, pvector<float>* emitlight );
+extern void     SaveBounceCheckpoint( int bounce, bool done, const pvector<float>* emitlight );
+
+extern bool     RestoreLightdataFromCheckpoint();
+extern void     SaveLightdataCheckpoint();
+
+extern bool     RestoreLeafAmbientFromCheckpoint();
+extern void     SaveLeafAmbientCheckpoint();
+
+extern void     DeleteRadCheckpoints();
+
+#endif // RADCHECKPOINT_H
@@ -0,0 +1,53 @@
+#ifndef RADHASH_H
+#define RADHASH_H
+
+#include "cmdlib.h"
+#include "lights.h"
+
+//
+// Hashing shared by the incremental lighting cache and the stage checkpoints.
+//
+
+typedef unsigned long long radhash_t;
+
+#define RADHASH_INIT    14695981039346656037ULL
+#define RADHASH_PRIME   1099511628211ULL
+
+// =====================================================================================
+//  Hashing
+//      FNV-1a over the raw bytes. Sets of things (lights, leaves) are combined by adding
+//      up their mixed hashes so that the result doesn't depend on the order of the lumps.
+// =====================================================================================
+static inline radhash_t HashBytes( radhash_t hash, const void* data, size_t length )
+{
+        const byte* p = (const byte*)data;
+        for ( size_t i = 0; i < length; i++ )
+        {
+                hash ^= p[i];
+                hash *= RADHASH_PRIME;
+        }
+        return hash;
+}
+
+template <class T>
+static inline radhash_t HashValue( radhash_t hash, const T& value )
+{
+        return HashBytes( hash, &value, sizeof( T ) );
+}
+
+static inline radhash_t MixHash( radhash_t hash )
+{
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+}
+
+// Defined in radcache.cpp.
+extern radhash_t HashDirectLight( const directlight_t* dl );
+extern radhash_t HashDirectSettings();
+extern radhash_t HashTransferSettings();
+
+#endif // RADHASH_H
@@ -473,18 +473,48 @@ bool SampleRadial( radial_t *rad, const LVector3 &pos,
         return base_sample_ok;
 }
 
+// =====================================================================================
+//  FourVectorsToColorRGBExp32
+//      VectorToColorRGBExp32 for four colors at once. The largest channel picks the
+//      exponent: masking off its mantissa leaves the power of two below it, and 2^7
+//      over that scales the channels into [0, 256). Writes out the first count colors.
+// =====================================================================================
+static void FourVectorsToColorRGBExp32( const FourVectors &v, int count, colorrgbexp32_t *out )
+{
+        fltx4 maxc = MaxSIMD( MaxSIMD( v.x, v.y ), v.z );
+        fltx4 pow2 = AndSIMD( maxc, ReplicateIX4( 0x7F800000 ) );
+
+        // zero and denormal colors come out as black
+        fltx4 nonzero = CmpGtSIMD( pow2, Four_Zeros );
+        fltx4 scale = AndSIMD( DivSIMD( ReplicateX4( 128.0f ), pow2 ), nonzero );
+
+        fltx4 r = MulSIMD( v.x, scale );
+        fltx4 g = MulSIMD( v.y, scale );
+        fltx4 b = MulSIMD( v.z, scale );
+
+        for ( int i = 0; i < count; i++ )
+        {
+                out[i].r = (int)SubFloat( r, i );
+                out[i].g = (int)SubFloat( g, i );
+                out[i].b = (int)SubFloat( b, i );
+                out[i].exponent = SubInt( nonzero, i ) ? (signed char)( (int)( SubInt( pow2, i ) >> 23 ) - ( 127 + 7 ) ) : 0;
+        }
+}
+
 // =====================================================================================
 //  FinalLightFace
-//      Add the indirect lighting on top of the direct lighting and save into final map format
+//      Add the indirect lighting on top of the direct lighting and save into final map format.
+//      The luxels are clamped and packed four at a time, straight into the space
+//      PrecompLightmapOffsets set aside for the face.
 // =====================================================================================
 void FinalLightFace( const int facenum )
 {
         dface_t *f;
-        int i, j, k;
+        int j, k;
         facelight_t *fl;
         float minlight;
         int lightstyles;
-        bumpsample_t lb, v;
+        bumpsample_t lb[4], v[4];
         int bump_sample;
         radial_t *rad = nullptr;
         radial_t *prad = nullptr;
@@ -516,6 +546,7 @@ void FinalLightFace( const int facenum )
         // sample the triangulation
         //
         minlight = FloatForKey( g_face_entity[facenum], "_minlight" ) * 128;
+        fltx4 minlight4 = ReplicateX4( minlight );
 
         bool needs_bumpmap = fl->bumped;
         int bump_sample_count = needs_bumpmap ? NUM_BUMP_VECTS + 1 : 1;
@@ -527,70 +558,75 @@ void FinalLightFace( const int facenum )
                         rad = BuildLuxelRadial( facenum, k );
                 }
                 
+                // bounced light only goes into the style 0 lightmap
                 if ( g_numbounce > 0 && k == 0 )
                 {
                         prad = BuildPatchRadial( facenum );
                 }
 
-                // compute average luxel color, but not for the bump samples
-                LVector3 avg( 0.0 );
-                int avg_count = 0;
-
-                for ( j = 0; j < fl->numluxels; j++ )
+                for ( j = 0; j < fl->numluxels; j += 4 )
                 {
-                        // direct lighting
-                        bool base_sample_ok = true;
+                        int count = std::min( 4, fl->numluxels - j );
 
-                        LVector3 samp_pos;
-                        VectorCopy( fl->luxel_points[j], samp_pos );
-
-                        if ( !g_fastmode )
+                        for ( int l = 0; l < count; l++ )
                         {
-                                base_sample_ok = SampleRadial( rad, samp_pos, &lb, bump_sample_count );
+                                LVector3 samp_pos;
+                                VectorCopy( fl->luxel_points[j + l], samp_pos );
 
-                        }
-                        else
-                        {
-                                for ( int bump = 0; bump < bump_sample_count; bump++ )
+                                // direct lighting
+                                if ( !g_fastmode )
                                 {
-                                        lb[bump] = fl->light[0][j].light[bump];
+                                        SampleRadial( rad, samp_pos, &lb[l], bump_sample_count );
+                                }
+                                else
+                                {
+                                        for ( int bump = 0; bump < bump_sample_count; bump++ )
+                                        {
+                                                lb[l][bump] = fl->light[k][j + l].light[bump];
+                                        }
                                 }
-                        }
 
-                        if ( prad )
-                        {
                                 // bounced light
                                 // v is indirect light that is received on the luxel
-                                SampleRadial( prad, samp_pos, &v, bump_sample_count );
+                                if ( prad )
+                                {
+                                        SampleRadial( prad, samp_pos, &v[l], 1 );
+                                }
+                                else
+                                {
+                                        v[l][0].Zero();
+                                }
+                        }
 
-                                //for ( bump_sample = 0; bump_sample < bump_sample_count; bump_sample++ )
-                                //{
-                                //        lb[bump_sample].AddLight( v[bump_sample] );
-                                //}
+                        // pad the last group out with its final luxel
+                        for ( int l = count; l < 4; l++ )
+                        {
+                                lb[l] = lb[count - 1];
+                                v[l] = v[count - 1];
                         }
 
+                        // clip from the bottom first and save out to BSP file
                         for ( bump_sample = 0; bump_sample < bump_sample_count; bump_sample++ )
                         {
-                                // clip from the bottom first
-                                for ( i = 0; i < 3; i++ )
-                                {
-                                        lb[bump_sample][i] = std::max( lb[bump_sample][i], minlight );
-                                        v[bump_sample][i] = std::max( v[bump_sample][i], minlight );
-                                }
-
-                                // save out to BSP file
+                                FourVectors direct;
+                                direct.LoadAndSwizzle( lb[0][bump_sample].light, lb[1][bump_sample].light,
+                                                       lb[2][bump_sample].light, lb[3][bump_sample].light );
+                                direct.x = MaxSIMD( direct.x, minlight4 );
+                                direct.y = MaxSIMD( direct.y, minlight4 );
+                                direct.z = MaxSIMD( direct.z, minlight4 );
+
+                                FourVectorsToColorRGBExp32( direct, count, SampleLightmap( g_bspdata, f, j, k, bump_sample ) );
+                        }
 
-                                // direct
-                                colorrgbexp32_t *dcol = SampleLightmap( g_bspdata, g_bspdata->dfaces + facenum, j, k, bump_sample );
-                                LVector3 dvcol;
-                                VectorCopy( lb[bump_sample], dvcol );
-                                VectorToColorRGBExp32( dvcol, *dcol );
+                        if ( k == 0 )
+                        {
+                                FourVectors bounced;
+                                bounced.LoadAndSwizzle( v[0][0].light, v[1][0].light, v[2][0].light, v[3][0].light );
+                                bounced.x = MaxSIMD( bounced.x, minlight4 );
+                                bounced.y = MaxSIMD( bounced.y, minlight4 );
+                                bounced.z = MaxSIMD( bounced.z, minlight4 );
 
-                                // bounced
-                                colorrgbexp32_t *bcol = SampleBouncedLightmap( g_bspdata, g_bspdata->dfaces + facenum, j );
-                                LVector3 bvcol;
-                                VectorCopy( v[bump_sample], bvcol );
-                                VectorToColorRGBExp32( bvcol, *bcol );
+                                FourVectorsToColorRGBExp32( bounced, count, SampleBouncedLightmap( g_bspdata, f, j ) );
                         }
                 }
 
@@ -599,4 +635,4 @@ void FinalLightFace( const int facenum )
                 FreeRadial( prad );
                 prad = nullptr;
         }
-}
\ No newline at end of file
+}
@@ -0,0 +1,231 @@
+#include "radpalette.h"
+#include "qrad.h"
+#include "threads.h"
+#include "bc6h.h"
+#include "TexturePacker.h"
+
+#include <math.h>
+
+#define PALETTE_ALIGN( x )      ( ( ( x ) + 3 ) & ~3 )
+
+// Every page of the palette as it is being built, top row first.
+static int              s_width = 0;
+static int              s_height = 0;
+static int              s_blocks_x = 0;
+static int              s_blocks_y = 0;
+static pvector<float>   s_texels;                               // three floats per texel
+static pvector<bool>    s_covered;                              // texels that hold a luxel
+static pvector<byte>    s_blocks;
+
+static float* PaletteTexel( int page, int x, int y )
+{
+        return &s_texels[( ( (size_t)page * s_height + y ) * s_width + x ) * 3];
+}
+
+// =====================================================================================
+//  PlaceLightmap
+//      Copies one lightmap of a face into a page. A rotated lightmap is stored with its
+//      rows as palette columns.
+// =====================================================================================
+static void PlaceLightmap( const colorrgbexp32_t* src, int width, int height,
+                           const TextureLocation& tloc, int page )
+{
+        for ( int y = 0; y < height; y++ )
+        {
+                for ( int x = 0; x < width; x++ )
+                {
+                        int px = tloc.get_rotated() ? tloc.get_x() + y : tloc.get_x() + x;
+                        int py = tloc.get_rotated() ? tloc.get_y() + x : tloc.get_y() + y;
+
+                        LVector3 color;
+                        ColorRGBExp32ToVector( src[y * width + x], color );
+
+                        float* texel = PaletteTexel( page, px, py );
+                        texel[0] = color[0] / 255.0f;
+                        texel[1] = color[1] / 255.0f;
+                        texel[2] = color[2] / 255.0f;
+                        s_covered[( (size_t)page * s_height + py ) * s_width + px] = true;
+                }
+        }
+}
+
+// =====================================================================================
+//  EncodePaletteRow
+//      Encodes one row of blocks of one page. Only the texels that hold a luxel are
+//      fit, so the black padding around a lightmap doesn't widen the endpoints.
+// =====================================================================================
+static void EncodePaletteRow( int work )
+{
+        int page = work / s_blocks_y;
+        int by = work % s_blocks_y;
+
+        for ( int bx = 0; bx < s_blocks_x; bx++ )
+        {
+                float texels[BC6H_BLOCK_TEXELS * 3];
+                bool covered[BC6H_BLOCK_TEXELS];
+                for ( int y = 0; y < 4; y++ )
+                {
+                        memcpy( &texels[y * 4 * 3], PaletteTexel( page, bx * 4, by * 4 + y ), 4 * 3 * sizeof( float ) );
+                        for ( int x = 0; x < 4; x++ )
+                        {
+                                covered[y * 4 + x] = s_covered[( (size_t)page * s_height + by * 4 + y ) * s_width + bx * 4 + x];
+                        }
+                }
+
+                size_t block = ( (size_t)page * s_blocks_y + by ) * s_blocks_x + bx;
+                BC6HEncodeBlock( texels, &s_blocks[block * BC6H_BLOCK_SIZE], covered );
+        }
+}
+
+// =====================================================================================
+//  MeasurePalettePSNR
+//      Decodes the blocks again and compares the luxels against the source, clamped to
+//      the [0, 1] range the palette texture holds. Returns a negative value if nothing
+//      was lost.
+// =====================================================================================
+static double MeasurePalettePSNR()
+{
+        double error = 0.0;
+        long long count = 0;
+
+        for ( int page = 0; page < LMPALETTE_PAGES; page++ )
+        {
+                for ( int by = 0; by < s_blocks_y; by++ )
+                {
+                        for ( int bx = 0; bx < s_blocks_x; bx++ )
+                        {
+                                size_t block = ( (size_t)page * s_blocks_y + by ) * s_blocks_x + bx;
+                                unsigned short halfs[BC6H_BLOCK_TEXELS * 3];
+                                BC6HDecodeBlock( &s_blocks[block * BC6H_BLOCK_SIZE], halfs );
+
+                                for ( int i = 0; i < BC6H_BLOCK_TEXELS; i++ )
+                                {
+                                        int x = bx * 4 + ( i & 3 );
+                                        int y = by * 4 + ( i >> 2 );
+                                        if ( !s_covered[( (size_t)page * s_height + y ) * s_width + x] )
+                                                continue;
+
+                                        const float* texel = PaletteTexel( page, x, y );
+                                        for ( int c = 0; c < 3; c++ )
+                                        {
+                                                double source = std::min( std::max( texel[c], 0.0f ), 1.0f );
+                                                double decoded = std::min( std::max( HalfToFloat( halfs[i * 3 + c] ), 0.0f ), 1.0f );
+                                                error += ( decoded - source ) * ( decoded - source );
+                                        }
+                                        count += 3;
+                                }
+                        }
+                }
+        }
+
+        if ( count == 0 || error <= 0.0 )
+                return -1.0;
+
+        return 10.0 * log10( count / error );
+}
+
+// =====================================================================================
+//  BuildLightmapPalette
+// =====================================================================================
+void BuildLightmapPalette()
+{
+        g_bspdata->lightmappalette.clear();
+
+        pvector<int> facenums;
+        TexturePacker* packer = TexturePacker::createTexturePacker();
+        for ( int facenum = 0; facenum < g_bspdata->numfaces; facenum++ )
+        {
+                const dface_t* face = &g_bspdata->dfaces[facenum];
+                if ( face->lightofs == -1 )
+                        continue;
+
+                packer->addNewTexture( PALETTE_ALIGN( face->lightmap_size[0] + 1 ),
+                                       PALETTE_ALIGN( face->lightmap_size[1] + 1 ) );
+                facenums.push_back( facenum );
+        }
+
+        if ( facenums.empty() )
+        {
+                TexturePacker::releaseTexturePacker( packer );
+                return;
+        }
+
+        PackResult presult = packer->packTextures( true, false );
+        s_width = PALETTE_ALIGN( presult.get_width() );
+        s_height = PALETTE_ALIGN( presult.get_height() );
+        s_blocks_x = s_width / 4;
+        s_blocks_y = s_height / 4;
+
+        size_t page_texels = (size_t)s_width * s_height;
+        s_texels.assign( page_texels * 3 * LMPALETTE_PAGES, 0.0f );
+        s_covered.assign( page_texels * LMPALETTE_PAGES, false );
+        s_blocks.assign( (size_t)s_blocks_x * s_blocks_y * LMPALETTE_PAGES * BC6H_BLOCK_SIZE, 0 );
+
+        pvector<dlightmappaletteface_t> faces;
+        faces.resize( facenums.size() );
+        for ( size_t i = 0; i < facenums.size(); i++ )
+        {
+                const dface_t* face = &g_bspdata->dfaces[facenums[i]];
+                TextureLocation tloc = packer->getTextureLocation( (int)i );
+                int width = face->lightmap_size[0] + 1;
+                int height = face->lightmap_size[1] + 1;
+
+                faces[i].facenum = facenums[i];
+                faces[i].xshift = (unsigned short)tloc.get_x();
+                faces[i].yshift = (unsigned short)tloc.get_y();
+                faces[i].flipped = tloc.get_rotated() ? 1 : 0;
+
+                // same pages as the loader builds
+                PlaceLightmap( SampleBouncedLightmap( g_bspdata, face, 0 ), width, height, tloc, 0 );
+                if ( face->bumped_lightmap )
+                {
+                        for ( int n = 0; n < NUM_BUMP_VECTS + 1; n++ )
+                        {
+                                PlaceLightmap( SampleLightmap( g_bspdata, face, 0, 0, n ), width, height, tloc, n + 1 );
+                        }
+                }
+                else
+                {
+                        PlaceLightmap( SampleLightmap( g_bspdata, face, 0, 0, 0 ), width, height, tloc, 1 );
+                }
+        }
+        TexturePacker::releaseTexturePacker( packer );
+
+        NamedRunThreadsOnIndividual( s_blocks_y * LMPALETTE_PAGES, g_estimate, EncodePaletteRow );
+
+        dlightmappalette_t header;
+        header.format = LMPALETTE_FORMAT_BC6H;
+        header.width = s_width;
+        header.height = s_height;
+        header.numpages = LMPALETTE_PAGES;
+        header.numfaces = (int)faces.size();
+
+        pvector<byte>& lump = g_bspdata->lightmappalette;
+        lump.resize( sizeof( header ) + faces.size() * sizeof( dlightmappaletteface_t ) + s_blocks.size() );
+        byte* dst = lump.data();
+        memcpy( dst, &header, sizeof( header ) );
+        dst += sizeof( header );
+        memcpy( dst, faces.data(), faces.size() * sizeof( dlightmappaletteface_t ) );
+        dst += faces.size() * sizeof( dlightmappaletteface_t );
+        memcpy( dst, s_blocks.data(), s_blocks.size() );
+
+        double psnr = MeasurePalettePSNR();
+        double rgbe_kb = ( g_bspdata->lightdata.size() + g_bspdata->bouncedlightdata.size() ) * sizeof( colorrgbexp32_t ) / 1024.0;
+        if ( psnr < 0.0 )
+        {
+                Log( "Lightmap palette: %dx%d, %d faces, %.1f kb (%.1f kb rgbe), lossless\n",
+                     s_width, s_height, header.numfaces, lump.size() / 1024.0, rgbe_kb );
+        }
+        else
+        {
+                Log( "Lightmap palette: %dx%d, %d faces, %.1f kb (%.1f kb rgbe), psnr %.2f db\n",
+                     s_width, s_height, header.numfaces, lump.size() / 1024.0, rgbe_kb, psnr );
+        }
+
+        s_texels.clear();
+        s_texels.shrink_to_fit();
+        s_covered.clear();
+        s_covered.shrink_to_fit();
+        s_blocks.clear();
+        s_blocks.shrink_to_fit();
+}
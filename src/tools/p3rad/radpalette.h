@@ -0,0 +1,23 @@
+#ifndef RADPALETTE_H
+#define RADPALETTE_H
+
+#include "cmdlib.h"
+#include "mathlib.h"
+
+//
+// Compressed lightmap palette (-compresslightmaps)
+//
+// Packs the style 0 lightmaps of every face into one palette and encodes every page
+// of it into BC6H blocks, stored in LUMP_LIGHTMAPPALETTE. The pages are laid out like
+// the ones the level loader builds: bounced light first, then the flat and bumped
+// direct light. Every lightmap is padded out to whole 4x4 blocks so no block mixes
+// two faces, and the padding is left out when the blocks are fit.
+//
+// The palette is decoded again once it is written and the PSNR of the result against
+// the uncompressed lightmaps is logged, in the [0, 1] range the loader displays.
+//
+
+// Must run once the lightmaps are final.
+extern void     BuildLightmapPalette();
+
+#endif // RADPALETTE_H
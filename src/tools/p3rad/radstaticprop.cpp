@@ -112,113 +112,181 @@ pvector<PT( GeomNode )> BuildGeomNodes( const NodePath &root )
         return list;
 }
 
+/**
+ * One vertex data of a lit static prop. Each one is lit by its own work unit, so
+ * big props with many vertex datas are spread across threads.
+ */
 struct VDataDef
 {
         CPT( GeomVertexData ) vdata;
-        LMatrix4 mat_to_world;
+        // Where the samples of this vertex data go in g_bspdata->staticproplighting.
+        int first_lighting_sample;
 };
 
-void ComputeStaticPropLighting( const int prop_idx )
+static pvector<VDataDef> g_prop_vdatas;
+
+/**
+ * A world space vertex. Vertices with the same position and normal (UV seams,
+ * flat shading) only get lit once.
+ */
+struct PropVertex
 {
-        if ( prop_idx < 0 || prop_idx > (int)g_static_props.size() - 1 )
+        LVector3 pos;
+        LNormalf normal;
+        int row;
+
+        bool operator < ( const PropVertex &other ) const
         {
-                Warning( "ThreadComputeStaticPropLighting: prop %i is invalid\n", prop_idx );
-                return;
+                int cmp = pos.compare_to( other.pos, 0.0f );
+                if ( cmp != 0 )
+                        return cmp < 0;
+                return normal.compare_to( other.normal, 0.0f ) < 0;
         }
-        RADStaticProp *prop = g_static_props[prop_idx];
-        if ( ( g_bspdata->dstaticprops[prop->propnum].flags & STATICPROPFLAGS_STATICLIGHTING ) == 0 )
+
+        bool operator == ( const PropVertex &other ) const
         {
-                // baked lighting not wanted
-                return;
+                return pos == other.pos && normal == other.normal;
         }
+};
 
-        pvector<VDataDef> vdatas;
-        vdatas.reserve( 1000 );
+/**
+ * Collects the vertex datas of every prop that wants baked lighting and reserves
+ * their vertex data and lighting sample ranges in the BSP up front, so the
+ * threads can write their results in place without locking.
+ */
+static void SetupStaticPropVertexDatas()
+{
+        g_prop_vdatas.clear();
 
-        // transform all vertices to be in world space
-        prop->mdl.clear_model_nodes();
-        prop->mdl.flatten_light();
+        int first_sample = (int)g_bspdata->staticproplighting.size();
 
-        // we're not using NodePath::find_all_matches() because we need a consistent order in the list
-        pvector<PT( GeomNode )> geomnodes = BuildGeomNodes( prop->mdl );
-        for ( size_t i = 0; i < geomnodes.size(); i++ )
+        for ( size_t prop_idx = 0; prop_idx < g_static_props.size(); prop_idx++ )
         {
-                PT( GeomNode ) gn = geomnodes[i];
-                for ( int j = 0; j < gn->get_num_geoms(); j++ )
+                RADStaticProp *prop = g_static_props[prop_idx];
+                dstaticprop_t *dprop = &g_bspdata->dstaticprops[prop->propnum];
+                if ( ( dprop->flags & STATICPROPFLAGS_STATICLIGHTING ) == 0 )
                 {
-                        CPT( Geom ) geom = gn->get_geom( j );
-                        CPT( GeomVertexData ) vdata = geom->get_vertex_data();
+                        // baked lighting not wanted
+                        continue;
+                }
+
+                // transform all vertices to be in world space
+                prop->mdl.clear_model_nodes();
+                prop->mdl.flatten_light();
 
-                        VDataDef def;
-                        def.vdata = vdata;
-                        def.mat_to_world = NodePath( gn ).get_net_transform()->get_mat();
-                        vdatas.push_back( def );
+                dprop->first_vertex_data = (int)( g_bspdata->dstaticpropvertexdatas.size() + g_prop_vdatas.size() );
+
+                // we're not using NodePath::find_all_matches() because we need a consistent order in the list
+                pvector<PT( GeomNode )> geomnodes = BuildGeomNodes( prop->mdl );
+                for ( size_t i = 0; i < geomnodes.size(); i++ )
+                {
+                        PT( GeomNode ) gn = geomnodes[i];
+                        for ( int j = 0; j < gn->get_num_geoms(); j++ )
+                        {
+                                VDataDef def;
+                                def.vdata = gn->get_geom( j )->get_vertex_data();
+                                def.first_lighting_sample = first_sample;
+                                first_sample += def.vdata->get_num_rows();
+                                g_prop_vdatas.push_back( def );
+                        }
                 }
+
+                dprop->num_vertex_datas = (int)( g_bspdata->dstaticpropvertexdatas.size() + g_prop_vdatas.size() ) -
+                        dprop->first_vertex_data;
+        }
+
+        for ( size_t i = 0; i < g_prop_vdatas.size(); i++ )
+        {
+                dstaticpropvertexdata_t dvdata;
+                dvdata.first_lighting_sample = g_prop_vdatas[i].first_lighting_sample;
+                dvdata.num_lighting_samples = g_prop_vdatas[i].vdata->get_num_rows();
+                g_bspdata->dstaticpropvertexdatas.push_back( dvdata );
+        }
+
+        g_bspdata->staticproplighting.resize( first_sample );
+}
+
+void ComputeStaticPropLighting( const int vdata_idx )
+{
+        const VDataDef &def = g_prop_vdatas[vdata_idx];
+        const GeomVertexData *vdata = def.vdata;
+        int num_rows = vdata->get_num_rows();
+        if ( num_rows == 0 )
+        {
+                return;
         }
 
-        pvector<dstaticpropvertexdata_t> newvdatas;
-        newvdatas.reserve( vdatas.size() );
-        pvector<colorrgbexp32_t> newsamples;
-        newsamples.reserve( 10000 );
+        GeomVertexReader vtx_reader( vdata, InternalName::get_vertex() );
+        GeomVertexReader norm_reader( vdata, InternalName::get_normal() );
 
-        for ( size_t i = 0; i < vdatas.size(); i++ )
+        pvector<PropVertex> verts;
+        verts.resize( num_rows );
+        for ( int row = 0; row < num_rows; row++ )
         {
-                CPT( GeomVertexData ) vdata = vdatas[i].vdata;
-                GeomVertexReader vtx_reader( vdata, InternalName::get_vertex() );
-                GeomVertexReader norm_reader( vdata, InternalName::get_normal() );
+                verts[row].pos = vtx_reader.get_data3f();
+                verts[row].normal = norm_reader.get_data3f();
+                verts[row].row = row;
+        }
 
-                dstaticpropvertexdata_t dvdata;
-                dvdata.first_lighting_sample = newsamples.size();
+        // Group identical vertices together.
+        std::sort( verts.begin(), verts.end() );
 
-                for ( int row = 0; row < vdata->get_num_rows(); row++ )
+        pvector<int> unique;
+        unique.reserve( num_rows );
+        for ( int i = 0; i < num_rows; i++ )
+        {
+                if ( i == 0 || !( verts[i] == verts[i - 1] ) )
                 {
-                        vtx_reader.set_row( row );
-                        norm_reader.set_row( row );
-
-                        LVector3 world_pos( vtx_reader.get_data3f() );
-                        LNormalf world_normal( norm_reader.get_data3f() );
+                        unique.push_back( i );
+                }
+        }
 
-                        LVector3 direct_col( 0 );
-                        ComputeDirectLightingAtPoint( world_pos, world_normal, direct_col );
+        colorrgbexp32_t *samples = &g_bspdata->staticproplighting[def.first_lighting_sample];
 
-                        LVector3 indirect_col( 0 );
-                        ComputeIndirectLightingAtPoint( world_pos, world_normal, indirect_col, true );
+        // Light the unique vertices four at a time.
+        int num_unique = (int)unique.size();
+        for ( int group = 0; group < num_unique; group += 4 )
+        {
+                int num_points = std::min( 4, num_unique - group );
 
-                        colorrgbexp32_t sample;
-                        VectorToColorRGBExp32( direct_col + indirect_col, sample );
-                        newsamples.push_back( sample );
+                LVector3 v[4], n[4];
+                for ( int i = 0; i < 4; i++ )
+                {
+                        const PropVertex &vert = verts[unique[group + std::min( i, num_points - 1 )]];
+                        v[i] = vert.pos;
+                        n[i] = vert.normal;
                 }
 
-                dvdata.num_lighting_samples = newsamples.size() - dvdata.first_lighting_sample;
+                FourVectors pos4, normal4;
+                pos4.LoadAndSwizzle( v[0], v[1], v[2], v[3] );
+                normal4.LoadAndSwizzle( n[0], n[1], n[2], n[3] );
 
-                newvdatas.push_back( dvdata );
-        }
+                LVector3 colors[4];
+                memset( colors, 0, sizeof( colors ) );
+                ComputeDirectLightingAt4Points( pos4, normal4, num_points, colors );
 
-        ThreadLock();
-        dstaticprop_t *dprop = &g_bspdata->dstaticprops[prop->propnum];
-        dprop->first_vertex_data = g_bspdata->dstaticpropvertexdatas.size();
-        for ( size_t i_vdata = 0; i_vdata < newvdatas.size(); i_vdata++ )
-        {
-                dstaticpropvertexdata_t &dvdata = newvdatas[i_vdata];
-                int first = dvdata.first_lighting_sample;
-                dvdata.first_lighting_sample = g_bspdata->staticproplighting.size();
-                for ( int i = 0; i < dvdata.num_lighting_samples; i++ )
+                for ( int i = 0; i < num_points; i++ )
                 {
-                        g_bspdata->staticproplighting.push_back( newsamples[first + i] );
+                        LVector3 indirect_col( 0 );
+                        ComputeIndirectLightingAtPoint( v[i], n[i], indirect_col, true );
+
+                        colorrgbexp32_t sample;
+                        VectorToColorRGBExp32( colors[i] + indirect_col, sample );
+
+                        // Every vertex that shares this position and normal gets the sample.
+                        int end = ( group + i + 1 < num_unique ) ? unique[group + i + 1] : num_rows;
+                        for ( int j = unique[group + i]; j < end; j++ )
+                        {
+                                samples[verts[j].row] = sample;
+                        }
                 }
-                g_bspdata->dstaticpropvertexdatas.push_back( dvdata );
         }
-        dprop->num_vertex_datas = g_bspdata->dstaticpropvertexdatas.size() - dprop->first_vertex_data;
-        ThreadUnlock();
 }
 
 void DoComputeStaticPropLighting()
 {
         //Log( "Computing static prop lighting...\n" );
-        NamedRunThreadsOnIndividual( (int)g_static_props.size(), g_estimate, ComputeStaticPropLighting );
-        //for ( size_t i = 0; i < g_static_props.size(); i++ )
-        //{
-        //        Log( "%i ", (int)i );
-        //        ComputeStaticPropLighting( i );
-        //}
-}
\ No newline at end of file
+        SetupStaticPropVertexDatas();
+        NamedRunThreadsOnIndividual( (int)g_prop_vdatas.size(), g_estimate, ComputeStaticPropLighting );
+        g_prop_vdatas.clear();
+}
@@ -0,0 +1,340 @@
+#include "skyvis.h"
+#include "radhash.h"
+#include "qrad.h"
+#include "lights.h"
+#include "halton.h"
+#include "anorms.h"
+#include "trace.h"
+
+#include <simpleHashMap.h>
+#include <lightMutexHolder.h>
+
+#define SKYVIS_SHARDS           64
+
+// The cells of one shard. Every cell owns 2 * s_numwords words of bits: the
+// directions that were traced from it, then the ones of those that reach the sky.
+typedef struct
+{
+        LightMutex      lock;
+        SimpleHashMap<unsigned long long, int, integer_hash<unsigned long long> > cells;
+        pvector<unsigned int> bits;
+        long long       numrays;                                // directions asked for
+        long long       numtraced;                              // directions that had to be traced
+        long long       numdropped;                             // cells that could not be stored, the shard was full
+}
+skyvisshard_t;
+
+static bool             s_enabled = false;
+static float            s_invcell = 1.0f;
+static int              s_numsundirs = 0;
+static int              s_numambientdirs = 0;
+static int              s_numwords = 0;
+static size_t           s_maxshardbytes = 0;                    // 0 for no limit
+static LVector3         s_deltas[MAX_SKYVIS_DIRS];              // trace from the sample towards the sky
+static skyvisshard_t    s_shards[SKYVIS_SHARDS];
+
+// =====================================================================================
+//  InitSkyVisibility
+//      Builds the direction table. The directions are generated exactly like
+//      GatherSampleSkyLightSSE and GatherSampleAmbientSkySSE generate them.
+// =====================================================================================
+void InitSkyVisibility()
+{
+        FreeSkyVisibility();
+
+        s_enabled = false;
+        s_numsundirs = 0;
+        s_numambientdirs = 0;
+
+        if ( g_sky_vis_cell <= 0.0f || ( !Lights::skylight && !Lights::ambientlight ) )
+        {
+                return;
+        }
+
+        if ( Lights::skylight )
+        {
+                s_numsundirs = 1;
+                if ( Lights::sun_angular_extent > 0.0 )
+                {
+                        s_numsundirs = NSAMPLES_SUN_AREA_LIGHT;
+                        if ( g_fastmode )
+                                s_numsundirs /= 4;
+                }
+        }
+
+        if ( Lights::ambientlight )
+        {
+                s_numambientdirs = NUMVERTEXNORMALS;
+                if ( g_fastmode )
+                        s_numambientdirs /= 4;
+                else
+                        s_numambientdirs *= g_skysamplescale;
+        }
+
+        int numdirs = s_numsundirs + s_numambientdirs;
+        if ( numdirs > MAX_SKYVIS_DIRS )
+        {
+                Warning( "%d sky directions exceed the sky visibility cache limit of %d, sky rays will not be shared\n",
+                         numdirs, MAX_SKYVIS_DIRS );
+                s_numsundirs = 0;
+                s_numambientdirs = 0;
+                return;
+        }
+
+        if ( Lights::skylight )
+        {
+                DirectionalSampler_t sampler;
+                for ( int d = 0; d < s_numsundirs; d++ )
+                {
+                        VectorScale( Lights::skylight->normal, -MAX_TRACE_LENGTH, s_deltas[d] );
+                        if ( d )
+                        {
+                                // jitter light source location
+                                LVector3 ofs = sampler.NextValue();
+                                ofs *= MAX_TRACE_LENGTH * Lights::sun_angular_extent;
+                                s_deltas[d] += ofs;
+                        }
+                }
+        }
+
+        if ( Lights::ambientlight )
+        {
+                DirectionalSampler_t sampler;
+                for ( int j = 0; j < s_numambientdirs; j++ )
+                {
+                        s_deltas[s_numsundirs + j] = sampler.NextValue() * -MAX_TRACE_LENGTH;
+                }
+        }
+
+        s_invcell = 1.0f / std::max( g_sky_vis_cell, (float)SKYVIS_MIN_CELL );
+        s_numwords = ( numdirs + 31 ) / 32;
+        s_maxshardbytes = (size_t)std::max( g_sky_vis_memory, 0 ) * 1024 * 1024 / SKYVIS_SHARDS;
+        s_enabled = true;
+}
+
+// =====================================================================================
+//  SkyVisShardBytes
+//      Memory held by the cells of a shard. The hash map keeps its table at most half
+//      full, so every cell is counted twice there.
+// =====================================================================================
+static size_t SkyVisShardBytes( const skyvisshard_t* shard )
+{
+        return shard->bits.size() * sizeof( unsigned int ) +
+               shard->cells.get_num_entries() * 2 * ( sizeof( unsigned long long ) + sizeof( int ) );
+}
+
+// =====================================================================================
+//  FreeSkyVisibility
+// =====================================================================================
+void FreeSkyVisibility()
+{
+        int numcells = 0;
+        size_t numbytes = 0;
+        long long numrays = 0;
+        long long numtraced = 0;
+        long long numdropped = 0;
+
+        for ( int i = 0; i < SKYVIS_SHARDS; i++ )
+        {
+                skyvisshard_t* shard = &s_shards[i];
+                numcells += shard->cells.get_num_entries();
+                numbytes += SkyVisShardBytes( shard );
+                numrays += shard->numrays;
+                numtraced += shard->numtraced;
+                numdropped += shard->numdropped;
+
+                shard->cells.clear();
+                shard->bits.clear();
+                shard->bits.shrink_to_fit();
+                shard->numrays = 0;
+                shard->numtraced = 0;
+                shard->numdropped = 0;
+        }
+
+        if ( numrays > 0 )
+        {
+                Log( "Sky visibility: %d cells (%.1f mb), %.1f%% of %lld sky rays shared\n", numcells,
+                     numbytes / ( 1024.0 * 1024.0 ), 100.0 * ( numrays - numtraced ) / numrays, numrays );
+        }
+        if ( numdropped > 0 )
+        {
+                Log( "Sky visibility: cache full, %lld samples traced without it (-skyvismem)\n", numdropped );
+        }
+
+        s_enabled = false;
+}
+
+bool SkyVisibilityEnabled()
+{
+        return s_enabled;
+}
+
+int GetNumSunDirections()
+{
+        return s_numsundirs;
+}
+
+int GetNumSkyAmbientDirections()
+{
+        return s_numambientdirs;
+}
+
+// =====================================================================================
+//  SkyVisCellKey
+//      20 bits per axis for the cell, 3 bits for the major axis and sign of the normal.
+// =====================================================================================
+static unsigned long long SkyVisCellKey( const LVector3& pos, const LVector3& normal )
+{
+        unsigned long long key = 0;
+        for ( int i = 0; i < 3; i++ )
+        {
+                long long cell = (long long)floor( pos[i] * s_invcell ) + ( 1 << 19 );
+                key = ( key << 20 ) | ( (unsigned long long)cell & 0xFFFFF );
+        }
+
+        int axis = 0;
+        for ( int i = 1; i < 3; i++ )
+        {
+                if ( fabs( normal[i] ) > fabs( normal[axis] ) )
+                        axis = i;
+        }
+        key = ( key << 3 ) | (unsigned long long)( axis * 2 + ( normal[axis] < 0.0f ? 1 : 0 ) );
+
+        return key;
+}
+
+static int CountSkyDirections( const unsigned int* bits, int numwords )
+{
+        int count = 0;
+        for ( int i = 0; i < numwords; i++ )
+        {
+                for ( unsigned int w = bits[i]; w; w &= w - 1 )
+                        count++;
+        }
+        return count;
+}
+
+// =====================================================================================
+//  TraceSkyDirections
+//      Traces the directions in missing from pos, four at a time.
+// =====================================================================================
+static void TraceSkyDirections( const LVector3& pos, const skyvis_t& missing, skyvis_t& visible )
+{
+        int dirs[MAX_SKYVIS_DIRS];
+        int numdirs = 0;
+        for ( int dir = 0; dir < s_numsundirs + s_numambientdirs; dir++ )
+        {
+                if ( SkyDirectionVisible( missing, dir ) )
+                        dirs[numdirs++] = dir;
+        }
+
+        FourVectors start;
+        start.DuplicateVector( pos );
+
+        for ( int i = 0; i < numdirs; i += 4 )
+        {
+                int count = std::min( 4, numdirs - i );
+
+                LVector3 end[4];
+                for ( int l = 0; l < 4; l++ )
+                {
+                        end[l] = pos + s_deltas[dirs[i + std::min( l, count - 1 )]];
+                }
+
+                FourVectors end4;
+                end4.LoadAndSwizzle( end[0], end[1], end[2], end[3] );
+
+                fltx4 fraction;
+                RADTrace::test_four_lines( start, end4, &fraction, CONTENTS_SKY, true );
+
+                for ( int l = 0; l < count; l++ )
+                {
+                        if ( SubFloat( fraction, l ) > 0.0f )
+                                SetSkyDirection( visible, dirs[i + l] );
+                }
+        }
+}
+
+// =====================================================================================
+//  GetSkyVisibility
+// =====================================================================================
+void GetSkyVisibility( const LVector3& pos, const LVector3& normal,
+                       const skyvis_t& needed, skyvis_t& visible )
+{
+        unsigned long long key = SkyVisCellKey( pos, normal );
+        skyvisshard_t* shard = &s_shards[MixHash( key ) % SKYVIS_SHARDS];
+
+        skyvis_t known;
+        ClearSkyVisibility( known );
+        ClearSkyVisibility( visible );
+
+        int numneeded = CountSkyDirections( needed.bits, s_numwords );
+
+        {
+                LightMutexHolder holder( shard->lock );
+                int index = shard->cells.find( key );
+                if ( index != -1 )
+                {
+                        const unsigned int* bits = &shard->bits[shard->cells.get_data( index )];
+                        memcpy( known.bits, bits, s_numwords * sizeof( unsigned int ) );
+                        memcpy( visible.bits, bits + s_numwords, s_numwords * sizeof( unsigned int ) );
+                }
+        }
+
+        skyvis_t missing;
+        ClearSkyVisibility( missing );
+        bool trace = false;
+        for ( int i = 0; i < s_numwords; i++ )
+        {
+                missing.bits[i] = needed.bits[i] & ~known.bits[i];
+                if ( missing.bits[i] )
+                        trace = true;
+        }
+
+        // the rays are traced without holding the lock, another sample of the cell
+        // may have traced the same directions in the meantime
+        int numtraced = 0;
+        if ( trace )
+        {
+                TraceSkyDirections( pos, missing, visible );
+                numtraced = CountSkyDirections( missing.bits, s_numwords );
+        }
+
+        {
+                LightMutexHolder holder( shard->lock );
+                shard->numrays += numneeded;
+                shard->numtraced += numtraced;
+
+                if ( trace )
+                {
+                        int index = shard->cells.find( key );
+                        if ( index == -1 && s_maxshardbytes > 0 && SkyVisShardBytes( shard ) >= s_maxshardbytes )
+                        {
+                                // full, the cell traces its own rays from now on
+                                shard->numdropped++;
+                        }
+                        else if ( index == -1 )
+                        {
+                                int offset = (int)shard->bits.size();
+                                shard->bits.resize( offset + 2 * s_numwords );
+                                memcpy( &shard->bits[offset], missing.bits, s_numwords * sizeof( unsigned int ) );
+                                memcpy( &shard->bits[offset + s_numwords], visible.bits, s_numwords * sizeof( unsigned int ) );
+                                shard->cells[key] = offset;
+                        }
+                        else
+                        {
+                                unsigned int* bits = &shard->bits[shard->cells.get_data( index )];
+                                for ( int i = 0; i < s_numwords; i++ )
+                                {
+                                        bits[i] |= missing.bits[i];
+                                        bits[s_numwords + i] |= visible.bits[i] & missing.bits[i];
+                                }
+                        }
+                }
+        }
+
+        for ( int i = 0; i < s_numwords; i++ )
+        {
+                visible.bits[i] &= needed.bits[i];
+        }
+}
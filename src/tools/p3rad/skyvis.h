@@ -0,0 +1,93 @@
+#ifndef SKYVIS_H
+#define SKYVIS_H
+
+#include "cmdlib.h"
+#include "mathlib.h"
+#include "mathlib/ssemath.h"
+
+//
+// Sky visibility cache (-skyviscell)
+//
+// The sun (emit_skylight) and the sky ambient light (emit_skyambient) each trace a
+// fixed set of directions towards the sky from every sample. Both sets are built once
+// into one direction table, and every traced sample stores a bitmask holding which of
+// those directions reach the sky. The masks are kept per cell of a grid in world
+// space, so samples that fall into the same cell (the seams between coplanar faces,
+// the supersamples of -extra, duplicated SIMD lanes) and both sky light types share
+// their rays instead of tracing them again. A cell only traces the directions that
+// its callers actually needed, the rest are filled in as they are asked for.
+//
+// The cells are also keyed on the major axis of the sample normal, so the two sides
+// of a thin wall never share one.
+//
+// The cells take up to -skyvismem megabytes. Once that is used up, samples in cells
+// that aren't stored yet trace all of their rays themselves.
+//
+// Sharing is lossy: every sample of a cell gets the rays of whichever sample traced
+// them first, which depends on thread scheduling and on which cells fit in memory.
+// So the cache is off unless -skyviscell is given, and default compiles stay exact
+// and repeatable.
+//
+
+#define NSAMPLES_SUN_AREA_LIGHT 30                              // number of samples to take for an
+                                                                // non-point sun light
+
+#define SKYVIS_MIN_CELL         ( 1.0 / 16.0 )
+#define MAX_SKYVIS_DIRS         1024
+#define MAX_SKYVIS_WORDS        ( MAX_SKYVIS_DIRS / 32 )
+
+typedef struct
+{
+        unsigned int    bits[MAX_SKYVIS_WORDS];
+}
+skyvis_t;
+
+// Must run after the direct lights have been created and scaled.
+extern void     InitSkyVisibility();
+extern void     FreeSkyVisibility();
+
+// True if the sky lights should sample through the cache.
+extern bool     SkyVisibilityEnabled();
+
+extern int      GetNumSunDirections();
+extern int      GetNumSkyAmbientDirections();
+
+// Index of a direction in the table, for SkyDirectionVisible().
+#define SKYVIS_SUN_DIR( d )             ( d )
+#define SKYVIS_AMBIENT_DIR( j )         ( GetNumSunDirections() + ( j ) )
+
+static inline void ClearSkyVisibility( skyvis_t& vis )
+{
+        memset( vis.bits, 0, sizeof( vis.bits ) );
+}
+
+static inline void SetSkyDirection( skyvis_t& vis, int dir )
+{
+        vis.bits[dir >> 5] |= 1u << ( dir & 31 );
+}
+
+static inline bool SkyDirectionVisible( const skyvis_t& vis, int dir )
+{
+        return ( vis.bits[dir >> 5] & ( 1u << ( dir & 31 ) ) ) != 0;
+}
+
+// 1.0 in every lane whose sample sees the sky along the direction, 0.0 otherwise.
+static inline fltx4 SkyDirectionVisible4( const skyvis_t* vis, int dir )
+{
+        fltx4 result = Four_Zeros;
+        for ( int i = 0; i < 4; i++ )
+        {
+                if ( SkyDirectionVisible( vis[i], dir ) )
+                {
+                        SubFloat( result, i ) = 1.0f;
+                }
+        }
+        return result;
+}
+
+// Fills in visible with the directions out of needed that reach the sky from pos.
+// Directions that are not in needed are left clear.
+extern void     GetSkyVisibility( const LVector3& pos, const LVector3& normal,
+                                  const skyvis_t& needed, skyvis_t& visible );
+
+#endif // SKYVIS_H